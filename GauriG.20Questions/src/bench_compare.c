@@ -0,0 +1,159 @@
+/*
+ * bench_compare.c - Flags regressions between two bench_suite runs
+ *
+ * Usage: ./bench_compare [-t percent] baseline.json current.json
+ * Matches results by shape, size and operation and prints how the best
+ * time per unit moved. A result is flagged REGRESSION when it is more
+ * than percent (default 10) slower than the baseline and also slower
+ * than the baseline's slowest sample, so a run that merely lands at the
+ * other end of the usual noise isn't flagged. The exit status is 1 if
+ * any was; results only one side has are listed but not counted.
+ *
+ * Only bench_suite's own output is read: one result object a line.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+	char shape[32];
+	unsigned long nodes;
+	char op[32];
+	double ns;              /* per unit, best sample */
+	double worst;           /* per unit, slowest sample */
+	int matched;
+} Entry;
+
+typedef struct {
+	Entry *items;
+	int count;
+	int capacity;
+} Entries;
+
+/* field
+ * - Point at the value after "name": in line, or NULL if it isn't there
+ */
+static const char *field(const char *line, const char *name) {
+	char key[40];
+	snprintf(key, sizeof(key), "\"%s\":", name);
+	const char* at = strstr(line, key);
+	if(at == NULL)
+		return NULL;
+	at += strlen(key);
+	while(*at == ' ')
+		at++;
+	return at;
+}
+
+/* string_field
+ * - Copy the string value of name into out; 0 if missing or too long
+ */
+static int string_field(const char *line, const char *name, char *out, size_t size) {
+	const char* at = field(line, name);
+	if(at == NULL || *at != '"')
+		return 0;
+	const char* end = strchr(++at, '"');
+	if(end == NULL || (size_t)(end - at) >= size)
+		return 0;
+	memcpy(out, at, (size_t)(end - at));
+	out[end - at] = '\0';
+	return 1;
+}
+
+/* read_results
+ * - Every result line of filename; 0 if it can't be read or has none
+ */
+static int read_results(const char *filename, Entries *out) {
+	FILE* fp = fopen(filename, "r");
+	if(fp == NULL)
+		return 0;
+	char line[512];
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		Entry e;
+		memset(&e, 0, sizeof(e));
+		const char* nodes = field(line, "nodes");
+		const char* ns = field(line, "ns_per_unit");
+		if(nodes == NULL || ns == NULL || !string_field(line, "shape", e.shape, sizeof(e.shape))
+			|| !string_field(line, "op", e.op, sizeof(e.op)))
+			continue;
+		e.nodes = strtoul(nodes, NULL, 10);
+		e.ns = strtod(ns, NULL);
+		const char* worst = field(line, "ns_worst");
+		e.worst = worst != NULL ? strtod(worst, NULL) : e.ns;
+		if(out->count == out->capacity) {
+			int cap = out->capacity ? out->capacity * 2 : 64;
+			Entry* grown = (Entry*)realloc(out->items, (size_t)cap * sizeof(Entry));
+			if(grown == NULL)
+				break;
+			out->items = grown;
+			out->capacity = cap;
+		}
+		out->items[out->count++] = e;
+	}
+	fclose(fp);
+	return out->count > 0;
+}
+
+static Entry *find(Entries *list, const Entry *key) {
+	for(int i = 0; i < list->count; i++) {
+		Entry* e = &list->items[i];
+		if(!e->matched && e->nodes == key->nodes && strcmp(e->shape, key->shape) == 0
+			&& strcmp(e->op, key->op) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	double threshold = 10;
+	int opt;
+	while((opt = getopt(argc, argv, "t:")) != -1) {
+		if(opt != 't') {
+			fprintf(stderr, "usage: %s [-t percent] baseline.json current.json\n", argv[0]);
+			return 2;
+		}
+		threshold = strtod(optarg, NULL);
+	}
+	if(argc - optind != 2) {
+		fprintf(stderr, "usage: %s [-t percent] baseline.json current.json\n", argv[0]);
+		return 2;
+	}
+
+	Entries base = {NULL, 0, 0}, cur = {NULL, 0, 0};
+	if(!read_results(argv[optind], &base) || !read_results(argv[optind + 1], &cur)) {
+		fprintf(stderr, "bench_compare: can't read results from %s\n",
+			base.count == 0 ? argv[optind] : argv[optind + 1]);
+		return 2;
+	}
+
+	printf("%-9s %11s  %-16s %12s %12s %9s\n", "shape", "nodes", "op", "base ns", "now ns", "change");
+	int regressions = 0, compared = 0;
+	for(int i = 0; i < cur.count; i++) {
+		Entry* now = &cur.items[i];
+		Entry* was = find(&base, now);
+		if(was == NULL) {
+			printf("%-9s %11lu  %-16s %12s %12.2f %9s\n", now->shape, now->nodes, now->op, "-", now->ns, "new");
+			continue;
+		}
+		was->matched = 1;
+		compared++;
+		double change = was->ns > 0 ? (now->ns - was->ns) * 100 / was->ns : 0;
+		int slower = change > threshold && now->ns > was->worst;
+		regressions += slower;
+		printf("%-9s %11lu  %-16s %12.2f %12.2f %+8.1f%%%s\n", now->shape, now->nodes, now->op,
+			was->ns, now->ns, change, slower ? "  REGRESSION" : "");
+	}
+	for(int i = 0; i < base.count; i++) {
+		const Entry* was = &base.items[i];
+		if(!was->matched)
+			printf("%-9s %11lu  %-16s %12.2f %12s %9s\n", was->shape, was->nodes, was->op, was->ns, "-", "gone");
+	}
+
+	printf("%d compared, %d more than %.0f%% slower\n", compared, regressions, threshold);
+	free(base.items);
+	free(cur.items);
+	return regressions > 0;
+}
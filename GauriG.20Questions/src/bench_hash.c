@@ -0,0 +1,203 @@
+/*
+ * bench_hash.c - Open-addressing Hash vs the old chained hash table
+ *
+ * Usage: ./bench_hash [maxKeys]
+ * For 1K, 100K and 10M keys (capped at maxKeys) inserts every key, then
+ * looks each one up (hits) plus as many absent keys (misses), and prints
+ * nanoseconds per operation for:
+ * - chained/31: the old table at the fixed 31 buckets g_index used
+ * - chained/N:  the old table given one bucket per key up front
+ * - open:       the current table, starting from the same 31 hint
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lab5.h"
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ===== The previous chained table, kept here as the baseline ===== */
+typedef struct ChainEntry {
+	char *key;
+	IdList vals;
+	struct ChainEntry *next;
+} ChainEntry;
+
+typedef struct {
+	ChainEntry **buckets;
+	int nbuckets;
+	int size;
+} ChainHash;
+
+static void ch_init(ChainHash *h, int nbuckets) {
+	h->buckets = (ChainEntry**)calloc(nbuckets, sizeof(ChainEntry*));
+	h->nbuckets = nbuckets;
+	h->size = 0;
+}
+
+static int ch_put(ChainHash *h, const char *key, int id) {
+	int idx = h_hash(key) % h->nbuckets;
+	for(ChainEntry* e = h->buckets[idx]; e != NULL; e = e->next) {
+		if(strcmp(key, e->key) == 0) {
+			for(int i = 0; i < e->vals.count; i++) {
+				if(e->vals.ids[i] == id)
+					return 0;
+			}
+			if(e->vals.count == e->vals.capacity) {
+				e->vals.capacity += 4;
+				e->vals.ids = (int*)realloc(e->vals.ids, sizeof(int) * e->vals.capacity);
+			}
+			e->vals.ids[e->vals.count++] = id;
+			return 1;
+		}
+	}
+	ChainEntry* e = (ChainEntry*)malloc(sizeof(ChainEntry));
+	e->key = (char*)malloc(strlen(key) + 1);
+	strcpy(e->key, key);
+	e->vals.capacity = 4;
+	e->vals.ids = (int*)calloc(e->vals.capacity, sizeof(int));
+	e->vals.ids[0] = id;
+	e->vals.count = 1;
+	e->next = h->buckets[idx];
+	h->buckets[idx] = e;
+	h->size++;
+	return 1;
+}
+
+static int ch_contains(const ChainHash *h, const char *key, int id) {
+	int idx = h_hash(key) % h->nbuckets;
+	for(ChainEntry* e = h->buckets[idx]; e != NULL; e = e->next) {
+		if(strcmp(key, e->key) == 0) {
+			for(int i = 0; i < e->vals.count; i++) {
+				if(e->vals.ids[i] == id)
+					return 1;
+			}
+			return 0;
+		}
+	}
+	return 0;
+}
+
+static void ch_free(ChainHash *h) {
+	for(int i = 0; i < h->nbuckets; i++) {
+		ChainEntry* e = h->buckets[i];
+		while(e != NULL) {
+			ChainEntry* next = e->next;
+			free(e->key);
+			free(e->vals.ids);
+			free(e);
+			e = next;
+		}
+	}
+	free(h->buckets);
+}
+
+/* ===== Workload ===== */
+
+#define KEY_LEN 24
+
+static char *g_keys = NULL;     /* n present keys, then n absent ones */
+
+static const char *key_at(int i) {
+	return g_keys + (size_t)i * KEY_LEN;
+}
+
+/* Keys are numbered in a shuffled order: with sequential numbers djb2
+ * puts consecutive keys in consecutive buckets, which flatters chaining
+ * with a locality real question text doesn't have. */
+static void make_keys(int n) {
+	int* perm = (int*)malloc(sizeof(int) * n);
+	for(int i = 0; i < n; i++)
+		perm[i] = i;
+	srand(42);
+	for(int i = n - 1; i > 0; i--) {
+		int j = (int)(((long)rand() * RAND_MAX + rand()) % (i + 1));
+		int t = perm[i];
+		perm[i] = perm[j];
+		perm[j] = t;
+	}
+
+	g_keys = (char*)malloc((size_t)2 * n * KEY_LEN);
+	for(int i = 0; i < 2 * n; i++)
+		snprintf(g_keys + (size_t)i * KEY_LEN, KEY_LEN, "%s_question_%d", i < n ? "has" : "not", perm[i % n]);
+	free(perm);
+}
+
+static void report(const char *name, int n, double tIns, double tHit, double tMiss, long found) {
+	if(found != n) {
+		printf("%-12s %10d lookup mismatch (%ld found)\n", name, n, found);
+		exit(1);
+	}
+	printf("%-12s %10d %12.1f %12.1f %12.1f\n", name, n,
+		tIns * 1e9 / n, tHit * 1e9 / n, tMiss * 1e9 / n);
+}
+
+static void run_chained(int n, int nbuckets, const char *name) {
+	ChainHash h;
+	ch_init(&h, nbuckets);
+
+	double t0 = now_sec();
+	for(int i = 0; i < n; i++)
+		ch_put(&h, key_at(i), i);
+	double t1 = now_sec();
+	long found = 0;
+	for(int i = 0; i < n; i++)
+		found += ch_contains(&h, key_at(i), i);
+	double t2 = now_sec();
+	for(int i = n; i < 2 * n; i++)
+		found += ch_contains(&h, key_at(i), i - n);
+	double t3 = now_sec();
+
+	report(name, n, t1 - t0, t2 - t1, t3 - t2, found);
+	ch_free(&h);
+}
+
+static void run_open(int n) {
+	Hash h;
+	h_init(&h, 31);
+
+	double t0 = now_sec();
+	for(int i = 0; i < n; i++)
+		h_put(&h, key_at(i), i);
+	double t1 = now_sec();
+	long found = 0;
+	for(int i = 0; i < n; i++)
+		found += h_contains(&h, key_at(i), i);
+	double t2 = now_sec();
+	for(int i = n; i < 2 * n; i++)
+		found += h_contains(&h, key_at(i), i - n);
+	double t3 = now_sec();
+
+	report("open", n, t1 - t0, t2 - t1, t3 - t2, found);
+	h_free(&h);
+}
+
+int main(int argc, char **argv) {
+	int maxKeys = argc > 1 ? atoi(argv[1]) : 10000000;
+	int sizes[] = {1000, 100000, 10000000};
+
+	printf("%-12s %10s %12s %12s %12s\n", "table", "keys", "put ns", "hit ns", "miss ns");
+	for(int s = 0; s < 3 && sizes[s] <= maxKeys; s++) {
+		int n = sizes[s];
+		make_keys(n);
+
+		//31 fixed buckets is quadratic; past 100K keys it would run for hours
+		if(n <= 100000)
+			run_chained(n, 31, "chained/31");
+		else
+			printf("%-12s %10d %12s\n", "chained/31", n, "skipped");
+		run_chained(n, n, "chained/N");
+		run_open(n);
+
+		free(g_keys);
+		g_keys = NULL;
+	}
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * bench_layout.c - Random root-to-animal descent time in three node layouts
+ *
+ * Usage: ./bench_layout [nodes] [games]
+ * Builds one random tree of about nodes nodes (default 4M) by splitting
+ * random leaves, so nodes sit in the arena in the order they were learned
+ * (scattered, as malloc'd nodes would be). Then times games (default 2M)
+ * random descents from the root to an animal in that layout, after
+ * tree_relayout(LAYOUT_BFS) (what load_tree gives) and after
+ * tree_relayout(LAYOUT_VEB). Every layout sees the same answers, so it
+ * must take the same number of steps.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lab5.h"
+
+#define RUNS 3
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* descend
+ * - Walk games random paths down the tree (xorshift answers, the same
+ *   sequence every call); return the best of RUNS times, with the steps
+ *   taken
+ */
+static double descend(uint32_t games, uint64_t *steps) {
+	double best = 0;
+	for(int r = 0; r < RUNS; r++) {
+		uint64_t state = 88172645463325252ull, taken = 0;
+		double t0 = now_sec();
+		for(uint32_t g = 0; g < games; g++) {
+			NodeId id = g_root;
+			while(node_is_question(id)) {
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+				id = state >> 63 ? node_yes(id) : node_no(id);
+				taken++;
+			}
+		}
+		double t = now_sec() - t0;
+		if(r == 0 || t < best)
+			best = t;
+		*steps = taken;
+	}
+	return best;
+}
+
+int main(int argc, char **argv) {
+	uint32_t nodes = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 4000000;
+	uint32_t games = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 2000000;
+
+	gen_tree(GEN_RANDOM, nodes, 42);
+	TreeStats ts;
+	tree_stats(g_root, &ts);
+	printf("%u nodes, height %u, %u games\n", ts.nodes, ts.height, games);
+	printf("%-10s %12s %12s %12s\n", "layout", "seconds", "steps/game", "ns/step");
+
+	const char* names[] = {"learned", "bfs", "veb"};
+	uint64_t expected = 0;
+	for(int layout = 0; layout < 3; layout++) {
+		if(layout > 0 && !tree_relayout(layout == 1 ? LAYOUT_BFS : LAYOUT_VEB)) {
+			printf("tree_relayout failed\n");
+			return 1;
+		}
+		uint64_t steps = 0;
+		double secs = descend(games, &steps);
+		if(layout == 0)
+			expected = steps;
+		if(steps != expected) {
+			printf("%s layout changed the tree\n", names[layout]);
+			return 1;
+		}
+		printf("%-10s %12.4f %12.1f %12.2f\n", names[layout], secs,
+			(double)steps / games, secs * 1e9 / steps);
+	}
+
+	free_tree();
+	arena_free(&g_arena);
+	return 0;
+}
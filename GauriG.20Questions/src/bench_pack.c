@@ -0,0 +1,117 @@
+/*
+ * bench_pack.c - Size and load time of the packed format against the others
+ *
+ * Usage: ./bench_pack [nodes] [threads]
+ * Saves one random tree of about nodes nodes (default 4M) as a VERSION 1
+ * file, a VERSION 2 image and a VERSION 4 packed file, then reports each
+ * file's size, how long it took to write, and how long it takes to load
+ * serially and on threads threads (default: every online CPU). Load
+ * times are the best of RUNS loads, each checked to give back the tree.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lab5.h"
+
+#define RUNS 3
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+enum { V1_SERIAL, V1_PARALLEL, IMAGE, PACKED_SERIAL, PACKED_PARALLEL };
+
+/* load
+ * - Load filename the way kind says; 1 if it gave back nodes nodes
+ */
+static int load(int kind, const char *filename, int threads, uint32_t nodes) {
+	int ok = 0;
+	switch(kind) {
+	case V1_SERIAL: ok = load_tree(filename); break;
+	case V1_PARALLEL: ok = load_tree_parallel(filename, threads); break;
+	case IMAGE: ok = map_tree(filename); break;
+	case PACKED_SERIAL: ok = load_tree_packed(filename, 1); break;
+	case PACKED_PARALLEL: ok = load_tree_packed(filename, threads); break;
+	}
+	return ok && (uint32_t)count_nodes(g_root) == nodes;
+}
+
+/* best_of
+ * - Fastest of RUNS loads, or -1 if one fails
+ */
+static double best_of(int kind, const char *filename, int threads, uint32_t nodes) {
+	double best = 0;
+	for(int r = 0; r < RUNS; r++) {
+		double t0 = now_sec();
+		int ok = load(kind, filename, threads, nodes);
+		double t = now_sec() - t0;
+		if(!ok)
+			return -1;
+		if(r == 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+static long file_size(const char *filename) {
+	struct stat st;
+	return stat(filename, &st) == 0 ? (long)st.st_size : -1;
+}
+
+int main(int argc, char **argv) {
+	uint32_t nodes = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 4000000;
+	int threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(threads < 1)
+		threads = 1;
+
+	gen_tree(GEN_RANDOM, nodes, 42);
+	nodes = count_nodes(g_root);
+	printf("%u nodes, %d threads\n", nodes, threads);
+
+	//write each format once, timing it
+	const char* files[] = {"bench.dat", "bench.img", "bench.pk"};
+	double saved[3];
+	for(int f = 0; f < 3; f++) {
+		double t0 = now_sec();
+		int ok = f == 0 ? save_tree(files[f]) : f == 1 ? save_image(files[f]) : save_tree_packed(files[f], threads);
+		saved[f] = now_sec() - t0;
+		if(!ok) {
+			printf("saving %s failed\n", files[f]);
+			return 1;
+		}
+	}
+
+	const struct { const char *name; int kind; int file; } rows[] = {
+		{"v1 load_tree", V1_SERIAL, 0},
+		{"v1 load_tree_parallel", V1_PARALLEL, 0},
+		{"v2 map_tree", IMAGE, 1},
+		{"v4 packed, 1 thread", PACKED_SERIAL, 2},
+		{"v4 packed, parallel", PACKED_PARALLEL, 2},
+	};
+	long v1 = file_size(files[0]);
+	printf("%-24s %10s %8s %10s %10s\n", "format", "MB", "ratio", "save s", "load s");
+	for(int i = 0; i < 5; i++) {
+		double secs = best_of(rows[i].kind, files[rows[i].file], threads, nodes);
+		if(secs < 0) {
+			printf("%s failed\n", rows[i].name);
+			return 1;
+		}
+		long size = file_size(files[rows[i].file]);
+		printf("%-24s %10.2f %8.2f %10.4f %10.4f\n", rows[i].name, size / 1e6,
+			(double)size / v1, saved[rows[i].file], secs);
+	}
+
+	for(int f = 0; f < 3; f++)
+		remove(files[f]);
+	free_tree();
+	arena_free(&g_arena);
+	h_free(&g_index);
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * bench_pload.c - Times load_tree_parallel against thread count
+ *
+ * Usage: ./bench_pload [nodes] [maxThreads]
+ * Saves one random tree of about nodes nodes (default 10M) with
+ * save_tree, then loads it with load_tree and with load_tree_parallel on
+ * 1, 2, 4, ... up to maxThreads threads (default 32), checking every load
+ * gets the whole tree back. Each time is the best of RUNS loads.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lab5.h"
+
+#define RUNS 3
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* best_of
+ * - Fastest of RUNS loads with threads threads (0: load_tree); -1 if a
+ *   load fails or comes back with a different number of nodes
+ */
+static double best_of(const char *filename, int threads, uint32_t nodes) {
+	double best = 0;
+	for(int r = 0; r < RUNS; r++) {
+		double t0 = now_sec();
+		int ok = threads == 0 ? load_tree(filename) : load_tree_parallel(filename, threads);
+		double t = now_sec() - t0;
+		if(!ok || (uint32_t)count_nodes(g_root) != nodes)
+			return -1;
+		if(r == 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+int main(int argc, char **argv) {
+	uint32_t nodes = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 10000000;
+	int maxThreads = argc > 2 ? atoi(argv[2]) : 32;
+
+	gen_tree(GEN_RANDOM, nodes, 42);
+	nodes = count_nodes(g_root);
+	if(!save_tree("bench.dat")) {
+		printf("save_tree failed\n");
+		return 1;
+	}
+	printf("%u nodes, %ld online CPUs\n", nodes, sysconf(_SC_NPROCESSORS_ONLN));
+
+	double serial = best_of("bench.dat", 0, nodes);
+	if(serial < 0) {
+		printf("load_tree failed\n");
+		return 1;
+	}
+	printf("%8s %12s %12s %10s\n", "threads", "seconds", "nodes/sec", "speedup");
+	printf("%8s %12.4f %12.0f %10.2f\n", "serial", serial, nodes / serial, 1.0);
+
+	for(int t = 1; t <= maxThreads; t *= 2) {
+		double secs = best_of("bench.dat", t, nodes);
+		if(secs < 0) {
+			printf("load_tree_parallel failed at %d threads\n", t);
+			return 1;
+		}
+		printf("%8d %12.4f %12.0f %10.2f\n", t, secs, nodes / secs, serial / secs);
+	}
+
+	remove("bench.dat");
+	arena_free(&g_arena);
+	h_free(&g_index);
+	return 0;
+}
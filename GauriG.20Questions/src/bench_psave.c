@@ -0,0 +1,91 @@
+/*
+ * bench_psave.c - Times save_tree_parallel against thread count
+ *
+ * Usage: ./bench_psave [nodes] [maxThreads]
+ * Builds one random tree of about nodes nodes (default 4M) and saves it
+ * with save_tree, then with save_tree_parallel on 1, 2, 4, ... up to
+ * maxThreads threads (default 32), checking every file comes out the
+ * same as save_tree's. Each time is the best of RUNS saves.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lab5.h"
+
+#define RUNS 3
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int same_file(const char *a, const char *b) {
+	FILE* fa = fopen(a, "rb");
+	FILE* fb = fopen(b, "rb");
+	int same = fa != NULL && fb != NULL;
+	char x[65536], y[65536];
+	while(same) {
+		size_t na = fread(x, 1, sizeof(x), fa);
+		size_t nb = fread(y, 1, sizeof(y), fb);
+		same = na == nb && memcmp(x, y, na) == 0;
+		if(na == 0)
+			break;
+	}
+	if(fa != NULL)
+		fclose(fa);
+	if(fb != NULL)
+		fclose(fb);
+	return same;
+}
+
+/* best_of
+ * - Fastest of RUNS saves with threads threads (0: save_tree)
+ */
+static double best_of(const char *filename, int threads) {
+	double best = 0;
+	for(int r = 0; r < RUNS; r++) {
+		double t0 = now_sec();
+		int ok = threads == 0 ? save_tree(filename) : save_tree_parallel(filename, threads);
+		double t = now_sec() - t0;
+		if(!ok)
+			return -1;
+		if(r == 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+int main(int argc, char **argv) {
+	uint32_t nodes = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 4000000;
+	int maxThreads = argc > 2 ? atoi(argv[2]) : 32;
+
+	gen_tree(GEN_RANDOM, nodes, 42);
+	printf("%u nodes, %ld online CPUs\n", count_nodes(g_root), sysconf(_SC_NPROCESSORS_ONLN));
+
+	double serial = best_of("bench.dat", 0);
+	if(serial < 0) {
+		printf("save_tree failed\n");
+		return 1;
+	}
+	printf("%8s %12s %12s %10s\n", "threads", "seconds", "nodes/sec", "speedup");
+	printf("%8s %12.4f %12.0f %10.2f\n", "serial", serial, count_nodes(g_root) / serial, 1.0);
+
+	for(int t = 1; t <= maxThreads; t *= 2) {
+		double secs = best_of("bench2.dat", t);
+		if(secs < 0 || !same_file("bench.dat", "bench2.dat")) {
+			printf("save_tree_parallel failed or differs at %d threads\n", t);
+			return 1;
+		}
+		printf("%8d %12.4f %12.0f %10.2f\n", t, secs, count_nodes(g_root) / secs, serial / secs);
+	}
+
+	remove("bench.dat");
+	remove("bench2.dat");
+	arena_free(&g_arena);
+	return 0;
+}
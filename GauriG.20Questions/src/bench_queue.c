@@ -0,0 +1,121 @@
+/*
+ * bench_queue.c - Ring-buffer Queue vs the old linked-list queue
+ *
+ * Usage: ./bench_queue [entries]
+ * Runs the same BFS-shaped workload (dequeue one, enqueue two, then
+ * drain) through both implementations and prints million ops/sec.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "lab5.h"
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ===== The previous linked-list queue, kept here as the baseline ===== */
+typedef struct LinkedNode {
+	NodeId treeNode;
+	int id;
+	struct LinkedNode *next;
+} LinkedNode;
+
+typedef struct {
+	LinkedNode *front;
+	LinkedNode *rear;
+	int size;
+} LinkedQueue;
+
+static void lq_enqueue(LinkedQueue *q, NodeId node, int id) {
+	LinkedNode* n = (LinkedNode*)malloc(sizeof(LinkedNode));
+	n->treeNode = node;
+	n->id = id;
+	n->next = NULL;
+	if(q->rear == NULL) {
+		q->front = n;
+		q->rear = n;
+	} else {
+		q->rear->next = n;
+		q->rear = n;
+	}
+	q->size++;
+}
+
+static int lq_dequeue(LinkedQueue *q, NodeId *node, int *id) {
+	if(q->front == NULL)
+		return 0;
+	LinkedNode* n = q->front;
+	*node = n->treeNode;
+	*id = n->id;
+	q->front = n->next;
+	if(q->front == NULL)
+		q->rear = NULL;
+	free(n);
+	q->size--;
+	return 1;
+}
+
+/* Each run visits `total` entries the way a BFS over a full binary tree
+ * does: every dequeued entry enqueues two more until total is reached. */
+static double run_ring(int total, long *checksum) {
+	Queue q;
+	q_init(&q);
+	double t0 = now_sec();
+
+	NodeId node;
+	int id;
+	int next = 1;
+	q_enqueue(&q, 1, 0);
+	while(q_dequeue(&q, &node, &id)) {
+		*checksum += id;
+		if(next < total) { q_enqueue(&q, node + 1, next++); }
+		if(next < total) { q_enqueue(&q, node + 2, next++); }
+	}
+
+	double t = now_sec() - t0;
+	q_free(&q);
+	return t;
+}
+
+static double run_linked(int total, long *checksum) {
+	LinkedQueue q = {NULL, NULL, 0};
+	double t0 = now_sec();
+
+	NodeId node;
+	int id;
+	int next = 1;
+	lq_enqueue(&q, 1, 0);
+	while(lq_dequeue(&q, &node, &id)) {
+		*checksum += id;
+		if(next < total) { lq_enqueue(&q, node + 1, next++); }
+		if(next < total) { lq_enqueue(&q, node + 2, next++); }
+	}
+
+	return now_sec() - t0;
+}
+
+int main(int argc, char **argv) {
+	int maxEntries = argc > 1 ? atoi(argv[1]) : 10000000;
+
+	printf("%12s %16s %16s %10s\n", "entries", "linked Mops/s", "ring Mops/s", "speedup");
+	for(int n = 1000; n <= maxEntries; n *= 10) {
+		long sumLinked = 0;
+		long sumRing = 0;
+		double tl = run_linked(n, &sumLinked);
+		double tr = run_ring(n, &sumRing);
+		if(sumLinked != sumRing) {
+			printf("checksum mismatch at %d entries\n", n);
+			return 1;
+		}
+
+		//one enqueue + one dequeue per entry
+		double ops = 2.0 * n / 1e6;
+		printf("%12d %16.1f %16.1f %9.1fx\n", n, ops / tl, ops / tr, tl / tr);
+	}
+	return 0;
+}
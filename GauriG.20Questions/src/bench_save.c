@@ -0,0 +1,118 @@
+/*
+ * bench_save.c - Times save_tree throughput against tree size
+ *
+ * Usage: ./bench_save [maxNodes]
+ * Builds random trees of 1K, 10K, ... nodes up to maxNodes (default 1M)
+ * and prints how long one save_tree takes for each. A second table shows
+ * what a page snapshot (save_pages) writes the first time, and again
+ * after LEARNS more animals.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lab5.h"
+
+/* Animals learned between the two page snapshots */
+#define LEARNS 10
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* learn_random
+ * - Walk to a random leaf and split it like the game does when it
+ *   learns an animal
+ */
+static void learn_random(uint32_t i) {
+	NodeId leaf = g_root;
+	while(node_is_question(leaf))
+		leaf = rand() & 1 ? node_yes(leaf) : node_no(leaf);
+
+	char text[64];
+	snprintf(text, sizeof(text), "Is it learned animal %u?", i);
+	NodeId q = create_question_node(text);
+	snprintf(text, sizeof(text), "Learned animal %u", i);
+	node_set_yes(q, create_animal_node(text));
+
+	NodeId parent = node_parent(leaf);
+	int wasYes = parent != NODE_NIL && node_yes(parent) == leaf;
+	node_set_no(q, leaf);
+	if(parent == NODE_NIL)
+		tree_set_root(q);
+	else if(wasYes)
+		node_set_yes(parent, q);
+	else
+		node_set_no(parent, q);
+}
+
+/* bench_pages
+ * - One page snapshot of the tree, then another after LEARNS animals
+ */
+static int bench_pages(void) {
+	remove_pages("bench.pg");
+	double t0 = now_sec();
+	if(!save_pages("bench.pg"))
+		return 0;
+	double first = now_sec() - t0;
+	PageStats full;
+	pages_stats(&full);
+
+	for(uint32_t i = 0; i < LEARNS; i++)
+		learn_random(i);
+	t0 = now_sec();
+	if(!save_pages("bench.pg"))
+		return 0;
+	double again = now_sec() - t0;
+	PageStats inc;
+	pages_stats(&inc);
+
+	printf("%12u %10u %12.2f %12.4f %10u %12.4f %12.4f\n", count_nodes(g_root), inc.pages,
+		full.bytesWritten / 1e6, first, inc.written, inc.bytesWritten / 1e6, again);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	uint32_t maxNodes = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 1000000;
+
+	printf("%12s %12s %12s %14s\n", "nodes", "seconds", "MB", "nodes/sec");
+	for(uint32_t n = 1000; n <= maxNodes; n *= 10) {
+		gen_tree(GEN_RANDOM, n, 42);
+
+		double t0 = now_sec();
+		if(!save_tree("bench.dat")) {
+			printf("save_tree failed at %u nodes\n", n);
+			return 1;
+		}
+		double t = now_sec() - t0;
+
+		FILE* fp = fopen("bench.dat", "rb");
+		fseek(fp, 0, SEEK_END);
+		long bytes = ftell(fp);
+		fclose(fp);
+
+		printf("%12u %12.4f %12.2f %14.0f\n", count_nodes(g_root), t, bytes / 1e6,
+			count_nodes(g_root) / t);
+	}
+
+	printf("\npage snapshots, then again after %d animals are learned:\n", LEARNS);
+	printf("%12s %10s %12s %12s %10s %12s %12s\n", "nodes", "pages", "first MB", "seconds",
+		"rewritten", "then MB", "seconds");
+	for(uint32_t n = 1000; n <= maxNodes; n *= 10) {
+		gen_tree(GEN_RANDOM, n, 42);
+		if(!bench_pages()) {
+			printf("save_pages failed at %u nodes\n", n);
+			return 1;
+		}
+	}
+
+	remove("bench.dat");
+	pages_forget();
+	remove_pages("bench.pg");
+	arena_free(&g_arena);
+	return 0;
+}
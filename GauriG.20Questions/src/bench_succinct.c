@@ -0,0 +1,95 @@
+/*
+ * bench_succinct.c - Memory and walk speed of a succinct tree vs the arena
+ *
+ * Usage: ./bench_succinct [nodes] [games]
+ * Builds one random tree of about nodes nodes (default 4M), makes a
+ * succinct copy of it, and reports the bytes each holds and how fast
+ * games (default 1M) walk down them from the root to an animal with
+ * random answers, reading each question's text on the way as a server
+ * would. Both walks see the same answers and must reach the same animals.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lab5.h"
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* next_answer
+ * - A cheap random bit stream (xorshift), the same for both walks
+ */
+static int next_answer(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return (int)(*state >> 63);
+}
+
+int main(int argc, char **argv) {
+	uint32_t nodes = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 4000000;
+	uint32_t games = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1000000;
+
+	gen_tree(GEN_RANDOM, nodes, 42);
+	SuccinctTree t;
+	if(!succinct_build(&t, g_root)) {
+		printf("succinct_build failed\n");
+		return 1;
+	}
+	size_t nodeBytes = sizeof(NodeLinks) + sizeof(Node);
+	size_t arenaBytes = (size_t)g_arena.count * nodeBytes + g_arena.strings.size;
+	size_t shapeBytes = succinct_bytes(&t) - t.textSize;
+	printf("%u nodes, %u games\n", t.nodes, games);
+	printf("%-10s %14s %14s %14s\n", "tree", "total bytes", "shape bytes", "bits/node");
+	printf("%-10s %14zu %14zu %14.1f\n", "arena", arenaBytes,
+		(size_t)g_arena.count * nodeBytes, 8.0 * nodeBytes);
+	printf("%-10s %14zu %14zu %14.1f\n", "succinct", succinct_bytes(&t), shapeBytes,
+		8.0 * shapeBytes / t.nodes);
+
+	//arena walks
+	uint64_t state = 88172645463325252ull, steps = 0, check = 0;
+	double t0 = now_sec();
+	for(uint32_t g = 0; g < games; g++) {
+		NodeId id = g_root;
+		while(node_is_question(id)) {
+			check += (unsigned char)node_text(id)[0];
+			id = next_answer(&state) ? node_yes(id) : node_no(id);
+			steps++;
+		}
+		check += (unsigned char)node_text(id)[0];
+	}
+	double arenaSecs = now_sec() - t0;
+
+	//succinct walks, same answers
+	uint64_t checkArena = check;
+	state = 88172645463325252ull;
+	check = 0;
+	t0 = now_sec();
+	for(uint32_t g = 0; g < games; g++) {
+		uint32_t i = 0;
+		while(succinct_is_question(&t, i)) {
+			check += (unsigned char)succinct_text(&t, i)[0];
+			i = next_answer(&state) ? succinct_yes(&t, i) : succinct_no(&t, i);
+		}
+		check += (unsigned char)succinct_text(&t, i)[0];
+	}
+	double succinctSecs = now_sec() - t0;
+	if(check != checkArena) {
+		printf("the walks disagree\n");
+		return 1;
+	}
+
+	printf("%-10s %14s %14s\n", "walk", "seconds", "ns/step");
+	printf("%-10s %14.4f %14.1f\n", "arena", arenaSecs, arenaSecs * 1e9 / steps);
+	printf("%-10s %14.4f %14.1f\n", "succinct", succinctSecs, succinctSecs * 1e9 / steps);
+
+	succinct_free(&t);
+	arena_free(&g_arena);
+	return 0;
+}
@@ -0,0 +1,304 @@
+/*
+ * bench_suite.c - The benchmark suite behind make bench
+ *
+ * Usage: ./bench_suite [-n maxNodes] [-m minNodes] [-s shapes] [-r runs] [-o results.json] [-p]
+ * For every shape (default all; -s takes a comma list of balanced, chain,
+ * random and skewed) and every size from minNodes (default 1K) up to
+ * maxNodes (default 1M), ten times bigger each step, generates a tree
+ * with gen_tree and times:
+ *   generate         gen_tree itself, per node
+ *   check_integrity  per node
+ *   count_nodes      per call
+ *   index_rebuild    putting every node in g_index, per node
+ *   index_find       looking an animal up by name, per lookup
+ *   descent          engine games with random answers, per question
+ *   save_tree        per node
+ *   load_tree        per node
+ * Each time is the best of runs (default 5) samples, and a sample repeats
+ * its operation for at least SAMPLE_SEC, so a 1K tree is timed as
+ * steadily as a big one. Results are printed as a table and written to
+ * results.json (default bench.json) with the slowest sample too, so
+ * bench_compare can tell a slowdown from noise.
+ *
+ * -p also counts cycles, instructions, LLC, branch and dTLB misses over
+ * each sample (see perfctr.c) and reports the best sample's, per unit,
+ * next to its time: what a change to Node's layout should move. Where
+ * the counters can't be had (no PMU in a VM, perf_event_paranoid above
+ * 2) the run says so and goes on with times alone.
+ *
+ * Every tree comes from a fixed seed, so two runs time the same work.
+ * 100M nodes take about 6 GB of memory and as much again on disk.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lab5.h"
+
+#define SEED 42
+#define SAMPLE_SEC 0.05
+#define COUNT_CALLS 1000000
+#define LOOKUPS 10000
+#define GAMES 10000
+#define MAX_RESULTS 1024
+
+static const char *BENCH_FILE = "bench.dat";
+
+typedef struct {
+	const char *shape;
+	uint32_t nodes;
+	const char *op;
+	uint64_t units;         /* nodes, calls, lookups or questions per call */
+	double seconds;         /* one call, best sample */
+	double worst;           /* one call, slowest sample */
+	double perUnit[PERF_COUNTERS];  /* best sample's counts per unit, -p */
+} Result;
+
+/* What the current tree is, for the operations */
+static GenShape g_shape;
+static uint32_t g_size;
+static Result g_results[MAX_RESULTS];
+static int g_nresults;
+static PerfCounters g_perf;
+static int g_counting;          /* -p and at least one counter opened */
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The operations: each does one call's worth of work and returns how
+ * many units it covered */
+static uint64_t op_generate(void) {
+	if(!gen_tree(g_shape, g_size, SEED)) {
+		fprintf(stderr, "gen_tree failed: out of memory\n");
+		exit(1);
+	}
+	return count_nodes(g_root);
+}
+
+static uint64_t op_check_integrity(void) {
+	if(!check_integrity()) {
+		fprintf(stderr, "check_integrity failed on a generated tree\n");
+		exit(1);
+	}
+	return count_nodes(g_root);
+}
+
+static uint64_t op_count_nodes(void) {
+	volatile int sink = 0;
+	for(int i = 0; i < COUNT_CALLS; i++)
+		sink += count_nodes(g_root);
+	(void)sink;
+	return COUNT_CALLS;
+}
+
+static uint64_t op_index_rebuild(void) {
+	index_rebuild();
+	return count_nodes(g_root);
+}
+
+static uint64_t op_index_find(void) {
+	uint32_t state = 2463534242u;
+	char name[32];
+	for(int i = 0; i < LOOKUPS; i++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		snprintf(name, sizeof(name), "Animal %u", state % g_size);
+		int count;
+		index_find(name, 0, &count);
+	}
+	return LOOKUPS;
+}
+
+static uint64_t op_descent(void) {
+	GameSession s;
+	engine_init(&s);
+	uint32_t state = 88675123u;
+	uint64_t questions = 0;
+	for(int g = 0; g < GAMES; g++) {
+		engine_start(&s);
+		while(s.state == ENGINE_QUESTION) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			engine_answer(&s, state & 1);
+			questions++;
+		}
+		engine_answer(&s, 1);
+	}
+	engine_free(&s);
+	return questions;
+}
+
+static uint64_t op_save_tree(void) {
+	if(!save_tree(BENCH_FILE)) {
+		fprintf(stderr, "save_tree failed\n");
+		exit(1);
+	}
+	return count_nodes(g_root);
+}
+
+static uint64_t op_load_tree(void) {
+	if(!load_tree(BENCH_FILE)) {
+		fprintf(stderr, "load_tree failed\n");
+		exit(1);
+	}
+	return count_nodes(g_root);
+}
+
+/* time_op
+ * - One call to size the samples, then the best of runs samples of reps
+ *   calls each; record and print the time of one call
+ */
+static void time_op(const char *name, uint64_t (*op)(void), int runs) {
+	double t0 = now_sec();
+	uint64_t units = op();
+	double first = now_sec() - t0;
+	uint32_t reps = first >= SAMPLE_SEC ? 1 : (uint32_t)(SAMPLE_SEC / (first > 1e-6 ? first : 1e-6)) + 1;
+
+	Result* res = &g_results[g_nresults++];
+	double best = 0, worst = 0;
+	for(int r = 0; r < runs; r++) {
+		if(g_counting)
+			perf_start(&g_perf);
+		t0 = now_sec();
+		for(uint32_t i = 0; i < reps; i++)
+			op();
+		double t = (now_sec() - t0) / reps;
+		if(g_counting)
+			perf_stop(&g_perf);
+		if(r == 0 || t < best) {
+			best = t;
+			for(int c = 0; g_counting && c < PERF_COUNTERS; c++)
+				res->perUnit[c] = units ? (double)g_perf.value[c] / reps / units : 0.0;
+		}
+		if(r == 0 || t > worst)
+			worst = t;
+	}
+
+	res->shape = gen_shape_name(g_shape);
+	res->nodes = (uint32_t)count_nodes(g_root);
+	res->op = name;
+	res->units = units;
+	res->seconds = best;
+	res->worst = worst;
+	printf("%-9s %11u  %-16s %11llu %12.4f %10.2f\n", res->shape, res->nodes, name,
+		(unsigned long long)units, best * 1e3, units ? best * 1e9 / units : 0.0);
+	if(g_counting) {
+		printf("%37s", "per unit:");
+		for(int c = 0; c < PERF_COUNTERS; c++) {
+			if(perf_available(&g_perf, (PerfCounter)c))
+				printf("  %s %.2f", perf_counter_name((PerfCounter)c), res->perUnit[c]);
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+/* write_json
+ * - Every result, one object a line, for bench_compare
+ */
+static int write_json(const char *filename, int runs) {
+	FILE* fp = fopen(filename, "w");
+	if(fp == NULL)
+		return 0;
+	fprintf(fp, "{\n  \"suite\": \"bench_suite\",\n  \"seed\": %d,\n  \"runs\": %d,\n  \"results\": [\n",
+		SEED, runs);
+	for(int i = 0; i < g_nresults; i++) {
+		const Result* r = &g_results[i];
+		fprintf(fp, "    {\"shape\": \"%s\", \"nodes\": %u, \"op\": \"%s\", \"units\": %llu, "
+			"\"seconds\": %.9f, \"ns_per_unit\": %.3f, \"ns_worst\": %.3f",
+			r->shape, r->nodes, r->op, (unsigned long long)r->units, r->seconds,
+			r->units ? r->seconds * 1e9 / r->units : 0.0, r->units ? r->worst * 1e9 / r->units : 0.0);
+		//counters as <name>_per_unit, only the ones this machine gave
+		for(int c = 0; g_counting && c < PERF_COUNTERS; c++) {
+			if(perf_available(&g_perf, (PerfCounter)c))
+				fprintf(fp, ", \"%s_per_unit\": %.4f", perf_counter_name((PerfCounter)c), r->perUnit[c]);
+		}
+		fprintf(fp, "}%s\n", i + 1 < g_nresults ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+	return fclose(fp) == 0;
+}
+
+int main(int argc, char **argv) {
+	uint64_t maxNodes = 1000000, minNodes = 1000;
+	const char* shapes = "balanced,chain,random,skewed";
+	const char* out = "bench.json";
+	int runs = 5, counters = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "n:m:s:r:o:p")) != -1) {
+		switch(opt) {
+		case 'n': maxNodes = strtoull(optarg, NULL, 10); break;
+		case 'm': minNodes = strtoull(optarg, NULL, 10); break;
+		case 's': shapes = optarg; break;
+		case 'r': runs = atoi(optarg); break;
+		case 'o': out = optarg; break;
+		case 'p': counters = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-n maxNodes] [-m minNodes] [-s shapes] [-r runs] [-o results.json] [-p]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if(minNodes < 1 || maxNodes > NODE_ID_MAX || runs < 1) {
+		fprintf(stderr, "bench_suite: sizes must be 1 to %u nodes, runs at least 1\n", NODE_ID_MAX);
+		return 2;
+	}
+
+	//the shapes to run, in the order given
+	GenShape order[4];
+	int nshapes = 0;
+	char* list = strdup(shapes);
+	for(char* name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+		if(nshapes == 4 || !gen_shape_parse(name, &order[nshapes])) {
+			fprintf(stderr, "bench_suite: unknown shape '%s'\n", name);
+			return 2;
+		}
+		nshapes++;
+	}
+	free(list);
+
+	//hardware counters, if asked for and to be had
+	if(counters) {
+		g_counting = perf_open(&g_perf) > 0;
+		if(!g_counting)
+			fprintf(stderr, "bench_suite: no hardware counters here (no PMU, or perf_event_paranoid > 2); timing only\n");
+	}
+
+	printf("%-9s %11s  %-16s %11s %12s %10s\n", "shape", "nodes", "op", "units", "ms/call", "ns/unit");
+	for(int s = 0; s < nshapes; s++) {
+		for(uint64_t size = minNodes; size <= maxNodes; size *= 10) {
+			if(g_nresults + 8 > MAX_RESULTS)
+				break;
+			g_shape = order[s];
+			g_size = (uint32_t)size;
+			time_op("generate", op_generate, runs);
+			time_op("check_integrity", op_check_integrity, runs);
+			time_op("count_nodes", op_count_nodes, runs);
+			time_op("index_rebuild", op_index_rebuild, runs);
+			time_op("index_find", op_index_find, runs);
+			time_op("descent", op_descent, runs);
+			time_op("save_tree", op_save_tree, runs);
+			time_op("load_tree", op_load_tree, runs);
+		}
+	}
+	remove(BENCH_FILE);
+	if(counters)
+		perf_close(&g_perf);
+	free_tree();
+	arena_free(&g_arena);
+
+	if(!write_json(out, runs)) {
+		fprintf(stderr, "bench_suite: can't write %s\n", out);
+		return 1;
+	}
+	printf("results in %s\n", out);
+	return 0;
+}
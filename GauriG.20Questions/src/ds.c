@@ -1,106 +1,414 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/mman.h>
 #include "lab5.h"
 
-/* ========== Node Functions ========== */
+/* ========== Node Arena ========== */
 
-/* create_question_node
- * - Allocate memory for a Node structure
- * - Use strdup() (I USED STRCPY INSTEAD) to copy the question string (heap allocation)
- * - Set isQuestion to 1
- * - Initialize yes and no pointers to NULL
- * - Return the new node
- */
-Node *create_question_node(const char *question) {
-	//Allocate Memory for a Node Structure
-	Node* qNode = (Node*)malloc(sizeof(Node));
-	if(qNode == NULL)
-		return NULL;
+/* Global node store. Every tree node and every byte of node text lives here. */
+NodeArena g_arena = {NULL, NULL, 0, 0, {NULL, 0, 0, NULL, NULL, 0, 0, 0, 0, 0, 0, NULL}, NULL, 0, 0, NULL,
+	NULL, 0, 0, 0, 0};
 
-	//Use malloc and strcpy to copy the question string (heap allocation)
-	qNode->text = (char*)malloc(strlen(question) + 1);
-	if(qNode->text != NULL)
-		strcpy(qNode->text, question);
+/* Source of NodeArena.generation */
+static uint32_t g_generation;
 
-	//Set isQuestion to 1
-	qNode->isQuestion = 1;
+/* arena_init
+ * - Start with no storage; the first arena_reserve/arena_alloc allocates it
+ * - count starts at 1 because slot 0 is the reserved NODE_NIL slot
+ */
+void arena_init(NodeArena *a) {
+	a->links = NULL;
+	a->nodes = NULL;
+	a->count = 1;
+	a->capacity = 0;
+	sp_init(&a->strings);
+	a->map = NULL;
+	a->mapSize = 0;
+	a->nodesMapped = 0;
+	a->retire = NULL;
+	a->dirty = NULL;
+	a->dirtyCount = 0;
+	a->dirtyCapacity = 0;
+	a->trackDirty = 0;
+	a->generation = ++g_generation;
+}
 
-	//Initialize yes and no pointers to NULL
-	qNode->yes = NULL;
-	qNode->no = NULL;
+/* arena_set_retire
+ * - Route the old node arrays and text slab through retire() when they
+ *   grow (NULL goes back to plain realloc)
+ * - Call before readers start; a mapped image must already have been
+ *   copied out, since a mapping is unmapped rather than retired
+ */
+void arena_set_retire(NodeArena *a, void (*retire)(void *old)) {
+	a->retire = retire;
+	a->strings.retire = retire;
+}
 
-	//Return the new node
-	return qNode;
+/* arena_unmap
+ * Drop the mapped image once nothing points into it any more
+ */
+static void arena_unmap(NodeArena *a) {
+	if(a->map == NULL || a->nodesMapped || a->strings.external)
+		return;
+	munmap(a->map, a->mapSize);
+	a->map = NULL;
+	a->mapSize = 0;
 }
 
-/* create_animal_node
- * - Similar to create_question_node but set isQuestion to 0
- * - This represents a leaf node with an animal name
+/* grow_half
+ * Move one of the arena's node arrays (*array, count elements of size
+ * bytes) to room for capacity elements, the way arena_reserve explains
+ * - Return 1 on success, 0 if out of memory (*array unchanged)
  */
-Node *create_animal_node(const char *animal) {
-	//Allocate Memory for a Node Structure
-        Node* aNode = (Node*)malloc(sizeof(Node));
-	if(aNode == NULL)
-		return NULL;
+static int grow_half(NodeArena *a, void **array, size_t size, uint64_t capacity) {
+	void* grown;
+	if(a->nodesMapped || (a->retire != NULL && *array != NULL)) {
+		grown = malloc((size_t)capacity * size);
+		if(grown != NULL)
+			memcpy(grown, *array, (size_t)a->count * size);
+	} else {
+		grown = realloc(*array, (size_t)capacity * size);
+	}
+	if(grown == NULL)
+		return 0;
+
+	//the reserved slot is an all-zero leaf
+	if(*array == NULL)
+		memset(grown, 0, size);
+
+	void* old = *array;
+	__atomic_store_n(array, grown, __ATOMIC_RELEASE);
+	if(a->retire != NULL && !a->nodesMapped && old != NULL)
+		a->retire(old);
+	return 1;
+}
+
+/* arena_reserve
+ * Make sure the arena can take `nodes` more nodes without reallocating.
+ * - Grow both node arrays by doubling until they are big enough
+ * - Return 1 on success, 0 if out of memory (the arena keeps its
+ *   capacity; one array may have moved, which readers can't tell, unless
+ *   it was mapped: then the copy is dropped, as nothing would free it)
+ */
+int arena_reserve(NodeArena *a, uint32_t nodes) {
+	//lazily set up an arena that was zero-initialized
+	if(a->count == 0)
+		a->count = 1;
+
+	uint64_t needNodes = (uint64_t)a->count + nodes;
+	if(needNodes > (uint64_t)NODE_ID_MAX + 1)
+		return 0;
+	if(needNodes <= a->capacity)
+		return 1;
+
+	uint64_t newCap = a->capacity ? a->capacity : 64;
+	while(newCap < needNodes)
+		newCap *= 2;
+	if(newCap > (uint64_t)NODE_ID_MAX + 1)
+		newCap = (uint64_t)NODE_ID_MAX + 1;
+
+	//arrays of a mapped image can't be realloc'd, so copy them out the
+	//first time; arrays that readers may still hold are copied too and
+	//retired. Both are in place before any new node is linked, so a
+	//reader that follows a link to one finds it in both
+	TRACE_BEGIN(arena_grow);
+	NodeLinks* links = a->links;
+	int grown = grow_half(a, (void**)&a->links, sizeof(NodeLinks), newCap);
+	if(grown && !grow_half(a, (void**)&a->nodes, sizeof(Node), newCap)) {
+		//a still-mapped arena frees neither array, so put the mapped
+		//links back rather than leak a copy on every retry
+		if(a->nodesMapped) {
+			NodeLinks* copy = a->links;
+			__atomic_store_n(&a->links, links, __ATOMIC_RELEASE);
+			if(a->retire != NULL)
+				a->retire(copy);
+			else
+				free(copy);
+		}
+		grown = 0;
+	}
+	TRACE_END(arena_grow);
+	if(!grown)
+		return 0;
+	a->capacity = (uint32_t)newCap;
+	a->nodesMapped = 0;
+	arena_unmap(a);
+	return 1;
+}
 
-        //Use strcpy() to copy the animal string (heap allocation)
-        aNode->text = (char*)malloc(strlen(animal) + 1);
-	if(aNode->text != NULL)
-		strcpy(aNode->text, animal);
+/* arena_alloc
+ * - Reserve room for one node
+ * - Intern the text in the arena's string pool (duplicates share a copy)
+ * - Fill in the node with no children and no parent; its aggregates are
+ *   those of a subtree of one node
+ * - Return the new node's index, or NODE_NIL if out of memory
+ */
+NodeId arena_alloc(NodeArena *a, const char *text, int isQuestion) {
+	if(!arena_reserve(a, 1))
+		return NODE_NIL;
+
+	uint32_t offset = sp_intern(&a->strings, text);
+	if(offset == SP_NONE)
+		return NODE_NIL;
+
+	//the pool may just have copied its text out of a mapped image
+	if(a->map != NULL)
+		arena_unmap(a);
+
+	//fill in the node
+	NodeId id = a->count++;
+	a->links[id].yes = isQuestion ? NODE_QUESTION : NODE_NIL;
+	a->links[id].no = NODE_NIL;
+	a->nodes[id].text = offset;
+	a->nodes[id].parent = NODE_NIL;
+	a->nodes[id].size = 1;
+	a->nodes[id].leaves = isQuestion ? 0 : 1;
+	a->nodes[id].height = 1;
+	a->nodes[id].plays = 0;
+	a->nodes[id].yeses = 0;
+	a->nodes[id].correct = 0;
+	return id;
+}
 
-        //Set isQuestion to 0
-        aNode->isQuestion = 0;
+/* arena_reset
+ * Drop every node and all text at once, keeping the memory for reuse
+ */
+void arena_reset(NodeArena *a) {
+	//a mapped node array is read-only storage we don't own; start over on the heap
+	if(a->nodesMapped) {
+		a->links = NULL;
+		a->nodes = NULL;
+		a->capacity = 0;
+		a->nodesMapped = 0;
+	}
+	a->count = 1;
+	sp_reset(&a->strings);
+	arena_unmap(a);
+	a->dirtyCount = 0;
+	a->trackDirty = 0;
+	a->generation = ++g_generation;
+}
 
-        //Initialize yes and no pointers to NULL
-        aNode->yes = NULL;
-        aNode->no = NULL;
+/* arena_free
+ * Give the arena's memory back to the system
+ */
+void arena_free(NodeArena *a) {
+	if(!a->nodesMapped) {
+		free(a->links);
+		free(a->nodes);
+	}
+	sp_free(&a->strings);
+	if(a->map != NULL)
+		munmap(a->map, a->mapSize);
+	free(a->dirty);
+	arena_init(a);
+}
+
+/* ========== Node Functions ========== */
+
+/* create_question_node
+ * - Allocate a node slot and intern the question in the arena's string pool
+ * - Flag it as a question
+ * - yes and no start as NODE_NIL
+ * - Return the new node's index (NODE_NIL if out of memory)
+ */
+NodeId create_question_node(const char *question) {
+	return arena_alloc(&g_arena, question, 1);
+}
+
+/* create_animal_node
+ * - Similar to create_question_node but without the question flag
+ * - This represents a leaf node with an animal name
+ */
+NodeId create_animal_node(const char *animal) {
+	return arena_alloc(&g_arena, animal, 0);
+}
 
-        //Return the new node
-        return aNode;
+/* free_tree
+ * - Every node and its interned text live in g_arena, so freeing the
+ *   tree is a single arena reset instead of a walk over every node
+ * - Nodes detached by undo are reclaimed here too
+ * - g_index only holds ids of these nodes, so it is dropped as well and
+ *   rebuilt from g_root the next time it is used
+ * IMPORTANT: every NodeId handed out before the reset is now invalid!
+ */
+void free_tree(void) {
+	arena_reset(&g_arena);
+	h_free(&g_index);
+	index_invalidate();
 }
 
-/*   free_tree (recursive)
- * - This is one of the few recursive functions allowed
- * - Base case: if node is NULL, return
- * - Recursively free left subtree (yes)
- * - Recursively free right subtree (no)
- * - Free the text string
- * - Free the node itself
- * IMPORTANT: Free children before freeing the parent!
+/* node_mark_dirty
+ * - Note that id's page must be read again at the next page snapshot
+ * - Nothing is recorded until the arena has a snapshot; if the list
+ *   would outgrow DIRTY_MAX (or memory), stop and let the snapshot read
+ *   every page
  */
-void free_tree(Node *node) {
-	//Base case: if node is NULL, return
-	if(node == NULL) {
+static void node_mark_dirty(NodeId id) {
+	NodeArena* a = &g_arena;
+	if(a->trackDirty <= 0 || id == NODE_NIL)
 		return;
+	if(a->dirtyCount == a->dirtyCapacity) {
+		uint32_t cap = a->dirtyCapacity ? a->dirtyCapacity * 2 : 64;
+		NodeId* grown = cap <= DIRTY_MAX ? (NodeId*)realloc(a->dirty, cap * sizeof(NodeId)) : NULL;
+		if(grown == NULL) {
+			a->trackDirty = -1;
+			return;
+		}
+		a->dirty = grown;
+		a->dirtyCapacity = cap;
 	}
+	a->dirty[a->dirtyCount++] = id;
+}
 
-	//Recursively free left subtree (yes)
-	free_tree(node->yes);
+/* node_refresh
+ * Recompute id's aggregates from its children's, then walk up the parent
+ * links doing the same until an ancestor comes out unchanged
+ * - NODE_NIL's slot is all zero, so a missing child adds nothing
+ * - A question always has leaves from its children; a leaf counts itself
+ * - A node whose size changes class may start or stop starting a page
+ */
+static void node_refresh(NodeId id) {
+	while(id != NODE_NIL) {
+		Node* n = node_at(id);
+		const Node* y = node_at(node_yes(id));
+		const Node* o = node_at(node_no(id));
+
+		uint32_t size = 1 + y->size + o->size;
+		uint32_t leaves = node_is_question(id) ? y->leaves + o->leaves : 1;
+		uint32_t height = 1 + (y->height > o->height ? y->height : o->height);
+		if(size == n->size && leaves == n->leaves && height == n->height)
+			return;
+
+		if(page_size_class(size) != page_size_class(n->size))
+			node_mark_dirty(id);
+		n->size = size;
+		n->leaves = leaves;
+		n->height = height;
+		id = n->parent;
+	}
+}
 
-	//Recursively free right subtree (no)
-	free_tree(node->no);
+/* node_set_yes / node_set_no
+ * - Link child under id and point child's parent back at id
+ * - The link is a release store: a reader that sees child also sees the
+ *   node that was filled in before it was linked
+ * - Refresh the aggregates from id up to the root, O(depth)
+ * - Both nodes are marked dirty for the next page snapshot
+ * - The node that was there before keeps its parent link; callers that
+ *   detach it (undo) either relink it elsewhere or drop it
+ */
+void node_set_yes(NodeId id, NodeId child) {
+	node_mark_dirty(id);
+	if(child != NODE_NIL) {
+		node_at(child)->parent = id;
+		node_mark_dirty(child);
+	}
+	uint32_t* yes = &arena_links()[id].yes;
+	uint32_t flag = __atomic_load_n(yes, __ATOMIC_RELAXED) & NODE_QUESTION;
+	__atomic_store_n(yes, child | flag, __ATOMIC_RELEASE);
+	node_refresh(id);
+}
 
-	//Free the text string
-	free(node->text);
+void node_set_no(NodeId id, NodeId child) {
+	node_mark_dirty(id);
+	if(child != NODE_NIL) {
+		node_at(child)->parent = id;
+		node_mark_dirty(child);
+	}
+	__atomic_store_n(&arena_links()[id].no, child, __ATOMIC_RELEASE);
+	node_refresh(id);
+}
 
-	//Free the node itself
-	free(node);
+/* node_cas_child
+ * Swing one child slot from *expected to child in a single step
+ * - id NODE_NIL names the root slot (g_root); yes picks the branch
+ * - On success the store is a release, like node_set_yes/node_set_no,
+ *   but nothing else changes: node_attach finishes the job
+ * - On failure *expected is set to what the slot holds now
+ * - Several learners may race on one slot; exactly one of them wins
+ * - The yes slot shares its word with the question flag, which never
+ *   changes, so it is compared and stored along with the id
+ */
+int node_cas_child(NodeId id, int yes, NodeId *expected, NodeId child) {
+	uint32_t* slot = id == NODE_NIL ? &g_root : yes ? &arena_links()[id].yes : &arena_links()[id].no;
+	uint32_t flag = id != NODE_NIL && yes ? __atomic_load_n(slot, __ATOMIC_RELAXED) & NODE_QUESTION : 0;
+	uint32_t seen = *expected | flag;
+	int won = __atomic_compare_exchange_n(slot, &seen, child | flag, 0,
+		__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	*expected = seen & NODE_ID_MAX;
+	return won;
 }
 
-/* count_nodes (recursive)
- * - Base case: if root is NULL, return 0
- * - Return 1 + count of left subtree + count of right subtree
+/* node_attach
+ * Finish a splice made with node_cas_child: id now hangs under parent
+ * - Point id at parent and id's children at id. A child may itself be a
+ *   question another learner spliced in below id already
+ * - Refresh the aggregates from id, then from parent up to the root; id
+ *   may already be up to date if that learner got here first
+ * - Writer lock held
  */
-int count_nodes(Node *root) {
-	//Base case: if root is NULL, return 0
-	if(root == NULL) {
-		return 0;
+void node_attach(NodeId parent, NodeId id) {
+	NodeId y = node_yes(id);
+	NodeId n = node_no(id);
+	node_at(id)->parent = parent;
+	node_mark_dirty(parent);
+	node_mark_dirty(id);
+	if(y != NODE_NIL) {
+		node_at(y)->parent = id;
+		node_mark_dirty(y);
+	}
+	if(n != NODE_NIL) {
+		node_at(n)->parent = id;
+		node_mark_dirty(n);
 	}
+	node_refresh(id);
+	node_refresh(parent);
+}
+
+/* tree_set_root
+ * - Make id the root; a node that used to hang under a question (undo of
+ *   a split at the root) must not keep pointing at it
+ */
+void tree_set_root(NodeId id) {
+	if(id != NODE_NIL) {
+		node_at(id)->parent = NODE_NIL;
+		node_mark_dirty(id);
+	}
+	__atomic_store_n(&g_root, id, __ATOMIC_RELEASE);
+}
+
+/* count_nodes
+ * - NODE_NIL has no nodes
+ * - Otherwise the subtree size is cached on the node, O(1)
+ */
+int count_nodes(NodeId root) {
+	if(root == NODE_NIL)
+		return 0;
+	return (int)node_at(root)->size;
+}
 
-	//Return 1 + count of left subtree + count of right subtree
-	return (1 + count_nodes(root->yes) + count_nodes(root->no));
+/* ========== Tree Statistics ========== */
+
+/* tree_stats
+ * - An empty tree (NODE_NIL) has all-zero stats, even before the arena
+ *   has any storage
+ * - Otherwise copy the cached aggregates of root's subtree into out
+ * - Every node that is not an animal is a question
+ */
+void tree_stats(NodeId root, TreeStats *out) {
+	if(root == NODE_NIL) {
+		memset(out, 0, sizeof(*out));
+		return;
+	}
+	const Node* n = node_at(root);
+	out->nodes = n->size;
+	out->animals = n->leaves;
+	out->questions = n->size - n->leaves;
+	out->height = n->height;
 }
 
 /* ========== Frame Stack (for iterative tree traversal) ========== */
@@ -127,7 +435,7 @@ void fs_init(FrameStack *s) {
  * - Store the node and answeredYes in frames[size]
  * - Increment size
  */
-void fs_push(FrameStack *s, Node *node, int answeredYes) {
+void fs_push(FrameStack *s, NodeId node, int answeredYes) {
 	//Check if size >= capacity
 	if(s->size >= s->capacity) {
 		//If so, double the capacity and reallocate the array
@@ -205,7 +513,8 @@ void es_init(EditStack *s) {
 void es_push(EditStack *s, Edit e) {
 	//literally the exact same thing as fs_push but for Edit
         if(s->size >= s->capacity) {
-                s->capacity = s->capacity * 2;
+                //a zeroed stack (e.g. a global never es_init'ed) starts at 16
+                s->capacity = s->capacity ? s->capacity * 2 : 16;
                 s->edits = (Edit*)realloc(s->edits, sizeof(Edit) * s->capacity);
         }
 
@@ -258,89 +567,104 @@ void free_edit_stack(EditStack *s) {
 
 /* ========== Queue (for BFS traversal) ========== */
 
+/* The queue is a ring buffer over one array, so a BFS over N nodes costs
+ * O(log N) reallocs in total instead of 2N malloc/free calls.
+ */
+
 /* q_init
- * - Set front and rear to NULL
- * - Set size to 0
+ * - Start with no array; the first enqueue (or q_reserve) allocates it
+ * - Set head and size to 0
  */
 void q_init(Queue *q) {
-	//Set front and rear to NULL
-	q->front = NULL;
-	q->rear = NULL;
-
-	//Set size to 0
+	q->items = NULL;
+	q->head = 0;
 	q->size = 0;
+	q->capacity = 0;
 }
 
-/* q_enqueue
- * - Allocate a new QueueNode
- * - Set its treeNode and id fields
- * - Set its next pointer to NULL
- * - If queue is empty (rear == NULL):
- *   - Set both front and rear to the new node
- * - Otherwise:
- *   - Link rear->next to the new node
- *   - Update rear to point to the new node
- * - Increment size
+/* q_grow
+ * - Move the entries into an array of newCap slots (a power of two)
+ * - Entries that wrapped past the end are copied after the others so the
+ *   queue starts at index 0 again
+ * - Return 1 on success, 0 if out of memory (queue unchanged)
  */
-void q_enqueue(Queue *q, Node *node, int id) {
-    	//Allocate a new QueueNode
-	QueueNode* addNode = (QueueNode*)malloc(sizeof(QueueNode));
+static int q_grow(Queue *q, int newCap) {
+	QueueEntry* grown = (QueueEntry*)malloc(sizeof(QueueEntry) * newCap);
+	if(grown == NULL)
+		return 0;
+	TRACE_BEGIN(q_grow);
+
+	//copy [head, end) then the wrapped [0, rest)
+	int first = q->capacity - q->head;
+	if(first > q->size)
+		first = q->size;
+	if(first > 0)
+		memcpy(grown, q->items + q->head, sizeof(QueueEntry) * first);
+	if(q->size > first)
+		memcpy(grown + first, q->items, sizeof(QueueEntry) * (q->size - first));
+
+	free(q->items);
+	q->items = grown;
+	q->head = 0;
+	q->capacity = newCap;
+	TRACE_END(q_grow);
+	return 1;
+}
 
-	//Set its treeNode and id fields
-	addNode->treeNode = node;
-	addNode->id = id;
+/* q_reserve
+ * - Hint that the queue will hold at least n entries at once
+ * - Round up to a power of two and grow now, so the BFS never reallocates
+ */
+void q_reserve(Queue *q, int n) {
+	if(n <= q->capacity)
+		return;
 
-	//Set its next pointer to NULL
-	addNode->next = NULL;
+	int newCap = q->capacity ? q->capacity : 16;
+	while(newCap < n)
+		newCap *= 2;
+	q_grow(q, newCap);
+}
 
-	//If queue is empty (rear == NULL):
-	if(q->rear == NULL) {
-		//Set both front and rear to the new node
-		q->front = addNode;
-		q->rear = addNode;
-	} else {
-	//Otherwise:
-		//Link rear->next to the new node
-		q->rear->next = addNode;
-		q->rear = addNode;
+/* q_enqueue
+ * - If the ring is full, double the capacity
+ * - Store the node and id at (head + size) & (capacity - 1)
+ * - Increment size
+ */
+void q_enqueue(Queue *q, NodeId node, int id) {
+	//If the ring is full, double it
+	if(q->size == q->capacity) {
+		if(!q_grow(q, q->capacity ? q->capacity * 2 : 16))
+			return;
 	}
+
+	//Store at the slot just past the last entry
+	int slot = (q->head + q->size) & (q->capacity - 1);
+	q->items[slot].treeNode = node;
+	q->items[slot].id = id;
+
 	//Increment Size
 	q->size = q->size + 1;
 }
 
 /* q_dequeue
- * - If queue is empty (front == NULL), return 0
- * -B Save the front node's data to output parameters (*node, *id)
- * - Save front in a temp variable
- * - Move front to front->next
- * - If front is now NULL, set rear to NULL too
- * - Free the temp node
+ * - If queue is empty (size == 0), return 0
+ * - Save the front entry's data to output parameters (*node, *id)
+ * - Advance head, wrapping around the end of the array
  * - Decrement size
  * - Return 1
  */
-int q_dequeue(Queue *q, Node **node, int *id) {
-    	//If queue is empty (front == NULL), return 0
-	if(q->front == NULL){
+int q_dequeue(Queue *q, NodeId *node, int *id) {
+	//If queue is empty, return 0
+	if(q->size == 0){
 		return 0;
 	}
 
-	//Save the front node's data to output parameters (*node, *id)
-	*id = q->front->id;
-	*node = q->front->treeNode;
-
-	//Save front in a temp variable
-	QueueNode* temp = q->front;
-
-	//Move front to front->next
-	q->front = q->front->next;
-
-	//If front is now NULL, set rear to NULL too
-	if(q->front == NULL) {
-		q->rear = NULL;
-	}
+	//Save the front entry's data to output parameters (*node, *id)
+	*node = q->items[q->head].treeNode;
+	*id = q->items[q->head].id;
 
-	//Free the temp node
-	free(temp);
+	//Advance head with wraparound
+	q->head = (q->head + 1) & (q->capacity - 1);
 
 	//Decrement Size
 	q->size = q->size - 1;
@@ -362,25 +686,12 @@ int q_empty(Queue *q) {
 }
 
 /* q_free
- * - Dequeue all remaining nodes
- * - Use a loop with q_dequeue until queue is empty
+ * - Free the ring buffer and reset the queue to empty
+ * - The Queue struct itself belongs to the caller
  */
 void q_free(Queue *q) {
-	//place to put dequeued items, just temp variables
-	int *id = 0;
-	Node **node = NULL;
-
-	//if nothing to free, return
-	if(q->front == NULL) { return; }
-
-	//while you can dequeue, keep doing it (while dequeue returns 1, keep dequeueing)
-	int a = 1;
-	while(a != 0) {
-		a = q_dequeue(q, node, id);
-	}
-
-	//USER MUST FREE ACTUAL QUEUE
-
+	free(q->items);
+	q_init(q);
 }
 
 /* ========== Hash Table ========== */
@@ -406,33 +717,41 @@ void q_free(Queue *q) {
 char *canonicalize(const char *s) {
 	//malloc the string that will have the canonicalized phrase
 	char* buffer = (char*)malloc(strlen(s) + 1);
+	if(buffer == NULL)
+		return NULL;
 
-	//track current index of actual string
-	int i = 0;
+	canonicalize_to(buffer, s);
 
-	//track current index of buffer
-	int nullIdx = 0;
+	//return buffer
+	return buffer;
+}
+
+/* canonicalize_to
+ * Same as canonicalize but writes into dst, which must hold strlen(s) + 1
+ * bytes. Returns the canonical length. Used where a malloc per string
+ * would dominate (rebuilding the attribute index).
+ */
+size_t canonicalize_to(char *dst, const char *s) {
+	//track current index of buffer (skipped characters leave no gap)
+	size_t nullIdx = 0;
 
 	//loop through actual string
-	for(i = 0; s[i] != '\0'; i++) {
+	for(size_t i = 0; s[i] != '\0'; i++) {
+		unsigned char c = (unsigned char)s[i];
 
 		//if alphanumeric, put the lowercase version in the buffer
-		if(isalnum(s[i])){
-			buffer[i] = tolower(s[i]);
-			nullIdx++;
+		if(isalnum(c)){
+			dst[nullIdx++] = (char)tolower(c);
 
 		//if space, convert to underscore, put in buffer
-		} else if(isspace(s[i])){
-			buffer[i] = '_';
-			nullIdx++;
+		} else if(isspace(c)){
+			dst[nullIdx++] = '_';
 		}
 	}
 
 	//put null at end of buffered string
-	buffer[nullIdx] = '\0';
-
-	//return buffer
-	return buffer;
+	dst[nullIdx] = '\0';
+	return nullIdx;
 }
 
 /* h_hash (djb2 algorithm)
@@ -454,103 +773,199 @@ unsigned h_hash(const char *s) {
 	return hash;
 }
 
+/* Grow once more than 4/5 of the slots are in use */
+#define H_LOAD_NUM 4
+#define H_LOAD_DEN 5
+
 /* h_init
- * - Allocate buckets array using calloc (initializes to NULL)
- * - Set nbuckets field
- * - Set size to 0
+ * - nbuckets is a sizing hint: allocate enough slots (a power of two)
+ *   to hold that many keys under the load limit
+ * - Set size to 0 and start with an empty key slab
  */
 void h_init(Hash *h, int nbuckets) {
-	//Allocate buckets array using calloc (initializes to NULL)
-	h->buckets = (Entry**)calloc(nbuckets, sizeof(Entry*));
+	h->slots = NULL;
+	h->nslots = 0;
+	h->size = 0;
+	h->keys = NULL;
+	h->keysSize = 0;
+	h->keysCapacity = 0;
+	h->keysDead = 0;
+
+	int nslots = 8;
+	while((long)nslots * H_LOAD_NUM < (long)nbuckets * H_LOAD_DEN)
+		nslots *= 2;
+
+	//Allocate slots using calloc (dist 0 marks every slot empty)
+	h->slots = (HashSlot*)calloc(nslots, sizeof(HashSlot));
+	if(h->slots != NULL)
+		h->nslots = nslots;
+}
+
+/* h_place
+ * Robin Hood insert of a slot that is known not to be in the table:
+ * - Walk from the key's home slot
+ * - Whenever the resident is closer to its home than we are, swap and
+ *   keep going with the resident ("take from the rich")
+ * - Stop at the first empty slot
+ */
+static void h_place(HashSlot *slots, int nslots, HashSlot cur) {
+	int mask = nslots - 1;
+	int i = (int)(cur.hash & (unsigned)mask);
+	cur.dist = 1;
+
+	while(slots[i].dist != 0) {
+		if(slots[i].dist < cur.dist) {
+			HashSlot tmp = slots[i];
+			slots[i] = cur;
+			cur = tmp;
+		}
+		i = (i + 1) & mask;
+		cur.dist++;
+	}
+	slots[i] = cur;
+}
 
-	//Set nbuckets field
-	h->nbuckets = nbuckets;
+/* h_resize
+ * - Allocate nslots empty slots and re-place every key using its cached
+ *   hash, so no key string is read again
+ * - Return 1 on success, 0 if out of memory (table unchanged)
+ */
+static int h_resize(Hash *h, int nslots) {
+	HashSlot* slots = (HashSlot*)calloc(nslots, sizeof(HashSlot));
+	if(slots == NULL)
+		return 0;
 
-	//Set size to 0
-	h->size = 0;
+	TRACE_BEGIN(h_resize);
+	for(int i = 0; i < h->nslots; i++) {
+		if(h->slots[i].dist != 0)
+			h_place(slots, nslots, h->slots[i]);
+	}
+
+	free(h->slots);
+	h->slots = slots;
+	h->nslots = nslots;
+	TRACE_END(h_resize);
+	return 1;
+}
+
+/* h_find
+ * Return the slot index holding key, or -1 if it isn't there; *probes
+ * (unless NULL) gets how many slots were looked at
+ * - Probe from the home slot; stop at an empty slot or as soon as the
+ *   resident is closer to home than we are (Robin Hood invariant: the
+ *   key would have been placed there)
+ * - Compare cached hashes first, strings only on a hash match
+ */
+static int h_find(const Hash *h, const char *key, unsigned hash, uint32_t *probes) {
+	uint32_t dummy;
+	if(probes == NULL)
+		probes = &dummy;
+	*probes = 0;
+	if(h->nslots == 0)
+		return -1;
+
+	int mask = h->nslots - 1;
+	int i = (int)(hash & (unsigned)mask);
+	uint32_t dist = 1;
+
+	while(h->slots[i].dist != 0 && h->slots[i].dist >= dist) {
+		*probes = dist;
+		if(h->slots[i].hash == hash && strcmp(h->keys + h->slots[i].key, key) == 0)
+			return i;
+		i = (i + 1) & mask;
+		dist++;
+	}
+	*probes = dist;
+	return -1;
 }
 
 /* h_put
  * Add animalId to the list for the given key
  *
  * Steps:
- * 1. Compute bucket index: idx = h_hash(key) % nbuckets
- * 2. Search the chain at buckets[idx] for an entry with matching key
- * 3. If found:
+ * 1. Hash the key and look for its slot
+ * 2. If found:
  *    - Check if animalId already exists in the vals list
  *    - If yes, return 0 (no change)
  *    - If no, add animalId to vals.ids array (resize if needed), return 1
- * 4. If not found:
- *    - Create new Entry with strdup(key) (I USED STRCPY INSTEAD)
- *    - Initialize vals with initial capacity (e.g., 4)
- *    - Add animalId as first element
- *    - Insert at head of chain (buckets[idx])
+ * 3. If not found:
+ *    - Grow the table if one more key would pass the load limit
+ *    - Copy the key into the key slab
+ *    - Initialize vals with a small capacity and add animalId
+ *    - Robin Hood insert the new slot
  *    - Increment h->size
  *    - Return 1
  */
 int h_put(Hash *h, const char *key, int animalId) {
-	//1. Compute bucket index: idx = h_hash(key) % nbuckets
-	int idx = h_hash(key) % h->nbuckets;
-
-	//2. Search the chain at buckets[idx] for an entry with matching key
-	Entry* ptr = h->buckets[idx];
-	while(ptr != NULL) {
-
-		//3. If found:
-		if(strcmp(key, ptr->key) == 0){
-
-			//Check if animalId already exists in the vals list
-			int i = 0;
-			for(i = 0; i < ptr->vals.count; i++) {
-				if(ptr->vals.ids[i] == animalId){
-					//If yes, return 0 (no change)
-					return 0;
-				}
-			}
-
-			//If no, add animalId to vals.ids array (resize if needed), return 1
-			if(ptr->vals.count == ptr->vals.capacity){
-				//resize if full
-				ptr->vals.ids = (int*)realloc(ptr->vals.ids, ptr->vals.capacity + 4);
-				ptr->vals.capacity += 4;
-
-			}
-
-			//put animalID in arr
-			ptr->vals.ids[ptr->vals.count] = animalId;
-			ptr->vals.count++;
-			return 1;
+	//1. Hash the key and look for its slot
+	unsigned hash = h_mix(h_hash(key));
+	int idx = h_find(h, key, hash, NULL);
+
+	//2. If found:
+	if(idx >= 0) {
+		IdList* vals = &h->slots[idx].vals;
+
+		//Check if animalId already exists in the vals list
+		for(int i = 0; i < vals->count; i++) {
+			if(vals->ids[i] == animalId)
+				return 0;
 		}
 
-		//Check next node
-		else {
-			ptr = ptr->next;
+		//If no, add animalId to vals.ids array (resize if needed)
+		if(vals->count == vals->capacity) {
+			int* grown = (int*)realloc(vals->ids, sizeof(int) * vals->capacity * 2);
+			if(grown == NULL)
+				return 0;
+			vals->ids = grown;
+			vals->capacity *= 2;
 		}
+		vals->ids[vals->count++] = animalId;
+		return 1;
 	}
 
-	//If not found:
+	//3. If not found: grow the table first if needed
+	if((long)(h->size + 1) * H_LOAD_DEN > (long)h->nslots * H_LOAD_NUM) {
+		if(!h_resize(h, h->nslots ? h->nslots * 2 : 8))
+			return 0;
+	}
 
-	//Create new Entry with malloc and probably also strcpy
-	Entry* notFound = (Entry*)malloc(sizeof(Entry));
-	notFound->key = (char*)malloc(strlen(key) + 1);
-	strcpy(notFound->key, key);
+	//Copy the key into the slab; offsets are 32-bit, so it can't pass 4 GiB
+	uint64_t need = (uint64_t)h->keysSize + strlen(key) + 1;
+	if(need > UINT32_MAX)
+		return 0;
+	uint32_t len = (uint32_t)(need - h->keysSize);
+	if(need > h->keysCapacity) {
+		uint64_t newCap = h->keysCapacity ? h->keysCapacity : 256;
+		while(newCap < need)
+			newCap *= 2;
+		if(newCap > UINT32_MAX)
+			newCap = UINT32_MAX;
+		char* grown = (char*)realloc(h->keys, newCap);
+		if(grown == NULL)
+			return 0;
+		h->keys = grown;
+		h->keysCapacity = (uint32_t)newCap;
+	}
 
-	//Initialize vals with initial capacity (e.g., 4)
-	notFound->vals.capacity = 4;
-	notFound->vals.ids = (int*)calloc(notFound->vals.capacity,sizeof(int));
+	HashSlot slot;
+	slot.hash = hash;
+	slot.key = h->keysSize;
+	slot.dist = 0;
 
-	//Add animalId as first element
-	notFound->vals.ids[0] = animalId;
-	notFound->vals.count = 1;
+	//Initialize vals with a small capacity and add animalId
+	slot.vals.capacity = 2;
+	slot.vals.ids = (int*)malloc(sizeof(int) * slot.vals.capacity);
+	if(slot.vals.ids == NULL)
+		return 0;
+	slot.vals.ids[0] = animalId;
+	slot.vals.count = 1;
 
-	//Insert at head of chain (buckets[idx])
-	notFound->next = h->buckets[idx];
-	h->buckets[idx] = notFound;
+	memcpy(h->keys + h->keysSize, key, len);
+	h->keysSize += len;
 
-	//Increment h->size
+	//Robin Hood insert and count the key
+	h_place(h->slots, h->nslots, slot);
 	h->size++;
-
-	//Return 1
 	return 1;
 }
 
@@ -558,40 +973,23 @@ int h_put(Hash *h, const char *key, int animalId) {
  * Check if the hash table contains the given key-animalId pair
  *
  * Steps:
- * 1. Compute bucket index
- * 2. Search the chain for matching key
- * 3. If found, search vals.ids array for animalId
- * 4. Return 1 if found, 0 otherwise
+ * 1. Find the key's slot
+ * 2. If found, search vals.ids array for animalId
+ * 3. Return 1 if found, 0 otherwise
  */
 int h_contains(const Hash *h, const char *key, int animalId) {
-	//1. Compute bucket index
-	int idx = h_hash(key) % h->nbuckets;
-	Entry* ptr = h->buckets[idx];
-
-	//2. Search the chain for matching key
-        while(ptr != NULL) {
-
-                //3. If found:
-                if(strcmp(key, ptr->key) == 0){
-
-                        //Check if animalId already exists in the vals list
-                        int i = 0;
-                        for(i = 0; i < ptr->vals.count; i++) {
-                                if(ptr->vals.ids[i] == animalId){
-                                        //If yes, return 0 (no change)
-                                        return 1;
-                                }
-                        }
-
-			return 0;
-                }
+	//1. Find the key's slot
+	int idx = h_find(h, key, h_mix(h_hash(key)), NULL);
+	if(idx < 0)
+		return 0;
 
-                //Check next node
-                else {
-                        ptr = ptr->next;
-		}
+	//2. Search vals for animalId
+	const IdList* vals = &h->slots[idx].vals;
+	for(int i = 0; i < vals->count; i++) {
+		if(vals->ids[i] == animalId)
+			return 1;
 	}
-    return 0;
+	return 0;
 }
 
 /* h_get_ids
@@ -600,88 +998,147 @@ int h_contains(const Hash *h, const char *key, int animalId) {
  * Return NULL if key not found
  *
  * Steps:
- * 1. Compute bucket index
- * 2. Search chain for matching key
- * 3. If found:
+ * 1. Find the key's slot
+ * 2. If found:
  *    - Set *outCount = vals.count
  *    - Return vals.ids
- * 4. If not found:
+ * 3. If not found:
  *    - Set *outCount = 0
  *    - Return NULL
  */
 int *h_get_ids(const Hash *h, const char *key, int *outCount) {
-    	//1. Compute bucket index
-        int idx = h_hash(key) % h->nbuckets;
-        Entry* ptr = h->buckets[idx];
-
-	//2. Search chain for matching key
-        while(ptr != NULL) {
-
-                //3. If found:
-                if(strcmp(key, ptr->key) == 0){
-			//Set *outCount = vals.count
-                        *outCount = ptr->vals.count;
-
-			//Return vals.ids
-                        return ptr->vals.ids;
-                }
-
-                //Check next node
-                else {
-                        ptr = ptr->next;
-                }
-        }
+	return h_get_ids_probed(h, key, outCount, NULL);
+}
 
-	//If not found:
+/* h_get_ids_probed
+ * - h_get_ids, also setting *probes (unless NULL) to the slots it read
+ */
+int *h_get_ids_probed(const Hash *h, const char *key, int *outCount, uint32_t *probes) {
+	//1. Find the key's slot
+	int idx = h_find(h, key, h_mix(h_hash(key)), probes);
 
-	//Set *outCount = 0
-	*outCount = 0;
+	//3. If not found:
+	if(idx < 0) {
+		*outCount = 0;
+		return NULL;
+	}
 
-	//return NULL
-	return NULL;
+	//2. If found:
+	*outCount = h->slots[idx].vals.count;
+	return h->slots[idx].vals.ids;
 }
 
-/* h_free
- * Free all memory associated with the hash table
+/* h_compact_keys
+ * - Copy only live keys into a fresh slab and point slots at the copies
+ * - Called once removed keys make up over half the slab
+ */
+static void h_compact_keys(Hash *h) {
+	uint32_t live = h->keysSize - h->keysDead;
+	char* keys = (char*)malloc(live > 0 ? live : 1);
+	if(keys == NULL)
+		return;
+
+	TRACE_BEGIN(h_compact_keys);
+	uint32_t used = 0;
+	for(int i = 0; i < h->nslots; i++) {
+		if(h->slots[i].dist == 0)
+			continue;
+		uint32_t len = (uint32_t)strlen(h->keys + h->slots[i].key) + 1;
+		memcpy(keys + used, h->keys + h->slots[i].key, len);
+		h->slots[i].key = used;
+		used += len;
+	}
+
+	free(h->keys);
+	h->keys = keys;
+	h->keysSize = used;
+	h->keysCapacity = live > 0 ? live : 1;
+	h->keysDead = 0;
+	TRACE_END(h_compact_keys);
+}
+
+/* h_remove
+ * Remove animalId from the list for the given key
  *
  * Steps:
- * - For each bucket:
- *   - Traverse the chain
- *   - For each entry:
- *     - Free the key string
- *     - Free the vals.ids array
- *     - Free the entry itself
- * - Free the buckets array
- * - Set buckets to NULL, size to 0
+ * 1. Find the key's slot; return 0 if the key or the id isn't there
+ * 2. Remove the id, keeping the other ids in order
+ * 3. If that was the last id, drop the key:
+ *    - Free its id array
+ *    - Backward-shift deletion: pull each following slot that isn't in
+ *      its home slot back by one, until an empty or home slot
+ *    - Decrement h->size; compact the key slab if it is mostly dead
+ * 4. Return 1
  */
-void h_free(Hash *h) {
-	int i = 0;
+int h_remove(Hash *h, const char *key, int animalId) {
+	//1. Find the key's slot and the id in it
+	int idx = h_find(h, key, h_mix(h_hash(key)), NULL);
+	if(idx < 0)
+		return 0;
 
-	//For each bucket:
-	for(i = 0; i < h->nbuckets; i++) {
-		//head ptr of chain
-		Entry* ptr = h->buckets[i];
+	IdList* vals = &h->slots[idx].vals;
+	int at = -1;
+	for(int i = 0; i < vals->count; i++) {
+		if(vals->ids[i] == animalId) {
+			at = i;
+			break;
+		}
+	}
+	if(at < 0)
+		return 0;
 
-		//traverse the chain
-		while(ptr != NULL){
-			//Free the key string
-			free(ptr->key);
+	//2. Remove the id, keeping order
+	memmove(vals->ids + at, vals->ids + at + 1, sizeof(int) * (vals->count - at - 1));
+	vals->count--;
+	if(vals->count > 0)
+		return 1;
 
-			//Free the vals.ids array
-			free(ptr->vals.ids);
+	//3. Last id gone: drop the key
+	free(vals->ids);
+	h->keysDead += (uint32_t)strlen(h->keys + h->slots[idx].key) + 1;
+
+	int mask = h->nslots - 1;
+	int j = idx;
+	while(1) {
+		int next = (j + 1) & mask;
+		if(h->slots[next].dist <= 1)
+			break;
+		h->slots[j] = h->slots[next];
+		h->slots[j].dist--;
+		j = next;
+	}
+	memset(&h->slots[j], 0, sizeof(HashSlot));
+	h->size--;
 
-			//Free the entry itself (used temp variable)
-			Entry* temp = ptr;
-			ptr = ptr->next;
-			free(temp);
-		}
+	if(h->keysDead * 2 > h->keysSize)
+		h_compact_keys(h);
+
+	//4. Return 1
+	return 1;
+}
+
+/* h_free
+ * Free all memory associated with the hash table
+ *
+ * Steps:
+ * - Free the vals.ids array of every occupied slot
+ * - Free the slots array and the key slab
+ * - Reset to an empty table
+ */
+void h_free(Hash *h) {
+	for(int i = 0; i < h->nslots; i++) {
+		if(h->slots[i].dist != 0)
+			free(h->slots[i].vals.ids);
 	}
 
-	//Free Buckets Array
-	free(h->buckets);
+	free(h->slots);
+	free(h->keys);
 
-	//set buckets to NULL, size to 0
-	h->buckets = NULL;
-	h->nbuckets = 0;
+	h->slots = NULL;
+	h->nslots = 0;
 	h->size = 0;
+	h->keys = NULL;
+	h->keysSize = 0;
+	h->keysCapacity = 0;
+	h->keysDead = 0;
 }
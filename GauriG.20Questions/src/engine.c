@@ -0,0 +1,578 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "lab5.h"
+
+extern NodeId g_root;
+extern EditStack g_undo;
+extern EditStack g_redo;
+
+/* ========== Game Engine ========== */
+
+/* Writers serialize on g_learnLock. Splices (node_cas_child) don't: they
+ * share g_spliceLock, which only growing the node array and undo/redo,
+ * the writes that aren't a single swap, take for themselves. Lock order
+ * is g_learnLock, then g_spliceLock. */
+pthread_mutex_t g_learnLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t g_spliceLock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Learns that have allocated their nodes but not yet recorded the edit;
+ * guarded by g_learnLock */
+static int g_inFlight = 0;
+
+/* engine_quiesce
+ * Hold the tree still: every learn is either not yet allocated or fully
+ * recorded (bookkept, on g_undo, journaled), and no splice can start
+ * - Returns holding g_learnLock and g_spliceLock; engine_resume lets go
+ * - Lock-free readers carry on
+ */
+void engine_quiesce(void) {
+	pthread_mutex_lock(&g_learnLock);
+	while(g_inFlight > 0) {
+		pthread_mutex_unlock(&g_learnLock);
+		sched_yield();
+		pthread_mutex_lock(&g_learnLock);
+	}
+	pthread_rwlock_wrlock(&g_spliceLock);
+}
+
+void engine_resume(void) {
+	pthread_rwlock_unlock(&g_spliceLock);
+	pthread_mutex_unlock(&g_learnLock);
+}
+
+/* engine_init
+ * - Set up an idle session; engine_start begins a game
+ */
+void engine_init(GameSession *s) {
+	memset(s, 0, sizeof(*s));
+	fs_init(&s->path);
+	s->state = ENGINE_DONE;
+	s->result = ENGINE_PLAYING;
+	s->current = NODE_NIL;
+}
+
+/* count_tree
+ * - Bring the tree size gauge up to date after an edit; g_learnLock held
+ */
+static void count_tree(void) {
+	NodeId root = tree_root();
+	metric_set(METRIC_TREE_NODES, root != NODE_NIL ? node_at(root)->size : 0);
+}
+
+/* usage_add
+ * - One finished game at n: a play, a yes if it answered yes there, and a
+ *   correct if it was guessed right. Relaxed adds, since other sessions
+ *   may be counting the same node
+ */
+static void usage_add(Node *n, int yes, int correct) {
+	__atomic_fetch_add(&n->plays, 1, __ATOMIC_RELAXED);
+	if(yes)
+		__atomic_fetch_add(&n->yeses, 1, __ATOMIC_RELAXED);
+	if(correct)
+		__atomic_fetch_add(&n->correct, 1, __ATOMIC_RELAXED);
+}
+
+/* count_usage
+ * Credit a finished game to the nodes it reached
+ * - Every question on the path and the guess it ended at; at the guess a
+ *   yes is the right guess
+ * - Done once a game rather than at every answer, under the shared side
+ *   of g_spliceLock so no count lands in a node array that is being
+ *   copied away. Games on a succinct tree have no nodes to count in
+ */
+static void count_usage(const GameSession *s) {
+	if(s->succinct != NULL || s->current == NODE_NIL)
+		return;
+	int correct = s->result == ENGINE_GUESSED;
+	pthread_rwlock_rdlock(&g_spliceLock);
+	Node* nodes = arena_nodes();
+	for(int i = 0; i < s->path.size; i++)
+		usage_add(&nodes[s->path.frames[i].node], s->path.frames[i].answeredYes == 1, correct);
+	usage_add(&nodes[s->current], correct, correct);
+	pthread_rwlock_unlock(&g_spliceLock);
+}
+
+/* finish
+ * - End the game with result and count it: how it ended, how many
+ *   questions it took, and in the usage of every node it reached
+ */
+static void finish(GameSession *s, EngineResult result) {
+	static const MetricId ends[] = {
+		[ENGINE_GUESSED] = METRIC_GAMES_GUESSED,
+		[ENGINE_LEARNED] = METRIC_GAMES_LEARNED,
+		[ENGINE_REPEATED] = METRIC_GAMES_REPEATED,
+		[ENGINE_STUMPED] = METRIC_GAMES_STUMPED,
+	};
+	s->state = ENGINE_DONE;
+	s->result = result;
+	metric_add(ends[result], 1);
+	metric_observe(METRIC_GAME_QUESTIONS, (uint64_t)s->path.size);
+	count_usage(s);
+}
+
+/* is_question / child
+ * - Read the tree the session plays, g_root's or a succinct one
+ */
+static int is_question(const GameSession *s, NodeId id) {
+	if(s->succinct != NULL)
+		return succinct_is_question(s->succinct, id - 1);
+	return node_is_question(id);
+}
+
+static NodeId child(const GameSession *s, NodeId id, int yes) {
+	if(s->succinct != NULL) {
+		const SuccinctTree* t = s->succinct;
+		return (yes ? succinct_yes(t, id - 1) : succinct_no(t, id - 1)) + 1;
+	}
+	return yes ? node_yes(id) : node_no(id);
+}
+
+/* start_at
+ * - Forget the previous game's path and learned text and start on root
+ *   of whichever tree the session plays: a question, or straight to a
+ *   guess if the whole tree is one animal
+ * - Return 0 (and stay DONE) if there is no tree
+ */
+static int start_at(GameSession *s, const SuccinctTree *t, NodeId root) {
+	s->path.size = 0;
+	s->animal[0] = '\0';
+	s->question[0] = '\0';
+	s->knownAnimal = 0;
+	s->askedQuestion = 0;
+	s->result = ENGINE_PLAYING;
+	s->succinct = t;
+	s->current = root;
+
+	if(s->current == NODE_NIL) {
+		s->state = ENGINE_DONE;
+		return 0;
+	}
+	s->state = is_question(s, s->current) ? ENGINE_QUESTION : ENGINE_GUESS;
+	metric_add(METRIC_GAMES, 1);
+	return 1;
+}
+
+/* engine_start
+ * - Begin a new game at g_root
+ */
+int engine_start(GameSession *s) {
+	return start_at(s, NULL, tree_root());
+}
+
+/* engine_start_succinct
+ * - Begin a new game on read-only tree t. It plays like any other game
+ *   until a wrong guess, which ends it STUMPED instead of learning
+ */
+int engine_start_succinct(GameSession *s, const SuccinctTree *t) {
+	return start_at(s, t, t->nodes > 0 ? 1 : NODE_NIL);
+}
+
+/* engine_text
+ * - Text of the question being asked or the animal guessed
+ */
+const char *engine_text(const GameSession *s) {
+	if(s->succinct != NULL)
+		return succinct_text(s->succinct, s->current - 1);
+	return node_text(s->current);
+}
+
+/* engine_prompt
+ * Write what the player should be asked now into buf
+ * - Returns 0 with an empty buf once the game is DONE
+ */
+int engine_prompt(const GameSession *s, char *buf, size_t size) {
+	switch(s->state) {
+	case ENGINE_QUESTION:
+		snprintf(buf, size, "%s (y/n): ", engine_text(s));
+		return 1;
+	case ENGINE_GUESS:
+		snprintf(buf, size, "Is it a %s? (y/n): ", engine_text(s));
+		return 1;
+	case ENGINE_ASK_ANIMAL:
+		snprintf(buf, size, "What animal were you thinking of? ");
+		return 1;
+	case ENGINE_ASK_QUESTION:
+		snprintf(buf, size, "Give me a yes/no question to distinguish %s from %s: ",
+			s->animal, node_text(s->current));
+		return 1;
+	case ENGINE_ASK_ANSWER:
+		snprintf(buf, size, "For %s, what is the answer? (y/n): ", s->animal);
+		return 1;
+	case ENGINE_DONE:
+		break;
+	}
+	if(size > 0)
+		buf[0] = '\0';
+	return 0;
+}
+
+/* find_leaf_slot
+ * Find the child slot that holds leaf now, somewhere under from
+ * - Only learning moves a leaf, and it always hangs it under the new
+ *   question, so from's subtree is just the few questions other players
+ *   spliced in since this one last looked
+ * - Return 0 if leaf was pushed further down while we looked; looking
+ *   again from the same question finds it
+ */
+static int find_leaf_slot(NodeId from, NodeId leaf, NodeId *parent, int *yes) {
+	FrameStack todo;
+	fs_init(&todo);
+	fs_push(&todo, from, 0);
+
+	int found = 0;
+	while(!found && !fs_empty(&todo)) {
+		NodeId q = fs_pop(&todo).node;
+		NodeId y = node_yes(q);
+		NodeId n = node_no(q);
+		if(y == leaf || n == leaf) {
+			*parent = q;
+			*yes = y == leaf;
+			found = 1;
+		} else {
+			if(node_is_question(y))
+				fs_push(&todo, y, 1);
+			if(node_is_question(n))
+				fs_push(&todo, n, 0);
+		}
+	}
+	fs_free(&todo);
+	return found;
+}
+
+/* engine_learn
+ * Splice the player's animal in where the wrong guess was
+ * - New question gets the new animal on the side the player answered and
+ *   the old guess on the other; both are filled in before anyone can
+ *   reach them
+ * - The splice is one compare-and-swap of the slot the game walked
+ *   through (the root slot if the tree was a single animal). If another
+ *   player split the same guess first, the slot holds their question now:
+ *   descend into it to the slot that holds the guess and try again, so
+ *   the new question goes below theirs and neither animal is lost
+ * - Allocation and the bookkeeping after the splice (parent links,
+ *   aggregates, the undo record, the journal, the index) take
+ *   g_learnLock; the swap itself takes only the shared side of
+ *   g_spliceLock, so it never lands in a node array that is being copied
+ *   away
+ * - An edit is recorded only after the one it was spliced under: until
+ *   then the new question is its own parent, and a learner that landed
+ *   below it waits. So g_undo and the journal list the edits in an order
+ *   they can be replayed in
+ * - Return 0 if out of memory (the tree is left as it was)
+ */
+static int engine_learn(GameSession *s, int yes) {
+	NodeId guess = s->current;
+	uint64_t t0 = metrics_now();
+
+	//create new question node and new animal node; growing the node
+	//array moves it, so that waits for splices in flight to finish
+	pthread_mutex_lock(&g_learnLock);
+	int room = 1;
+	if(g_arena.count + 2 > g_arena.capacity) {
+		pthread_rwlock_wrlock(&g_spliceLock);
+		room = arena_reserve(&g_arena, 2);
+		pthread_rwlock_unlock(&g_spliceLock);
+	}
+	NodeId newNode = room ? create_question_node(s->question) : NODE_NIL;
+	NodeId newAnimal = room ? create_animal_node(s->animal) : NODE_NIL;
+	if(newNode == NODE_NIL || newAnimal == NODE_NIL) {
+		pthread_mutex_unlock(&g_learnLock);
+		return 0;
+	}
+
+	//link them: the new animal goes on the side the player answered. Only
+	//the new nodes are written; the guess is still someone else's to read
+	NodeLinks* q = &arena_links()[newNode];
+	q->yes = (yes ? newAnimal : guess) | NODE_QUESTION;
+	q->no = yes ? guess : newAnimal;
+	node_at(newNode)->parent = newNode;
+	node_at(newAnimal)->parent = newNode;
+	g_inFlight++;
+	pthread_mutex_unlock(&g_learnLock);
+
+	//swing the slot the game came through from the guess to the question
+	NodeId parent = NODE_NIL;
+	int parentAnswer = -1;
+	if(!fs_empty(&s->path)) {
+		parent = s->path.frames[s->path.size - 1].node;
+		parentAnswer = s->path.frames[s->path.size - 1].answeredYes;
+	}
+	pthread_rwlock_rdlock(&g_spliceLock);
+	NodeId expected = guess;
+	while(!node_cas_child(parent, parentAnswer, &expected, newNode)) {
+		//lost the race: expected is the question that won it
+		while(!find_leaf_slot(expected, guess, &parent, &parentAnswer))
+			;
+		expected = guess;
+	}
+	pthread_rwlock_unlock(&g_spliceLock);
+
+	//fix up parent links and cached subtree stats, record the edit for
+	//undo (where it actually landed) and in the journal, drop the redo
+	//history, index it; first wait for the question we landed under
+	pthread_mutex_lock(&g_learnLock);
+	while(parent != NODE_NIL && node_parent(parent) == parent) {
+		pthread_mutex_unlock(&g_learnLock);
+		sched_yield();
+		pthread_mutex_lock(&g_learnLock);
+	}
+	node_attach(parent, newNode);
+
+	Edit record;
+	record.type = EDIT_INSERT_SPLIT;
+	record.parent = parent;
+	record.wasYesChild = parent == NODE_NIL ? -1 : parentAnswer;
+	record.oldLeaf = guess;
+	record.newQuestion = newNode;
+	record.newLeaf = newAnimal;
+	record.newLeafYes = yes;
+	es_push(&g_undo, record);
+	es_clear(&g_redo);
+	journal_log_split(&record);
+
+	index_add(newNode);
+	index_add(newAnimal);
+	g_inFlight--;
+	count_tree();
+	pthread_mutex_unlock(&g_learnLock);
+	metric_observe(METRIC_LEARN_SECONDS, metrics_now() - t0);
+	return 1;
+}
+
+/* engine_answer
+ * Feed a yes/no reply into the game
+ * - QUESTION: remember the answer on the path and move to that child
+ * - GUESS: yes ends the game (GUESSED), no starts learning (or, on a
+ *   succinct tree, ends it STUMPED)
+ * - ASK_ANSWER: splice the new animal in and end the game (LEARNED)
+ * - Return 0 if the game isn't waiting for a yes/no (or the tree is
+ *   broken under the current question), 1 otherwise
+ */
+int engine_answer(GameSession *s, int yes) {
+	yes = yes ? 1 : 0;
+
+	switch(s->state) {
+	case ENGINE_QUESTION: {
+		NodeId next = child(s, s->current, yes);
+		if(next == NODE_NIL)
+			return 0;
+		fs_push(&s->path, s->current, yes);
+		s->current = next;
+		s->state = is_question(s, next) ? ENGINE_QUESTION : ENGINE_GUESS;
+		return 1;
+	}
+	case ENGINE_GUESS:
+		if(yes || s->succinct != NULL)
+			finish(s, yes ? ENGINE_GUESSED : ENGINE_STUMPED);
+		else
+			s->state = ENGINE_ASK_ANIMAL;
+		return 1;
+	case ENGINE_ASK_ANSWER:
+		if(!engine_learn(s, yes))
+			return 0;
+		finish(s, ENGINE_LEARNED);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* engine_submit
+ * Feed a line of text into the learning phase
+ * - ASK_ANIMAL: the animal the player meant. Naming the animal that was
+ *   just guessed ends the game (REPEATED); otherwise knownAnimal says
+ *   how many leaves elsewhere already name it
+ * - ASK_QUESTION: the distinguishing question; askedQuestion says how
+ *   many nodes already ask it
+ * - Text longer than the session's buffers is truncated
+ * - The index lookups take g_learnLock, since other sessions may be
+ *   adding to it
+ * - Return 0 for empty text or when no text is expected
+ */
+int engine_submit(GameSession *s, const char *text) {
+	if(text == NULL || text[0] == '\0')
+		return 0;
+
+	switch(s->state) {
+	case ENGINE_ASK_ANIMAL:
+		snprintf(s->animal, sizeof(s->animal), "%s", text);
+		pthread_mutex_lock(&g_learnLock);
+		index_find(s->animal, 0, &s->knownAnimal);
+		int repeated = strcmp(s->animal, node_text(s->current)) == 0;
+		pthread_mutex_unlock(&g_learnLock);
+		if(repeated)
+			finish(s, ENGINE_REPEATED);
+		else
+			s->state = ENGINE_ASK_QUESTION;
+		return 1;
+	case ENGINE_ASK_QUESTION:
+		snprintf(s->question, sizeof(s->question), "%s", text);
+		pthread_mutex_lock(&g_learnLock);
+		index_find(s->question, 1, &s->askedQuestion);
+		pthread_mutex_unlock(&g_learnLock);
+		s->state = ENGINE_ASK_ANSWER;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* engine_free
+ * - Release the session's path stack
+ */
+void engine_free(GameSession *s) {
+	fs_free(&s->path);
+}
+
+/* ========== Undo/Redo ========== */
+
+/* undo_last_edit
+ * Undo the most recent tree modification
+ *
+ * Steps:
+ * 1. Check if g_undo stack is empty, return 0 if so
+ * 2. Pop edit from g_undo
+ * 3. Restore the tree structure:
+ *    - Take newQuestion out of the slot it hangs in now, and put what
+ *      hangs on its old-leaf side there instead. For a single player
+ *      that is edit.parent's slot and edit.oldLeaf; when several players
+ *      learned at once, edits can be recorded in a different order than
+ *      they were spliced, so another player's question may sit between
+ *      newQuestion and oldLeaf, or newQuestion may have been spliced
+ *      in below another question. Either way that question survives
+ *    - Relinking moves the lifted node's parent back and refreshes the
+ *      cached subtree stats of every ancestor
+ *    - Remember the slot in edit, for redo
+ * 4. Drop newQuestion/newLeaf from g_index (they are detached now)
+ * 5. Push edit to g_redo stack, and append it to the journal
+ * 6. Return 1
+ *
+ * Note: newQuestion/newLeaf stay in the arena because they might be redone
+ * Note: relinking isn't a single swap, so it waits for learns in flight
+ *       and holds off new ones (engine_quiesce)
+ */
+int undo_last_edit() {
+	engine_quiesce();
+
+	//1. Check if g_undo stack is empty, return 0 if so
+	int checkEmpty = es_empty(&g_undo);
+	if(checkEmpty == 1) {
+		engine_resume();
+		return 0;
+	}
+
+	//2. Pop edit from g_undo
+	Edit edit = es_pop(&g_undo);
+
+	//3. Restore the tree structure:
+	NodeId q = edit.newQuestion;
+	NodeId keep = edit.newLeafYes ? node_no(q) : node_yes(q);
+	edit.parent = node_parent(q);
+
+	//If newQuestion is the root:
+	if(edit.parent == NODE_NIL) {
+		//Set g_root = what hangs on its old-leaf side
+		edit.wasYesChild = -1;
+		tree_set_root(keep);
+	}
+
+	//Else if it is its parent's yes child:
+	else if(node_yes(edit.parent) == q) {
+		//Set the parent's yes child to what hangs on its old-leaf side
+		edit.wasYesChild = 1;
+		node_set_yes(edit.parent, keep);
+	}
+
+	//Else:
+	else {
+		//Set the parent's no child to what hangs on its old-leaf side
+		edit.wasYesChild = 0;
+		node_set_no(edit.parent, keep);
+	}
+
+	//4. Drop the detached nodes from g_index
+	index_remove(edit.newQuestion);
+	index_remove(edit.newLeaf);
+
+	//5. Push edit to g_redo stack (and journal it)
+	es_push(&g_redo, edit);
+	journal_log_undo(&edit);
+	count_tree();
+
+	//6. Return 1
+	engine_resume();
+	return 1;
+}
+
+/* redo_last_edit
+ * Redo a previously undone edit
+ *
+ * Steps:
+ * 1. Check if g_redo stack is empty, return 0 if so
+ * 2. Pop edit from g_redo
+ * 3. Reapply the tree modification:
+ *    - Hang what is in the slot undo took newQuestion out of (oldLeaf,
+ *      for a single player) back on newQuestion's old-leaf side
+ *    - If edit.parent is NODE_NIL:
+ *      - Set g_root = edit.newQuestion
+ *    - Else if edit.wasYesChild:
+ *      - Set edit.parent->yes = edit.newQuestion
+ *    - Else:
+ *      - Set edit.parent->no = edit.newQuestion
+ * 4. Put newQuestion/newLeaf back in g_index
+ * 5. Push edit back to g_undo stack, and append it to the journal
+ * 6. Return 1
+ */
+int redo_last_edit() {
+	engine_quiesce();
+
+	//1. Check if g_redo stack is empty, return 0 if so
+	int checkEmpty = es_empty(&g_redo);
+	if(checkEmpty == 1) {
+		engine_resume();
+		return 0;
+	}
+
+	//2. Pop edit from g_redo
+	Edit edit = es_pop(&g_redo);
+
+	//3. Reapply the tree modification:
+	//Hang the slot's current occupant back under newQuestion
+	NodeId occupant = edit.parent == NODE_NIL ? tree_root()
+		: edit.wasYesChild ? node_yes(edit.parent) : node_no(edit.parent);
+	if(edit.newLeafYes)
+		node_set_no(edit.newQuestion, occupant);
+	else
+		node_set_yes(edit.newQuestion, occupant);
+
+	//If edit.parent is NODE_NIL:
+	if(edit.parent == NODE_NIL)
+		//Set g_root = edit.newQuestion
+		tree_set_root(edit.newQuestion);
+
+	//Else if edit.wasYesChild:
+	else if(edit.wasYesChild)
+		//Set edit.parent's yes child to edit.newQuestion
+		node_set_yes(edit.parent, edit.newQuestion);
+	//Else:
+	else
+		//Set edit.parent's no child to edit.newQuestion
+		node_set_no(edit.parent, edit.newQuestion);
+
+	//4. Re-index the reattached nodes
+	index_add(edit.newQuestion);
+	index_add(edit.newLeaf);
+
+	//5. Push edit back to g_undo stack (and journal it)
+	es_push(&g_undo, edit);
+	journal_log_redo(&edit);
+	count_tree();
+
+	//6. Return 1
+	engine_resume();
+	return 1;
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+/* ========== Epoch-Based Reclamation ========== */
+
+/* A global epoch counter only ever moves forward. Each reader slot holds
+ * the epoch it entered in, or EPOCH_IDLE while it is outside the tree.
+ * A retired block is tagged with the epoch current at retirement. The
+ * epoch only advances once every active reader has entered in the current
+ * one, so when it is two past a block's tag, no reader that could have
+ * loaded the block's address is still inside. */
+
+#define EPOCH_IDLE 0u
+
+/* One reader slot per cache line so readers don't slow each other down */
+typedef struct {
+    uint64_t local;
+    int used;
+    char pad[64 - sizeof(uint64_t) - sizeof(int)];
+} EpochSlot;
+
+typedef struct {
+    void *ptr;
+    uint64_t epoch;
+} Retired;
+
+static uint64_t g_epoch = 1;
+static EpochSlot g_slots[EPOCH_MAX_THREADS];
+
+/* Blocks waiting to be freed; only the writer touches these */
+static Retired *g_limbo = NULL;
+static uint32_t g_limboSize = 0;
+static uint32_t g_limboCapacity = 0;
+
+/* epoch_register
+ * - Claim a free reader slot for the calling thread
+ * - Return its index, or -1 if all EPOCH_MAX_THREADS are taken
+ */
+int epoch_register(void) {
+	for(int i = 0; i < EPOCH_MAX_THREADS; i++) {
+		int expected = 0;
+		if(__atomic_compare_exchange_n(&g_slots[i].used, &expected, 1, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&g_slots[i].local, EPOCH_IDLE, __ATOMIC_RELEASE);
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* epoch_unregister
+ * - Give the slot back; the thread must be outside the tree
+ */
+void epoch_unregister(int slot) {
+	__atomic_store_n(&g_slots[slot].local, EPOCH_IDLE, __ATOMIC_RELEASE);
+	__atomic_store_n(&g_slots[slot].used, 0, __ATOMIC_RELEASE);
+}
+
+/* epoch_enter
+ * - Announce the current epoch before touching any node or text
+ * - The store is sequentially consistent, so the writer can't advance
+ *   past this epoch without seeing it
+ */
+void epoch_enter(int slot) {
+	uint64_t e = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&g_slots[slot].local, e, __ATOMIC_SEQ_CST);
+}
+
+/* epoch_exit
+ * - Done with every pointer loaded since epoch_enter
+ */
+void epoch_exit(int slot) {
+	__atomic_store_n(&g_slots[slot].local, EPOCH_IDLE, __ATOMIC_RELEASE);
+}
+
+/* epoch_try_advance
+ * - Move the epoch on if every active reader is in the current one
+ */
+static void epoch_try_advance(void) {
+	uint64_t e = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+	for(int i = 0; i < EPOCH_MAX_THREADS; i++) {
+		if(!__atomic_load_n(&g_slots[i].used, __ATOMIC_ACQUIRE))
+			continue;
+		uint64_t local = __atomic_load_n(&g_slots[i].local, __ATOMIC_SEQ_CST);
+		if(local != EPOCH_IDLE && local != e)
+			return;
+	}
+	__atomic_store_n(&g_epoch, e + 1, __ATOMIC_SEQ_CST);
+}
+
+/* epoch_reclaim
+ * - Try to advance the epoch, then free every block retired at least two
+ *   epochs ago
+ * - Writer only
+ */
+void epoch_reclaim(void) {
+	epoch_try_advance();
+	uint64_t e = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+
+	uint32_t kept = 0;
+	for(uint32_t i = 0; i < g_limboSize; i++) {
+		if(g_limbo[i].epoch + 2 <= e)
+			free(g_limbo[i].ptr);
+		else
+			g_limbo[kept++] = g_limbo[i];
+	}
+	g_limboSize = kept;
+}
+
+/* epoch_retire
+ * - old is already unreachable for new readers (its replacement has been
+ *   published); free it once the current readers are gone
+ * - Writer only. If the limbo list can't grow, wait for the readers
+ *   rather than leak or free early
+ */
+void epoch_retire(void *old) {
+	if(g_limboSize == g_limboCapacity) {
+		uint32_t cap = g_limboCapacity ? g_limboCapacity * 2 : 16;
+		Retired* grown = (Retired*)realloc(g_limbo, cap * sizeof(Retired));
+		if(grown == NULL) {
+			while(g_limboSize == g_limboCapacity)
+				epoch_reclaim();
+		} else {
+			g_limbo = grown;
+			g_limboCapacity = cap;
+		}
+	}
+
+	g_limbo[g_limboSize].ptr = old;
+	g_limbo[g_limboSize].epoch = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+	g_limboSize++;
+	epoch_reclaim();
+}
+
+/* epoch_pending
+ * - Number of retired blocks not yet freed
+ */
+uint32_t epoch_pending(void) {
+	return g_limboSize;
+}
+
+/* epoch_drain
+ * - Free everything still retired; only call once no reader is left
+ */
+void epoch_drain(void) {
+	for(uint32_t i = 0; i < g_limboSize; i++)
+		free(g_limbo[i].ptr);
+	free(g_limbo);
+	g_limbo = NULL;
+	g_limboSize = 0;
+	g_limboCapacity = 0;
+}
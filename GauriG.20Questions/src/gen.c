@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+extern NodeId g_root;
+extern EditStack g_undo;
+extern EditStack g_redo;
+
+/* ========== Tree Generator ========== */
+
+/* Synthetic trees for the benchmarks and tests. A tree grows the way the
+ * game grows one: a leaf is split into a question with two new animals
+ * under it. The shape only decides which leaf is split next:
+ *   balanced  the oldest leaf, so levels fill up one at a time
+ *   chain     the newest no-side leaf, so every question has an animal
+ *             on its yes side and the rest of the tree on its no side
+ *   random    any leaf, all equally likely
+ *   skewed    whichever leaf a scripted player reaches. Players belong to
+ *             families with Zipf-like popularity; a family answers every
+ *             question its own way, give or take a slip now and then, so
+ *             popular families keep learning animals in the same corner
+ *             and it grows deep, as real play does
+ * Splitting a leaf in place means children always get higher ids than
+ * their parents, so the cached stats are filled in with one backwards
+ * sweep at the end, as load_tree does.
+ *
+ * Everything is drawn from a private xorshift generator: the same shape,
+ * size and seed give the same tree, node for node, on every machine. */
+
+#define GEN_FAMILY_BITS 20      /* families 0 .. 2^20 - 1 */
+#define GEN_SLIP 16             /* a player slips on one answer in GEN_SLIP */
+
+static const char *g_shapeNames[] = {"balanced", "chain", "random", "skewed"};
+
+/* gen_next
+ * - xorshift64*; state must not be 0
+ */
+static uint64_t gen_next(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ull;
+}
+
+/* gen_split
+ * - Turn leaf into question number made with two new animals under it,
+ *   returned in kids (yes, no)
+ * - The arena already has room, so nothing moves
+ */
+static int gen_split(NodeArena *a, NodeId leaf, uint32_t made, NodeId kids[2]) {
+	char text[64];
+	snprintf(text, sizeof(text), "Does it have trait number %u?", made);
+	uint32_t offset = sp_intern(&a->strings, text);
+	for(int k = 0; k < 2; k++) {
+		snprintf(text, sizeof(text), "Animal %u", made + 1 + k);
+		kids[k] = offset != SP_NONE ? arena_alloc(a, text, 0) : NODE_NIL;
+		if(kids[k] == NODE_NIL)
+			return 0;
+		a->nodes[kids[k]].parent = leaf;
+	}
+	a->nodes[leaf].text = offset;
+	a->links[leaf].yes = kids[0] | NODE_QUESTION;
+	a->links[leaf].no = kids[1];
+	return 1;
+}
+
+/* gen_family
+ * - A family drawn so that family f comes up about 1 / (f + 1) as often
+ *   as family 0: pick a bit length, then a family of that length
+ */
+static uint64_t gen_family(uint64_t *state) {
+	uint64_t bits = gen_next(state) % (GEN_FAMILY_BITS + 1);
+	return gen_next(state) & (((uint64_t)1 << bits) - 1);
+}
+
+/* gen_descend
+ * - Play one scripted game from the root and return the leaf it ends on:
+ *   the family's answer to a question is a bit of the pair's hash,
+ *   flipped on a slip
+ */
+static NodeId gen_descend(const NodeArena *a, uint64_t family, uint64_t *state) {
+	NodeId id = 1;
+	while(links_question(a->links[id])) {
+		uint32_t answer = h_mix((uint32_t)(family * 2654435761u) ^ id) & 1;
+		if(gen_next(state) % GEN_SLIP == 0)
+			answer ^= 1;
+		id = answer ? links_yes(a->links[id]) : a->links[id].no;
+	}
+	return id;
+}
+
+/* gen_tree
+ * Replace the tree with a generated one of the given shape
+ *
+ * Steps:
+ * 1. Round nodes down to an odd count (every question has two children,
+ *    so a tree always has an odd number of nodes); 0 makes nothing
+ * 2. Start a fresh arena with room for them all and one animal as root
+ * 3. Split leaves in the shape's order until the tree is full. Random
+ *    keeps a list of the leaves; balanced and chain know which leaf is
+ *    next from the ids alone
+ * 4. Fill in the cached stats, children (higher ids) first
+ * 5. Swap the arena in like load_tree does
+ * 6. Return 1, or 0 (tree untouched) if out of memory or nodes is 0
+ */
+int gen_tree(GenShape shape, uint32_t nodes, uint64_t seed) {
+	//1. An odd count, at most what the arena can hold
+	if(nodes == 0 || nodes > NODE_ID_MAX)
+		return 0;
+	if(nodes % 2 == 0)
+		nodes--;
+
+	//2. The arena and its root
+	NodeArena arena;
+	arena_init(&arena);
+	NodeId* leaves = NULL;
+	uint64_t state = (seed * 0x9E3779B97F4A7C15ull) | 1;
+	int ok = arena_reserve(&arena, nodes) && arena_alloc(&arena, "Animal 0", 0) == 1;
+	if(ok && shape == GEN_RANDOM) {
+		leaves = (NodeId*)malloc(((size_t)nodes / 2 + 1) * sizeof(NodeId));
+		ok = leaves != NULL;
+	}
+
+	//3. Split leaves until there are nodes of them
+	uint32_t nleaves = 1;
+	NodeId next = 1;
+	if(leaves != NULL)
+		leaves[0] = 1;
+	for(uint32_t made = 1; ok && made < nodes; made += 2) {
+		NodeId leaf;
+		uint32_t pick = 0;
+		if(shape == GEN_BALANCED) {
+			leaf = next++;
+		} else if(shape == GEN_CHAIN) {
+			leaf = arena.count - 1;
+		} else if(shape == GEN_RANDOM) {
+			pick = (uint32_t)(gen_next(&state) % nleaves);
+			leaf = leaves[pick];
+		} else {
+			leaf = gen_descend(&arena, gen_family(&state), &state);
+		}
+
+		NodeId kids[2];
+		ok = gen_split(&arena, leaf, made, kids);
+		if(ok && leaves != NULL) {
+			leaves[pick] = kids[0];
+			leaves[nleaves++] = kids[1];
+		}
+	}
+	free(leaves);
+	if(!ok) {
+		arena_free(&arena);
+		return 0;
+	}
+
+	//4. Cached subtree stats, leaves first
+	for(uint32_t id = arena.count - 1; id >= 1; id--) {
+		NodeLinks l = arena.links[id];
+		Node* n = &arena.nodes[id];
+		const Node* y = &arena.nodes[links_yes(l)];
+		const Node* o = &arena.nodes[l.no];
+		n->size = 1 + y->size + o->size;
+		n->leaves = links_question(l) ? y->leaves + o->leaves : 1;
+		n->height = 1 + (y->height > o->height ? y->height : o->height);
+	}
+
+	//5. Replace the old arena, as load_tree does
+	arena_free(&g_arena);
+	g_arena = arena;
+	es_clear(&g_undo);
+	es_clear(&g_redo);
+	g_root = 1;
+	index_invalidate();
+
+	//6. Return 1 on success
+	return 1;
+}
+
+/* gen_shape_name
+ * - The name gen_shape_parse reads back, e.g. "balanced"
+ */
+const char *gen_shape_name(GenShape shape) {
+	return shape <= GEN_SKEWED ? g_shapeNames[shape] : "?";
+}
+
+/* gen_shape_parse
+ * - Look a shape up by name; 0 if there is no such shape
+ */
+int gen_shape_parse(const char *name, GenShape *out) {
+	for(int s = GEN_BALANCED; s <= GEN_SKEWED; s++) {
+		if(strcmp(name, g_shapeNames[s]) == 0) {
+			*out = (GenShape)s;
+			return 1;
+		}
+	}
+	return 0;
+}
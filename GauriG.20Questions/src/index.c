@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+extern NodeId g_root;
+extern Hash g_index;
+
+/* ========== Attribute Index ==========
+ *
+ * g_index maps canonical node text to the ids of the nodes that carry it:
+ * - "q:<canonical question>" -> every question node asking it
+ * - "a:<canonical animal>"   -> every leaf guessing that animal
+ * canonicalize() drops ':' so the two namespaces can't collide.
+ *
+ * The index covers the nodes reachable from g_root. It is rebuilt in one
+ * pass when a tree is loaded, and kept in step by learn, undo and redo,
+ * so "was this question already asked elsewhere?" and "do I already know
+ * this animal?" are single lookups instead of tree walks.
+ */
+
+/* Set when the index no longer matches g_root and must be rebuilt before
+ * its next use (e.g. after map_tree, where an eager rebuild would page in
+ * the whole image) */
+static int g_indexStale = 0;
+
+/* index_key
+ * - Write "q:" or "a:" plus the canonical form of text into buf
+ * - buf must hold strlen(text) + 3 bytes
+ */
+static void index_key(char *buf, const char *text, int isQuestion) {
+	buf[0] = isQuestion ? 'q' : 'a';
+	buf[1] = ':';
+	canonicalize_to(buf + 2, text);
+}
+
+/* index_update
+ * - Add (or remove) one node under its key
+ */
+static void index_update(NodeId id, int add) {
+	const char* text = node_text(id);
+	size_t len = strlen(text);
+
+	//short texts use the stack, long ones a temporary buffer
+	char small[256];
+	char* key = len + 3 <= sizeof(small) ? small : (char*)malloc(len + 3);
+	if(key == NULL)
+		return;
+
+	index_key(key, text, node_is_question(id));
+	if(add)
+		h_put(&g_index, key, (int)id);
+	else
+		h_remove(&g_index, key, (int)id);
+
+	if(key != small)
+		free(key);
+}
+
+/* index_rebuild
+ * Rebuild g_index from scratch in one pass over the tree
+ *
+ * Steps:
+ * 1. Free the old index and size the new one for the arena
+ * 2. Walk the tree from g_root with a FrameStack (no recursion)
+ * 3. Put every node under its key
+ * 4. The tree is new, so bring the tree size gauge up to date
+ */
+void index_rebuild(void) {
+	//1. Start over
+	TRACE_BEGIN(index_rebuild);
+	h_free(&g_index);
+	h_init(&g_index, (int)(g_arena.count / 2));
+	g_indexStale = 0;
+
+	if(g_root == NODE_NIL) {
+		metric_set(METRIC_TREE_NODES, 0);
+		TRACE_END(index_rebuild);
+		return;
+	}
+
+	//2. Walk the tree
+	FrameStack stack;
+	fs_init(&stack);
+	fs_push(&stack, g_root, -1);
+
+	while(!fs_empty(&stack)) {
+		NodeId id = fs_pop(&stack).node;
+
+		//3. Index the node and visit its children
+		index_update(id, 1);
+		if(node_yes(id) != NODE_NIL)
+			fs_push(&stack, node_yes(id), 1);
+		if(node_no(id) != NODE_NIL)
+			fs_push(&stack, node_no(id), 0);
+	}
+	fs_free(&stack);
+
+	//4. The size gauge
+	metric_set(METRIC_TREE_NODES, node_at(g_root)->size);
+	TRACE_END(index_rebuild);
+}
+
+/* index_invalidate
+ * Mark the index out of date; the next lookup rebuilds it
+ */
+void index_invalidate(void) {
+	g_indexStale = 1;
+}
+
+/* index_add
+ * Index a node that just became reachable (learned or redone)
+ */
+void index_add(NodeId id) {
+	//a stale index picks the node up when it is rebuilt
+	if(!g_indexStale)
+		index_update(id, 1);
+}
+
+/* index_remove
+ * Drop a node that is no longer reachable (undone)
+ */
+void index_remove(NodeId id) {
+	if(!g_indexStale)
+		index_update(id, 0);
+}
+
+/* index_find
+ * Return the ids of every question (isQuestion = 1) or leaf (0) whose
+ * text canonicalizes the same as text; *outCount gets how many.
+ * Returns NULL with *outCount = 0 if there are none.
+ * The array belongs to g_index and is only valid until it changes.
+ */
+int *index_find(const char *text, int isQuestion, int *outCount) {
+	if(g_indexStale)
+		index_rebuild();
+
+	char* key = (char*)malloc(strlen(text) + 3);
+	if(key == NULL) {
+		*outCount = 0;
+		return NULL;
+	}
+	index_key(key, text, isQuestion);
+
+	uint32_t probes;
+	int* ids = h_get_ids_probed(&g_index, key, outCount, &probes);
+	metric_observe(METRIC_INDEX_PROBES, probes);
+	free(key);
+	return ids;
+}
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+/* ========== String Pool (interned node text) ========== */
+
+/* Strings are stored back to back, NUL-terminated, in one byte slab and
+ * are never modified once interned. A string is named by its byte offset
+ * in the slab. An open-addressing table of (offset, hash) pairs finds an
+ * existing copy so identical texts are stored only once.
+ */
+
+#define SP_EMPTY 0u          /* slot marker: slots hold offset + 1 */
+#define SP_MIN_SLOTS 64u
+
+/* sp_init
+ * - Start with no storage; everything is allocated on first use
+ */
+void sp_init(StringPool *p) {
+	p->bytes = NULL;
+	p->size = 0;
+	p->capacity = 0;
+	p->slots = NULL;
+	p->hashes = NULL;
+	p->nslots = 0;
+	p->count = 0;
+	p->requested = 0;
+	p->hits = 0;
+	p->external = 0;
+	p->unindexed = 0;
+	p->retire = NULL;
+}
+
+/* sp_reserve
+ * Make sure `bytes` more bytes of text fit in the slab without a realloc.
+ * Return 1 on success, 0 if out of memory (pool unchanged).
+ */
+int sp_reserve(StringPool *p, uint32_t bytes) {
+	uint64_t need = (uint64_t)p->size + bytes;
+	if(need > UINT32_MAX)
+		return 0;
+	if(need <= p->capacity)
+		return 1;
+
+	//double until it fits
+	uint64_t newCap = p->capacity ? p->capacity : 1024;
+	while(newCap < need)
+		newCap *= 2;
+	if(newCap > UINT32_MAX)
+		newCap = UINT32_MAX;
+
+	//borrowed bytes can't be realloc'd, so copy them out the first time;
+	//bytes that readers may still hold are copied too and retired
+	char* grown;
+	if(p->external || p->retire != NULL) {
+		grown = (char*)malloc((size_t)newCap);
+		if(grown != NULL && p->size > 0)
+			memcpy(grown, p->bytes, p->size);
+	} else {
+		grown = (char*)realloc(p->bytes, (size_t)newCap);
+	}
+	if(grown == NULL)
+		return 0;
+
+	char* old = p->bytes;
+	__atomic_store_n(&p->bytes, grown, __ATOMIC_RELEASE);
+	if(p->retire != NULL && !p->external && old != NULL)
+		p->retire(old);
+	p->external = 0;
+	p->capacity = (uint32_t)newCap;
+	return 1;
+}
+
+/* sp_rehash
+ * - Allocate a table with nslots slots (a power of two)
+ * - Re-insert every live (offset, hash) pair using linear probing
+ * - Return 1 on success, 0 if out of memory (old table kept)
+ */
+static int sp_rehash(StringPool *p, uint32_t nslots) {
+	uint32_t* slots = (uint32_t*)calloc(nslots, sizeof(uint32_t));
+	uint32_t* hashes = (uint32_t*)malloc(nslots * sizeof(uint32_t));
+	if(slots == NULL || hashes == NULL) {
+		free(slots);
+		free(hashes);
+		return 0;
+	}
+
+	uint32_t mask = nslots - 1;
+	for(uint32_t i = 0; i < p->nslots; i++) {
+		if(p->slots[i] == SP_EMPTY)
+			continue;
+
+		//cached hash means no string has to be re-read
+		uint32_t j = p->hashes[i] & mask;
+		while(slots[j] != SP_EMPTY)
+			j = (j + 1) & mask;
+		slots[j] = p->slots[i];
+		hashes[j] = p->hashes[i];
+	}
+
+	free(p->slots);
+	free(p->hashes);
+	p->slots = slots;
+	p->hashes = hashes;
+	p->nslots = nslots;
+	return 1;
+}
+
+/* sp_index_adopted
+ * Put every string of an adopted slab into the table. Done on the first
+ * intern after sp_adopt so that mapping a file never has to read its text.
+ */
+static int sp_index_adopted(StringPool *p) {
+	uint32_t n = 0;
+	for(uint32_t off = 0; off < p->size; off += (uint32_t)strlen(p->bytes + off) + 1)
+		n++;
+
+	//size the table for the adopted strings plus room to grow
+	uint32_t nslots = SP_MIN_SLOTS;
+	while((uint64_t)nslots * 7 < (uint64_t)(n + 1) * 10)
+		nslots *= 2;
+	free(p->slots);
+	free(p->hashes);
+	p->slots = NULL;
+	p->hashes = NULL;
+	p->nslots = 0;
+	p->count = 0;
+	if(!sp_rehash(p, nslots))
+		return 0;
+
+	uint32_t mask = p->nslots - 1;
+	for(uint32_t off = 0; off < p->size; off += (uint32_t)strlen(p->bytes + off) + 1) {
+		uint32_t hash = h_mix(h_hash(p->bytes + off));
+		uint32_t j = hash & mask;
+		int dup = 0;
+		while(p->slots[j] != SP_EMPTY) {
+			if(p->hashes[j] == hash && strcmp(p->bytes + p->slots[j] - 1, p->bytes + off) == 0) {
+				dup = 1;
+				break;
+			}
+			j = (j + 1) & mask;
+		}
+		if(dup)
+			continue;
+		p->slots[j] = off + 1;
+		p->hashes[j] = hash;
+		p->count++;
+	}
+	p->unindexed = 0;
+	return 1;
+}
+
+/* sp_intern
+ * Return the offset of the pooled copy of s, adding it if it is new.
+ *
+ * Steps:
+ * 1. Hash s with h_hash (the same djb2 hash the attribute index uses),
+ *    mixed with h_mix so similar strings don't cluster
+ * 2. Probe the table; a slot matches when the cached hash is equal and
+ *    the stored bytes compare equal. If found, count the bytes saved and
+ *    return the existing offset
+ * 3. Otherwise grow the table if it is over 70% full, append s (and its
+ *    NUL) to the slab and record it in the first empty slot
+ * 4. Return SP_NONE if out of memory
+ */
+uint32_t sp_intern(StringPool *p, const char *s) {
+	uint32_t len = (uint32_t)strlen(s);
+
+	//strings adopted from a mapped file are indexed lazily
+	if(p->unindexed && !sp_index_adopted(p))
+		return SP_NONE;
+
+	//1. Hash the text
+	uint32_t hash = h_mix(h_hash(s));
+	p->requested += (uint64_t)len + 1;
+
+	//grow before probing so the probe result stays valid for the insert
+	if(p->nslots == 0 || (uint64_t)(p->count + 1) * 10 > (uint64_t)p->nslots * 7) {
+		uint32_t nslots = p->nslots ? p->nslots * 2 : SP_MIN_SLOTS;
+		if(!sp_rehash(p, nslots)) {
+			p->requested -= (uint64_t)len + 1;
+			return SP_NONE;
+		}
+	}
+
+	//2. Probe for an existing copy
+	uint32_t mask = p->nslots - 1;
+	uint32_t j = hash & mask;
+	while(p->slots[j] != SP_EMPTY) {
+		uint32_t off = p->slots[j] - 1;
+		if(p->hashes[j] == hash && strcmp(p->bytes + off, s) == 0) {
+			p->hits++;
+			return off;
+		}
+		j = (j + 1) & mask;
+	}
+
+	//3. Append a new copy to the slab
+	if(!sp_reserve(p, len + 1)) {
+		p->requested -= (uint64_t)len + 1;
+		return SP_NONE;
+	}
+
+	uint32_t off = p->size;
+	memcpy(p->bytes + off, s, len + 1);
+	p->size += len + 1;
+
+	p->slots[j] = off + 1;
+	p->hashes[j] = hash;
+	p->count++;
+	return off;
+}
+
+/* sp_adopt
+ * Use an existing slab of NUL-terminated strings (e.g. the string blob of
+ * a mapped tree image) in place, without copying it.
+ * - size must include the final NUL; the slab is never written to
+ * - The hash table is built on the first sp_intern, not here, so adopting
+ *   a multi-hundred-MB blob is O(1)
+ */
+void sp_adopt(StringPool *p, char *bytes, uint32_t size) {
+	sp_free(p);
+	p->bytes = bytes;
+	p->size = size;
+	p->capacity = size;
+	p->requested = size;
+	p->external = 1;
+	p->unindexed = size > 0;
+}
+
+/* sp_extend
+ * Take bytes of NUL-terminated strings that were copied straight into
+ * space made by sp_reserve as part of the pool
+ * - requested is what interning them cost the writer, duplicates included
+ * - The strings may repeat ones already pooled; like an adopted slab they
+ *   are indexed (and repeats skipped) on the next sp_intern
+ */
+void sp_extend(StringPool *p, uint32_t bytes, uint64_t requested) {
+	p->size += bytes;
+	p->requested += requested;
+	p->unindexed = p->size > 0;
+}
+
+/* sp_stats
+ * Report how many distinct strings are pooled and how many bytes
+ * deduplication saved compared to one copy per request
+ */
+void sp_stats(const StringPool *p, InternStats *out) {
+	out->strings = p->count;
+	out->hits = p->hits;
+	out->bytesStored = p->size;
+	out->bytesRequested = p->requested;
+	out->bytesSaved = p->requested - p->size;
+}
+
+/* sp_reset
+ * Forget every string at once; keep the slab and table for reuse
+ */
+void sp_reset(StringPool *p) {
+	//let go of borrowed bytes instead of writing over them
+	if(p->external) {
+		p->bytes = NULL;
+		p->capacity = 0;
+		p->external = 0;
+	}
+	p->unindexed = 0;
+	p->size = 0;
+	p->count = 0;
+	p->requested = 0;
+	p->hits = 0;
+	if(p->slots != NULL)
+		memset(p->slots, 0, p->nslots * sizeof(uint32_t));
+}
+
+/* sp_free
+ * Give the slab and table back to the system
+ */
+void sp_free(StringPool *p) {
+	if(!p->external)
+		free(p->bytes);
+	free(p->slots);
+	free(p->hashes);
+	sp_init(p);
+}
@@ -0,0 +1,880 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "lab5.h"
+
+/* ========== Journal ========== */
+
+/* Log layout: a JournalHeader, then records back to back. Each record is
+ *   uint32 length, uint32 checksum (FNV-1a of the payload), payload
+ * and every payload starts with a uint64 lsn and a uint32 type. A crash
+ * can leave a torn record at the end; replay stops at the first record
+ * whose length or checksum doesn't add up, and the log is cut back there.
+ *
+ * LSNs number the edits since the tree was first journaled. An image
+ * stores the last one it includes, and each log starts with a STACKS
+ * record: the undo and redo stacks as of its first LSN. Replay sets the
+ * stacks from it, follows the records at or below the image's LSN on the
+ * stacks alone, and applies the rest to the tree as well. That makes
+ * every step of compaction safe to crash in:
+ *   1. (quiesced) the live log becomes "<image>.log.old" and a new one
+ *      is started, and the tree is copied
+ *   2. what was still buffered goes to the old log, which is synced
+ *   3. the copy is written as the new image and renamed into place
+ *   4. "<image>.log.old" is removed
+ * journal_open maps the image, then replays .old (if still there), then
+ * the live log.
+ *
+ * Split records name the nodes they created by id. Ids come out of the
+ * arena in allocation order, which is not quite the order concurrent
+ * learners record their edits in, so replay creates nodes at the ids the
+ * record names and leaves empty placeholders in any gap. */
+#define JOURNAL_MAGIC 0x414A4C35  /* "AJL5" */
+#define JOURNAL_VERSION 1
+
+/* Anything claiming to be longer is a torn length, not a record */
+#define RECORD_MAX_BYTES (1u << 30)
+
+enum {
+    REC_SPLIT = 1,      /* Edit, then question and animal text */
+    REC_UNDO = 2,       /* Edit as undo pushed it onto g_redo */
+    REC_REDO = 3,       /* Edit as redo pushed it onto g_undo */
+    REC_STACKS = 4      /* g_undo and g_redo, bottom first */
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} JournalHeader;
+
+/* Payloads are built in a growable byte buffer */
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    int ok;             /* cleared if a grow failed */
+} ByteBuf;
+
+typedef struct {
+    int active;
+    char *image;
+    char *logName;
+    char *oldName;
+    int fd;
+    uint64_t limit;
+
+    pthread_mutex_t mu;         /* appends: buf, lsn, logBytes */
+    pthread_mutex_t io;         /* writes and fsyncs of fd; spare */
+    pthread_mutex_t compactLock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int stop;
+
+    ByteBuf buf;                /* appended, not yet written */
+    ByteBuf spare;              /* being written by whoever holds io */
+    uint64_t lsn;
+    uint64_t synced;
+    uint64_t logBytes;
+    uint64_t replayed;
+    uint32_t compactions;
+    uint64_t retryAt;           /* after a failed checkpoint: wait for this */
+    int failed;                 /* an append ran out of memory */
+} Journal;
+
+static Journal g_journal = {
+    0, NULL, NULL, NULL, -1, 0,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, 0, 0,
+    {NULL, 0, 0, 1}, {NULL, 0, 0, 1}, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* ========== Record Encoding ========== */
+
+static void bb_put(ByteBuf *b, const void *data, size_t len) {
+	if(!b->ok)
+		return;
+	if(b->size + len > b->capacity) {
+		size_t cap = b->capacity ? b->capacity : 4096;
+		while(cap < b->size + len)
+			cap *= 2;
+		char* grown = (char*)realloc(b->data, cap);
+		if(grown == NULL) {
+			b->ok = 0;
+			return;
+		}
+		b->data = grown;
+		b->capacity = cap;
+	}
+	memcpy(b->data + b->size, data, len);
+	b->size += len;
+}
+
+static void bb_free(ByteBuf *b) {
+	free(b->data);
+	b->data = NULL;
+	b->size = 0;
+	b->capacity = 0;
+	b->ok = 1;
+}
+
+/* put_edit
+ * - Edits are written field by field, so the record doesn't depend on
+ *   how the compiler lays out Edit
+ */
+static void put_edit(ByteBuf *b, const Edit *e) {
+	int32_t side = e->wasYesChild;
+	uint32_t leafYes = e->newLeafYes ? 1 : 0;
+	bb_put(b, &e->parent, sizeof(uint32_t));
+	bb_put(b, &side, sizeof(int32_t));
+	bb_put(b, &e->oldLeaf, sizeof(uint32_t));
+	bb_put(b, &e->newQuestion, sizeof(uint32_t));
+	bb_put(b, &e->newLeaf, sizeof(uint32_t));
+	bb_put(b, &leafYes, sizeof(uint32_t));
+}
+
+static void put_text(ByteBuf *b, const char *text) {
+	uint32_t len = (uint32_t)strlen(text);
+	bb_put(b, &len, sizeof(uint32_t));
+	bb_put(b, text, len);
+}
+
+/* begin_record / end_record
+ * - Reserve the length and checksum in front of the payload, then fill
+ *   them in once the payload is complete
+ */
+static size_t begin_record(ByteBuf *b, uint64_t lsn, uint32_t type) {
+	size_t at = b->size;
+	uint32_t frame[2] = {0, 0};
+	bb_put(b, frame, sizeof(frame));
+	bb_put(b, &lsn, sizeof(uint64_t));
+	bb_put(b, &type, sizeof(uint32_t));
+	return at;
+}
+
+static void end_record(ByteBuf *b, size_t at) {
+	if(!b->ok)
+		return;
+	uint32_t frame[2];
+	frame[0] = (uint32_t)(b->size - at - sizeof(frame));
+	frame[1] = fnv1a(b->data + at + sizeof(frame), frame[0]);
+	memcpy(b->data + at, frame, sizeof(frame));
+}
+
+/* put_stacks
+ * - A STACKS record holding both edit stacks, stamped with lsn
+ */
+static void put_stacks(ByteBuf *b, uint64_t lsn) {
+	size_t at = begin_record(b, lsn, REC_STACKS);
+	uint32_t undo = (uint32_t)g_undo.size;
+	uint32_t redo = (uint32_t)g_redo.size;
+	bb_put(b, &undo, sizeof(uint32_t));
+	bb_put(b, &redo, sizeof(uint32_t));
+	for(int i = 0; i < g_undo.size; i++)
+		put_edit(b, &g_undo.edits[i]);
+	for(int i = 0; i < g_redo.size; i++)
+		put_edit(b, &g_redo.edits[i]);
+	end_record(b, at);
+}
+
+/* Reading a payload; every get checks the bounds first */
+typedef struct {
+    const char *p;
+    const char *end;
+    int ok;
+} Reader;
+
+static void get(Reader *r, void *out, size_t len) {
+	if(!r->ok || (size_t)(r->end - r->p) < len) {
+		r->ok = 0;
+		memset(out, 0, len);
+		return;
+	}
+	memcpy(out, r->p, len);
+	r->p += len;
+}
+
+static void get_edit(Reader *r, Edit *e) {
+	int32_t side;
+	uint32_t leafYes;
+	e->type = EDIT_INSERT_SPLIT;
+	get(r, &e->parent, sizeof(uint32_t));
+	get(r, &side, sizeof(int32_t));
+	get(r, &e->oldLeaf, sizeof(uint32_t));
+	get(r, &e->newQuestion, sizeof(uint32_t));
+	get(r, &e->newLeaf, sizeof(uint32_t));
+	get(r, &leafYes, sizeof(uint32_t));
+	e->wasYesChild = side;
+	e->newLeafYes = leafYes != 0;
+}
+
+/* get_text
+ * - Copy a length-prefixed string out of the payload and NUL-terminate
+ *   it; NULL (and the reader marked bad) if it runs past the end
+ */
+static char *get_text(Reader *r) {
+	uint32_t len = 0;
+	get(r, &len, sizeof(uint32_t));
+	if(!r->ok || (size_t)(r->end - r->p) < len) {
+		r->ok = 0;
+		return NULL;
+	}
+	char* text = (char*)malloc((size_t)len + 1);
+	if(text == NULL) {
+		r->ok = 0;
+		return NULL;
+	}
+	memcpy(text, r->p, len);
+	text[len] = '\0';
+	r->p += len;
+	return text;
+}
+
+/* ========== Replay ========== */
+
+/* Where replay has got to: the tree is at the image's LSN plus every
+ * record applied since; the stacks are at the last STACKS record plus
+ * every record followed since (stacksKnown is 0 until the first one) */
+typedef struct {
+    uint64_t tree;
+    uint64_t stacks;
+    int stacksKnown;
+    uint64_t applied;
+} ReplayPos;
+
+/* replay_node
+ * Make node id hold text, as if arena_alloc had just handed it out
+ * - Ids past the end are reached by allocating placeholders (empty leaf
+ *   text, all-zero aggregates) that a later record may fill in
+ * - Return 0 if id is an existing node rather than a placeholder, or if
+ *   out of memory
+ */
+static int replay_node(NodeId id, const char *text, int isQuestion) {
+	if(id == NODE_NIL)
+		return 0;
+	while(g_arena.count < id) {
+		NodeId hole = arena_alloc(&g_arena, "", 0);
+		if(hole == NODE_NIL)
+			return 0;
+		node_at(hole)->size = 0;
+		node_at(hole)->leaves = 0;
+		node_at(hole)->height = 0;
+	}
+	if(g_arena.count == id)
+		return arena_alloc(&g_arena, text, isQuestion) == id;
+
+	Node* n = node_at(id);
+	if(n->size != 0)
+		return 0;
+	uint32_t offset = sp_intern(&g_arena.strings, text);
+	if(offset == SP_NONE)
+		return 0;
+	n = node_at(id);
+	n->text = offset;
+	arena_links()[id].yes = isQuestion ? NODE_QUESTION : NODE_NIL;
+	n->size = 1;
+	n->leaves = isQuestion ? 0 : 1;
+	n->height = 1;
+	return 1;
+}
+
+/* replay_split
+ * Redo a learned split exactly where it happened
+ * - The slot must still hold the old leaf; anything else means the log
+ *   doesn't belong to this image
+ */
+static int replay_split(const Edit *e, const char *question, const char *animal) {
+	uint32_t count = g_arena.count;
+	if(e->oldLeaf == NODE_NIL || e->oldLeaf >= count || e->parent >= count
+		|| e->newQuestion == e->newLeaf)
+		return 0;
+	NodeId occupant = e->parent == NODE_NIL ? g_root
+		: e->wasYesChild ? node_yes(e->parent) : node_no(e->parent);
+	if(occupant != e->oldLeaf)
+		return 0;
+
+	if(!replay_node(e->newQuestion, question, 1) || !replay_node(e->newLeaf, animal, 0))
+		return 0;
+
+	if(e->newLeafYes) {
+		node_set_yes(e->newQuestion, e->newLeaf);
+		node_set_no(e->newQuestion, e->oldLeaf);
+	} else {
+		node_set_no(e->newQuestion, e->newLeaf);
+		node_set_yes(e->newQuestion, e->oldLeaf);
+	}
+	if(e->parent == NODE_NIL)
+		tree_set_root(e->newQuestion);
+	else if(e->wasYesChild)
+		node_set_yes(e->parent, e->newQuestion);
+	else
+		node_set_no(e->parent, e->newQuestion);
+	return 1;
+}
+
+/* replay_record
+ * Follow one record; return 0 if it doesn't fit where replay has got to
+ */
+static int replay_record(ReplayPos *pos, uint64_t lsn, uint32_t type, Reader *r) {
+	if(type == REC_STACKS) {
+		//the stacks as of lsn; the tree must not be behind that
+		if(lsn > pos->tree || (pos->stacksKnown && lsn != pos->stacks))
+			return 0;
+		uint32_t undo = 0, redo = 0;
+		get(r, &undo, sizeof(uint32_t));
+		get(r, &redo, sizeof(uint32_t));
+		es_clear(&g_undo);
+		es_clear(&g_redo);
+		for(uint32_t i = 0; r->ok && i < undo; i++) {
+			Edit e;
+			get_edit(r, &e);
+			es_push(&g_undo, e);
+		}
+		for(uint32_t i = 0; r->ok && i < redo; i++) {
+			Edit e;
+			get_edit(r, &e);
+			es_push(&g_redo, e);
+		}
+		pos->stacks = lsn;
+		pos->stacksKnown = 1;
+		return r->ok;
+	}
+
+	//every other record is the next edit after the stacks
+	if(!pos->stacksKnown || lsn != pos->stacks + 1)
+		return 0;
+	int onTree = lsn > pos->tree;
+
+	Edit e;
+	get_edit(r, &e);
+	int ok = r->ok;
+	if(type == REC_SPLIT) {
+		char* question = get_text(r);
+		char* animal = get_text(r);
+		ok = r->ok && (!onTree || replay_split(&e, question, animal));
+		free(question);
+		free(animal);
+		if(ok) {
+			es_push(&g_undo, e);
+			es_clear(&g_redo);
+		}
+	} else if(type == REC_UNDO) {
+		if(onTree) {
+			ok = ok && undo_last_edit();
+		} else if(ok && !es_empty(&g_undo)) {
+			es_pop(&g_undo);
+			es_push(&g_redo, e);
+		} else {
+			ok = 0;
+		}
+	} else if(type == REC_REDO) {
+		if(onTree) {
+			ok = ok && redo_last_edit();
+		} else if(ok && !es_empty(&g_redo)) {
+			es_pop(&g_redo);
+			es_push(&g_undo, e);
+		} else {
+			ok = 0;
+		}
+	} else {
+		ok = 0;
+	}
+	if(!ok)
+		return 0;
+
+	pos->stacks = lsn;
+	if(onTree) {
+		pos->tree = lsn;
+		pos->applied++;
+	}
+	return 1;
+}
+
+/* replay_log
+ * Follow every whole record in the log at name
+ * - Return the offset just past the last good record (where appending
+ *   may resume), 0 if the file isn't a log, or -1 if a good record
+ *   doesn't fit the tree
+ * - A missing file counts as an empty log
+ */
+static long replay_log(const char *name, ReplayPos *pos, int *exists) {
+	FILE* fp = fopen(name, "rb");
+	*exists = fp != NULL;
+	if(fp == NULL)
+		return (long)sizeof(JournalHeader);
+
+	JournalHeader hdr;
+	if(fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != JOURNAL_MAGIC
+		|| hdr.version != JOURNAL_VERSION) {
+		fclose(fp);
+		return 0;
+	}
+
+	long good = (long)sizeof(hdr);
+	char* payload = NULL;
+	size_t capacity = 0;
+	for(;;) {
+		uint32_t frame[2];
+		if(fread(frame, sizeof(frame), 1, fp) != 1)
+			break;
+		if(frame[0] < sizeof(uint64_t) + sizeof(uint32_t) || frame[0] > RECORD_MAX_BYTES)
+			break;
+		if(frame[0] > capacity) {
+			char* grown = (char*)realloc(payload, frame[0]);
+			if(grown == NULL)
+				break;
+			payload = grown;
+			capacity = frame[0];
+		}
+		if(fread(payload, 1, frame[0], fp) != frame[0] || fnv1a(payload, frame[0]) != frame[1])
+			break;
+
+		Reader r = {payload, payload + frame[0], 1};
+		uint64_t lsn;
+		uint32_t type;
+		get(&r, &lsn, sizeof(uint64_t));
+		get(&r, &type, sizeof(uint32_t));
+		if(!replay_record(pos, lsn, type, &r)) {
+			good = -1;
+			break;
+		}
+		good += (long)(sizeof(frame) + frame[0]);
+	}
+	free(payload);
+	fclose(fp);
+	return good;
+}
+
+/* ========== Writing ========== */
+
+/* start_log
+ * - Create (or truncate) a log at name: header plus a STACKS record as of
+ *   lsn, synced. Return its fd, or -1
+ */
+static int start_log(const char *name, uint64_t lsn, uint64_t *bytes) {
+	ByteBuf b = {NULL, 0, 0, 1};
+	JournalHeader hdr = {JOURNAL_MAGIC, JOURNAL_VERSION};
+	bb_put(&b, &hdr, sizeof(hdr));
+	put_stacks(&b, lsn);
+
+	int fd = b.ok ? open(name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644) : -1;
+	if(fd >= 0 && (!write_all(fd, b.data, b.size) || fsync(fd) != 0)) {
+		close(fd);
+		fd = -1;
+	}
+	*bytes = b.size;
+	bb_free(&b);
+	return fd;
+}
+
+/* append
+ * - Add one edit record to the buffer the background thread writes out
+ * - Called with g_learnLock held, so records go in the order edits were
+ *   recorded on the stacks
+ */
+static void append(uint32_t type, const Edit *e) {
+	Journal* j = &g_journal;
+	if(!__atomic_load_n(&j->active, __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_mutex_lock(&j->mu);
+	size_t before = j->buf.size;
+	size_t at = begin_record(&j->buf, j->lsn + 1, type);
+	put_edit(&j->buf, e);
+	if(type == REC_SPLIT) {
+		put_text(&j->buf, node_text(e->newQuestion));
+		put_text(&j->buf, node_text(e->newLeaf));
+	}
+	end_record(&j->buf, at);
+
+	if(j->buf.ok) {
+		j->lsn++;
+		j->logBytes += j->buf.size - before;
+		if(j->logBytes > j->limit)
+			pthread_cond_signal(&j->wake);
+	} else {
+		j->failed = 1;
+		j->buf.size = before;
+		j->buf.ok = 1;
+	}
+	pthread_mutex_unlock(&j->mu);
+}
+
+void journal_log_split(const Edit *e) {
+	append(REC_SPLIT, e);
+}
+
+void journal_log_undo(const Edit *e) {
+	append(REC_UNDO, e);
+}
+
+void journal_log_redo(const Edit *e) {
+	append(REC_REDO, e);
+}
+
+/* flush_locked
+ * - Write out everything appended so far and fsync it; io held
+ */
+static int flush_locked(Journal *j) {
+	pthread_mutex_lock(&j->mu);
+	ByteBuf out = j->buf;
+	j->buf = j->spare;
+	j->spare = out;
+	uint64_t upto = j->lsn;
+	int fd = j->fd;
+	int ok = !j->failed;
+	pthread_mutex_unlock(&j->mu);
+
+	if(j->spare.size > 0)
+		ok = write_all(fd, j->spare.data, j->spare.size) && fsync(fd) == 0 && ok;
+	j->spare.size = 0;
+
+	if(ok) {
+		pthread_mutex_lock(&j->mu);
+		j->synced = upto;
+		pthread_mutex_unlock(&j->mu);
+	}
+	return ok;
+}
+
+/* journal_sync
+ * - Make every edit journaled so far durable now rather than at the next
+ *   background flush
+ * - Return 0 if a write or fsync failed, or an edit couldn't be recorded
+ */
+int journal_sync(void) {
+	Journal* j = &g_journal;
+	if(!__atomic_load_n(&j->active, __ATOMIC_ACQUIRE))
+		return 0;
+	pthread_mutex_lock(&j->io);
+	int ok = flush_locked(j);
+	pthread_mutex_unlock(&j->io);
+	return ok;
+}
+
+/* journal_checkpoint
+ * Fold the log into a fresh image (the steps at the top of the file)
+ * - Learning waits only while the tree is copied; writing the image
+ *   happens with the tree live again
+ * - Return 0 if the image couldn't be written; the logs are left as they
+ *   were, so nothing is lost
+ */
+int journal_checkpoint(void) {
+	Journal* j = &g_journal;
+	if(!__atomic_load_n(&j->active, __ATOMIC_ACQUIRE))
+		return 0;
+	pthread_mutex_lock(&j->compactLock);
+
+	//1. Hold the tree still; take what is buffered for the old log
+	engine_quiesce();
+	pthread_mutex_lock(&j->io);
+	pthread_mutex_lock(&j->mu);
+	ByteBuf pending = j->buf;
+	j->buf = j->spare;
+	j->spare = pending;
+	uint64_t lsn = j->lsn;
+	pthread_mutex_unlock(&j->mu);
+
+	//an .old left by a failed checkpoint still holds records the image
+	//lacks, so keep appending to the live log until one succeeds
+	int oldFd = j->fd;
+	int rotated = 0;
+	if(access(j->oldName, F_OK) != 0 && rename(j->logName, j->oldName) == 0) {
+		uint64_t bytes;
+		int fd = start_log(j->logName, lsn, &bytes);
+		if(fd >= 0) {
+			pthread_mutex_lock(&j->mu);
+			j->fd = fd;
+			j->logBytes = bytes + j->buf.size;
+			pthread_mutex_unlock(&j->mu);
+			rotated = 1;
+		} else {
+			rename(j->oldName, j->logName);
+		}
+	}
+
+	NodeArena snap;
+	memset(&snap, 0, sizeof(snap));
+	snap.count = g_arena.count;
+	snap.links = (NodeLinks*)malloc((size_t)snap.count * sizeof(NodeLinks));
+	snap.nodes = (Node*)malloc((size_t)snap.count * sizeof(Node));
+	snap.strings.size = g_arena.strings.size;
+	snap.strings.bytes = (char*)malloc(snap.strings.size ? snap.strings.size : 1);
+	NodeId root = tree_root();
+	if(snap.links != NULL && snap.nodes != NULL && snap.strings.bytes != NULL) {
+		memcpy(snap.links, g_arena.links, (size_t)snap.count * sizeof(NodeLinks));
+		memcpy(snap.nodes, g_arena.nodes, (size_t)snap.count * sizeof(Node));
+		memcpy(snap.strings.bytes, g_arena.strings.bytes, snap.strings.size);
+	}
+	engine_resume();
+
+	//2. The old log gets the rest of its records
+	int ok = snap.links != NULL && snap.nodes != NULL && snap.strings.bytes != NULL;
+	if(j->spare.size > 0)
+		ok = write_all(oldFd, j->spare.data, j->spare.size) && ok;
+	j->spare.size = 0;
+	ok = fsync(oldFd) == 0 && ok;
+	if(rotated)
+		close(oldFd);
+	pthread_mutex_lock(&j->mu);
+	if(ok)
+		j->synced = lsn;
+	pthread_mutex_unlock(&j->mu);
+	pthread_mutex_unlock(&j->io);
+	sync_dir(j->logName);
+
+	//3. The image, then 4. the old log is no longer needed
+	ok = ok && save_arena_image(j->image, &snap, root, lsn);
+	if(ok) {
+		sync_dir(j->image);
+		unlink(j->oldName);
+	}
+	pthread_mutex_lock(&j->mu);
+	if(ok) {
+		j->compactions++;
+		j->retryAt = 0;
+	} else {
+		j->retryAt = j->logBytes + j->limit;
+	}
+	pthread_mutex_unlock(&j->mu);
+	free(snap.links);
+	free(snap.nodes);
+	free(snap.strings.bytes);
+	pthread_mutex_unlock(&j->compactLock);
+	return ok;
+}
+
+/* journal_main
+ * - The background thread: flush every JOURNAL_SYNC_MS, and checkpoint
+ *   once the live log is over its limit
+ */
+static void *journal_main(void *arg) {
+	Journal* j = (Journal*)arg;
+	pthread_mutex_lock(&j->mu);
+	while(!j->stop) {
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += JOURNAL_SYNC_MS * 1000000L;
+		if(until.tv_nsec >= 1000000000L) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&j->wake, &j->mu, &until);
+		int compact = !j->stop && j->logBytes > j->limit && j->logBytes > j->retryAt;
+		pthread_mutex_unlock(&j->mu);
+
+		pthread_mutex_lock(&j->io);
+		flush_locked(j);
+		pthread_mutex_unlock(&j->io);
+		if(compact)
+			journal_checkpoint();
+
+		pthread_mutex_lock(&j->mu);
+	}
+	pthread_mutex_unlock(&j->mu);
+	return NULL;
+}
+
+/* ========== Opening and Closing ========== */
+
+/* journal_start
+ * - Remember the names, open the live log for appending at offset end
+ *   (creating it with a STACKS record if there is none) and start the
+ *   background thread
+ */
+static int journal_start(Journal *j, uint64_t lsn, long end, int exists) {
+	uint64_t bytes = 0;
+	if(exists) {
+		j->fd = open(j->logName, O_WRONLY | O_APPEND);
+		if(j->fd >= 0 && ftruncate(j->fd, end) != 0) {
+			close(j->fd);
+			j->fd = -1;
+		}
+		bytes = (uint64_t)end;
+	} else {
+		j->fd = start_log(j->logName, lsn, &bytes);
+		sync_dir(j->logName);
+	}
+	if(j->fd < 0)
+		return 0;
+
+	j->lsn = lsn;
+	j->synced = lsn;
+	j->logBytes = bytes;
+	j->compactions = 0;
+	j->retryAt = 0;
+	j->failed = 0;
+	j->stop = 0;
+	__atomic_store_n(&j->active, 1, __ATOMIC_RELEASE);
+	if(pthread_create(&j->thread, NULL, journal_main, j) != 0) {
+		__atomic_store_n(&j->active, 0, __ATOMIC_RELEASE);
+		close(j->fd);
+		j->fd = -1;
+		return 0;
+	}
+	return 1;
+}
+
+static int journal_names(Journal *j, const char *image, uint64_t compactBytes) {
+	j->image = suffixed(image, "");
+	j->logName = suffixed(image, ".log");
+	j->oldName = suffixed(image, ".log.old");
+	j->limit = compactBytes;
+	return j->image != NULL && j->logName != NULL && j->oldName != NULL;
+}
+
+static void journal_forget(Journal *j) {
+	free(j->image);
+	free(j->logName);
+	free(j->oldName);
+	j->image = j->logName = j->oldName = NULL;
+	bb_free(&j->buf);
+	bb_free(&j->spare);
+}
+
+/* journal_open
+ * Recover the tree kept at image and keep journaling to "<image>.log"
+ * - If image exists: open it, replay "<image>.log.old" and "<image>.log"
+ *   on top, and cut a torn record off the end of the live log
+ * - If it doesn't, the current tree becomes the image (there must be no
+ *   log without it)
+ * - compactBytes is how big the live log may grow before it is folded
+ *   into a new image
+ * - Return 0 if the image can't be read, a log doesn't fit it, or the
+ *   files can't be written
+ */
+int journal_open(const char *image, uint64_t compactBytes) {
+	Journal* j = &g_journal;
+	if(j->active)
+		return 0;
+	if(!journal_names(j, image, compactBytes)) {
+		journal_forget(j);
+		return 0;
+	}
+
+	if(access(image, F_OK) != 0) {
+		int ok = access(j->logName, F_OK) != 0 && access(j->oldName, F_OK) != 0
+			&& g_root != NODE_NIL && save_arena_image(image, &g_arena, g_root, 0);
+		if(ok) {
+			sync_dir(image);
+			j->replayed = 0;
+			ok = journal_start(j, 0, 0, 0);
+		}
+		if(!ok)
+			journal_forget(j);
+		return ok;
+	}
+
+	ReplayPos pos = {image_lsn(image), 0, 0, 0};
+	if(!open_tree(image)) {
+		journal_forget(j);
+		return 0;
+	}
+
+	int oldExists, exists;
+	long oldEnd = replay_log(j->oldName, &pos, &oldExists);
+	long end = oldEnd > 0 ? replay_log(j->logName, &pos, &exists) : -1;
+	if(end <= 0) {
+		journal_forget(j);
+		return 0;
+	}
+	index_invalidate();
+
+	//an image saved after the last record that made it to disk has edits
+	//the stacks never heard of; undoing past them would be wrong. Start
+	//the history, and a log that carries on from the image, afresh
+	if(!pos.stacksKnown || pos.stacks < pos.tree) {
+		es_clear(&g_undo);
+		es_clear(&g_redo);
+		unlink(j->oldName);
+		exists = 0;
+	}
+
+	j->replayed = pos.applied;
+	if(!journal_start(j, pos.tree, end, exists)) {
+		journal_forget(j);
+		return 0;
+	}
+	return 1;
+}
+
+/* journal_create
+ * - Start journaling the current tree afresh: it is saved as image and
+ *   any old log is dropped. With a journal already open on image, just
+ *   checkpoint
+ */
+int journal_create(const char *image, uint64_t compactBytes) {
+	Journal* j = &g_journal;
+	if(j->active)
+		return strcmp(j->image, image) == 0 && journal_checkpoint();
+	if(g_root == NODE_NIL || !journal_names(j, image, compactBytes)) {
+		journal_forget(j);
+		return 0;
+	}
+
+	int ok = save_arena_image(image, &g_arena, g_root, 0);
+	if(ok) {
+		unlink(j->oldName);
+		unlink(j->logName);
+		sync_dir(image);
+		ok = journal_start(j, 0, 0, 0);
+	}
+	if(!ok)
+		journal_forget(j);
+	return ok;
+}
+
+/* journal_close
+ * - Stop the background thread, make everything durable and close the
+ *   log; the tree itself is left alone
+ */
+void journal_close(void) {
+	Journal* j = &g_journal;
+	if(!j->active)
+		return;
+
+	pthread_mutex_lock(&j->mu);
+	j->stop = 1;
+	pthread_cond_signal(&j->wake);
+	pthread_mutex_unlock(&j->mu);
+	pthread_join(j->thread, NULL);
+
+	journal_sync();
+	__atomic_store_n(&j->active, 0, __ATOMIC_RELEASE);
+	close(j->fd);
+	j->fd = -1;
+	journal_forget(j);
+}
+
+int journal_active(void) {
+	return __atomic_load_n(&g_journal.active, __ATOMIC_ACQUIRE);
+}
+
+/* journal_lsn
+ * - The last edit journaled; 0 without a journal
+ */
+uint64_t journal_lsn(void) {
+	Journal* j = &g_journal;
+	if(!journal_active())
+		return 0;
+	pthread_mutex_lock(&j->mu);
+	uint64_t lsn = j->lsn;
+	pthread_mutex_unlock(&j->mu);
+	return lsn;
+}
+
+void journal_stats(JournalStats *out) {
+	Journal* j = &g_journal;
+	pthread_mutex_lock(&j->mu);
+	out->lsn = j->lsn;
+	out->synced = j->synced;
+	out->logBytes = j->logBytes;
+	out->replayed = j->replayed;
+	out->compactions = j->compactions;
+	pthread_mutex_unlock(&j->mu);
+}
@@ -1,25 +1,173 @@
 #ifndef LAB5_H
 #define LAB5_H
 
+#include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
 
 /* ========== Tree Node ========== */
+/* Nodes live in one contiguous arena and refer to each other by index.
+ * Index 0 is reserved so that NODE_NIL (0) means "no child". */
+typedef uint32_t NodeId;
+#define NODE_NIL 0u
+
+/* A node is split in two, each half in its own array indexed by NodeId.
+ * NodeLinks is what a walk down the tree reads, eight nodes to a cache
+ * line; the question flag rides in the top bit of yes, so ids stop at
+ * NODE_ID_MAX. Node holds the rest, read when a node's text is shown or
+ * the tree is edited. */
+#define NODE_QUESTION 0x80000000u
+#define NODE_ID_MAX 0x7fffffffu
+
+typedef struct NodeLinks {
+    uint32_t yes;       /* yes child, | NODE_QUESTION for a question */
+    NodeId no;
+} NodeLinks;
+
 typedef struct Node {
-    char *text;
-    struct Node *yes;
-    struct Node *no;
-    int isQuestion;
+    uint32_t text;      /* offset of the interned text in the string pool */
+    NodeId parent;      /* NODE_NIL for the root and for detached nodes */
+    /* Aggregates over the subtree rooted here, kept current by
+     * node_set_yes/node_set_no. NODE_NIL's slot is all zero. */
+    uint32_t size;      /* nodes */
+    uint32_t leaves;    /* animals */
+    uint32_t height;    /* nodes on the longest path down to a leaf */
+    /* Usage over finished games (see engine.c): games that asked this
+     * question or made this guess, how many answered yes here, and how
+     * many of them the engine then guessed right. Saved with the tree. */
+    uint32_t plays;
+    uint32_t yeses;
+    uint32_t correct;
 } Node;
 
+static inline NodeId links_yes(NodeLinks l) { return l.yes & NODE_ID_MAX; }
+static inline int links_question(NodeLinks l) { return (l.yes & NODE_QUESTION) != 0; }
+
+/* ========== String Pool ========== */
+/* Interned, immutable node text. A string is named by its byte offset in
+ * the slab; identical texts share one copy. */
+#define SP_NONE UINT32_MAX
+
+typedef struct {
+    char *bytes;            /* NUL-terminated strings back to back */
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t *slots;        /* open addressing: offset + 1, 0 = empty */
+    uint32_t *hashes;       /* cached h_mix(h_hash()) of each slot's string */
+    uint32_t nslots;
+    uint32_t count;         /* distinct strings */
+    uint64_t requested;     /* bytes asked for, duplicates included */
+    uint64_t hits;          /* interns answered by an existing copy */
+    int external;           /* bytes borrowed (e.g. mmap), not malloc'd */
+    int unindexed;          /* adopted strings not yet in the table */
+    void (*retire)(void *old);  /* see arena_set_retire */
+} StringPool;
+
+typedef struct {
+    uint32_t strings;
+    uint64_t hits;
+    uint64_t bytesStored;
+    uint64_t bytesRequested;
+    uint64_t bytesSaved;
+} InternStats;
+
+void sp_init(StringPool *p);
+int sp_reserve(StringPool *p, uint32_t bytes);
+uint32_t sp_intern(StringPool *p, const char *s);
+void sp_adopt(StringPool *p, char *bytes, uint32_t size);
+void sp_extend(StringPool *p, uint32_t bytes, uint64_t requested);
+void sp_stats(const StringPool *p, InternStats *out);
+void sp_reset(StringPool *p);
+void sp_free(StringPool *p);
+
+/* ========== Node Arena ========== */
+typedef struct {
+    NodeLinks *links;       /* hot half; links[NODE_NIL] is all zero */
+    Node *nodes;            /* cold half; nodes[NODE_NIL] is all zero */
+    uint32_t count;         /* slots in use, including the reserved one */
+    uint32_t capacity;
+    StringPool strings;     /* interned text for every node */
+    void *map;              /* mmap'ed image backing the arrays, if any */
+    size_t mapSize;
+    int nodesMapped;        /* links and nodes still point into map */
+    void (*retire)(void *old);  /* see arena_set_retire */
+    /* Nodes changed since the last page snapshot (see pages.c). Only
+     * recorded once this arena has one; past DIRTY_MAX the list is given
+     * up and the next snapshot reads every page instead. */
+    NodeId *dirty;
+    uint32_t dirtyCount;
+    uint32_t dirtyCapacity;
+    int trackDirty;         /* 0 off, 1 recording, -1 gave up */
+    uint32_t generation;    /* new for every arena_init/arena_reset */
+} NodeArena;
+
+#define DIRTY_MAX (1u << 20)
+
+extern NodeArena g_arena;
+
+void arena_init(NodeArena *a);
+int arena_reserve(NodeArena *a, uint32_t nodes);
+NodeId arena_alloc(NodeArena *a, const char *text, int isQuestion);
+void arena_reset(NodeArena *a);
+void arena_free(NodeArena *a);
+
+/* Readers may walk the tree while one writer learns (see server.c).
+ * With a retire hook set, growing the node arrays or the text slab copies
+ * them, publishes the copies and hands the old blocks to retire() instead
+ * of realloc'ing them out from under the readers. */
+void arena_set_retire(NodeArena *a, void (*retire)(void *old));
+
+/* Accessors; every caller goes through these instead of touching g_arena.
+ * The arrays and child links are loaded with acquire semantics to pair
+ * with the writer's release stores; on x86 these are plain loads. */
+static inline NodeLinks *arena_links(void) { return __atomic_load_n(&g_arena.links, __ATOMIC_ACQUIRE); }
+static inline Node *arena_nodes(void) { return __atomic_load_n(&g_arena.nodes, __ATOMIC_ACQUIRE); }
+static inline Node *node_at(NodeId id) { return &arena_nodes()[id]; }
+static inline const char *node_text(NodeId id) {
+    return __atomic_load_n(&g_arena.strings.bytes, __ATOMIC_ACQUIRE) + arena_nodes()[id].text;
+}
+static inline int node_is_question(NodeId id) {
+    return (__atomic_load_n(&arena_links()[id].yes, __ATOMIC_RELAXED) & NODE_QUESTION) != 0;
+}
+static inline NodeId node_yes(NodeId id) {
+    return __atomic_load_n(&arena_links()[id].yes, __ATOMIC_ACQUIRE) & NODE_ID_MAX;
+}
+static inline NodeId node_no(NodeId id) { return __atomic_load_n(&arena_links()[id].no, __ATOMIC_ACQUIRE); }
+static inline NodeId node_parent(NodeId id) { return arena_nodes()[id].parent; }
+
+/* Linking a child also sets its parent and refreshes the aggregates of
+ * id and its ancestors, O(depth) */
+void node_set_yes(NodeId id, NodeId child);
+void node_set_no(NodeId id, NodeId child);
+void tree_set_root(NodeId id);
+
+/* Splicing without the writer lock: node_cas_child publishes a filled-in
+ * node in one compare-and-swap, node_attach (under the lock) then fixes
+ * the parent links and aggregates around it */
+int node_cas_child(NodeId id, int yes, NodeId *expected, NodeId child);
+void node_attach(NodeId parent, NodeId id);
+
 /* Node constructors */
-Node *create_question_node(const char *question);
-Node *create_animal_node(const char *animal);
-void free_tree(Node *node);
-int count_nodes(Node *root);
+NodeId create_question_node(const char *question);
+NodeId create_animal_node(const char *animal);
+void free_tree(void);
+int count_nodes(NodeId root);
+
+/* ========== Tree Statistics ========== */
+/* Read straight from the cached aggregates, O(1) */
+typedef struct {
+    uint32_t nodes;
+    uint32_t questions;
+    uint32_t animals;
+    uint32_t height;        /* deepest guess takes height - 1 questions */
+} TreeStats;
+
+void tree_stats(NodeId root, TreeStats *out);
 
 /* ========== Stack for Gameplay ========== */
 typedef struct Frame {
-    Node *node;
+    NodeId node;
     int answeredYes;  /* -1 unset, 0 no, 1 yes */
 } Frame;
 
@@ -30,7 +178,7 @@ typedef struct {
 } FrameStack;
 
 void fs_init(FrameStack *s);
-void fs_push(FrameStack *s, Node *node, int answeredYes);
+void fs_push(FrameStack *s, NodeId node, int answeredYes);
 Frame fs_pop(FrameStack *s);
 int fs_empty(FrameStack *s);
 void fs_free(FrameStack *s);
@@ -42,11 +190,12 @@ typedef enum {
 
 typedef struct {
     EditType type;
-    Node *parent;
+    NodeId parent;
     int wasYesChild;  /* 1=yes branch, 0=no branch, -1=root */
-    Node *oldLeaf;
-    Node *newQuestion;
-    Node *newLeaf;
+    NodeId oldLeaf;
+    NodeId newQuestion;
+    NodeId newLeaf;
+    int newLeafYes;   /* 1 if newLeaf hangs on newQuestion's yes branch */
 } Edit;
 
 typedef struct {
@@ -65,27 +214,33 @@ void free_edit_stack(EditStack *s);
 
 extern EditStack g_undo;
 extern EditStack g_redo;
-extern Node *g_root;
+extern NodeId g_root;
+
+/* g_root as a reader should see it; tree_set_root publishes it */
+static inline NodeId tree_root(void) { return __atomic_load_n(&g_root, __ATOMIC_ACQUIRE); }
 
 int undo_last_edit();
 int redo_last_edit();
 
 /* ========== Queue for BFS ========== */
-typedef struct QueueNode {
-    Node *treeNode;
+/* Ring buffer: items[(head + i) & (capacity - 1)] is the i-th entry.
+ * capacity is always 0 or a power of two. */
+typedef struct QueueEntry {
+    NodeId treeNode;
     int id;
-    struct QueueNode *next;
-} QueueNode;
+} QueueEntry;
 
 typedef struct {
-    QueueNode *front;
-    QueueNode *rear;
+    QueueEntry *items;
+    int head;
     int size;
+    int capacity;
 } Queue;
 
 void q_init(Queue *q);
-void q_enqueue(Queue *q, Node *node, int id);
-int q_dequeue(Queue *q, Node **node, int *id);
+void q_reserve(Queue *q, int n);
+void q_enqueue(Queue *q, NodeId node, int id);
+int q_dequeue(Queue *q, NodeId *node, int *id);
 int q_empty(Queue *q);
 void q_free(Queue *q);
 
@@ -96,41 +251,403 @@ typedef struct IdList {
     int capacity;
 } IdList;
 
-typedef struct Entry {
-    char *key;
+/* Open addressing with Robin Hood probing. Each slot keeps the key's
+ * cached hash and the key's offset in the table's own key slab. */
+typedef struct HashSlot {
     IdList vals;
-    struct Entry *next;
-} Entry;
+    uint32_t dist;          /* 0 = empty, otherwise probe length + 1 */
+    uint32_t hash;          /* cached h_mix(h_hash(key)) */
+    uint32_t key;           /* offset of the key in keys */
+} HashSlot;
 
 typedef struct {
-    Entry **buckets;
-    int nbuckets;
-    int size;
+    HashSlot *slots;
+    int nslots;             /* 0 or a power of two */
+    int size;               /* number of keys */
+    char *keys;             /* NUL-terminated keys back to back */
+    uint32_t keysSize;
+    uint32_t keysCapacity;
+    uint32_t keysDead;      /* slab bytes of removed keys */
 } Hash;
 
 extern void h_init(Hash *h, int nbuckets);
 extern unsigned h_hash(const char *s);
+
+/* djb2's low bits follow the last few characters closely, which clusters
+ * badly in power-of-two tables; tables mask h_mix(h_hash(key)) instead
+ * (murmur3 finalizer) */
+static inline unsigned h_mix(unsigned h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
 extern int h_put(Hash *h, const char *key, int animalId);
 extern int h_contains(const Hash *h, const char *key, int animalId);
 extern int *h_get_ids(const Hash *h, const char *key, int *outCount);
+extern int *h_get_ids_probed(const Hash *h, const char *key, int *outCount, uint32_t *probes);
+extern int h_remove(Hash *h, const char *key, int animalId);
 extern void h_free(Hash *h);
 extern char *canonicalize(const char *s);
+extern size_t canonicalize_to(char *dst, const char *s);
 extern int get_yes_no(int y, int x, const char *prompt);
 extern char *get_input(int y, int x, const char *prompt);
 
 extern Hash g_index;
 
+/* ========== Attribute Index ========== */
+void index_rebuild(void);
+void index_invalidate(void);
+void index_add(NodeId id);
+void index_remove(NodeId id);
+int *index_find(const char *text, int isQuestion, int *outCount);
+
 /* ========== Persistence ========== */
 int save_tree(const char *filename);
+int save_tree_parallel(const char *filename, int threads);
 int load_tree(const char *filename);
+int load_tree_parallel(const char *filename, int threads);
+int save_tree_packed(const char *filename, int threads);
+int load_tree_packed(const char *filename, int threads);
+int save_image(const char *filename);
+int save_arena_image(const char *filename, const NodeArena *a, NodeId root, uint64_t lsn);
+uint64_t image_lsn(const char *filename);
+int map_tree(const char *filename);
+int open_tree(const char *filename);
+
+/* ========== Block Compression ========== */
+uint8_t *put_varint(uint8_t *p, uint32_t v);
+int get_varint(const uint8_t **p, const uint8_t *end, uint32_t *v);
+size_t lz_compress(const uint8_t *in, size_t n, uint8_t *out, size_t capacity);
+int lz_decompress(const uint8_t *in, size_t n, uint8_t *out, size_t rawSize);
+
+/* ========== Succinct Tree ========== */
+/* A read-only copy of a tree in a few bits per node plus its text: one
+ * bit per node in BFS order saying whether it is a question, and the
+ * texts in the same order. Nodes are positions 0 .. nodes - 1, root
+ * first; navigation is arithmetic on rank/select, with no pointers. */
+#define SUCCINCT_TEXT_SAMPLE 16     /* nodes per stored text offset */
+
+typedef struct {
+    uint64_t *bits;         /* bit i set if node i is a question */
+    uint32_t *ranks;        /* questions before each word of bits */
+    uint32_t nodes;
+    uint32_t animals;
+    uint32_t height;
+    char *text;             /* every node's text, BFS order, NUL-terminated */
+    size_t textSize;
+    uint64_t *textAt;       /* offset of every SUCCINCT_TEXT_SAMPLE-th text */
+} SuccinctTree;
+
+int succinct_build(SuccinctTree *t, NodeId root);
+void succinct_free(SuccinctTree *t);
+uint32_t succinct_rank(const SuccinctTree *t, uint32_t i);
+uint32_t succinct_select(const SuccinctTree *t, uint32_t k);
+int succinct_is_question(const SuccinctTree *t, uint32_t i);
+uint32_t succinct_yes(const SuccinctTree *t, uint32_t i);
+uint32_t succinct_no(const SuccinctTree *t, uint32_t i);
+uint32_t succinct_parent(const SuccinctTree *t, uint32_t i);
+const char *succinct_text(const SuccinctTree *t, uint32_t i);
+size_t succinct_bytes(const SuccinctTree *t);
+
+/* ========== Node Layout ========== */
+/* Renumber the tree so nodes sit in the arena in a chosen order. Ids
+ * change, so like a load this clears undo/redo, and it is refused while
+ * a journal is open. */
+typedef enum {
+    LAYOUT_BFS,             /* level by level, as load_tree leaves it */
+    LAYOUT_VEB              /* van Emde Boas: recursive blocks of levels */
+} TreeLayout;
+
+int tree_relayout(TreeLayout layout);
+
+/* ========== Tree Generator ========== */
+/* Deterministic synthetic trees for benchmarks and tests (see gen.c).
+ * gen_tree replaces the tree like a load does. */
+typedef enum {
+    GEN_BALANCED,           /* complete: every level full but the last */
+    GEN_CHAIN,              /* one long no-side spine, an animal per step */
+    GEN_RANDOM,             /* a random leaf split at every step */
+    GEN_SKEWED              /* grown by scripted games of Zipf-popular players */
+} GenShape;
+
+int gen_tree(GenShape shape, uint32_t nodes, uint64_t seed);
+const char *gen_shape_name(GenShape shape);
+int gen_shape_parse(const char *name, GenShape *out);
+
+/* ========== Performance Counters ========== */
+/* Hardware counters around a measured region, for the benchmarks (see
+ * perfctr.c). Linux perf_event_open; a counter the kernel or the machine
+ * won't give is just left out, and none at all is not an error. */
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_COUNTERS
+} PerfCounter;
+
+typedef struct {
+    int fd[PERF_COUNTERS];          /* -1 where the counter is unavailable */
+    uint64_t value[PERF_COUNTERS];  /* counts between the last start and stop */
+    uint64_t mark[PERF_COUNTERS][3];/* count, time enabled, time running at start */
+} PerfCounters;
+
+int perf_open(PerfCounters *pc);
+int perf_available(const PerfCounters *pc, PerfCounter c);
+void perf_start(PerfCounters *pc);
+void perf_stop(PerfCounters *pc);
+void perf_close(PerfCounters *pc);
+const char *perf_counter_name(PerfCounter c);
+
+/* ========== Page Snapshots ========== */
+/* A snapshot split into content-addressed pages of subtrees, so saving
+ * again only writes the pages that changed (see pages.c) */
+#define PAGE_NODES 256
+
+/* Subtree sizes fall in classes of 2^7, 2^15 and 2^23 nodes; a node a
+ * class smaller than its parent starts a page of its own */
+static inline uint32_t page_size_class(uint32_t size) {
+    return size == 0 ? 0 : (uint32_t)(32 - __builtin_clz(size)) / 8;
+}
+
+typedef struct {
+    uint32_t pages;         /* pages in the last snapshot */
+    uint32_t rebuilt;       /* pages the last save read from the tree */
+    uint32_t written;       /* page files it had to write */
+    uint64_t bytesWritten;  /* those files plus the page table */
+} PageStats;
+
+int save_pages(const char *filename);
+int load_pages(const char *filename);
+int remove_pages(const char *filename);
+void pages_stats(PageStats *out);
+void pages_forget(void);
+
+/* ========== Journal ========== */
+/* Learned edits are appended to "<image>.log" as they happen instead of
+ * rewriting the whole image. A background thread writes and fsyncs the
+ * log every JOURNAL_SYNC_MS and, once it outgrows its limit, folds it
+ * into a fresh image. journal_open replays the log on top of the image. */
+#define JOURNAL_SYNC_MS 10
+#define JOURNAL_COMPACT_BYTES (8u << 20)
+
+typedef struct {
+    uint64_t lsn;           /* last edit appended */
+    uint64_t synced;        /* last edit known to be on disk */
+    uint64_t logBytes;      /* size of the live log, buffered bytes included */
+    uint64_t replayed;      /* edits journal_open applied to the image */
+    uint32_t compactions;
+} JournalStats;
+
+int journal_open(const char *image, uint64_t compactBytes);
+int journal_create(const char *image, uint64_t compactBytes);
+int journal_sync(void);
+int journal_checkpoint(void);
+void journal_close(void);
+int journal_active(void);
+uint64_t journal_lsn(void);
+void journal_stats(JournalStats *out);
+
+/* Called by the engine with g_learnLock held; no-ops without a journal */
+void journal_log_split(const Edit *e);
+void journal_log_undo(const Edit *e);
+void journal_log_redo(const Edit *e);
 
 /* ========== Utilities ========== */
 int check_integrity();
+uint32_t fnv1a(const char *data, size_t len);
+char *suffixed(const char *name, const char *suffix);
+int write_all(int fd, const char *data, size_t len);
+void sync_dir(const char *name);
+
+/* ========== Epoch-Based Reclamation ========== */
+/* Reader threads bracket every tree access with epoch_enter/epoch_exit
+ * on their own slot and never block. The single writer (holding the
+ * learn lock) retires blocks readers might still hold; a block is freed
+ * once every reader has been seen outside the epoch it was retired in. */
+#define EPOCH_MAX_THREADS 256
+
+int epoch_register(void);
+void epoch_unregister(int slot);
+void epoch_enter(int slot);
+void epoch_exit(int slot);
+void epoch_retire(void *old);
+void epoch_reclaim(void);
+uint32_t epoch_pending(void);
+void epoch_drain(void);
+
+/* ========== Metrics ========== */
+/* Process-wide counters, gauges and latency histograms (see metrics.c).
+ * Counters and histograms are sharded by thread so recording is one
+ * uncontended atomic add; reads sum the shards. Ids are grouped by kind:
+ * histograms first, then counters, then gauges. */
+typedef enum {
+    METRIC_GAME_QUESTIONS,      /* histograms */
+    METRIC_ANSWER_SECONDS,
+    METRIC_LEARN_SECONDS,
+    METRIC_SAVE_SECONDS,
+    METRIC_LOAD_SECONDS,
+    METRIC_INDEX_PROBES,
+    METRIC_HISTOGRAMS,
+    METRIC_GAMES = METRIC_HISTOGRAMS,   /* counters */
+    METRIC_GAMES_GUESSED,
+    METRIC_GAMES_LEARNED,
+    METRIC_GAMES_REPEATED,
+    METRIC_GAMES_STUMPED,
+    METRIC_SAVE_BYTES,
+    METRIC_LOAD_BYTES,
+    METRIC_SAVE_ERRORS,
+    METRIC_LOAD_ERRORS,
+    METRIC_COUNTERS_END,
+    METRIC_TREE_NODES = METRIC_COUNTERS_END,   /* gauges */
+    METRIC_CONNECTIONS,
+    METRIC_COUNT
+} MetricId;
+
+typedef enum {
+    METRIC_HISTOGRAM,
+    METRIC_COUNTER,
+    METRIC_GAUGE
+} MetricKind;
+
+/* Histogram buckets are log-linear: exact below 2^(METRIC_SUB_BITS + 1),
+ * then 2^METRIC_SUB_BITS buckets per power of two (within 12.5%), up to
+ * 2^METRIC_MAX_BITS - 1 (about 18 minutes in ns); larger values land in
+ * the last bucket */
+#define METRIC_SUB_BITS 3
+#define METRIC_MAX_BITS 40
+#define METRIC_BUCKETS ((METRIC_MAX_BITS - METRIC_SUB_BITS + 1) << METRIC_SUB_BITS)
+
+typedef struct {
+    uint64_t count;
+    double sum;             /* in the metric's unit, e.g. seconds */
+    double p50;             /* quantiles: the upper edge of their bucket */
+    double p90;
+    double p99;
+    double max;
+} MetricSummary;
+
+uint64_t metrics_now(void);
+void metric_add(MetricId id, uint64_t n);
+void metric_observe(MetricId id, uint64_t value);
+void metric_set(MetricId id, int64_t value);
+void metric_gauge_add(MetricId id, int64_t delta);
+double metric_read(MetricId id);
+void metric_summary(MetricId id, MetricSummary *out);
+MetricKind metric_kind(MetricId id);
+const char *metric_name(MetricId id);
+const char *metric_help(MetricId id);
+uint32_t metric_bucket(uint64_t value);
+uint64_t metric_bucket_high(uint32_t bucket);
+void metrics_reset(void);
+int metrics_expose(FILE *fp);
+int metrics_write_file(const char *filename);
+
+/* ========== Tracing ========== */
+/* Begin/end spans around the expensive phases, built in only with
+ * make TRACE=1 (-DTRACE); otherwise the macros are empty statements. A
+ * span is one TRACE_BEGIN(name) and a later TRACE_END(name) in the same
+ * block. Spans go to a per-thread ring (see trace.c) and trace_write
+ * turns them into Chrome trace_event JSON; ANIMALS_TRACE=file writes
+ * them there at exit. */
+#ifdef TRACE
+#define TRACE_BEGIN(span) uint64_t trace_##span = metrics_now()
+#define TRACE_END(span) trace_span(#span, trace_##span)
+#else
+#define TRACE_BEGIN(span) do { } while(0)
+#define TRACE_END(span) do { } while(0)
+#endif
+
+#define TRACE_RING_EVENTS 65536     /* spans kept per thread */
+
+void trace_span(const char *name, uint64_t start);
+int trace_write(const char *filename);
+uint64_t trace_count(void);
+void trace_reset(void);
+
+/* ========== Usage Report ========== */
+/* What the per-node usage counters say about the tree (see usage.c): the
+ * animals most often reached, and the subtrees no finished game has
+ * reached although their parent was */
+typedef struct {
+    NodeId node;
+    uint32_t plays;         /* of node */
+    uint32_t correct;
+    uint32_t size;          /* nodes in node's subtree */
+} UsageEntry;
+
+int usage_hot(NodeId root, UsageEntry *out, int max);
+int usage_dead(NodeId root, UsageEntry *out, int max);
+size_t usage_path(NodeId node, char *buf, size_t size);
+int usage_report(FILE *fp, NodeId root, int top);
+int usage_write_file(const char *filename, NodeId root, int top);
+
+/* ========== Game Engine ========== */
+/* One game with no UI attached. A frontend shows engine_prompt() and
+ * feeds the player's replies back with engine_answer (yes/no states) or
+ * engine_submit (text states) until the state is ENGINE_DONE. */
+typedef enum {
+    ENGINE_QUESTION,        /* asking the current question: yes/no */
+    ENGINE_GUESS,           /* guessing the current animal: yes/no */
+    ENGINE_ASK_ANIMAL,      /* wrong guess: submit the right animal */
+    ENGINE_ASK_QUESTION,    /* submit a question telling the two apart */
+    ENGINE_ASK_ANSWER,      /* its answer for the new animal: yes/no */
+    ENGINE_DONE
+} EngineState;
+
+typedef enum {
+    ENGINE_PLAYING,
+    ENGINE_GUESSED,         /* the guess was right */
+    ENGINE_LEARNED,         /* the new animal was spliced into the tree */
+    ENGINE_REPEATED,        /* the player named the animal just guessed */
+    ENGINE_STUMPED          /* wrong guess on a tree that can't learn */
+} EngineResult;
+
+typedef struct {
+    EngineState state;
+    EngineResult result;
+    FrameStack path;        /* each question answered so far, root first */
+    NodeId current;         /* question being asked or animal guessed */
+    const SuccinctTree *succinct;   /* read-only tree being played, or NULL
+                                       for g_root; current is then its
+                                       position + 1 */
+    char animal[50];
+    char question[1000];
+    int knownAnimal;        /* leaves that already name animal */
+    int askedQuestion;      /* questions that already ask question */
+} GameSession;
+
+/* Held for anything that changes the tree besides the splice itself:
+ * allocating nodes, parent links and aggregates, the index and the
+ * edit stacks. Frontends that read those from several threads (tree_stats
+ * while others learn) take it too. */
+extern pthread_mutex_t g_learnLock;
+
+/* Wait until no learn is part-way through, then keep the tree still
+ * (readers carry on) until engine_resume */
+void engine_quiesce(void);
+void engine_resume(void);
+
+void engine_init(GameSession *s);
+int engine_start(GameSession *s);
+int engine_start_succinct(GameSession *s, const SuccinctTree *t);
+const char *engine_text(const GameSession *s);
+int engine_prompt(const GameSession *s, char *buf, size_t size);
+int engine_answer(GameSession *s, int yes);
+int engine_submit(GameSession *s, const char *text);
+void engine_free(GameSession *s);
 
 /* ========== Gameplay ========== */
 void play_game();
 
 /* ========== Visualization ========== */
+int build_tree_display(NodeId root);
+void format_display_line(int index, char *buf, size_t size);
+void free_tree_display(void);
 void draw_tree();
 
 #endif
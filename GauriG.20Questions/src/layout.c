@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+extern NodeId g_root;
+extern EditStack g_undo;
+extern EditStack g_redo;
+
+/* ========== Node Layout ========== */
+
+/* A game reads one node per question on its way down. Where those nodes
+ * sit decides how many cache lines the walk touches: in the order they
+ * were learned they are all over the arena, and in BFS order (what
+ * load_tree gives) the levels below the first few are far apart, so
+ * every step is a miss.
+ *
+ * The van Emde Boas layout cuts a subtree of h levels into its top h/2
+ * levels and the subtrees hanging below them, and lays out the top and
+ * then each bottom subtree the same way, one after the other. Whatever a
+ * cache line or page holds, some level of that recursion makes pieces
+ * about its size, and a root-to-leaf walk crosses only O(log_B n) of
+ * them. Learned trees aren't balanced, so each bottom subtree is laid
+ * out for its own height, not the level it was cut at.
+ */
+
+typedef struct {
+	NodeId node;
+	uint32_t depth;
+} Reach;
+
+typedef struct {
+	NodeId *order;      /* nodes in their new order */
+	uint32_t count;
+	NodeId *roots;      /* bottom subtree roots, a list per open level */
+	uint32_t nroots;
+	uint32_t rootCap;
+	Reach *stack;       /* scratch for collect_level */
+	int ok;
+} Layout;
+
+/* collect_level
+ * - Append to roots the nodes exactly depth levels below top, yes sides
+ *   first, found with an explicit stack so a long chain can't overflow
+ *   the call stack
+ */
+static void collect_level(Layout *l, NodeId top, uint32_t depth) {
+	uint32_t size = 0;
+	l->stack[size++] = (Reach){top, 0};
+	while(l->ok && size > 0) {
+		Reach f = l->stack[--size];
+		if(f.depth == depth) {
+			if(l->nroots == l->rootCap) {
+				uint32_t grown = l->rootCap ? l->rootCap * 2 : 1024;
+				NodeId* roots = (NodeId*)realloc(l->roots, grown * sizeof(NodeId));
+				if(roots == NULL) {
+					l->ok = 0;
+					return;
+				}
+				l->roots = roots;
+				l->rootCap = grown;
+			}
+			l->roots[l->nroots++] = f.node;
+			continue;
+		}
+		if(!node_is_question(f.node))
+			continue;
+
+		//no before yes, so yes comes off the stack first
+		l->stack[size++] = (Reach){node_no(f.node), f.depth + 1};
+		l->stack[size++] = (Reach){node_yes(f.node), f.depth + 1};
+	}
+}
+
+/* lay_out_veb
+ * - Put the top levels of root's subtree in veb order: the top half,
+ *   then every subtree hanging below it
+ */
+static void lay_out_veb(Layout *l, NodeId root, uint32_t levels) {
+	if(!l->ok)
+		return;
+	if(levels <= 1 || !node_is_question(root)) {
+		l->order[l->count++] = root;
+		return;
+	}
+
+	uint32_t top = levels / 2;
+	lay_out_veb(l, root, top);
+
+	//this level's roots sit above the ones deeper levels add
+	uint32_t first = l->nroots;
+	collect_level(l, root, top);
+	uint32_t last = l->nroots;
+	for(uint32_t i = first; i < last && l->ok; i++) {
+		NodeId r = l->roots[i];
+		uint32_t h = node_at(r)->height;
+		lay_out_veb(l, r, levels - top < h ? levels - top : h);
+	}
+	l->nroots = first;
+}
+
+/* lay_out_bfs
+ * - Put the whole tree in BFS order, the order's own prefix as the queue
+ */
+static void lay_out_bfs(Layout *l) {
+	l->order[l->count++] = g_root;
+	for(uint32_t head = 0; head < l->count; head++) {
+		NodeId id = l->order[head];
+		if(node_yes(id) != NODE_NIL)
+			l->order[l->count++] = node_yes(id);
+		if(node_no(id) != NODE_NIL)
+			l->order[l->count++] = node_no(id);
+	}
+}
+
+/* tree_relayout
+ * Renumber the tree's nodes so they sit in the arena in layout's order
+ *
+ * Steps:
+ * 1. Refuse while journaling: the log names nodes by id
+ * 2. Work out the new order: every node in the tree once, root first
+ * 3. Copy the nodes into a fresh arena in that order, interning texts as
+ *    they come so each node's text is stored near it too, and map old
+ *    ids to new ones
+ * 4. Point children and parents at the new ids; cached stats and usage
+ *    counters carry over
+ * 5. Swap the arena in like load_tree does: nodes only undo could reach
+ *    are left behind, so the edit stacks are cleared, then g_root and
+ *    g_index follow the new ids
+ * 6. Return 1, or 0 (tree untouched) if out of memory
+ */
+int tree_relayout(TreeLayout layout) {
+	//1. Nothing to do for an empty tree; journal ids must stay put
+	if(g_root == NODE_NIL)
+		return 1;
+	if(journal_active())
+		return 0;
+
+	//2. The new order
+	uint32_t nodes = node_at(g_root)->size;
+	Layout l;
+	memset(&l, 0, sizeof(l));
+	l.ok = 1;
+	l.order = (NodeId*)malloc((size_t)nodes * sizeof(NodeId));
+	//a depth-first walk never holds more than two nodes a level
+	l.stack = (Reach*)malloc(((size_t)node_at(g_root)->height + 1) * 2 * sizeof(Reach));
+	NodeId* newId = (NodeId*)calloc(g_arena.count, sizeof(NodeId));
+	if(l.order == NULL || l.stack == NULL || newId == NULL)
+		l.ok = 0;
+	else if(layout == LAYOUT_VEB)
+		lay_out_veb(&l, g_root, node_at(g_root)->height);
+	else
+		lay_out_bfs(&l);
+
+	//3. Copy into a fresh arena in the new order
+	NodeArena arena;
+	arena_init(&arena);
+	l.ok = l.ok && l.count == nodes && arena_reserve(&arena, nodes);
+	for(uint32_t i = 0; l.ok && i < nodes; i++) {
+		NodeId old = l.order[i];
+		newId[old] = arena_alloc(&arena, node_text(old), node_is_question(old));
+		l.ok = newId[old] != NODE_NIL;
+	}
+
+	//4. Relink, keeping the cached stats and usage
+	for(uint32_t i = 0; l.ok && i < nodes; i++) {
+		NodeId old = l.order[i];
+		const Node* from = node_at(old);
+		Node* to = &arena.nodes[i + 1];
+		arena.links[i + 1].yes |= newId[node_yes(old)];
+		arena.links[i + 1].no = newId[node_no(old)];
+		to->parent = newId[from->parent];
+		to->size = from->size;
+		to->leaves = from->leaves;
+		to->height = from->height;
+		to->plays = from->plays;
+		to->yeses = from->yeses;
+		to->correct = from->correct;
+	}
+
+	free(l.order);
+	free(l.roots);
+	free(l.stack);
+	free(newId);
+	if(!l.ok) {
+		arena_free(&arena);
+		return 0;
+	}
+
+	//5. Replace the old arena, as load_tree does
+	arena_free(&g_arena);
+	g_arena = arena;
+	es_clear(&g_undo);
+	es_clear(&g_redo);
+	g_root = 1;
+	index_rebuild();
+
+	//6. Return 1 on success
+	return 1;
+}
@@ -0,0 +1,262 @@
+/*
+ * loadgen.c - Load generator for the game server
+ *
+ * Usage: ./loadgen [-s socket] [-t threads,...] [-c conns] [-d seconds] [-p percent]
+ *   -s socket   server socket (default animals.sock)
+ *   -t list     client thread counts to run, one phase each (default 1,2,4)
+ *   -c conns    open games per thread, played in turn (default 16)
+ *   -d seconds  length of each phase (default 3)
+ *   -p percent  chance that a guess is wrong and a new animal is taught
+ *               (default 2)
+ *
+ * Every request is timed from send to reply. Each phase prints finished
+ * games per second, replies per second and the p50/p99 reply latency.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Latency histogram: 1 µs buckets, the last one catches everything slower */
+#define LAT_BUCKETS 100000
+
+typedef struct {
+    int fd;
+    char buf[4096];
+    size_t len;             /* bytes buffered */
+    int index;
+    uint64_t taught;        /* animals this connection has taught */
+} Client;
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    unsigned seed;
+    uint64_t games;
+    uint64_t replies;
+    uint32_t *hist;
+    int failed;
+} Loader;
+
+static const char *g_sockPath = "animals.sock";
+static int g_conns = 16;
+static int g_learnPercent = 2;
+static double g_deadline;
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_server(void) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, g_sockPath, sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+/* request
+ * - Send one line and read the one-line reply into out
+ * - Return 0 on any I/O error
+ */
+static int request(Client *c, const char *line, char *out, size_t outSize) {
+	char msg[512];
+	int n = snprintf(msg, sizeof(msg), "%s\n", line);
+	if(n < 0 || n >= (int)sizeof(msg) || write(c->fd, msg, (size_t)n) != n)
+		return 0;
+
+	for(;;) {
+		char* nl = memchr(c->buf, '\n', c->len);
+		if(nl != NULL) {
+			size_t lineLen = (size_t)(nl - c->buf);
+			size_t copy = lineLen < outSize - 1 ? lineLen : outSize - 1;
+			memcpy(out, c->buf, copy);
+			out[copy] = '\0';
+			c->len -= lineLen + 1;
+			memmove(c->buf, nl + 1, c->len);
+			return 1;
+		}
+		if(c->len == sizeof(c->buf))
+			return 0;
+		ssize_t got = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+		if(got <= 0)
+			return 0;
+		c->len += (size_t)got;
+	}
+}
+
+/* next_request
+ * - What a player would send after the server said last
+ */
+static void next_request(Loader *l, Client *c, const char *last, char *line, size_t size) {
+	if(strncmp(last, "QUESTION", 8) == 0)
+		snprintf(line, size, "%s", rand_r(&l->seed) & 1 ? "y" : "n");
+	else if(strncmp(last, "GUESS", 5) == 0)
+		snprintf(line, size, "%s", (int)(rand_r(&l->seed) % 100) < g_learnPercent ? "n" : "y");
+	else if(strcmp(last, "ANIMAL") == 0)
+		snprintf(line, size, "Animal %d.%d.%llu", l->id, c->index, (unsigned long long)c->taught);
+	else if(strcmp(last, "DISTINGUISH") == 0)
+		snprintf(line, size, "Is it animal %d.%d.%llu?", l->id, c->index, (unsigned long long)c->taught++);
+	else if(strcmp(last, "ANSWER") == 0)
+		snprintf(line, size, "y");
+	else
+		snprintf(line, size, "NEW");
+}
+
+static void *loader_main(void *arg) {
+	Loader* l = (Loader*)arg;
+	Client* clients = (Client*)calloc((size_t)g_conns, sizeof(Client));
+	char (*last)[2048] = calloc((size_t)g_conns, sizeof(*last));
+	if(clients == NULL || last == NULL) {
+		l->failed = 1;
+		free(clients);
+		free(last);
+		return NULL;
+	}
+
+	for(int i = 0; i < g_conns; i++) {
+		clients[i].index = i;
+		clients[i].fd = connect_server();
+		if(clients[i].fd < 0)
+			l->failed = 1;
+	}
+
+	//play every open game one reply at a time, round-robin
+	char line[256];
+	while(!l->failed && now_sec() < g_deadline) {
+		for(int i = 0; i < g_conns && !l->failed; i++) {
+			next_request(l, &clients[i], last[i], line, sizeof(line));
+
+			double t0 = now_sec();
+			if(!request(&clients[i], line, last[i], sizeof(last[i]))) {
+				l->failed = 1;
+				break;
+			}
+			double us = (now_sec() - t0) * 1e6;
+			l->hist[us < LAT_BUCKETS - 1 ? (uint32_t)us : LAT_BUCKETS - 1]++;
+			l->replies++;
+
+			if(strncmp(last[i], "DONE", 4) == 0)
+				l->games++;
+			else if(strncmp(last[i], "ERR", 3) == 0)
+				l->failed = 1;
+		}
+	}
+
+	for(int i = 0; i < g_conns; i++)
+		if(clients[i].fd >= 0)
+			close(clients[i].fd);
+	free(clients);
+	free(last);
+	return NULL;
+}
+
+/* percentile
+ * - Smallest bucket (µs) with at least p of the samples at or below it
+ */
+static uint32_t percentile(const uint32_t *hist, uint64_t total, double p) {
+	uint64_t want = (uint64_t)(total * p);
+	uint64_t seen = 0;
+	for(uint32_t i = 0; i < LAT_BUCKETS; i++) {
+		seen += hist[i];
+		if(seen > want)
+			return i;
+	}
+	return LAT_BUCKETS - 1;
+}
+
+/* run_phase
+ * - Run nthreads loaders for the phase length and print one table row
+ */
+static int run_phase(int nthreads, double seconds) {
+	Loader* loaders = (Loader*)calloc((size_t)nthreads, sizeof(Loader));
+	uint32_t* total = (uint32_t*)calloc(LAT_BUCKETS, sizeof(uint32_t));
+	if(loaders == NULL || total == NULL) {
+		free(loaders);
+		free(total);
+		return 0;
+	}
+
+	g_deadline = now_sec() + seconds;
+	double t0 = now_sec();
+	for(int i = 0; i < nthreads; i++) {
+		loaders[i].id = i;
+		loaders[i].seed = (unsigned)(i * 7919 + 1) ^ (unsigned)time(NULL);
+		loaders[i].hist = (uint32_t*)calloc(LAT_BUCKETS, sizeof(uint32_t));
+		pthread_create(&loaders[i].thread, NULL, loader_main, &loaders[i]);
+	}
+
+	uint64_t games = 0, replies = 0;
+	int failed = 0;
+	for(int i = 0; i < nthreads; i++) {
+		pthread_join(loaders[i].thread, NULL);
+		games += loaders[i].games;
+		replies += loaders[i].replies;
+		failed |= loaders[i].failed;
+		for(uint32_t b = 0; b < LAT_BUCKETS; b++)
+			total[b] += loaders[i].hist[b];
+		free(loaders[i].hist);
+	}
+	double t = now_sec() - t0;
+
+	printf("%8d %8d %12llu %12.0f %12.0f %8u %8u\n", nthreads, nthreads * g_conns,
+		(unsigned long long)games, games / t, replies / t,
+		percentile(total, replies, 0.50), percentile(total, replies, 0.99));
+	fflush(stdout);
+
+	free(loaders);
+	free(total);
+	if(failed)
+		fprintf(stderr, "loadgen: a client lost its connection or got ERR\n");
+	return !failed;
+}
+
+int main(int argc, char **argv) {
+	const char* threads = "1,2,4";
+	double seconds = 3;
+
+	int opt;
+	while((opt = getopt(argc, argv, "s:t:c:d:p:")) != -1) {
+		switch(opt) {
+		case 's': g_sockPath = optarg; break;
+		case 't': threads = optarg; break;
+		case 'c': g_conns = atoi(optarg); break;
+		case 'd': seconds = atof(optarg); break;
+		case 'p': g_learnPercent = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-s socket] [-t threads,...] [-c conns] [-d seconds] [-p percent]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(g_conns < 1)
+		g_conns = 1;
+
+	printf("%8s %8s %12s %12s %12s %8s %8s\n", "threads", "games", "finished",
+		"games/sec", "replies/sec", "p50 us", "p99 us");
+
+	int ok = 1;
+	for(const char* p = threads; ok && *p != '\0'; ) {
+		char* end;
+		long n = strtol(p, &end, 10);
+		if(end == p || n < 1)
+			break;
+		ok = run_phase((int)n, seconds);
+		p = *end == ',' ? end + 1 : end;
+	}
+	return ok ? 0 : 1;
+}
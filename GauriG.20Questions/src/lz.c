@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+/* ========== Block Compression ========== */
+
+/* A small LZ77 codec for the packed tree format. A compressed block is a
+ * run of sequences:
+ *   varint literalCount, the literal bytes,
+ *   then, unless the block is complete, varint (matchLength - LZ_MIN_MATCH)
+ *   and varint distance back to copy matchLength bytes from
+ * The last sequence is literals only (possibly none). A match may overlap
+ * the bytes it produces, which is how runs come out. Blocks know nothing
+ * of each other, so they can be decompressed in any order, on any thread.
+ *
+ * Varints are little-endian base 128: seven bits a byte, high bit set on
+ * every byte but the last.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+
+/* put_varint
+ * - Write v at p and return the byte after it (at most 5 bytes)
+ */
+uint8_t *put_varint(uint8_t *p, uint32_t v) {
+	while(v >= 0x80) {
+		*p++ = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+/* get_varint
+ * - Read a varint from *p, which must stay below end, and advance *p
+ * - Return 0 if it runs past end or doesn't fit in 32 bits
+ */
+int get_varint(const uint8_t **p, const uint8_t *end, uint32_t *v) {
+	uint32_t value = 0;
+	for(int shift = 0; shift < 35; shift += 7) {
+		if(*p >= end)
+			return 0;
+		uint8_t b = *(*p)++;
+		if(shift == 28 && b > 0x0f)
+			return 0;
+		value |= (uint32_t)(b & 0x7f) << shift;
+		if(b < 0x80) {
+			*v = value;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static uint32_t lz_hash(const uint8_t *p) {
+	uint32_t x;
+	memcpy(&x, p, sizeof(x));
+	return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* lz_put_sequence
+ * - Append literals [from, to) and, if length > 0, a match; return the new
+ *   end of out, or NULL if it wouldn't fit below limit
+ */
+static uint8_t *lz_put_sequence(uint8_t *out, const uint8_t *limit, const uint8_t *from,
+		const uint8_t *to, uint32_t length, uint32_t distance) {
+	uint32_t literals = (uint32_t)(to - from);
+	if((size_t)(limit - out) < (size_t)literals + 15)
+		return NULL;
+	out = put_varint(out, literals);
+	memcpy(out, from, literals);
+	out += literals;
+	if(length > 0) {
+		out = put_varint(out, length - LZ_MIN_MATCH);
+		out = put_varint(out, distance);
+	}
+	return out;
+}
+
+/* lz_compress
+ * Compress n bytes of in into out, which has room for capacity bytes.
+ * Returns the compressed size, or 0 if it wouldn't fit (the caller then
+ * keeps the block as it is).
+ *
+ * Steps:
+ * 1. Keep, for every hash of 4 bytes, the last position they were seen at
+ * 2. At each position, look up the 4 bytes there. If they were seen
+ *    before, extend the match as far as it goes and emit the literals
+ *    since the last match followed by the match, then carry on after it
+ * 3. Otherwise move one byte on
+ * 4. Finish with the remaining literals
+ */
+size_t lz_compress(const uint8_t *in, size_t n, uint8_t *out, size_t capacity) {
+	//1. Positions are stored + 1 so that 0 means unseen
+	uint32_t* table = (uint32_t*)calloc((size_t)1 << LZ_HASH_BITS, sizeof(uint32_t));
+	if(table == NULL || n > UINT32_MAX) {
+		free(table);
+		return 0;
+	}
+
+	uint8_t* o = out;
+	const uint8_t* limit = out + capacity;
+	size_t anchor = 0, pos = 0;
+	while(n >= LZ_MIN_MATCH && pos <= n - LZ_MIN_MATCH) {
+		//2. Match against the last position with the same hash
+		uint32_t h = lz_hash(in + pos);
+		uint32_t seen = table[h];
+		table[h] = (uint32_t)pos + 1;
+		if(seen == 0 || memcmp(in + seen - 1, in + pos, LZ_MIN_MATCH) != 0) {
+			//3. No match here
+			pos++;
+			continue;
+		}
+
+		size_t from = seen - 1;
+		size_t length = LZ_MIN_MATCH;
+		while(pos + length < n && in[from + length] == in[pos + length])
+			length++;
+		o = lz_put_sequence(o, limit, in + anchor, in + pos, (uint32_t)length, (uint32_t)(pos - from));
+		if(o == NULL) {
+			free(table);
+			return 0;
+		}
+		pos += length;
+		anchor = pos;
+	}
+
+	//4. Trailing literals
+	o = lz_put_sequence(o, limit, in + anchor, in + n, 0, 0);
+	free(table);
+	return o == NULL ? 0 : (size_t)(o - out);
+}
+
+/* lz_decompress
+ * Expand the n compressed bytes at in into exactly rawSize bytes at out.
+ * Returns 1 on success, 0 if the data is damaged: a sequence runs past
+ * either end, a match reaches back before the start, or bytes are left
+ * over.
+ */
+int lz_decompress(const uint8_t *in, size_t n, uint8_t *out, size_t rawSize) {
+	const uint8_t* end = in + n;
+	size_t at = 0;
+	for(;;) {
+		uint32_t literals;
+		if(!get_varint(&in, end, &literals))
+			return 0;
+		if(literals > (size_t)(end - in) || literals > rawSize - at)
+			return 0;
+		memcpy(out + at, in, literals);
+		in += literals;
+		at += literals;
+		if(at == rawSize)
+			return in == end;
+
+		uint32_t length, distance;
+		if(!get_varint(&in, end, &length) || !get_varint(&in, end, &distance))
+			return 0;
+		if(distance == 0 || distance > at || (size_t)length + LZ_MIN_MATCH > rawSize - at)
+			return 0;
+		length += LZ_MIN_MATCH;
+
+		//byte by byte, since the match may overlap what it writes
+		const uint8_t* from = out + at - distance;
+		for(uint32_t i = 0; i < length; i++)
+			out[at + i] = from[i];
+		at += length;
+	}
+}
@@ -11,14 +11,14 @@
 #include "lab5.h"
 
 /* Global root node */
-Node *g_root = NULL;
+NodeId g_root = NODE_NIL;
 
 /* Global undo/redo stacks */
 EditStack g_undo = {NULL, 0, 0};
 EditStack g_redo = {NULL, 0, 0};
 
 /* Global attribute index */
-Hash g_index = {NULL, 0, 0};
+Hash g_index = {NULL, 0, 0, NULL, 0, 0, 0};
 
 /* GUI Colors */
 #define COLOR_HEADER 1
@@ -69,6 +69,7 @@ void display_menu() {
     int row = LINES - 3;
     attron(COLOR_PAIR(COLOR_HEADER));
     mvprintw(row, 2, "[P]lay | [V]iew Tree | [U]ndo | [R]edo | [S]ave | [L]oad | [I]ntegrity | [Q]uit");
+    mvprintw(row + 1, 2, "[J]ournal | [M]etrics | [H]ot Paths");
     attroff(COLOR_PAIR(COLOR_HEADER));
 }
 
@@ -108,19 +109,93 @@ void show_message(const char *msg, int is_error) {
     mvprintw(LINES - 5, 2, "%-76s", "");
 }
 
-void initialize_tree() {
+/* [S]ave writes the portable VERSION 1 file; [J]ournal keeps an image
+ * and a log of every edit since, so nothing learned is lost on a crash */
+#define TREE_FILE "animals.dat"
+#define JOURNAL_FILE "animals.img"
+
+/* Show every metric, then write them all to METRICS_FILE for a scraper */
+#define METRICS_FILE "animals.prom"
+
+void show_metrics() {
+    clear();
+    display_header();
+    draw_box(2, 1, LINES - 6, COLS - 2, "Metrics");
+    
+    int row = 4;
+    for (int i = 0; i < METRIC_COUNT && row < LINES - 6; i++, row++) {
+        MetricId id = (MetricId)i;
+        if (metric_kind(id) != METRIC_HISTOGRAM) {
+            mvprintw(row, 3, "%-30s %.0f", metric_name(id), metric_read(id));
+            continue;
+        }
+        MetricSummary ms;
+        metric_summary(id, &ms);
+        mvprintw(row, 3, "%-30s n=%llu p50=%.3g p90=%.3g p99=%.3g max=%.3g", metric_name(id),
+                 (unsigned long long)ms.count, ms.p50, ms.p90, ms.p99, ms.max);
+    }
+    
+    attron(COLOR_PAIR(COLOR_HEADER));
+    if (metrics_write_file(METRICS_FILE)) {
+        mvprintw(LINES - 3, 2, "Written to %s. Press any key...", METRICS_FILE);
+    } else {
+        mvprintw(LINES - 3, 2, "Couldn't write %s. Press any key...", METRICS_FILE);
+    }
+    attroff(COLOR_PAIR(COLOR_HEADER));
+    refresh();
+    getch();
+}
+
+/* Show the hottest paths and the largest subtrees no game reached, then
+ * write the full report to USAGE_FILE */
+#define USAGE_FILE "animals.usage"
+#define USAGE_TOP 10
+
+void show_usage() {
+    clear();
+    display_header();
+    draw_box(2, 1, LINES - 6, COLS - 2, "Hot Paths");
+    
+    UsageEntry entries[USAGE_TOP];
+    char path[256];
+    int width = COLS - 20 < (int)sizeof(path) ? COLS - 20 : (int)sizeof(path);
+    int row = 4;
+    int hot = usage_hot(g_root, entries, USAGE_TOP);
+    mvprintw(row++, 3, "%u games counted. Most reached:", g_root != NODE_NIL ? node_at(g_root)->plays : 0);
+    for (int i = 0; i < hot && row < LINES - 8; i++, row++) {
+        usage_path(entries[i].node, path, width > 1 ? (size_t)width : 1);
+        mvprintw(row, 3, "%6u %3.0f%%  %s", entries[i].plays, 100.0 * entries[i].correct / entries[i].plays, path);
+    }
+    
+    int dead = usage_dead(g_root, entries, USAGE_TOP);
+    mvprintw(++row, 3, "Never reached: %d subtree(s)", dead > 0 ? dead : 0);
+    row++;
+    for (int i = 0; i < dead && i < USAGE_TOP && row < LINES - 6; i++, row++) {
+        usage_path(entries[i].node, path, width > 1 ? (size_t)width : 1);
+        mvprintw(row, 3, "%6u nodes  %s", entries[i].size, path);
+    }
     
-    if (g_root != NULL) {
-        free_tree(g_root);
+    attron(COLOR_PAIR(COLOR_HEADER));
+    if (usage_write_file(USAGE_FILE, g_root, USAGE_TOP)) {
+        mvprintw(LINES - 3, 2, "Written to %s. Press any key...", USAGE_FILE);
+    } else {
+        mvprintw(LINES - 3, 2, "Couldn't write %s. Press any key...", USAGE_FILE);
     }
+    attroff(COLOR_PAIR(COLOR_HEADER));
+    refresh();
+    getch();
+}
+
+void initialize_tree() {
     
-    Node *water = create_question_node("Does it live in water?");
-    water->yes = create_animal_node("Fish");
-    water->no = create_animal_node("Dog");
+    free_tree();
+    
+    NodeId water = create_question_node("Does it live in water?");
+    node_set_yes(water, create_animal_node("Fish"));
+    node_set_no(water, create_animal_node("Dog"));
     g_root = water;
     
-    h_free(&g_index);
-    h_init(&g_index, 31);
+    index_rebuild();
     
     
 }
@@ -141,6 +216,10 @@ int main() {
     
     initialize_tree();
     
+    /* Set once a tree is loaded with [L]: from then on [J] journals the
+     * tree on screen rather than recovering JOURNAL_FILE over it */
+    int loaded = 0;
+    
     int running = 1;
     while (running) {
         clear();
@@ -148,10 +227,18 @@ int main() {
         draw_box(2, 1, LINES - 6, COLS - 2, "Game Status");
         display_menu();
         
-        mvprintw(4, 3, "Tree nodes: %d", g_root ? count_nodes(g_root) : 0);
+        TreeStats ts;
+        tree_stats(g_root, &ts);
+        mvprintw(4, 3, "Tree nodes: %u (%u animals, %u questions) | Deepest guess: %u questions",
+                 ts.nodes, ts.animals, ts.questions, ts.height ? ts.height - 1 : 0);
         mvprintw(5, 3, "Undo stack: %d | Redo stack: %d", g_undo.size, g_redo.size);
         
-        if (g_root == NULL) {
+        InternStats st;
+        sp_stats(&g_arena.strings, &st);
+        mvprintw(6, 3, "Distinct texts: %u | Bytes saved by interning: %llu",
+                 st.strings, (unsigned long long)st.bytesSaved);
+        
+        if (g_root == NODE_NIL) {
             attron(COLOR_PAIR(COLOR_ERROR));
             mvprintw(7, 3, "Tree not initialized! Implement TODOs 1-2 and uncomment code in main.c");
             attroff(COLOR_PAIR(COLOR_ERROR));
@@ -164,7 +251,7 @@ int main() {
         
         switch (tolower(ch)) {
             case 'p':
-                if (g_root == NULL) {
+                if (g_root == NODE_NIL) {
                     show_message("Error: Tree not initialized! Implement TODOs 1-2 first.", 1);
                 } else {
                     play_game();
@@ -187,23 +274,67 @@ int main() {
                 }
                 break;
             case 's':
-                if (g_root == NULL) {
+                if (g_root == NODE_NIL) {
                     show_message("Error: No tree to save! Initialize tree first.", 1);
-                } else if (save_tree("animals.dat")) {
+                } else if (save_tree(TREE_FILE)) {
                     show_message("Tree saved successfully!", 0);
                 } else {
                     show_message("Error saving tree!", 1);
                 }
                 break;
-            case 'l':
-                if (load_tree("animals.dat")) {
-                    show_message("Tree loaded successfully!", 0);
+            case 'l': {
+                // The journal logs edits to the tree it has, so a loaded
+                // tree ends it. It must be stopped before the load swaps
+                // the arena under its checkpoints; if the load fails, pick
+                // it up again from its image and log, which hold every edit
+                int journaling = journal_active();
+                journal_close();
+                if (open_tree(TREE_FILE)) {
+                    loaded = 1;
+                    show_message(journaling ? "Tree loaded! Journaling stopped, [J] journals this tree."
+                                            : "Tree loaded successfully!", 0);
+                } else if (journaling && !journal_open(JOURNAL_FILE, JOURNAL_COMPACT_BYTES)) {
+                    show_message("Error loading tree! Journaling stopped, edits are not logged.", 1);
                 } else {
                     show_message("Error loading tree!", 1);
                 }
                 break;
+            }
+            case 'j': {
+                // Checkpoint a running journal. Otherwise recover the one at
+                // JOURNAL_FILE, but only while the tree on screen is still
+                // the starter tree: one that was loaded or taught something
+                // this session becomes the journal's new image instead
+                FILE *fp = fopen(JOURNAL_FILE, "rb");
+                int recovering = fp != NULL && !loaded && g_undo.size == 0 && g_redo.size == 0;
+                if (fp != NULL) {
+                    fclose(fp);
+                }
+                if (journal_active()) {
+                    if (journal_checkpoint()) {
+                        show_message("Journal folded into " JOURNAL_FILE "!", 0);
+                    } else {
+                        show_message("Error writing " JOURNAL_FILE "! The log still has every edit.", 1);
+                    }
+                } else if (!recovering && g_root == NODE_NIL) {
+                    show_message("Error: No tree to journal! Initialize tree first.", 1);
+                } else if (recovering ? journal_open(JOURNAL_FILE, JOURNAL_COMPACT_BYTES)
+                                      : journal_create(JOURNAL_FILE, JOURNAL_COMPACT_BYTES)) {
+                    show_message(recovering ? "Recovered " JOURNAL_FILE "; journaling every edit."
+                                               : "Journaling every edit to " JOURNAL_FILE ".", 0);
+                } else {
+                    show_message("Error opening the journal! Edits are not logged.", 1);
+                }
+                break;
+            }
+            case 'm':
+                show_metrics();
+                break;
+            case 'h':
+                show_usage();
+                break;
             case 'i':
-                if (g_root == NULL) {
+                if (g_root == NODE_NIL) {
                     show_message("Error: No tree to check! Initialize tree first.", 1);
                 } else if (check_integrity()) {
                     show_message("Tree integrity check passed!", 0);
@@ -213,28 +344,15 @@ int main() {
                 break;
             case 'q':
                 running = 0;
-		if(g_redo.size != 0){
-    			for (int i = 0; i < g_redo.size; i++) {
-        			Edit *e = &g_redo.edits[i];
-        			switch (e->type) {
-            			case EDIT_INSERT_SPLIT:
-                			// After undo, newQuestion (and its subtree) is detached from g_root.
-                			// Free it so it doesn't leak when quitting without redo.
-                			if (e->newQuestion) {
-                    				free_tree(e->newQuestion);
-                    				e->newQuestion = NULL;
-                			}
-                			e->newLeaf = NULL;   // likely already freed via free_tree(newQuestion)
-                			break;
-        			}
-			}
-		}
+                // Subtrees detached by undo still live in the arena, so the
+                // arena_free below reclaims them along with the tree.
                 break;
         }
     }
     
     endwin();
-    free_tree(g_root);
+    journal_close();
+    arena_free(&g_arena);
     free_edit_stack(&g_undo);
     free_edit_stack(&g_redo);
     h_free(&g_index);
@@ -0,0 +1,260 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lab5.h"
+
+/* ========== Metrics ========== */
+
+/* Every thread records into one of METRIC_SHARDS shards, picked round-
+ * robin the first time it records anything, so server workers don't
+ * fight over a cache line. A shard holds every counter and histogram;
+ * reading sums all of them. Threads beyond METRIC_SHARDS share shards,
+ * which is why recording is still an atomic add, just a rarely
+ * contended one. Gauges are single values: set, not summed.
+ *
+ * Histograms keep a count per log-linear bucket (see metric_bucket) and
+ * the sum of what was observed. Latencies are recorded in nanoseconds
+ * and shown in seconds, so a metric carries the scale its values are
+ * shown at. */
+
+#define METRIC_SHARDS 8
+
+typedef struct {
+	uint64_t buckets[METRIC_HISTOGRAMS][METRIC_BUCKETS];
+	uint64_t sums[METRIC_HISTOGRAMS];
+	uint64_t counters[METRIC_COUNTERS_END - METRIC_HISTOGRAMS];
+} __attribute__((aligned(64))) MetricShard;
+
+typedef struct {
+	const char *name;
+	const char *help;
+	double scale;           /* shown value per recorded unit */
+} MetricDef;
+
+static const MetricDef g_defs[METRIC_COUNT] = {
+	[METRIC_GAME_QUESTIONS] = {"animals_game_questions", "Questions asked in a finished game", 1},
+	[METRIC_ANSWER_SECONDS] = {"animals_answer_seconds", "Time a player took to answer a question", 1e-9},
+	[METRIC_LEARN_SECONDS] = {"animals_learn_seconds", "Time to splice a learned animal into the tree", 1e-9},
+	[METRIC_SAVE_SECONDS] = {"animals_save_seconds", "Time to save the tree", 1e-9},
+	[METRIC_LOAD_SECONDS] = {"animals_load_seconds", "Time to load the tree", 1e-9},
+	[METRIC_INDEX_PROBES] = {"animals_index_probes", "Slots probed by an attribute index lookup", 1},
+	[METRIC_GAMES] = {"animals_games_total", "Games started", 1},
+	[METRIC_GAMES_GUESSED] = {"animals_games_guessed_total", "Games the engine guessed", 1},
+	[METRIC_GAMES_LEARNED] = {"animals_games_learned_total", "Games that taught the tree a new animal", 1},
+	[METRIC_GAMES_REPEATED] = {"animals_games_repeated_total", "Games the player ended by naming the guess", 1},
+	[METRIC_GAMES_STUMPED] = {"animals_games_stumped_total", "Wrong guesses on a tree that can't learn", 1},
+	[METRIC_SAVE_BYTES] = {"animals_save_bytes_total", "Bytes written by saves", 1},
+	[METRIC_LOAD_BYTES] = {"animals_load_bytes_total", "Bytes of tree files loaded", 1},
+	[METRIC_SAVE_ERRORS] = {"animals_save_errors_total", "Saves that failed", 1},
+	[METRIC_LOAD_ERRORS] = {"animals_load_errors_total", "Loads that failed", 1},
+	[METRIC_TREE_NODES] = {"animals_tree_nodes", "Nodes in the tree", 1},
+	[METRIC_CONNECTIONS] = {"animals_connections", "Open server connections", 1},
+};
+
+static MetricShard g_shards[METRIC_SHARDS];
+static int64_t g_gauges[METRIC_COUNT - METRIC_COUNTERS_END];
+static uint32_t g_nextShard = 0;
+static __thread MetricShard *t_shard = NULL;
+
+static MetricShard *my_shard(void) {
+	if(t_shard == NULL)
+		t_shard = &g_shards[__atomic_fetch_add(&g_nextShard, 1, __ATOMIC_RELAXED) % METRIC_SHARDS];
+	return t_shard;
+}
+
+/* metrics_now
+ * - A monotonic timestamp in nanoseconds, for the latency histograms
+ */
+uint64_t metrics_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* metric_bucket
+ * Which histogram bucket value falls in
+ * - Below 2^(SUB_BITS + 1) each value has its own bucket. Above, value's
+ *   top SUB_BITS + 1 bits pick one of 2^SUB_BITS buckets in its power of
+ *   two: shift away the rest and count 2^SUB_BITS buckets per shift
+ */
+uint32_t metric_bucket(uint64_t value) {
+	if(value >= (uint64_t)1 << METRIC_MAX_BITS)
+		return METRIC_BUCKETS - 1;
+	uint32_t top = 63 - (uint32_t)__builtin_clzll(value | 1);
+	uint32_t shift = top > METRIC_SUB_BITS ? top - METRIC_SUB_BITS : 0;
+	return (shift << METRIC_SUB_BITS) + (uint32_t)(value >> shift);
+}
+
+/* metric_bucket_high
+ * - The largest value that lands in bucket
+ */
+uint64_t metric_bucket_high(uint32_t bucket) {
+	uint32_t sub = 1u << METRIC_SUB_BITS;
+	if(bucket < 2 * sub)
+		return bucket;
+	uint32_t shift = bucket / sub - 1;
+	uint64_t top = bucket - (shift << METRIC_SUB_BITS);
+	return ((top + 1) << shift) - 1;
+}
+
+/* metric_add
+ * - Add n to a counter
+ */
+void metric_add(MetricId id, uint64_t n) {
+	__atomic_fetch_add(&my_shard()->counters[id - METRIC_HISTOGRAMS], n, __ATOMIC_RELAXED);
+}
+
+/* metric_observe
+ * - Record one value (ns for the _seconds histograms) in a histogram
+ */
+void metric_observe(MetricId id, uint64_t value) {
+	MetricShard* s = my_shard();
+	__atomic_fetch_add(&s->buckets[id][metric_bucket(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->sums[id], value, __ATOMIC_RELAXED);
+}
+
+/* metric_set / metric_gauge_add
+ * - Set a gauge, or move it by delta
+ */
+void metric_set(MetricId id, int64_t value) {
+	__atomic_store_n(&g_gauges[id - METRIC_COUNTERS_END], value, __ATOMIC_RELAXED);
+}
+
+void metric_gauge_add(MetricId id, int64_t delta) {
+	__atomic_fetch_add(&g_gauges[id - METRIC_COUNTERS_END], delta, __ATOMIC_RELAXED);
+}
+
+/* metric_read
+ * - A counter's total or a gauge's value; a histogram's count
+ */
+double metric_read(MetricId id) {
+	if(metric_kind(id) == METRIC_GAUGE)
+		return (double)__atomic_load_n(&g_gauges[id - METRIC_COUNTERS_END], __ATOMIC_RELAXED) * g_defs[id].scale;
+	uint64_t total = 0;
+	for(int s = 0; s < METRIC_SHARDS; s++) {
+		if(metric_kind(id) == METRIC_COUNTER) {
+			total += __atomic_load_n(&g_shards[s].counters[id - METRIC_HISTOGRAMS], __ATOMIC_RELAXED);
+			continue;
+		}
+		for(uint32_t b = 0; b < METRIC_BUCKETS; b++)
+			total += __atomic_load_n(&g_shards[s].buckets[id][b], __ATOMIC_RELAXED);
+	}
+	return metric_kind(id) == METRIC_COUNTER ? (double)total * g_defs[id].scale : (double)total;
+}
+
+/* merge
+ * - A histogram's buckets summed over the shards into counts; return the
+ *   sum of what was observed
+ */
+static uint64_t merge(MetricId id, uint64_t *counts) {
+	uint64_t sum = 0;
+	memset(counts, 0, METRIC_BUCKETS * sizeof(uint64_t));
+	for(int s = 0; s < METRIC_SHARDS; s++) {
+		for(uint32_t b = 0; b < METRIC_BUCKETS; b++)
+			counts[b] += __atomic_load_n(&g_shards[s].buckets[id][b], __ATOMIC_RELAXED);
+		sum += __atomic_load_n(&g_shards[s].sums[id], __ATOMIC_RELAXED);
+	}
+	return sum;
+}
+
+/* metric_summary
+ * Count, sum and quantiles of a histogram, in the metric's unit
+ * - A quantile is the upper edge of the bucket it falls in, so it reads
+ *   at most one bucket (12.5%) high; max is the last bucket's edge
+ */
+void metric_summary(MetricId id, MetricSummary *out) {
+	memset(out, 0, sizeof(*out));
+	if(metric_kind(id) != METRIC_HISTOGRAM)
+		return;
+	uint64_t counts[METRIC_BUCKETS];
+	uint64_t sum = merge(id, counts);
+	for(uint32_t b = 0; b < METRIC_BUCKETS; b++)
+		out->count += counts[b];
+	double scale = g_defs[id].scale;
+	out->sum = (double)sum * scale;
+
+	double* quantiles[] = {&out->p50, &out->p90, &out->p99};
+	const double wants[] = {0.50, 0.90, 0.99};
+	uint64_t seen = 0;
+	int q = 0;
+	for(uint32_t b = 0; b < METRIC_BUCKETS && out->count > 0; b++) {
+		if(counts[b] == 0)
+			continue;
+		seen += counts[b];
+		double edge = (double)metric_bucket_high(b) * scale;
+		while(q < 3 && (double)seen >= wants[q] * (double)out->count)
+			*quantiles[q++] = edge;
+		out->max = edge;
+	}
+}
+
+MetricKind metric_kind(MetricId id) {
+	return id < METRIC_HISTOGRAMS ? METRIC_HISTOGRAM : id < METRIC_COUNTERS_END ? METRIC_COUNTER : METRIC_GAUGE;
+}
+
+const char *metric_name(MetricId id) {
+	return id < METRIC_COUNT ? g_defs[id].name : "?";
+}
+
+const char *metric_help(MetricId id) {
+	return id < METRIC_COUNT ? g_defs[id].help : "?";
+}
+
+/* metrics_reset
+ * - Zero everything; only while nothing else is recording (tests)
+ */
+void metrics_reset(void) {
+	memset(g_shards, 0, sizeof(g_shards));
+	memset(g_gauges, 0, sizeof(g_gauges));
+}
+
+/* metrics_expose
+ * Write every metric to fp in the Prometheus text exposition format
+ * - Histograms list only the buckets something landed in, cumulative,
+ *   then +Inf, _sum and _count
+ */
+int metrics_expose(FILE *fp) {
+	static const char* types[] = {"histogram", "counter", "gauge"};
+	uint64_t counts[METRIC_BUCKETS];
+	for(int i = 0; i < METRIC_COUNT; i++) {
+		MetricId id = (MetricId)i;
+		const MetricDef* d = &g_defs[id];
+		fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", d->name, d->help, d->name, types[metric_kind(id)]);
+		if(metric_kind(id) != METRIC_HISTOGRAM) {
+			fprintf(fp, "%s %.17g\n", d->name, metric_read(id));
+			continue;
+		}
+		uint64_t sum = merge(id, counts), seen = 0;
+		for(uint32_t b = 0; b < METRIC_BUCKETS; b++) {
+			if(counts[b] == 0)
+				continue;
+			seen += counts[b];
+			fprintf(fp, "%s_bucket{le=\"%.9g\"} %llu\n", d->name, (double)metric_bucket_high(b) * d->scale,
+				(unsigned long long)seen);
+		}
+		fprintf(fp, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.17g\n%s_count %llu\n", d->name,
+			(unsigned long long)seen, d->name, (double)sum * d->scale, d->name, (unsigned long long)seen);
+	}
+	return !ferror(fp);
+}
+
+/* metrics_write_file
+ * - Expose every metric into filename.tmp and rename it over filename,
+ *   so a scraper reading filename never sees half a file
+ */
+int metrics_write_file(const char *filename) {
+	char* temp = suffixed(filename, ".tmp");
+	if(temp == NULL)
+		return 0;
+	FILE* fp = fopen(temp, "w");
+	int ok = fp != NULL && metrics_expose(fp);
+	if(fp != NULL && fclose(fp) != 0)
+		ok = 0;
+	ok = ok && rename(temp, filename) == 0;
+	if(!ok)
+		remove(temp);
+	free(temp);
+	return ok;
+}
@@ -0,0 +1,775 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lab5.h"
+
+/* ========== Page Snapshots ========== */
+
+/* A page snapshot is a page table (the file itself) and one file per page
+ * in "<file>.pages/", named by the FNV-1a hash of its bytes. A page is a
+ * piece of the tree: a page root and the nodes below it down to the next
+ * page roots. A node starts a page if it is the root, if its subtree is a
+ * size class smaller than its parent's (page_size_class), or if its id
+ * hashes to one in PAGE_NODES (so a long chain is cut too). Those rules
+ * only look at the node, its parent and their sizes, so learning an
+ * animal changes the page it lands in and leaves every other page with
+ * the bytes, and the file, it already had.
+ *
+ * Page table: PageTableHeader, then pageCount PageRefs sorted by root.
+ * Page: a node record per node, page root first, in preorder:
+ *   id (4 bytes), isQuestion (1 byte), textLen (4 bytes), text, yes, no
+ *
+ * Node ids are kept. Ids that aren't in the tree (nodes detached by undo)
+ * load as empty placeholders, so the pages cut the same way after a load
+ * and the next save is as cheap as one made before it.
+ *
+ * Once an arena has a snapshot it records the nodes that change
+ * (NodeArena.dirty). save_pages reads only the pages those nodes, or
+ * their parents, sit in; every other page comes straight out of the
+ * page table of the last save or load. */
+#define PAGES_MAGIC 0x41544C35  /* "ATL5", like the other tree files */
+#define PAGES_VERSION 3
+
+/* Longer texts are a corrupt record, as in load_tree */
+#define PAGE_TEXT_MAX 10000
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t root;
+    uint32_t nodeCount;     /* arena slots, NODE_NIL's included */
+    uint32_t pageCount;
+    uint32_t reserved;
+} PageTableHeader;
+
+/* A page as the page table lists it */
+typedef struct {
+    NodeId root;
+    uint32_t nodes;
+    uint64_t hash;
+} PageRef;
+
+/* In memory each page also knows the pages hanging below it:
+ * kids[firstKid .. firstKid + kidCount) */
+typedef struct {
+    PageRef ref;
+    uint32_t firstKid;
+    uint32_t kidCount;
+} PageEntry;
+
+typedef struct {
+    PageEntry *pages;
+    uint32_t count;
+    uint32_t capacity;
+    NodeId *kids;
+    uint32_t kidCount;
+    uint32_t kidCapacity;
+} PageTable;
+
+/* The page table of the last save or load, and whose it is */
+static struct {
+    PageTable table;        /* sorted by root */
+    char *name;
+    uint32_t generation;    /* of the arena it describes */
+    PageStats stats;
+} g_pages;
+
+/* Page bytes are built in a growable buffer */
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    int ok;
+} PageBuf;
+
+static uint64_t fnv1a64(const char *data, size_t len) {
+	uint64_t h = 14695981039346656037ull;
+	for(size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+static void pb_put(PageBuf *b, const void *data, size_t len) {
+	if(b->size + len > b->capacity) {
+		size_t cap = b->capacity ? b->capacity : 4096;
+		while(cap < b->size + len)
+			cap *= 2;
+		char* grown = (char*)realloc(b->data, cap);
+		if(grown == NULL) {
+			b->ok = 0;
+			return;
+		}
+		b->data = grown;
+		b->capacity = cap;
+	}
+	memcpy(b->data + b->size, data, len);
+	b->size += len;
+}
+
+/* grow
+ * - Make room for one more element in a table array; 0 if out of memory
+ */
+static int grow(void **items, uint32_t *capacity, uint32_t count, size_t size) {
+	if(count < *capacity)
+		return 1;
+	uint32_t cap = *capacity ? *capacity * 2 : 64;
+	void* grown = realloc(*items, (size_t)cap * size);
+	if(grown == NULL)
+		return 0;
+	*items = grown;
+	*capacity = cap;
+	return 1;
+}
+
+static int table_add(PageTable *t, PageRef ref) {
+	if(!grow((void**)&t->pages, &t->capacity, t->count, sizeof(PageEntry)))
+		return 0;
+	PageEntry* e = &t->pages[t->count++];
+	e->ref = ref;
+	e->firstKid = t->kidCount;
+	e->kidCount = 0;
+	return 1;
+}
+
+/* table_add_kid
+ * - The page added last has one more page below it
+ */
+static int table_add_kid(PageTable *t, NodeId kid) {
+	if(!grow((void**)&t->kids, &t->kidCapacity, t->kidCount, sizeof(NodeId)))
+		return 0;
+	t->kids[t->kidCount++] = kid;
+	t->pages[t->count - 1].kidCount++;
+	return 1;
+}
+
+static void table_free(PageTable *t) {
+	free(t->pages);
+	free(t->kids);
+	memset(t, 0, sizeof(*t));
+}
+
+static int cmp_entry(const void *a, const void *b) {
+	NodeId x = ((const PageEntry*)a)->ref.root;
+	NodeId y = ((const PageEntry*)b)->ref.root;
+	return x < y ? -1 : x > y;
+}
+
+static int cmp_id(const void *a, const void *b) {
+	NodeId x = *(const NodeId*)a;
+	NodeId y = *(const NodeId*)b;
+	return x < y ? -1 : x > y;
+}
+
+static int cmp_hash(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static const PageEntry *table_find(const PageTable *t, NodeId root) {
+	PageEntry key;
+	key.ref.root = root;
+	return (const PageEntry*)bsearch(&key, t->pages, t->count, sizeof(PageEntry), cmp_entry);
+}
+
+/* page_starts
+ * - Does id, hanging under parent, start a page of its own?
+ */
+static int page_starts(const Node *nodes, NodeId id, NodeId parent) {
+	if(parent == NODE_NIL || (h_mix(id) & (PAGE_NODES - 1)) == 0)
+		return 1;
+	return page_size_class(nodes[id].size) < page_size_class(nodes[parent].size);
+}
+
+/* page_root_of
+ * - The root of the page id is in, following parent links
+ * - A node detached by undo still points at its old parent; the walk is
+ *   bounded in case such links ever lead round in a circle
+ */
+static NodeId page_root_of(const Node *nodes, NodeId id) {
+	for(uint32_t steps = g_arena.count; id != NODE_NIL && id < g_arena.count && steps > 0; steps--) {
+		NodeId parent = nodes[id].parent;
+		if(page_starts(nodes, id, parent))
+			return id;
+		id = parent;
+	}
+	return NODE_NIL;
+}
+
+/* page_name
+ * - Return the malloc'd name of the page file with this hash
+ */
+static char *page_name(const char *dir, uint64_t hash) {
+	char leaf[24];
+	snprintf(leaf, sizeof(leaf), "/%016llx", (unsigned long long)hash);
+	return suffixed(dir, leaf);
+}
+
+/* read_page
+ * Lay the page rooted at root out in b and add it to t, with the roots
+ * of the pages below it as its kids
+ */
+static int read_page(PageTable *t, const NodeLinks *links, const Node *nodes, NodeId root, PageBuf *b,
+		FrameStack *dfs) {
+	b->size = 0;
+	PageRef ref = {root, 0, 0};
+	if(!table_add(t, ref))
+		return 0;
+
+	fs_push(dfs, root, -1);
+	while(!fs_empty(dfs)) {
+		NodeId id = fs_pop(dfs).node;
+		const char* text = g_arena.strings.bytes + nodes[id].text;
+		NodeId yes = links_yes(links[id]);
+		uint8_t isQ = (uint8_t)links_question(links[id]);
+		uint32_t textLen = (uint32_t)strlen(text);
+		pb_put(b, &id, sizeof(NodeId));
+		pb_put(b, &isQ, 1);
+		pb_put(b, &textLen, sizeof(uint32_t));
+		pb_put(b, text, textLen);
+		pb_put(b, &yes, sizeof(NodeId));
+		pb_put(b, &links[id].no, sizeof(NodeId));
+		t->pages[t->count - 1].ref.nodes++;
+
+		//no pushed first, so the yes side comes out first
+		NodeId kids[2] = {links[id].no, yes};
+		for(int i = 0; i < 2; i++) {
+			if(kids[i] == NODE_NIL)
+				continue;
+			if(!page_starts(nodes, kids[i], id))
+				fs_push(dfs, kids[i], -1);
+			else if(!table_add_kid(t, kids[i]))
+				return 0;
+		}
+	}
+	t->pages[t->count - 1].ref.hash = fnv1a64(b->data, b->size);
+	return b->ok;
+}
+
+/* write_page
+ * - Write the page file unless one with its hash is already there
+ * - Return 1 if it was written, 0 if it didn't need to be, -1 on error
+ */
+static int write_page(const char *dir, uint64_t hash, const PageBuf *b) {
+	char* name = page_name(dir, hash);
+	char* tmpName = name != NULL ? suffixed(name, ".tmp") : NULL;
+	int wrote = -1;
+	if(tmpName != NULL && access(name, F_OK) == 0) {
+		wrote = 0;
+	} else if(tmpName != NULL) {
+		int fd = open(tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		int ok = fd >= 0 && write_all(fd, b->data, b->size) && fsync(fd) == 0;
+		if(fd >= 0 && close(fd) != 0)
+			ok = 0;
+		if(ok && rename(tmpName, name) == 0)
+			wrote = 1;
+		else
+			remove(tmpName);
+	}
+	free(name);
+	free(tmpName);
+	return wrote;
+}
+
+/* collect_garbage
+ * - Remove every page file in dir that t doesn't list, and any temp file
+ *   a failed save left behind
+ */
+static void collect_garbage(const char *dir, const PageTable *t) {
+	uint64_t* keep = (uint64_t*)malloc((size_t)(t->count ? t->count : 1) * sizeof(uint64_t));
+	DIR* d = keep != NULL ? opendir(dir) : NULL;
+	if(d == NULL) {
+		free(keep);
+		return;
+	}
+	for(uint32_t i = 0; i < t->count; i++)
+		keep[i] = t->pages[i].ref.hash;
+	qsort(keep, t->count, sizeof(uint64_t), cmp_hash);
+
+	struct dirent* ent;
+	while((ent = readdir(d)) != NULL) {
+		char* end = NULL;
+		uint64_t hash = strtoull(ent->d_name, &end, 16);
+		if(end != ent->d_name + 16 || (*end != '\0' && strcmp(end, ".tmp") != 0))
+			continue;
+		if(*end == '\0' && bsearch(&hash, keep, t->count, sizeof(uint64_t), cmp_hash) != NULL)
+			continue;
+		char* name = page_name(dir, hash);
+		char* victim = name != NULL && *end != '\0' ? suffixed(name, end) : name;
+		if(victim != NULL)
+			unlink(victim);
+		if(victim != name)
+			free(victim);
+		free(name);
+	}
+	closedir(d);
+	free(keep);
+}
+
+/* write_table
+ * - Write t as filename's page table, through a temp file and rename()
+ */
+static int write_table(const char *filename, const PageTable *t, NodeId root, uint64_t *bytes) {
+	char* tmpName = suffixed(filename, ".tmp");
+	if(tmpName == NULL)
+		return 0;
+
+	PageBuf b = {NULL, 0, 0, 1};
+	PageTableHeader hdr = {PAGES_MAGIC, PAGES_VERSION, root, g_arena.count, t->count, 0};
+	pb_put(&b, &hdr, sizeof(hdr));
+	for(uint32_t i = 0; i < t->count; i++)
+		pb_put(&b, &t->pages[i].ref, sizeof(PageRef));
+
+	int fd = b.ok ? open(tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+	int ok = fd >= 0 && write_all(fd, b.data, b.size) && fsync(fd) == 0;
+	if(fd >= 0 && close(fd) != 0)
+		ok = 0;
+	if(ok && rename(tmpName, filename) != 0)
+		ok = 0;
+	if(!ok)
+		remove(tmpName);
+	*bytes = b.size;
+	free(b.data);
+	free(tmpName);
+	return ok;
+}
+
+/* save_pages
+ * Save the tree as a page snapshot, writing only pages that changed
+ *
+ * Steps:
+ * 1. Return 0 if the tree is empty; make "<filename>.pages/"
+ * 2. If the last save or load was of this file and this arena, and the
+ *    arena kept its dirty list, find the pages the dirty nodes are in:
+ *    a changed node changes its own page, and one that started or
+ *    stopped starting a page changes its parent's page too
+ * 3. Walk the pages from the root's. A clean page is copied from the
+ *    old page table; any other page is laid out afresh, and its file is
+ *    written unless a page with the same bytes is already on disk
+ * 4. Sync the directory, then write the page table and rename it into
+ *    place, so the table never names a page that isn't on disk
+ * 5. Remove page files the new table doesn't need
+ * 6. Keep the new table for next time and start a new dirty list
+ * Learning must be held off for the duration (single-threaded, or
+ * engine_quiesce).
+ */
+int save_pages(const char *filename) {
+	//1. Nothing to save without a tree
+	NodeId root = tree_root();
+	if(root == NODE_NIL)
+		return 0;
+	char* dir = suffixed(filename, ".pages");
+	if(dir == NULL || (mkdir(dir, 0755) != 0 && errno != EEXIST)) {
+		free(dir);
+		return 0;
+	}
+
+	//2. The pages that may have changed
+	const NodeLinks* links = arena_links();
+	const Node* nodes = arena_nodes();
+	int incremental = g_pages.name != NULL && strcmp(g_pages.name, filename) == 0
+		&& g_pages.generation == g_arena.generation && g_arena.trackDirty == 1;
+	uint32_t ndirty = 0;
+	NodeId* dirty = NULL;
+	if(incremental) {
+		dirty = (NodeId*)malloc(((size_t)g_arena.dirtyCount * 2 + 1) * sizeof(NodeId));
+		incremental = dirty != NULL;
+	}
+	for(uint32_t i = 0; incremental && i < g_arena.dirtyCount; i++) {
+		NodeId id = g_arena.dirty[i];
+		if(id >= g_arena.count)
+			continue;
+		NodeId mine = page_root_of(nodes, id);
+		NodeId above = page_root_of(nodes, nodes[id].parent);
+		if(mine != NODE_NIL)
+			dirty[ndirty++] = mine;
+		if(above != NODE_NIL)
+			dirty[ndirty++] = above;
+	}
+	if(ndirty > 0)
+		qsort(dirty, ndirty, sizeof(NodeId), cmp_id);
+
+	//3. Walk the pages
+	PageStats stats = {0, 0, 0, 0};
+	PageTable next;
+	memset(&next, 0, sizeof(next));
+	PageBuf b = {NULL, 0, 0, 1};
+	FrameStack todo, dfs;
+	fs_init(&todo);
+	fs_init(&dfs);
+	fs_push(&todo, root, -1);
+	int ok = 1;
+	while(ok && !fs_empty(&todo)) {
+		NodeId id = fs_pop(&todo).node;
+		const PageEntry* old = incremental
+			&& bsearch(&id, dirty, ndirty, sizeof(NodeId), cmp_id) == NULL
+			? table_find(&g_pages.table, id) : NULL;
+		if(old != NULL) {
+			ok = table_add(&next, old->ref);
+			for(uint32_t k = 0; ok && k < old->kidCount; k++)
+				ok = table_add_kid(&next, g_pages.table.kids[old->firstKid + k]);
+		} else {
+			ok = read_page(&next, links, nodes, id, &b, &dfs);
+			int wrote = ok ? write_page(dir, next.pages[next.count - 1].ref.hash, &b) : -1;
+			ok = wrote >= 0;
+			stats.rebuilt++;
+			if(wrote > 0) {
+				stats.written++;
+				stats.bytesWritten += b.size;
+			}
+		}
+		if(!ok)
+			break;
+		const PageEntry* e = &next.pages[next.count - 1];
+		for(uint32_t k = 0; k < e->kidCount; k++)
+			fs_push(&todo, next.kids[e->firstKid + k], -1);
+	}
+	fs_free(&todo);
+	fs_free(&dfs);
+	free(b.data);
+	free(dirty);
+
+	//4. The page table, once every page it names is on disk
+	uint64_t tableBytes = 0;
+	if(ok) {
+		qsort(next.pages, next.count, sizeof(PageEntry), cmp_entry);
+		if(stats.written > 0) {
+			char* any = page_name(dir, next.pages[0].ref.hash);
+			if(any != NULL)
+				sync_dir(any);
+			free(any);
+			sync_dir(dir);
+		}
+		ok = write_table(filename, &next, root, &tableBytes);
+	}
+	if(!ok) {
+		table_free(&next);
+		free(dir);
+		return 0;
+	}
+	sync_dir(filename);
+
+	//5. Pages only the old table needed
+	collect_garbage(dir, &next);
+	free(dir);
+
+	//6. Remember the table
+	char* name = g_pages.name != NULL && strcmp(g_pages.name, filename) == 0
+		? g_pages.name : suffixed(filename, "");
+	if(name != g_pages.name)
+		free(g_pages.name);
+	table_free(&g_pages.table);
+	g_pages.table = next;
+	g_pages.name = name;
+	g_pages.generation = g_arena.generation;
+	stats.pages = next.count;
+	stats.bytesWritten += tableBytes;
+	g_pages.stats = stats;
+	g_arena.dirtyCount = 0;
+	g_arena.trackDirty = name != NULL ? 1 : 0;
+	return 1;
+}
+
+/* read_file
+ * - Slurp name into a malloc'd buffer; NULL if it can't be read
+ */
+static char *read_file(const char *name, size_t *size) {
+	FILE* fp = fopen(name, "rb");
+	if(fp == NULL)
+		return NULL;
+	char* data = NULL;
+	struct stat st;
+	if(fstat(fileno(fp), &st) == 0 && st.st_size > 0) {
+		*size = (size_t)st.st_size;
+		data = (char*)malloc(*size);
+		if(data != NULL && fread(data, 1, *size, fp) != *size) {
+			free(data);
+			data = NULL;
+		}
+	}
+	fclose(fp);
+	return data;
+}
+
+/* fill_page
+ * Fill in the nodes of one page file
+ * - The bytes must hash to the name the table gave it, the first record
+ *   must be its root, and every record must name a slot no other record
+ *   has filled (owner[id] == 0); owner[id] becomes page + 1
+ */
+static int fill_page(NodeArena *a, const PageRef *ref, uint32_t page, const char *data, size_t size,
+		uint32_t *owner, char *text) {
+	if(fnv1a64(data, size) != ref->hash)
+		return 0;
+
+	const size_t fixed = sizeof(NodeId) + 1 + sizeof(uint32_t) + 2 * sizeof(NodeId);
+	size_t at = 0;
+	uint32_t nodes = 0;
+	while(at < size) {
+		NodeId id, yes, no;
+		uint8_t isQ;
+		uint32_t textLen;
+		if(size - at < fixed)
+			return 0;
+		memcpy(&id, data + at, sizeof(NodeId));
+		memcpy(&isQ, data + at + 4, 1);
+		memcpy(&textLen, data + at + 5, sizeof(uint32_t));
+		if(textLen > PAGE_TEXT_MAX || size - at - fixed < textLen)
+			return 0;
+		memcpy(text, data + at + 9, textLen);
+		text[textLen] = '\0';
+		memcpy(&yes, data + at + 9 + textLen, sizeof(NodeId));
+		memcpy(&no, data + at + 13 + textLen, sizeof(NodeId));
+		at += fixed + textLen;
+
+		if(id == NODE_NIL || id >= a->count || owner[id] != 0 || isQ > 1
+			|| yes >= a->count || no >= a->count || (nodes == 0 && id != ref->root))
+			return 0;
+		uint32_t offset = sp_intern(&a->strings, text);
+		if(offset == SP_NONE)
+			return 0;
+		a->nodes[id].text = offset;
+		a->links[id].yes = yes | (isQ ? NODE_QUESTION : 0);
+		a->links[id].no = no;
+		owner[id] = page + 1;
+		nodes++;
+	}
+	return nodes == ref->nodes;
+}
+
+/* load_pages
+ * Load a page snapshot, keeping every node id
+ *
+ * Steps:
+ * 1. Read and validate the page table
+ * 2. Set up an arena of nodeCount empty placeholders (size 0)
+ * 3. Fill in each page's nodes from its file
+ * 4. Link parents and walk the tree from the root: every node a page
+ *    filled in must be reached, and reached once
+ * 5. Fill in the cached subtree stats, children before parents
+ * 6. If the pages are cut where save_pages would cut them now, keep the
+ *    table (with each page's kids) so the next save is incremental
+ * 7. Swap the arena in like load_tree does, and rebuild g_index
+ * On any error the current tree is left untouched and 0 returned.
+ */
+int load_pages(const char *filename) {
+	//1. The page table
+	FILE* fp = fopen(filename, "rb");
+	if(fp == NULL)
+		return 0;
+	PageTableHeader hdr;
+	PageRef* refs = NULL;
+	int ok = fread(&hdr, sizeof(hdr), 1, fp) == 1
+		&& hdr.magic == PAGES_MAGIC && hdr.version == PAGES_VERSION
+		&& hdr.nodeCount >= 2 && hdr.root != NODE_NIL && hdr.root < hdr.nodeCount
+		&& hdr.pageCount >= 1 && hdr.pageCount < hdr.nodeCount;
+	if(ok) {
+		refs = (PageRef*)malloc((size_t)hdr.pageCount * sizeof(PageRef));
+		ok = refs != NULL && fread(refs, sizeof(PageRef), hdr.pageCount, fp) == hdr.pageCount;
+	}
+	fclose(fp);
+
+	//2. Placeholders everywhere
+	NodeArena arena;
+	arena_init(&arena);
+	char* dir = suffixed(filename, ".pages");
+	char* text = (char*)malloc(PAGE_TEXT_MAX + 1);
+	uint32_t* owner = NULL;
+	NodeId* order = NULL;
+	NodeId* pageOf = NULL;
+	ok = ok && dir != NULL && text != NULL && arena_reserve(&arena, hdr.nodeCount - 1);
+	uint32_t empty = ok ? sp_intern(&arena.strings, "") : SP_NONE;
+	ok = ok && empty != SP_NONE;
+	if(ok) {
+		memset(&arena.links[1], 0, (size_t)(hdr.nodeCount - 1) * sizeof(NodeLinks));
+		memset(&arena.nodes[1], 0, (size_t)(hdr.nodeCount - 1) * sizeof(Node));
+		for(uint32_t id = 1; id < hdr.nodeCount; id++)
+			arena.nodes[id].text = empty;
+		arena.count = hdr.nodeCount;
+		owner = (uint32_t*)calloc(hdr.nodeCount, sizeof(uint32_t));
+		ok = owner != NULL;
+	}
+
+	//3. The pages
+	uint32_t filled = 0;
+	for(uint32_t i = 0; ok && i < hdr.pageCount; i++) {
+		char* name = page_name(dir, refs[i].hash);
+		size_t size = 0;
+		char* data = name != NULL ? read_file(name, &size) : NULL;
+		ok = data != NULL && fill_page(&arena, &refs[i], i, data, size, owner, text);
+		filled += refs[i].nodes;
+		free(data);
+		free(name);
+	}
+
+	//4. Parents, then a walk from the root (order doubles as its queue)
+	const NodeLinks* l = arena.links;
+	Node* n = arena.nodes;
+	for(NodeId id = 1; ok && id < hdr.nodeCount; id++) {
+		NodeId kids[2] = {links_yes(l[id]), l[id].no};
+		for(int k = 0; ok && owner[id] != 0 && k < 2; k++) {
+			if(kids[k] == NODE_NIL)
+				continue;
+			ok = owner[kids[k]] != 0 && kids[k] != hdr.root && n[kids[k]].parent == NODE_NIL;
+			n[kids[k]].parent = id;
+		}
+	}
+	uint32_t reached = 0;
+	if(ok) {
+		order = (NodeId*)malloc((size_t)filled * sizeof(NodeId));
+		ok = order != NULL;
+	}
+	if(ok) {
+		order[reached++] = hdr.root;
+		for(uint32_t i = 0; i < reached; i++) {
+			NodeId id = order[i];
+			if(links_yes(l[id]) != NODE_NIL)
+				order[reached++] = links_yes(l[id]);
+			if(l[id].no != NODE_NIL)
+				order[reached++] = l[id].no;
+		}
+		ok = reached == filled;
+	}
+
+	//5. Subtree stats, leaves first
+	for(uint32_t i = reached; ok && i-- > 0; ) {
+		Node* x = &n[order[i]];
+		const Node* y = &n[links_yes(l[order[i]])];
+		const Node* o = &n[l[order[i]].no];
+		x->size = 1 + y->size + o->size;
+		x->leaves = links_question(l[order[i]]) ? y->leaves + o->leaves : 1;
+		x->height = 1 + (y->height > o->height ? y->height : o->height);
+	}
+
+	//6. Check the cuts and note each page's kids
+	PageTable table;
+	memset(&table, 0, sizeof(table));
+	int cutsAgree = ok;
+	if(ok) {
+		pageOf = (NodeId*)calloc(hdr.nodeCount, sizeof(NodeId));
+		cutsAgree = pageOf != NULL;
+	}
+	for(uint32_t i = 0; cutsAgree && i < reached; i++) {
+		NodeId id = order[i];
+		pageOf[id] = page_starts(n, id, n[id].parent) ? id : pageOf[n[id].parent];
+		cutsAgree = pageOf[id] == refs[owner[id] - 1].root;
+	}
+	if(cutsAgree) {
+		table.pages = (PageEntry*)malloc((size_t)hdr.pageCount * sizeof(PageEntry));
+		table.kids = (NodeId*)malloc((size_t)hdr.pageCount * sizeof(NodeId));
+		cutsAgree = table.pages != NULL && table.kids != NULL;
+	}
+	if(cutsAgree) {
+		//a page's kids are the page roots whose parents it holds
+		table.count = table.capacity = hdr.pageCount;
+		table.kidCapacity = hdr.pageCount;
+		for(uint32_t i = 0; i < hdr.pageCount; i++) {
+			table.pages[i].ref = refs[i];
+			table.pages[i].firstKid = 0;
+			table.pages[i].kidCount = 0;
+		}
+		for(uint32_t i = 1; i < reached; i++)
+			if(pageOf[order[i]] == order[i])
+				table.pages[owner[n[order[i]].parent] - 1].kidCount++;
+		for(uint32_t i = 0; i < hdr.pageCount; i++) {
+			table.pages[i].firstKid = table.kidCount;
+			table.kidCount += table.pages[i].kidCount;
+			table.pages[i].kidCount = 0;
+		}
+		for(uint32_t i = 1; i < reached; i++) {
+			if(pageOf[order[i]] != order[i])
+				continue;
+			PageEntry* e = &table.pages[owner[n[order[i]].parent] - 1];
+			table.kids[e->firstKid + e->kidCount++] = order[i];
+		}
+		qsort(table.pages, table.count, sizeof(PageEntry), cmp_entry);
+	}
+
+	free(dir);
+	free(text);
+	free(owner);
+	free(order);
+	free(pageOf);
+	free(refs);
+	if(!ok) {
+		table_free(&table);
+		arena_free(&arena);
+		return 0;
+	}
+
+	//7. Swap the arena in
+	arena_free(&g_arena);
+	g_arena = arena;
+	es_clear(&g_undo);
+	es_clear(&g_redo);
+	tree_set_root(hdr.root);
+	index_rebuild();
+
+	pages_forget();
+	if(cutsAgree) {
+		g_pages.table = table;
+		g_pages.name = suffixed(filename, "");
+		g_pages.generation = g_arena.generation;
+		g_pages.stats.pages = table.count;
+		g_arena.trackDirty = g_pages.name != NULL ? 1 : 0;
+	} else {
+		table_free(&table);
+	}
+	return 1;
+}
+
+/* remove_pages
+ * - Delete a page snapshot: its page table, every file in its page
+ *   directory and the directory itself
+ * - Return 0 if anything was left behind
+ */
+int remove_pages(const char *filename) {
+	char* dir = suffixed(filename, ".pages");
+	if(dir == NULL)
+		return 0;
+	DIR* d = opendir(dir);
+	struct dirent* ent;
+	while(d != NULL && (ent = readdir(d)) != NULL) {
+		if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
+		char* name = suffixed(dir, "/");
+		char* path = name != NULL ? suffixed(name, ent->d_name) : NULL;
+		if(path != NULL)
+			unlink(path);
+		free(name);
+		free(path);
+	}
+	if(d != NULL)
+		closedir(d);
+	int ok = (rmdir(dir) == 0 || errno == ENOENT);
+	ok = (unlink(filename) == 0 || errno == ENOENT) && ok;
+	free(dir);
+	return ok;
+}
+
+/* pages_stats
+ * - What the last save_pages (or load_pages) did
+ */
+void pages_stats(PageStats *out) {
+	*out = g_pages.stats;
+}
+
+/* pages_forget
+ * - Drop the remembered page table; the next save reads every page
+ */
+void pages_forget(void) {
+	table_free(&g_pages.table);
+	free(g_pages.name);
+	g_pages.name = NULL;
+	memset(&g_pages.stats, 0, sizeof(g_pages.stats));
+	g_arena.dirtyCount = 0;
+	g_arena.trackDirty = 0;
+}
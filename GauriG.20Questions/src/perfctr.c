@@ -0,0 +1,148 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "lab5.h"
+
+/* ========== Performance Counters ========== */
+
+/* Each counter is opened on its own rather than as one group: a group is
+ * only counted when the PMU can fit all of it, and five events don't fit
+ * everywhere. The kernel rotates counters that don't fit, so every read
+ * also takes how long the counter was enabled and how long it actually
+ * ran, and the count is scaled up by the ratio.
+ *
+ * Only user space is counted, which perf_event_paranoid up to 2 allows.
+ * Inside most VMs and containers there is no hardware PMU at all; then
+ * nothing opens and the benchmarks report times alone. */
+
+static const char *g_counterNames[PERF_COUNTERS] = {
+	"cycles", "instructions", "llc_misses", "branch_misses", "dtlb_misses"
+};
+
+/* What read gives back with the read_format perf_open asks for: the
+ * count, time enabled and time running, as PerfCounters.mark keeps them */
+typedef uint64_t PerfRead[3];
+
+/* perf_event_config
+ * - Fill in attr's event type and config for counter c
+ */
+static void perf_event_config(PerfCounter c, struct perf_event_attr *attr) {
+	attr->type = PERF_TYPE_HARDWARE;
+	switch(c) {
+	case PERF_CYCLES: attr->config = PERF_COUNT_HW_CPU_CYCLES; break;
+	case PERF_INSTRUCTIONS: attr->config = PERF_COUNT_HW_INSTRUCTIONS; break;
+	case PERF_LLC_MISSES: attr->config = PERF_COUNT_HW_CACHE_MISSES; break;
+	case PERF_BRANCH_MISSES: attr->config = PERF_COUNT_HW_BRANCH_MISSES; break;
+	default:
+		attr->type = PERF_TYPE_HW_CACHE;
+		attr->config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+			| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		break;
+	}
+}
+
+static int perf_read(int fd, PerfRead out) {
+	return read(fd, out, sizeof(PerfRead)) == (ssize_t)sizeof(PerfRead);
+}
+
+/* perf_open
+ * Open every counter this machine will give for this thread
+ *
+ * Steps:
+ * 1. Describe each counter: user space only, stopped until perf_start,
+ *    reads carry the enabled and running times
+ * 2. Open it; a failure just leaves that counter out
+ * 3. Return how many opened, 0 when there are no counters to be had
+ */
+int perf_open(PerfCounters *pc) {
+	int opened = 0;
+	memset(pc->value, 0, sizeof(pc->value));
+	for(int c = 0; c < PERF_COUNTERS; c++) {
+		//1. The event
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		perf_event_config((PerfCounter)c, &attr);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		//2. This thread, any CPU
+		pc->fd[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if(pc->fd[c] < 0)
+			pc->fd[c] = -1;
+		else
+			opened++;
+	}
+
+	//3. How many there are
+	return opened;
+}
+
+/* perf_available
+ * - 1 if counter c opened, so its values mean something
+ */
+int perf_available(const PerfCounters *pc, PerfCounter c) {
+	return pc->fd[c] >= 0;
+}
+
+/* perf_start
+ * - Start counting the region; a counter that can't be read is dropped
+ */
+void perf_start(PerfCounters *pc) {
+	for(int c = 0; c < PERF_COUNTERS; c++) {
+		if(pc->fd[c] < 0)
+			continue;
+		if(!perf_read(pc->fd[c], pc->mark[c])) {
+			close(pc->fd[c]);
+			pc->fd[c] = -1;
+			continue;
+		}
+		ioctl(pc->fd[c], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+/* perf_stop
+ * - Stop counting and put the region's counts in value, scaled up for
+ *   any time the kernel had the counter swapped out
+ */
+void perf_stop(PerfCounters *pc) {
+	for(int c = 0; c < PERF_COUNTERS; c++) {
+		pc->value[c] = 0;
+		if(pc->fd[c] < 0)
+			continue;
+		ioctl(pc->fd[c], PERF_EVENT_IOC_DISABLE, 0);
+		PerfRead now;
+		if(!perf_read(pc->fd[c], now))
+			continue;
+		uint64_t count = now[0] - pc->mark[c][0];
+		uint64_t enabled = now[1] - pc->mark[c][1];
+		uint64_t running = now[2] - pc->mark[c][2];
+		if(running > 0 && running < enabled)
+			count = (uint64_t)((double)count * enabled / running);
+		pc->value[c] = count;
+	}
+}
+
+/* perf_close
+ * - Close every counter; pc can be opened again
+ */
+void perf_close(PerfCounters *pc) {
+	for(int c = 0; c < PERF_COUNTERS; c++) {
+		if(pc->fd[c] >= 0)
+			close(pc->fd[c]);
+		pc->fd[c] = -1;
+	}
+}
+
+/* perf_counter_name
+ * - The counter's name as the benchmarks print it, e.g. "llc_misses"
+ */
+const char *perf_counter_name(PerfCounter c) {
+	return c < PERF_COUNTERS ? g_counterNames[c] : "?";
+}
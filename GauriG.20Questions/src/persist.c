@@ -1,20 +1,136 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "lab5.h"
 
-extern Node *g_root;
+extern NodeId g_root;
 
 #define MAGIC 0x41544C35  /* "ATL5" */
 #define VERSION 1
+#define IMAGE_VERSION 2
+#define PAGES_VERSION 3     /* page snapshot table, see pages.c */
+#define IMAGE_NODES_ALIGN 64
 
+/* Header of a VERSION 2 image. The rest of the file is the arena itself:
+ * nodeCount NodeLinks (children and the question flag), nodeCount
+ * fixed-size Node records (parent is an arena index, text is an offset
+ * into the string blob, cached subtree stats included), then the string
+ * pool's blob of NUL-terminated strings. nodeSize changes whenever Node
+ * does, so an image written with a different record layout is refused
+ * rather than misread. lsn and linksOffset sit in what used to be header
+ * padding, so older images read as lsn 0. */
 typedef struct {
-    Node *node;
-    int id;
-} NodeMapping;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nodeCount;      /* including the reserved NODE_NIL slot */
+    uint32_t root;
+    uint32_t nodeSize;       /* sizeof(Node) when written */
+    uint32_t stringsSize;
+    uint64_t nodesOffset;
+    uint64_t stringsOffset;
+    uint64_t lsn;            /* last journal record folded in; 0 if none */
+    uint64_t linksOffset;
+} ImageHeader;
 
-/* save_tree
+/* A VERSION 1 file ends with the usage section: USAGE_MAGIC, nodeCount,
+ * then a UsageRecord per node in record order. Files from before it end
+ * after the last record and load with every counter at zero; readers from
+ * before it stop at the last record, so they still load newer files. */
+#define USAGE_MAGIC 0x55534735  /* "USG5" */
+
+typedef struct {
+    uint32_t plays;
+    uint32_t yeses;
+    uint32_t correct;
+} UsageRecord;
+
+/* usage_of
+ * - node's usage counters; games may be counting them as we read
+ */
+static UsageRecord usage_of(NodeId node) {
+	const Node* n = node_at(node);
+	UsageRecord u = {__atomic_load_n(&n->plays, __ATOMIC_RELAXED), __atomic_load_n(&n->yeses, __ATOMIC_RELAXED),
+		__atomic_load_n(&n->correct, __ATOMIC_RELAXED)};
+	return u;
+}
+
+/* Writes go through one large buffer that every record is copied into */
+#define WRITE_BUF_SIZE (1u << 20)
+
+typedef struct {
+    FILE *fp;
+    char *buf;
+    size_t used;
+    int ok;       /* cleared by the first failed fwrite */
+} WriteBuf;
+
+/* wb_flush
+ * - Hand whatever is buffered to fwrite in one call
+ */
+static void wb_flush(WriteBuf *w) {
+	if(w->used > 0 && fwrite(w->buf, 1, w->used, w->fp) != w->used)
+		w->ok = 0;
+	w->used = 0;
+}
+
+/* wb_put
+ * - Append len bytes, flushing first if they don't fit
+ * - Anything bigger than the whole buffer is written straight through
+ */
+static void wb_put(WriteBuf *w, const void *data, size_t len) {
+	if(w->used + len > WRITE_BUF_SIZE) {
+		wb_flush(w);
+		if(len > WRITE_BUF_SIZE) {
+			if(fwrite(data, 1, len, w->fp) != len)
+				w->ok = 0;
+			return;
+		}
+	}
+	memcpy(w->buf + w->used, data, len);
+	w->used += len;
+}
+
+/* temp_name
+ * - Return a malloc'd "<filename>.tmp" to write into before rename()
+ */
+static char *temp_name(const char *filename) {
+	size_t nameLen = strlen(filename);
+	char* tmpName = (char*)malloc(nameLen + 5);
+	if(tmpName == NULL)
+		return NULL;
+	memcpy(tmpName, filename, nameLen);
+	memcpy(tmpName + nameLen, ".tmp", 5);
+	return tmpName;
+}
+
+/* persist_metered
+ * - Count one save (or load) of filename that began at t0 and came out
+ *   ok: its time, the file's size, or an error. A load also brings the
+ *   tree size gauge up to date
+ * - Return ok
+ */
+static int persist_metered(int save, const char *filename, uint64_t t0, int ok) {
+	if(!ok) {
+		metric_add(save ? METRIC_SAVE_ERRORS : METRIC_LOAD_ERRORS, 1);
+		return ok;
+	}
+	metric_observe(save ? METRIC_SAVE_SECONDS : METRIC_LOAD_SECONDS, metrics_now() - t0);
+	struct stat st;
+	if(stat(filename, &st) == 0)
+		metric_add(save ? METRIC_SAVE_BYTES : METRIC_LOAD_BYTES, (uint64_t)st.st_size);
+	if(!save)
+		metric_set(METRIC_TREE_NODES, g_root != NODE_NIL ? node_at(g_root)->size : 0);
+	return ok;
+}
+
+/* write_tree
  * Save the tree to a binary file using BFS traversal
  *
  * Binary format:
@@ -25,173 +141,626 @@ typedef struct {
  *   - text (textLen bytes, no null terminator)
  *   - yesId (4 bytes, -1 if NULL)
  *   - noId (4 bytes, -1 if NULL)
+ * - Usage section: USAGE_MAGIC (4 bytes), nodeCount (4 bytes), then for
+ *   each node in the same order plays, yeses, correct (4 bytes each)
+ *
+ * IDs are handed out in the order nodes are enqueued, which is also the
+ * order they are dequeued. So when a node is dequeued its own ID is the
+ * next record number and its children get the next free IDs right there:
+ * every record can be written the moment its node leaves the queue, with
+ * no node-to-ID lookup at all. That keeps the save O(n).
  *
  * Steps:
- * 1. Return 0 if g_root is NULL
- * 2. Open file for writing binary ("wb")
- * 3. Initialize queue and NodeMapping array
- * 4. Use BFS to assign IDs to all nodes:
- *    - Enqueue root with id=0
- *    - Store mapping[0] = {g_root, 0}
- *    - While queue not empty:
- *      - Dequeue node and id
- *      - If node has yes child: add to mappings, enqueue with new id
- *      - If node has no child: add to mappings, enqueue with new id
- * 5. Write header (magic, version, nodeCount)
- * 6. For each node in mapping order:
- *    - Write isQuestion, textLen, text bytes
- *    - Find yes child's id in mappings (or -1)
- *    - Find no child's id in mappings (or -1)
- *    - Write yesId, noId
- * 7. Clean up and return 1 on success
+ * 1. Return 0 if g_root is NODE_NIL
+ * 2. Open "<filename>.tmp" for writing binary ("wb")
+ * 3. Buffer the header with nodeCount = 0 for now
+ * 4. BFS from the root (id 0), nextId = 1:
+ *    - Dequeue node
+ *    - yesId = nextId++ if it has a yes child (and enqueue it), else -1
+ *    - noId = nextId++ if it has a no child (and enqueue it), else -1
+ *    - Buffer isQuestion, textLen, text, yesId, noId
+ *    - Keep its usage counters for the usage section
+ * 5. Buffer the usage section, flush, then seek back and patch
+ *    nodeCount = nextId
+ * 6. Close and rename() the temp file over filename, so a crash mid-save
+ *    never leaves a truncated tree behind
+ * 7. Return 1 on success
  */
-int save_tree(const char *filename) {
-	//1. Return 0 if g_root is NULL
-	if(g_root == NULL)
+static int write_tree(const char *filename) {
+	//1. Return 0 if g_root is NODE_NIL
+	if(g_root == NODE_NIL)
 		return 0;
 
-	//2. Open file for writing binary ("wb")
-	FILE* fp = fopen(filename, "wb");
+	//2. Open the temp file for writing binary ("wb")
+	char* tmpName = temp_name(filename);
+	if(tmpName == NULL)
+		return 0;
+
+	FILE* fp = fopen(tmpName, "wb");
 	if (fp == NULL){
 		printf("There was a problem opening the file\n");
+		free(tmpName);
 		return 0;
 	}
 
-	//3. Initialize queue and NodeMapping array
-	Queue* bfs = (Queue*)malloc(sizeof(Queue));
-	q_init(bfs);
-
-	NodeMapping* mapping = (NodeMapping*)malloc(100*sizeof(NodeMapping));
-	int size = 1;
-	int capacity = 100;
-	int initId = 0;
+	WriteBuf w = {fp, (char*)malloc(WRITE_BUF_SIZE), 0, 1};
+	if(w.buf == NULL) {
+		fclose(fp);
+		remove(tmpName);
+		free(tmpName);
+		return 0;
+	}
 
-	//4. Use BFS to assign IDs to all nodes:
-	// - Enqueue root with id=0
-	q_enqueue(bfs, g_root, initId);
+	//3. Header (magic, version, nodeCount) and all of these 4 bytes each
+	uint32_t magic = (uint32_t)MAGIC;
+	uint32_t version = (uint32_t)VERSION;
+	uint32_t nodeCount = 0;
 
-	// Store mapping[0] = {g_root, 0}
-	mapping[0] = (NodeMapping){g_root, 0};
+	wb_put(&w, &magic, sizeof(uint32_t));
+	wb_put(&w, &version, sizeof(uint32_t));
+	wb_put(&w, &nodeCount, sizeof(uint32_t));
 
-	//While queue not empty:
-	while(q_empty(bfs) == 0) {
+	//4. BFS, writing each record as its node is dequeued
+	TRACE_BEGIN(save_bfs);
+	Queue bfs;
+	q_init(&bfs);
+	q_enqueue(&bfs, g_root, 0);
+	int32_t nextId = 1;
+	uint32_t usageCapacity = node_at(g_root)->size + 1;
+	UsageRecord* usage = (UsageRecord*)malloc(usageCapacity * sizeof(UsageRecord));
+	if(usage == NULL)
+		w.ok = 0;
 
-		//Dequeue node and id
+	while(w.ok && q_empty(&bfs) == 0) {
 		int deId = 0;
-		Node* deNode = NULL;
-		q_dequeue(bfs, &deNode, &deId);
-
-		//If node has yes child: add to mappings, enqueue with new id
-		if(deNode->yes != NULL) {
-			initId++;
-			if(size >= capacity) {
-				capacity *= 2;
-				mapping = (NodeMapping*) realloc(mapping, capacity * sizeof(NodeMapping));
+		NodeId deNode = NODE_NIL;
+		q_dequeue(&bfs, &deNode, &deId);
+
+		// - Its usage goes in the usage section, at its record number
+		if((uint32_t)deId == usageCapacity) {
+			UsageRecord* grown = (UsageRecord*)realloc(usage, 2 * usageCapacity * sizeof(UsageRecord));
+			if(grown == NULL) {
+				w.ok = 0;
+				break;
 			}
-			mapping[size++] = (NodeMapping){deNode->yes, initId};
-			q_enqueue(bfs, deNode->yes, initId);
+			usage = grown;
+			usageCapacity *= 2;
 		}
+		usage[deId] = usage_of(deNode);
 
-		//If node has no child: add to mappings, enqueue with new id
-               if(deNode->no != NULL) {
-			initId++;
-                        if(size >= capacity) {
-                                capacity *= 2;
-                                mapping = (NodeMapping*) realloc(mapping, capacity * sizeof(NodeMapping));
-                        }
-                        mapping[size++] = (NodeMapping){deNode->no, initId};
-                        q_enqueue(bfs, deNode->no, initId);
-               }
+		// - Children get the next free IDs, in yes-then-no order
+		int32_t yesID = -1;
+		if(node_yes(deNode) != NODE_NIL) {
+			yesID = nextId++;
+			q_enqueue(&bfs, node_yes(deNode), yesID);
+		}
+
+		int32_t noID = -1;
+		if(node_no(deNode) != NODE_NIL) {
+			noID = nextId++;
+			q_enqueue(&bfs, node_no(deNode), noID);
+		}
+
+		// - Write isQuestion, textLen, text bytes, yesId, noId
+		const char* text = node_text(deNode);
+		uint8_t isQ = node_is_question(deNode);
+		uint32_t textLen = (uint32_t)strlen(text);
+
+		wb_put(&w, &isQ, 1);
+		wb_put(&w, &textLen, sizeof(uint32_t));
+		wb_put(&w, text, textLen);
+		wb_put(&w, &yesID, sizeof(int32_t));
+		wb_put(&w, &noID, sizeof(int32_t));
 	}
+	q_free(&bfs);
+	TRACE_END(save_bfs);
 
-	//5. Write header (magic, version, nodeCount) and all of these 4 bytes each
-	uint32_t magic = (uint32_t)MAGIC;
-	uint32_t version = (uint32_t)VERSION;
-	uint32_t nodeCount = (uint32_t)size;
+	//5. Usage section, flush and patch the node count into the header
+	TRACE_BEGIN(save_flush);
+	uint32_t usageHeader[2] = {USAGE_MAGIC, (uint32_t)nextId};
+	wb_put(&w, usageHeader, sizeof(usageHeader));
+	if(w.ok)
+		wb_put(&w, usage, (size_t)nextId * sizeof(UsageRecord));
+	free(usage);
+	wb_flush(&w);
+	free(w.buf);
+	nodeCount = (uint32_t)nextId;
+	if(fseek(fp, 2 * sizeof(uint32_t), SEEK_SET) != 0
+		|| fwrite(&nodeCount, sizeof(uint32_t), 1, fp) != 1)
+		w.ok = 0;
 
-	fwrite(&magic, sizeof(uint32_t), 1, fp);
-	fwrite(&version, sizeof(uint32_t), 1, fp);
-	fwrite(&nodeCount, sizeof(uint32_t), 1, fp);
+	//6. Close and atomically replace the old file
+	if(fclose(fp) != 0)
+		w.ok = 0;
+	if(w.ok && rename(tmpName, filename) != 0)
+		w.ok = 0;
+	if(!w.ok)
+		remove(tmpName);
+	free(tmpName);
+	TRACE_END(save_flush);
 
-	//6. For each node in mapping order:
-	for(int i = 0; i < size; i++){
-		Node* writing = mapping[i].node;
+	//7. Return 1 on success
+	return w.ok;
+}
 
-		// - Write isQuestion, textLen, text bytes
-		uint8_t isQ = writing->isQuestion;
-		fwrite(&isQ, 1, 1, fp);
+/* save_tree
+ * - write_tree, timed and counted in the save metrics
+ */
+int save_tree(const char *filename) {
+	uint64_t t0 = metrics_now();
+	TRACE_BEGIN(save_tree);
+	int ok = write_tree(filename);
+	TRACE_END(save_tree);
+	return persist_metered(1, filename, t0, ok);
+}
 
-		uint32_t textLen = (uint32_t)strlen(writing->text);
-		fwrite(&textLen, sizeof(uint32_t), 1, fp);
-		fwrite(writing->text, 1, textLen, fp);
+/* ========== Parallel Save ========== */
 
-		// - Find yes child's id in mappings (or -1)
-		int32_t yesID = -1;
-		if(writing->yes) {
-			for(int j = 0; j < size; j++) {
-				if(mapping[j].node == writing->yes){
-					yesID = mapping[j].id;
-					break;
+/* save_tree_parallel splits the tree into subtrees hanging off one BFS
+ * level and encodes them on worker threads. BFS numbers a whole level
+ * before the next, and within a level the nodes of one subtree come
+ * before the next subtree's, so a node's ID is
+ *   (first ID of its level) + (that level's nodes in earlier subtrees)
+ *   + (its rank within the subtree's level).
+ * Workers write each child ID as the child's rank within its subtree's
+ * level; once every subtree's level sizes are known, the first ID of
+ * each (subtree, level) follows by prefix sums, and a second parallel
+ * pass adds it to the child IDs in place. The file is then the top
+ * levels followed by each level's slices, subtree by subtree: byte for
+ * byte what save_tree writes. */
+
+/* Subtrees per worker, so one big subtree doesn't leave the rest idle */
+#define SUBTREES_PER_THREAD 8
+
+typedef struct {
+    NodeId root;
+    char *buf;              /* records, level by level */
+    size_t size;
+    size_t capacity;
+    size_t *levelAt;        /* levelAt[L]: first byte of level L; [levels] = size */
+    uint32_t *levelCount;   /* nodes on level L */
+    uint32_t *levelId;      /* ID of level L's first node, once planned */
+    uint32_t levels;
+    uint32_t levelCapacity;
+    UsageRecord *usage;     /* usage of each node, in record order */
+    uint32_t nodes;
+    uint32_t usageCapacity;
+    uint32_t usageAt;       /* usage records written out so far */
+    int ok;                 /* cleared if out of memory */
+} Subtree;
+
+typedef struct {
+    Subtree *subtrees;
+    uint32_t count;
+    uint32_t next;          /* next subtree to claim */
+    int rebase;             /* 0: encode, 1: add the planned IDs */
+} SaveJob;
+
+static void st_put(Subtree *st, const void *data, size_t len) {
+	if(st->size + len > st->capacity) {
+		size_t cap = st->capacity ? st->capacity : 4096;
+		while(cap < st->size + len)
+			cap *= 2;
+		char* grown = (char*)realloc(st->buf, cap);
+		if(grown == NULL) {
+			st->ok = 0;
+			return;
+		}
+		st->buf = grown;
+		st->capacity = cap;
+	}
+	memcpy(st->buf + st->size, data, len);
+	st->size += len;
+}
+
+/* st_level
+ * - Start level L at the current end of the buffer
+ */
+static void st_level(Subtree *st, uint32_t L, uint32_t count) {
+	if(L + 1 >= st->levelCapacity) {
+		uint32_t cap = st->levelCapacity ? st->levelCapacity * 2 : 16;
+		size_t* at = (size_t*)realloc(st->levelAt, cap * sizeof(size_t));
+		if(at != NULL)
+			st->levelAt = at;
+		uint32_t* counts = (uint32_t*)realloc(st->levelCount, cap * sizeof(uint32_t));
+		if(counts != NULL)
+			st->levelCount = counts;
+		if(at == NULL || counts == NULL) {
+			st->ok = 0;
+			return;
+		}
+		st->levelCapacity = cap;
+	}
+	st->levelAt[L] = st->size;
+	st->levelCount[L] = count;
+}
+
+/* st_usage
+ * - Note node's usage for the usage section, after the ones before it
+ */
+static void st_usage(Subtree *st, NodeId node) {
+	if(st->nodes == st->usageCapacity) {
+		uint32_t cap = st->usageCapacity ? st->usageCapacity * 2 : 64;
+		UsageRecord* grown = (UsageRecord*)realloc(st->usage, cap * sizeof(UsageRecord));
+		if(grown == NULL) {
+			st->ok = 0;
+			return;
+		}
+		st->usage = grown;
+		st->usageCapacity = cap;
+	}
+	st->usage[st->nodes++] = usage_of(node);
+}
+
+/* put_record
+ * - One VERSION 1 record, as save_tree writes it, and its usage
+ */
+static void put_record(Subtree *st, NodeId node, int32_t yesId, int32_t noId) {
+	const char* text = node_text(node);
+	uint8_t isQ = node_is_question(node);
+	uint32_t textLen = (uint32_t)strlen(text);
+	st_put(st, &isQ, 1);
+	st_put(st, &textLen, sizeof(uint32_t));
+	st_put(st, text, textLen);
+	st_put(st, &yesId, sizeof(int32_t));
+	st_put(st, &noId, sizeof(int32_t));
+	st_usage(st, node);
+}
+
+/* encode_subtree
+ * - BFS over one subtree a level at a time; children get their rank in
+ *   the next level as ID
+ */
+static void encode_subtree(Subtree *st) {
+	TRACE_BEGIN(encode_subtree);
+	Queue bfs;
+	q_init(&bfs);
+	q_enqueue(&bfs, st->root, 0);
+	uint32_t L = 0;
+	while(st->ok && !q_empty(&bfs)) {
+		uint32_t width = (uint32_t)bfs.size;
+		st_level(st, L, width);
+		int32_t rank = 0;
+		for(uint32_t i = 0; i < width; i++) {
+			NodeId node = NODE_NIL;
+			int id = 0;
+			q_dequeue(&bfs, &node, &id);
+			int32_t yesId = -1, noId = -1;
+			if(node_yes(node) != NODE_NIL) {
+				yesId = rank++;
+				q_enqueue(&bfs, node_yes(node), yesId);
+			}
+			if(node_no(node) != NODE_NIL) {
+				noId = rank++;
+				q_enqueue(&bfs, node_no(node), noId);
+			}
+			put_record(st, node, yesId, noId);
+		}
+		L++;
+	}
+	q_free(&bfs);
+	st_level(st, L, 0);
+	st->levels = L;
+	TRACE_END(encode_subtree);
+}
+
+/* rebase_subtree
+ * - Add the first ID of level L + 1 to the child IDs written on level L
+ */
+static void rebase_subtree(Subtree *st) {
+	TRACE_BEGIN(rebase_subtree);
+	for(uint32_t L = 0; L + 1 < st->levels; L++) {
+		int32_t base = (int32_t)st->levelId[L + 1];
+		size_t at = st->levelAt[L];
+		for(uint32_t i = 0; i < st->levelCount[L]; i++) {
+			uint32_t textLen;
+			memcpy(&textLen, st->buf + at + 1, sizeof(uint32_t));
+			at += 1 + sizeof(uint32_t) + textLen;
+			for(int k = 0; k < 2; k++, at += sizeof(int32_t)) {
+				int32_t id;
+				memcpy(&id, st->buf + at, sizeof(int32_t));
+				if(id >= 0) {
+					id += base;
+					memcpy(st->buf + at, &id, sizeof(int32_t));
 				}
 			}
 		}
+	}
+	TRACE_END(rebase_subtree);
+}
 
-		// - Find no child's id in mappings (or -1)
-		int32_t noID = -1;
-		if(writing->no) {
-                        for(int j = 0; j < size; j++) {
-                                if(mapping[j].node == writing->no){
-                                        noID = mapping[j].id;
-					break;
+static void *save_worker(void *arg) {
+	SaveJob* job = (SaveJob*)arg;
+	for(;;) {
+		uint32_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if(i >= job->count)
+			return NULL;
+		if(job->rebase)
+			rebase_subtree(&job->subtrees[i]);
+		else
+			encode_subtree(&job->subtrees[i]);
+	}
+}
+
+/* run_threads
+ * - Run worker(arg) on threads threads, the caller being one of them, and
+ *   wait for all of them; workers claim their own share of the work, so
+ *   fewer threads starting just means each does more
+ */
+static void run_threads(void *(*worker)(void *), void *arg, int threads) {
+	pthread_t* tids = (pthread_t*)malloc((size_t)threads * sizeof(pthread_t));
+	int started = 0;
+	while(tids != NULL && started < threads - 1
+		&& pthread_create(&tids[started], NULL, worker, arg) == 0)
+		started++;
+	worker(arg);
+	for(int i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+}
+
+/* run_workers
+ * - Have threads workers go through every subtree
+ */
+static void run_workers(SaveJob *job, int threads) {
+	job->next = 0;
+	run_threads(save_worker, job, threads);
+}
+
+/* put_levels
+ * - Buffer every level below the top, each as its slices subtree by
+ *   subtree: the records, or with usage set their usage records
+ * - Return 0 if out of memory
+ */
+static int put_levels(WriteBuf *w, SaveJob *job, int usage) {
+	if(job->count == 0)
+		return 1;
+	//subtrees still going at level L, in order
+	Subtree** alive = (Subtree**)malloc(job->count * sizeof(Subtree*));
+	if(alive == NULL)
+		return 0;
+	for(uint32_t i = 0; i < job->count; i++) {
+		alive[i] = &job->subtrees[i];
+		alive[i]->usageAt = 0;
+	}
+	uint32_t live = job->count;
+	for(uint32_t L = 0; live > 0; L++) {
+		uint32_t still = 0;
+		for(uint32_t i = 0; i < live; i++) {
+			Subtree* st = alive[i];
+			if(usage) {
+				wb_put(w, st->usage + st->usageAt, st->levelCount[L] * sizeof(UsageRecord));
+				st->usageAt += st->levelCount[L];
+			} else {
+				wb_put(w, st->buf + st->levelAt[L], st->levelAt[L + 1] - st->levelAt[L]);
+			}
+			if(L + 1 < st->levels)
+				alive[still++] = st;
+		}
+		live = still;
+	}
+	free(alive);
+	return 1;
+}
+
+/* write_tree_parallel
+ * Write the same file as save_tree, encoding on threads threads
+ *
+ * Steps:
+ * 1. threads <= 1 is just save_tree; an empty tree is an error
+ * 2. Encode the top levels here, a level at a time with the same
+ *    numbering as save_tree, until a level is SUBTREES_PER_THREAD nodes
+ *    per thread wide. If the tree runs out first, that was all of it
+ * 3. Workers encode the subtree under each node of that level
+ * 4. Plan IDs: the first ID of every level, then of every subtree's
+ *    share of it, in subtree order
+ * 5. Workers rebase their child IDs
+ * 6. Write header, top levels and then each level's slices to
+ *    "<filename>.tmp", then the usage section in the same order, and
+ *    rename() it over filename, as save_tree does
+ * 7. Return 1 on success
+ */
+static int write_tree_parallel(const char *filename, int threads) {
+	//1. Nothing to split up
+	if(threads <= 1)
+		return write_tree(filename);
+	if(g_root == NODE_NIL)
+		return 0;
+
+	//2. The top levels; level holds the nodes of the level being written
+	Subtree top;
+	memset(&top, 0, sizeof(top));
+	top.ok = 1;
+	uint32_t width = 1, capacity = 16;
+	NodeId* level = (NodeId*)malloc(capacity * sizeof(NodeId));
+	NodeId* below = (NodeId*)malloc(capacity * sizeof(NodeId));
+	if(level == NULL || below == NULL)
+		top.ok = 0;
+	else
+		level[0] = g_root;
+	int32_t nextId = 1;
+	while(top.ok && width > 0 && width < (uint32_t)threads * SUBTREES_PER_THREAD) {
+		uint32_t n = 0;
+		for(uint32_t i = 0; top.ok && i < width; i++) {
+			NodeId kids[2] = {node_yes(level[i]), node_no(level[i])};
+			int32_t ids[2] = {-1, -1};
+			for(int k = 0; k < 2; k++) {
+				if(kids[k] == NODE_NIL)
+					continue;
+				if(n == capacity) {
+					NodeId* a = (NodeId*)realloc(level, capacity * 2 * sizeof(NodeId));
+					NodeId* b = a != NULL ? (NodeId*)realloc(below, capacity * 2 * sizeof(NodeId)) : NULL;
+					if(a != NULL)
+						level = a;
+					if(b == NULL) {
+						top.ok = 0;
+						break;
+					}
+					below = b;
+					capacity *= 2;
 				}
-                        }
-                }
+				below[n++] = kids[k];
+				ids[k] = nextId++;
+			}
+			put_record(&top, level[i], ids[0], ids[1]);
+		}
+		NodeId* swap = level;
+		level = below;
+		below = swap;
+		width = n;
+	}
+	free(below);
 
-		// - Write yesId, noId
-		fwrite(&yesID, sizeof(int32_t), 1, fp);
-		fwrite(&noID, sizeof(int32_t), 1, fp);
+	//3. One subtree per node of the last level reached
+	SaveJob job = {NULL, width, 0, 0};
+	int ok = top.ok;
+	if(ok && width > 0) {
+		job.subtrees = (Subtree*)calloc(width, sizeof(Subtree));
+		ok = job.subtrees != NULL;
+	}
+	for(uint32_t i = 0; ok && i < width; i++) {
+		job.subtrees[i].root = level[i];
+		job.subtrees[i].ok = 1;
+	}
+	free(level);
+	if(ok && width > 0)
+		run_workers(&job, threads);
+	uint32_t depth = 0;
+	for(uint32_t i = 0; ok && i < width; i++) {
+		Subtree* st = &job.subtrees[i];
+		ok = st->ok;
+		if(st->levels > depth)
+			depth = st->levels;
+		if(ok) {
+			st->levelId = (uint32_t*)malloc((st->levels + 1) * sizeof(uint32_t));
+			ok = st->levelId != NULL;
+		}
+	}
 
+	//4. First ID of each level below the top, then of each subtree's part
+	uint32_t* levelId = ok ? (uint32_t*)calloc((size_t)depth + 1, sizeof(uint32_t)) : NULL;
+	ok = ok && levelId != NULL;
+	uint64_t total = (uint64_t)nextId - width;
+	for(uint32_t i = 0; ok && i < width; i++)
+		for(uint32_t L = 0; L < job.subtrees[i].levels; L++)
+			levelId[L] += job.subtrees[i].levelCount[L];
+	for(uint32_t L = 0; ok && L < depth; L++) {
+		uint32_t count = levelId[L];
+		levelId[L] = (uint32_t)total;
+		total += count;
+	}
+	ok = ok && total < INT32_MAX;
+	for(uint32_t i = 0; ok && i < width; i++) {
+		Subtree* st = &job.subtrees[i];
+		for(uint32_t L = 0; L < st->levels; L++) {
+			st->levelId[L] = levelId[L];
+			levelId[L] += st->levelCount[L];
+		}
 	}
+	free(levelId);
 
-	//7. Clean up and return 1 on success
-	free(mapping);
-	q_free(bfs);
-	free(bfs);
-	fclose(fp);
-	return 1;
+	//5. Rebase
+	if(ok && width > 0) {
+		job.rebase = 1;
+		run_workers(&job, threads);
+	}
+
+	//6. Write it all out
+	char* tmpName = ok ? temp_name(filename) : NULL;
+	FILE* fp = tmpName != NULL ? fopen(tmpName, "wb") : NULL;
+	WriteBuf w = {fp, fp != NULL ? (char*)malloc(WRITE_BUF_SIZE) : NULL, 0, 1};
+	ok = w.buf != NULL;
+	uint32_t nodeCount = (uint32_t)(width > 0 ? total : (uint64_t)nextId);
+	if(ok) {
+		uint32_t header[3] = {MAGIC, VERSION, nodeCount};
+		wb_put(&w, header, sizeof(header));
+		wb_put(&w, top.buf, top.size);
+		ok = put_levels(&w, &job, 0);
+	}
+	if(ok) {
+		uint32_t usageHeader[2] = {USAGE_MAGIC, nodeCount};
+		wb_put(&w, usageHeader, sizeof(usageHeader));
+		wb_put(&w, top.usage, top.nodes * sizeof(UsageRecord));
+		ok = put_levels(&w, &job, 1);
+	}
+	wb_flush(&w);
+	free(w.buf);
+	if(fp != NULL && fclose(fp) != 0)
+		ok = 0;
+	ok = ok && w.ok && rename(tmpName, filename) == 0;
+	if(!ok && fp != NULL)
+		remove(tmpName);
+	free(tmpName);
+
+	for(uint32_t i = 0; i < width && job.subtrees != NULL; i++) {
+		free(job.subtrees[i].buf);
+		free(job.subtrees[i].levelAt);
+		free(job.subtrees[i].levelCount);
+		free(job.subtrees[i].levelId);
+		free(job.subtrees[i].usage);
+	}
+	free(job.subtrees);
+	free(top.buf);
+	free(top.usage);
+
+	//7. Return 1 on success
+	return ok;
 }
 
-/* load_tree
+/* save_tree_parallel
+ * - write_tree_parallel, timed and counted in the save metrics
+ */
+int save_tree_parallel(const char *filename, int threads) {
+	uint64_t t0 = metrics_now();
+	TRACE_BEGIN(save_tree_parallel);
+	int ok = write_tree_parallel(filename, threads);
+	TRACE_END(save_tree_parallel);
+	return persist_metered(1, filename, t0, ok);
+}
+
+/* read_tree
  * Load a tree from a binary file and reconstruct the structure
  *
  * Steps:
  * 1. Open file for reading binary ("rb")
  * 2. Read and validate header (magic, version, count)
- * 3. Allocate arrays for nodes and child IDs:
- *    - Node **nodes = calloc(count, sizeof(Node*))
+ * 3. Set up a fresh arena with room for count nodes
+ *    - Records are allocated in file order, so record i becomes arena
+ *      node i + 1 (slot 0 is NODE_NIL)
  *    - int32_t *yesIds = calloc(count, sizeof(int32_t))
  *    - int32_t *noIds = calloc(count, sizeof(int32_t))
  * 4. Read each node:
  *    - Read isQuestion, textLen
  *    - Validate textLen (e.g., < 10000)
- *    - Allocate and read text string (add null terminator!)
+ *    - Read text into a reusable buffer and intern it in the arena's
+ *      string pool (repeated questions/animals share one copy)
  *    - Read yesId, noId
- *    - Validate IDs are in range [-1, count)
- *    - Create Node and store in nodes[i]
- * 5. Link nodes using stored IDs:
+ *    - Validate IDs are -1 or in range (i, count): save_tree numbers
+ *      nodes in BFS order, so a child always comes after its parent
+ *      (this also rules out cycles)
+ * 5. If the file goes on past the records, it is the usage section: check
+ *    its header and give each node its counters. A file that ends there
+ *    is from before usage was saved, and its counters stay zero
+ * 6. Link nodes using stored IDs:
  *    - For each node i:
- *      - If yesIds[i] >= 0: nodes[i]->yes = nodes[yesIds[i]]
- *      - If noIds[i] >= 0: nodes[i]->no = nodes[noIds[i]]
- * 6. Free old g_root if not NULL
- * 7. Set g_root = nodes[0]
- * 8. Clean up temporary arrays
- * 9. Return 1 on success
+ *      - If yesIds[i] >= 0: node i + 1 gets yes child yesIds[i] + 1
+ *      - If noIds[i] >= 0: node i + 1 gets no child noIds[i] + 1
+ *      - Each child's parent is node i + 1; a child that already has
+ *        one is named twice, and the file is refused
+ *    - Fill in the cached subtree stats in one backwards sweep; children
+ *      come after parents, so they are always done first
+ * 7. Swap the new arena into g_arena and free the old one
+ *    - Undo/redo records point into the old arena, so clear them
+ * 8. Set g_root to the first record and rebuild g_index in one pass
+ * 9. Clean up temporary arrays
+ * 10. Return 1 on success
  *
  * Error handling:
-In load_error: free all allocated memory and return 0 * - If any read fails or validation fails, goto load_error
- * - In load_error: free all allocated memory and return 0
+ * - If any read fails or validation fails, goto load_error
+ * - In load_error: free all allocated memory and return 0; the current
+ *   tree is left untouched
  */
-int load_tree(const char *filename) {
+static int read_tree(const char *filename) {
 	//1. Open file for reading binary ("rb")
 	FILE* fp = fopen(filename, "rb");
 	if(fp == NULL)
@@ -202,9 +771,12 @@ int load_tree(const char *filename) {
 	uint32_t version = 0;
 	uint32_t count = 0;
 
-	Node** nodes = NULL;
+	NodeArena arena;
+	arena_init(&arena);
+	char* text = NULL;
         int32_t* yesIds = NULL;
         int32_t* noIds = NULL;
+	UsageRecord* usage = NULL;
 
 	//use goto to get to load_error if problem, otherwise just read and move on
 	if(fread(&magic, sizeof(uint32_t), 1, fp) != 1)
@@ -216,19 +788,23 @@ int load_tree(const char *filename) {
 	if(fread(&count, sizeof(uint32_t), 1, fp) != 1)
 		goto load_error;
 
-	if(magic != MAGIC || version != VERSION || count == 0)
+	if(magic != MAGIC || version != VERSION || count == 0 || count >= UINT32_MAX)
+		goto load_error;
+
+	//3. Set up the arena and the child ID arrays
+	if(!arena_reserve(&arena, count))
 		goto load_error;
 
-	//3. Allocate arrays for nodes and child IDs:
-	nodes = calloc(count, sizeof(Node*));
+	text = (char*)malloc(10001);
 	yesIds = calloc(count, sizeof(int32_t));
 	noIds = calloc(count, sizeof(int32_t));
 
 	//make sure that they were allocated
-	if(!nodes || !yesIds || !noIds)
+	if(!text || !yesIds || !noIds)
 		goto load_error;
 
 	//4. Read each node
+	TRACE_BEGIN(load_decode);
 	uint8_t isQ = 0;
 	uint32_t textLen = 0;
 	for(uint32_t i = 0; i < count; i++){
@@ -243,104 +819,114 @@ int load_tree(const char *filename) {
 		if(textLen > 10000)
 			goto load_error;
 
-	// - Allocate and read text string (add null terminator!)
-		char* text = (char*)malloc(sizeof(char) * (textLen + 1));
-
-		if(text == NULL)
+	// - Read the text string into the reusable buffer
+		if(fread(text, 1, textLen, fp) != textLen)
 			goto load_error;
 
-		if(fread(text, 1, textLen, fp) != textLen){
-			free(text);
-			goto load_error;
-		}
-
 		text[textLen] = '\0';
 
 	// - Read yesId, noId (these are prolly signed)
 		int32_t yesId;
 		int32_t noId;
 
-		if(fread(&yesId, sizeof(int32_t), 1, fp) != 1){
-			free(text);
+		if(fread(&yesId, sizeof(int32_t), 1, fp) != 1)
 			goto load_error;
-		}
 
-		if(fread(&noId, sizeof(int32_t), 1, fp) != 1){
-			free(text);
+		if(fread(&noId, sizeof(int32_t), 1, fp) != 1)
 			goto load_error;
-		}
 
-	// - Validate IDs are in range [-1, count)
-		if(yesId < -1 || yesId  >= (int32_t)count) {
-			free(text);
+	// - Validate IDs are -1 or in range (i, count)
+		if(yesId < -1 || yesId  >= (int32_t)count || (yesId >= 0 && (uint32_t)yesId <= i))
 			goto load_error;
-		}
 
-		if(noId < -1 || noId  >= (int32_t)count) {
-                        free(text);
-                        goto load_error;
-                }
-
-	// - Create Node and store in nodes[i]
-
-		Node* node = (Node*)malloc(sizeof(Node));
-
-		if(node == NULL){
-			free(text);
+		if(noId < -1 || noId  >= (int32_t)count || (noId >= 0 && (uint32_t)noId <= i))
 			goto load_error;
-		}
-
-		node->text = text;
-		node->yes = NULL;
-		node->no = NULL;
 
-		node->isQuestion = isQ ? 1 : 0;
+	// - Allocate the node in the arena (lands at slot i + 1)
+		if(arena_alloc(&arena, text, isQ) == NODE_NIL)
+			goto load_error;
 
-		nodes[i] = node;
 		yesIds[i] = yesId;
 		noIds[i] = noId;
 	}
-	//5. Link nodes using stored IDs:
+	TRACE_END(load_decode);
+
+	//5. Usage counters, if the file has them
+	uint32_t usageHeader[2];
+	size_t got = fread(usageHeader, 1, sizeof(usageHeader), fp);
+	if(got > 0) {
+		if(got != sizeof(usageHeader) || usageHeader[0] != USAGE_MAGIC || usageHeader[1] != count)
+			goto load_error;
+		usage = (UsageRecord*)malloc((size_t)count * sizeof(UsageRecord));
+		if(usage == NULL || fread(usage, sizeof(UsageRecord), count, fp) != count)
+			goto load_error;
+		for(uint32_t i = 0; i < count; i++) {
+			arena.nodes[i + 1].plays = usage[i].plays;
+			arena.nodes[i + 1].yeses = usage[i].yeses;
+			arena.nodes[i + 1].correct = usage[i].correct;
+		}
+	}
+
+	//6. Link nodes using stored IDs:
 	// - For each node i:
+	TRACE_BEGIN(load_link);
 	for(uint32_t i = 0; i < count; i++){
-		// - If yesIds[i] >= 0: nodes[i]->yes = nodes[yesIds[i]]
-		if(yesIds[i] >= 0)
-			nodes[i]->yes = nodes[yesIds[i]];
+		// - If yesIds[i] >= 0: link yes child (record IDs are off by one from arena slots)
+		if(yesIds[i] >= 0){
+			if(arena.nodes[yesIds[i] + 1].parent != NODE_NIL)
+				goto load_error;
+			arena.links[i + 1].yes |= (NodeId)yesIds[i] + 1;
+			arena.nodes[yesIds[i] + 1].parent = i + 1;
+		}
+
+		// - If noIds[i] >= 0: link no child
+		if(noIds[i] >= 0){
+			if(arena.nodes[noIds[i] + 1].parent != NODE_NIL)
+				goto load_error;
+			arena.links[i + 1].no = (NodeId)noIds[i] + 1;
+			arena.nodes[noIds[i] + 1].parent = i + 1;
+		}
+	}
 
-		// - If noIds[i] >= 0: nodes[i]->no = nodes[noIds[i]]
-		if(noIds[i] >= 0)
-			nodes[i]->no = nodes[noIds[i]];
+	// - Cached subtree stats, leaves first
+	for(uint32_t id = count; id >= 1; id--){
+		NodeLinks l = arena.links[id];
+		Node* n = &arena.nodes[id];
+		const Node* y = &arena.nodes[links_yes(l)];
+		const Node* o = &arena.nodes[l.no];
+		n->size = 1 + y->size + o->size;
+		n->leaves = links_question(l) ? y->leaves + o->leaves : 1;
+		n->height = 1 + (y->height > o->height ? y->height : o->height);
 	}
+	TRACE_END(load_link);
+
+	//7. Replace the old arena; the edit stacks pointed into it
+	arena_free(&g_arena);
+	g_arena = arena;
+	es_clear(&g_undo);
+	es_clear(&g_redo);
 
-	//6. Free old g_root if not NULL
-	if(g_root != NULL)
-		free_tree(g_root);
-	//7. Set g_root = nodes[0]
-	g_root = nodes[0];
+	//8. Set g_root to the first record and rebuild the attribute index
+	g_root = 1;
+	index_rebuild();
 
-	//8. Clean up temporary arrays
+	//9. Clean up temporary arrays
+	free(text);
 	free(yesIds);
 	free(noIds);
-	free(nodes);
+	free(usage);
 	fclose(fp);
 
-	//9. Return 1 on success
+	//10. Return 1 on success
 	return 1;
 
 	//In load_error: free all allocated memory and return 0
 	load_error:
-	if(nodes != NULL){
-		for(uint32_t i = 0; i < count; i++) {
-			if(nodes[i] != NULL){
-				free(nodes[i]->text);
-				free(nodes[i]);
-			}
-		}
-	}
-
+	arena_free(&arena);
+	free(text);
 	free(yesIds);
 	free(noIds);
-	free(nodes);
+	free(usage);
 
 	if(fp != NULL)
 		fclose(fp);
@@ -348,4 +934,977 @@ int load_tree(const char *filename) {
 	return 0;
 }
 
+/* load_tree
+ * - read_tree, timed and counted in the load metrics
+ */
+int load_tree(const char *filename) {
+	uint64_t t0 = metrics_now();
+	TRACE_BEGIN(load_tree);
+	int ok = read_tree(filename);
+	TRACE_END(load_tree);
+	return persist_metered(0, filename, t0, ok);
+}
+
+/* ========== Parallel Load ========== */
+
+/* load_tree_parallel reads the same VERSION 1 files as load_tree and
+ * builds the same tree. Records vary in length, so a serial pre-scan
+ * first hops from one textLen to the next to find where each range of
+ * records starts. Record i always becomes arena node i + 1, so workers
+ * then decode disjoint ranges straight into their own slice of the one
+ * node array, each interning its texts into a string pool of its own.
+ * Once every pool's size is known, its place in the arena's slab follows
+ * by prefix sums, and a second parallel pass copies each pool into place,
+ * rebases its nodes' text and links children to parents. A text used in
+ * several ranges is kept once per range.
+ *
+ * save_tree hands out child IDs in BFS order, so they strictly increase
+ * through the file. The loader insists on that: then no node can have two
+ * parents, and no two threads ever link the same child.
+ *
+ * The packed format below is loaded the same way, a block to a range. */
+
+/* Ranges per worker, so a range of long texts doesn't leave the rest idle */
+#define LOAD_RANGES_PER_THREAD 4
+
+#define RECORD_FIXED 13      /* isQuestion, textLen, yesId, noId */
+#define MAX_TEXT_LEN 10000
+
+typedef struct {
+	uint32_t lo, hi;        /* records [lo, hi) */
+	size_t offset;          /* file offset of record lo */
+	const unsigned char *packed;    /* packed format: the block's bytes */
+	uint32_t packedSize;
+	uint32_t rawSize;
+	uint32_t hash;
+	NodeId nextChild;       /* packed format: ID of the range's first child */
+	StringPool strings;     /* this range's texts; offsets are local */
+	uint32_t base;          /* offset of strings in the arena's slab */
+	NodeId firstChild;      /* first and last child linked; NODE_NIL if none */
+	NodeId lastChild;
+	int ok;                 /* set once the range decoded cleanly */
+} LoadRange;
+
+typedef struct {
+	const unsigned char *data;  /* the whole file */
+	uint32_t count;
+	NodeLinks *links;
+	Node *nodes;
+	char *slab;             /* the arena's slab, for the link pass */
+	LoadRange *ranges;
+	uint32_t nranges;
+	uint32_t next;          /* next range to claim */
+	int packed;             /* ranges are packed blocks, not VERSION 1 records */
+	int link;               /* 0: decode, 1: link */
+	const unsigned char *usage; /* the usage section's records, or NULL */
+} LoadJob;
+
+/* claim_child
+ * - Note that the range links child, which must come after the last one
+ *   it linked; 0 if it doesn't
+ */
+static int claim_child(LoadRange *r, NodeId child) {
+	if(child <= r->lastChild)
+		return 0;
+	if(r->firstChild == NODE_NIL)
+		r->firstChild = child;
+	r->lastChild = child;
+	return 1;
+}
+
+/* decode_records
+ * - Fill in text, question flag and children of every node in the range;
+ *   the pre-scan already made sure each record fits in the file
+ * - Child IDs are checked as load_tree checks them, and must also keep
+ *   increasing
+ */
+static void decode_records(LoadJob *job, LoadRange *r) {
+	const unsigned char* p = job->data + r->offset;
+	char text[MAX_TEXT_LEN + 1];
+	for(uint32_t i = r->lo; i < r->hi; i++) {
+		uint32_t textLen;
+		int32_t ids[2];
+		memcpy(&textLen, p + 1, sizeof(uint32_t));
+		memcpy(text, p + 5, textLen);
+		text[textLen] = '\0';
+		memcpy(ids, p + 5 + textLen, sizeof(ids));
+
+		uint32_t offset = sp_intern(&r->strings, text);
+		if(offset == SP_NONE)
+			return;
+
+		Node* n = &job->nodes[i + 1];
+		n->text = offset;
+		n->parent = NODE_NIL;
+		NodeId children[2];
+		for(int c = 0; c < 2; c++) {
+			int32_t id = ids[c];
+			children[c] = NODE_NIL;
+			if(id < -1 || id >= (int32_t)job->count || (id >= 0 && (uint32_t)id <= i))
+				return;
+			if(id >= 0 && !claim_child(r, (NodeId)id + 1))
+				return;
+			if(id >= 0)
+				children[c] = (NodeId)id + 1;
+		}
+		job->links[i + 1].yes = children[0] | (p[0] ? NODE_QUESTION : 0);
+		job->links[i + 1].no = children[1];
+		p += RECORD_FIXED + textLen;
+	}
+	r->ok = 1;
+}
+
+static void decode_block(LoadJob *job, LoadRange *r);
+
+static void decode_range(LoadJob *job, LoadRange *r) {
+	TRACE_BEGIN(decode_range);
+	if(job->packed)
+		decode_block(job, r);
+	else
+		decode_records(job, r);
+	TRACE_END(decode_range);
+}
+
+/* link_range
+ * - Copy the range's strings to their place in the slab, rebase its
+ *   nodes' text onto it and point each child back at its parent
+ * - Give its nodes their usage counters, zero if the file has none
+ */
+static void link_range(LoadJob *job, LoadRange *r) {
+	TRACE_BEGIN(link_range);
+	if(r->strings.size > 0)
+		memcpy(job->slab + r->base, r->strings.bytes, r->strings.size);
+	for(uint32_t id = r->lo + 1; id <= r->hi; id++) {
+		NodeLinks l = job->links[id];
+		Node* n = &job->nodes[id];
+		n->text += r->base;
+		UsageRecord u = {0, 0, 0};
+		if(job->usage != NULL)
+			memcpy(&u, job->usage + (size_t)(id - 1) * sizeof(UsageRecord), sizeof(UsageRecord));
+		n->plays = u.plays;
+		n->yeses = u.yeses;
+		n->correct = u.correct;
+		if(links_yes(l) != NODE_NIL)
+			job->nodes[links_yes(l)].parent = id;
+		if(l.no != NODE_NIL)
+			job->nodes[l.no].parent = id;
+	}
+	TRACE_END(link_range);
+}
+
+static void *load_worker(void *arg) {
+	LoadJob* job = (LoadJob*)arg;
+	for(;;) {
+		uint32_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if(i >= job->nranges)
+			return NULL;
+		if(job->link)
+			link_range(job, &job->ranges[i]);
+		else
+			decode_range(job, &job->ranges[i]);
+	}
+}
+
+/* map_file
+ * - Map all of filename read-only; NULL if it can't be, or is shorter
+ *   than least bytes
+ */
+static const unsigned char *map_file(const char *filename, size_t least, size_t *size) {
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+	struct stat st;
+	void* map = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && st.st_size > 0 && (size_t)st.st_size >= least)
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return NULL;
+	*size = (size_t)st.st_size;
+	return (const unsigned char*)map;
+}
+
+/* load_ranges
+ * Build the tree from ranges that cover job->count nodes and put it in
+ * place of the current one
+ *
+ * Steps:
+ * 1. Workers decode the ranges into a fresh arena's node array
+ * 2. Check every range decoded, and that child IDs keep increasing from
+ *    one range to the next
+ * 3. Place each range's strings in the slab by prefix sums; workers copy
+ *    them in, rebase text offsets, link parents and fill in the usage
+ *    counters (job->usage, or zero)
+ * 4. Fill in the cached subtree stats in one backwards sweep
+ * 5. Swap the arena in, clear the edit stacks, set g_root and rebuild
+ *    g_index, exactly as load_tree does
+ * 6. Free the ranges' pools either way; return 1 on success, 0 with the
+ *    current tree untouched otherwise
+ */
+static int load_ranges(LoadJob *job, int threads) {
+	NodeArena arena;
+	arena_init(&arena);
+	int ok = 0;
+
+	//1. Decode
+	if(!arena_reserve(&arena, job->count))
+		goto done;
+	job->links = arena.links;
+	job->nodes = arena.nodes;
+	job->link = 0;
+	job->next = 0;
+	run_threads(load_worker, job, threads);
+
+	//2. Every range decoded, child IDs increasing across ranges
+	NodeId lastChild = NODE_NIL;
+	for(uint32_t r = 0; r < job->nranges; r++) {
+		LoadRange* range = &job->ranges[r];
+		if(!range->ok)
+			goto done;
+		if(range->firstChild == NODE_NIL)
+			continue;
+		if(range->firstChild <= lastChild)
+			goto done;
+		lastChild = range->lastChild;
+	}
+
+	//3. Strings placed by prefix sums, then link
+	uint64_t total = 0, requested = 0;
+	for(uint32_t r = 0; r < job->nranges; r++) {
+		job->ranges[r].base = (uint32_t)total;
+		total += job->ranges[r].strings.size;
+		requested += job->ranges[r].strings.requested;
+		if(total > UINT32_MAX)
+			goto done;
+	}
+	if(!sp_reserve(&arena.strings, (uint32_t)total))
+		goto done;
+	job->slab = arena.strings.bytes;
+	job->link = 1;
+	job->next = 0;
+	run_threads(load_worker, job, threads);
+	sp_extend(&arena.strings, (uint32_t)total, requested);
+	arena.count = job->count + 1;
+
+	//4. Cached subtree stats, leaves first
+	TRACE_BEGIN(load_stats);
+	for(uint32_t id = job->count; id >= 1; id--) {
+		NodeLinks l = arena.links[id];
+		Node* n = &arena.nodes[id];
+		const Node* y = &arena.nodes[links_yes(l)];
+		const Node* o = &arena.nodes[l.no];
+		n->size = 1 + y->size + o->size;
+		n->leaves = links_question(l) ? y->leaves + o->leaves : 1;
+		n->height = 1 + (y->height > o->height ? y->height : o->height);
+	}
+	TRACE_END(load_stats);
+
+	//5. Replace the old arena, as load_tree does
+	arena_free(&g_arena);
+	g_arena = arena;
+	es_clear(&g_undo);
+	es_clear(&g_redo);
+	g_root = 1;
+	index_rebuild();
+	ok = 1;
+
+	//6. The ranges' own pools are done with either way
+	done:
+	if(!ok)
+		arena_free(&arena);
+	for(uint32_t r = 0; r < job->nranges; r++)
+		sp_free(&job->ranges[r].strings);
+	return ok;
+}
+
+/* read_tree_parallel
+ * Load a file written by save_tree, decoding on threads threads
+ *
+ * Steps:
+ * 1. threads <= 1 is just load_tree
+ * 2. Map the file and validate the header as load_tree does
+ * 3. Split the records into ranges and pre-scan them: check every record
+ *    fits in the file and note the offset each range starts at. Whatever
+ *    follows the records must be a whole usage section, as load_tree
+ *    checks it
+ * 4. Decode, link and swap in the ranges (load_ranges)
+ * 5. Return 1 on success; on failure the current tree is left untouched
+ */
+static int read_tree_parallel(const char *filename, int threads) {
+	//1. Nothing to split up
+	if(threads <= 1)
+		return read_tree(filename);
+
+	//2. Map the file and check the header
+	size_t size = 0;
+	const unsigned char* data = map_file(filename, 3 * sizeof(uint32_t), &size);
+	if(data == NULL)
+		return 0;
+
+	LoadJob job;
+	memset(&job, 0, sizeof(job));
+	job.data = data;
+	uint32_t header[3];
+	memcpy(header, data, sizeof(header));
+	job.count = header[2];
+	int ok = 0;
+	if(header[0] != MAGIC || header[1] != VERSION || job.count == 0 || job.count >= UINT32_MAX)
+		goto done;
+
+	//3. Ranges and their offsets
+	job.nranges = (uint32_t)threads * LOAD_RANGES_PER_THREAD;
+	if(job.nranges > job.count)
+		job.nranges = job.count;
+	job.ranges = (LoadRange*)calloc(job.nranges, sizeof(LoadRange));
+	if(job.ranges == NULL)
+		goto done;
+	for(uint32_t r = 0; r < job.nranges; r++) {
+		job.ranges[r].lo = (uint32_t)((uint64_t)job.count * r / job.nranges);
+		job.ranges[r].hi = (uint32_t)((uint64_t)job.count * (r + 1) / job.nranges);
+		sp_init(&job.ranges[r].strings);
+	}
+
+	size_t at = 3 * sizeof(uint32_t);
+	uint32_t next = 0;
+	for(uint32_t i = 0; i < job.count; i++) {
+		if(next < job.nranges && job.ranges[next].lo == i)
+			job.ranges[next++].offset = at;
+		uint32_t textLen;
+		if(size - at < RECORD_FIXED)
+			goto done;
+		memcpy(&textLen, data + at + 1, sizeof(uint32_t));
+		if(textLen > MAX_TEXT_LEN || size - at - RECORD_FIXED < textLen)
+			goto done;
+		at += RECORD_FIXED + textLen;
+	}
+	if(size > at) {
+		uint32_t usageHeader[2];
+		if(size - at < sizeof(usageHeader))
+			goto done;
+		memcpy(usageHeader, data + at, sizeof(usageHeader));
+		at += sizeof(usageHeader);
+		if(usageHeader[0] != USAGE_MAGIC || usageHeader[1] != job.count
+			|| (size - at) / sizeof(UsageRecord) < job.count)
+			goto done;
+		job.usage = data + at;
+	}
+
+	//4. Decode, link, swap in
+	ok = load_ranges(&job, threads);
+
+	//5. Return 1 on success
+	done:
+	free(job.ranges);
+	munmap((void*)data, size);
+	return ok;
+}
+
+/* load_tree_parallel
+ * - read_tree_parallel, timed and counted in the load metrics
+ */
+int load_tree_parallel(const char *filename, int threads) {
+	uint64_t t0 = metrics_now();
+	TRACE_BEGIN(load_tree_parallel);
+	int ok = read_tree_parallel(filename, threads);
+	TRACE_END(load_tree_parallel);
+	return persist_metered(0, filename, t0, ok);
+}
 
+/* ========== Packed Format ========== */
+
+/* A VERSION 4 file holds the same BFS records as VERSION 1, smaller:
+ *   flags (1 byte: isQuestion, has yes child << 1, has no child << 2),
+ *   varint textLen, text
+ * Child IDs aren't stored at all. BFS hands them out in order, so a
+ * node's children are simply the next IDs not yet given out. The records
+ * are cut into blocks of about PACK_BLOCK_BYTES, and each block is
+ * compressed on its own with the LZ codec in lz.c (question texts repeat
+ * a lot) or, if that doesn't make it smaller, kept as it is.
+ *
+ * Layout: PackedHeader, blockCount PackedEntry, then the blocks back to
+ * back. An entry says where its block's children start numbering, so
+ * every block decodes without the ones before it, and the loader hands
+ * blocks to threads like load_tree_parallel's ranges. It also carries a
+ * hash of the block's records, so damage that would still decode (say,
+ * inside a text) is caught too. */
+
+#define PACKED_VERSION 4
+#define PACK_BLOCK_BYTES (256u << 10)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nodeCount;
+	uint32_t blockCount;
+} PackedHeader;
+
+typedef struct {
+	uint32_t nodes;         /* records in the block */
+	uint32_t firstChild;    /* ID the block's first child gets (IDs from 1) */
+	uint32_t rawSize;       /* bytes of records */
+	uint32_t packedSize;    /* bytes on disk; rawSize if stored as is */
+	uint32_t hash;          /* fnv1a of the records */
+} PackedEntry;
+
+typedef struct {
+	PackedEntry entry;
+	uint8_t *raw;
+	size_t capacity;
+	uint8_t *packed;        /* NULL if stored as is */
+} PackBlock;
+
+typedef struct {
+	PackBlock *blocks;
+	uint32_t count;
+	uint32_t next;          /* next block to claim */
+} PackJob;
+
+/* decode_block
+ * - Expand the block if it was compressed and check its hash, then fill
+ *   in its nodes like decode_records; children take the next IDs from
+ *   entry.firstChild on, and must come after their parent and inside
+ *   the tree
+ */
+static void decode_block(LoadJob *job, LoadRange *r) {
+	uint8_t* raw = NULL;
+	const uint8_t* p = r->packed;
+	if(r->packedSize != r->rawSize) {
+		raw = (uint8_t*)malloc(r->rawSize);
+		if(raw == NULL || !lz_decompress(r->packed, r->packedSize, raw, r->rawSize)) {
+			free(raw);
+			return;
+		}
+		p = raw;
+	}
+	if(fnv1a((const char*)p, r->rawSize) != r->hash) {
+		free(raw);
+		return;
+	}
+
+	const uint8_t* end = p + r->rawSize;
+	char text[MAX_TEXT_LEN + 1];
+	NodeId next = r->nextChild;
+	uint32_t i;
+	for(i = r->lo; i < r->hi; i++) {
+		uint32_t textLen;
+		if(p >= end || (*p & ~7u) != 0)
+			break;
+		uint8_t flags = *p++;
+		if(!get_varint(&p, end, &textLen) || textLen > MAX_TEXT_LEN || textLen > (size_t)(end - p))
+			break;
+		memcpy(text, p, textLen);
+		text[textLen] = '\0';
+		p += textLen;
+
+		uint32_t offset = sp_intern(&r->strings, text);
+		if(offset == SP_NONE)
+			break;
+
+		Node* n = &job->nodes[i + 1];
+		n->text = offset;
+		n->parent = NODE_NIL;
+		NodeId children[2] = {NODE_NIL, NODE_NIL};
+		for(int c = 0; c < 2; c++) {
+			if(!(flags & (2u << c)))
+				continue;
+			if(next <= i + 1 || next > job->count || !claim_child(r, next))
+				break;
+			children[c] = next++;
+		}
+		//a child that failed its checks was left out, which shows here
+		if(((flags >> 1) & 1) != (children[0] != NODE_NIL) || ((flags >> 2) & 1) != (children[1] != NODE_NIL))
+			break;
+		job->links[i + 1].yes = children[0] | (flags & 1 ? NODE_QUESTION : 0);
+		job->links[i + 1].no = children[1];
+	}
+	r->ok = i == r->hi && p == end;
+	free(raw);
+}
+
+/* pack_worker
+ * - Compress blocks until there are none left; a block that doesn't get
+ *   smaller is kept as it is
+ */
+static void *pack_worker(void *arg) {
+	PackJob* job = (PackJob*)arg;
+	for(;;) {
+		uint32_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if(i >= job->count)
+			return NULL;
+		TRACE_BEGIN(pack_block);
+		PackBlock* b = &job->blocks[i];
+		b->entry.hash = fnv1a((const char*)b->raw, b->entry.rawSize);
+		b->entry.packedSize = b->entry.rawSize;
+		b->packed = (uint8_t*)malloc(b->entry.rawSize);
+		size_t packed = 0;
+		if(b->packed != NULL)
+			packed = lz_compress(b->raw, b->entry.rawSize, b->packed, b->entry.rawSize - 1);
+		if(packed == 0) {
+			free(b->packed);
+			b->packed = NULL;
+		} else {
+			b->entry.packedSize = (uint32_t)packed;
+		}
+		TRACE_END(pack_block);
+	}
+}
+
+/* write_tree_packed
+ * Save the tree as a VERSION 4 packed file, compressing on threads threads
+ *
+ * Steps:
+ * 1. Return 0 if g_root is NODE_NIL
+ * 2. BFS from the root (ID 1), appending each node's record to the
+ *    current block; a block that has reached PACK_BLOCK_BYTES is closed
+ *    and the next one notes the first child ID it will hand out
+ * 3. Workers compress the blocks
+ * 4. Write header, entries and blocks to "<filename>.tmp" and rename()
+ *    it over filename, as save_tree does
+ * 5. Return 1 on success
+ */
+static int write_tree_packed(const char *filename, int threads) {
+	//1. Return 0 if g_root is NODE_NIL
+	if(g_root == NODE_NIL)
+		return 0;
+	if(threads < 1)
+		threads = 1;
+
+	//2. BFS into blocks
+	PackJob job = {NULL, 0, 0};
+	uint32_t capacity = 0;
+	int ok = 1;
+	Queue bfs;
+	q_init(&bfs);
+	q_enqueue(&bfs, g_root, 1);
+	uint32_t nextId = 2;
+	PackBlock* b = NULL;
+
+	while(ok && q_empty(&bfs) == 0) {
+		int deId = 0;
+		NodeId node = NODE_NIL;
+		q_dequeue(&bfs, &node, &deId);
+
+		// - Start a block when there is none or the last is full
+		if(b == NULL || b->entry.rawSize >= PACK_BLOCK_BYTES) {
+			if(job.count == capacity) {
+				uint32_t grown = capacity ? capacity * 2 : 16;
+				PackBlock* blocks = (PackBlock*)realloc(job.blocks, grown * sizeof(PackBlock));
+				if(blocks == NULL) {
+					ok = 0;
+					break;
+				}
+				job.blocks = blocks;
+				capacity = grown;
+			}
+			b = &job.blocks[job.count++];
+			memset(b, 0, sizeof(*b));
+			b->entry.firstChild = nextId;
+		}
+
+		// - Children get the next free IDs, in yes-then-no order
+		uint8_t flags = node_is_question(node) ? 1 : 0;
+		if(node_yes(node) != NODE_NIL) {
+			flags |= 2;
+			q_enqueue(&bfs, node_yes(node), (int)nextId++);
+		}
+		if(node_no(node) != NODE_NIL) {
+			flags |= 4;
+			q_enqueue(&bfs, node_no(node), (int)nextId++);
+		}
+
+		// - flags, varint textLen, text
+		const char* text = node_text(node);
+		uint32_t textLen = (uint32_t)strlen(text);
+		size_t need = (size_t)b->entry.rawSize + 6 + textLen;
+		if(need > b->capacity) {
+			size_t grown = b->capacity ? b->capacity : PACK_BLOCK_BYTES + 4096;
+			while(grown < need)
+				grown *= 2;
+			uint8_t* raw = (uint8_t*)realloc(b->raw, grown);
+			if(raw == NULL) {
+				ok = 0;
+				break;
+			}
+			b->raw = raw;
+			b->capacity = grown;
+		}
+		uint8_t* p = b->raw + b->entry.rawSize;
+		*p++ = flags;
+		p = put_varint(p, textLen);
+		memcpy(p, text, textLen);
+		p += textLen;
+		b->entry.rawSize = (uint32_t)(p - b->raw);
+		b->entry.nodes++;
+	}
+	q_free(&bfs);
+
+	//3. Compress
+	if(ok)
+		run_threads(pack_worker, &job, threads);
+
+	//4. Write it all to the temp file and rename it into place
+	char* tmpName = ok ? temp_name(filename) : NULL;
+	FILE* fp = tmpName != NULL ? fopen(tmpName, "wb") : NULL;
+	ok = fp != NULL;
+	PackedHeader header = {MAGIC, PACKED_VERSION, nextId - 1, job.count};
+	ok = ok && fwrite(&header, sizeof(header), 1, fp) == 1;
+	for(uint32_t i = 0; ok && i < job.count; i++)
+		ok = fwrite(&job.blocks[i].entry, sizeof(PackedEntry), 1, fp) == 1;
+	for(uint32_t i = 0; ok && i < job.count; i++) {
+		PackBlock* blk = &job.blocks[i];
+		const uint8_t* bytes = blk->packed != NULL ? blk->packed : blk->raw;
+		ok = fwrite(bytes, 1, blk->entry.packedSize, fp) == blk->entry.packedSize;
+	}
+	if(fp != NULL && fclose(fp) != 0)
+		ok = 0;
+	ok = ok && rename(tmpName, filename) == 0;
+	if(!ok && fp != NULL)
+		remove(tmpName);
+	free(tmpName);
+
+	for(uint32_t i = 0; i < job.count; i++) {
+		free(job.blocks[i].raw);
+		free(job.blocks[i].packed);
+	}
+	free(job.blocks);
+
+	//5. Return 1 on success
+	return ok;
+}
+
+/* save_tree_packed
+ * - write_tree_packed, timed and counted in the save metrics
+ */
+int save_tree_packed(const char *filename, int threads) {
+	uint64_t t0 = metrics_now();
+	TRACE_BEGIN(save_tree_packed);
+	int ok = write_tree_packed(filename, threads);
+	TRACE_END(save_tree_packed);
+	return persist_metered(1, filename, t0, ok);
+}
+
+/* read_tree_packed
+ * Load a VERSION 4 packed file, decompressing and decoding blocks on
+ * threads threads
+ *
+ * Steps:
+ * 1. Map the file and validate the header
+ * 2. Turn every entry into a range: its nodes follow the previous
+ *    block's, its bytes the previous block's bytes. Entries must add up
+ *    to the node count and their blocks fit in the file
+ * 3. Decode, link and swap in the ranges (load_ranges)
+ * 4. Return 1 on success; on failure the current tree is left untouched
+ */
+static int read_tree_packed(const char *filename, int threads) {
+	if(threads < 1)
+		threads = 1;
+
+	//1. Map the file and check the header
+	size_t size = 0;
+	const unsigned char* data = map_file(filename, sizeof(PackedHeader), &size);
+	if(data == NULL)
+		return 0;
+
+	LoadJob job;
+	memset(&job, 0, sizeof(job));
+	job.data = data;
+	job.packed = 1;
+	PackedHeader header;
+	memcpy(&header, data, sizeof(header));
+	job.count = header.nodeCount;
+	job.nranges = header.blockCount;
+	int ok = 0;
+	if(header.magic != MAGIC || header.version != PACKED_VERSION || job.count == 0
+		|| job.count >= UINT32_MAX || job.nranges == 0
+		|| (size - sizeof(header)) / sizeof(PackedEntry) < job.nranges)
+		goto done;
+
+	//2. One range per block
+	job.ranges = (LoadRange*)calloc(job.nranges, sizeof(LoadRange));
+	if(job.ranges == NULL)
+		goto done;
+	size_t at = sizeof(header) + (size_t)job.nranges * sizeof(PackedEntry);
+	uint64_t nodes = 0;
+	for(uint32_t r = 0; r < job.nranges; r++) {
+		PackedEntry e;
+		memcpy(&e, data + sizeof(header) + (size_t)r * sizeof(PackedEntry), sizeof(e));
+		if(e.nodes == 0 || e.packedSize > e.rawSize || e.packedSize > size - at
+			|| nodes + e.nodes > job.count)
+			goto done;
+		LoadRange* range = &job.ranges[r];
+		range->lo = (uint32_t)nodes;
+		range->hi = (uint32_t)(nodes + e.nodes);
+		range->packed = data + at;
+		range->packedSize = e.packedSize;
+		range->rawSize = e.rawSize;
+		range->hash = e.hash;
+		range->nextChild = e.firstChild;
+		sp_init(&range->strings);
+		nodes += e.nodes;
+		at += e.packedSize;
+	}
+	if(nodes != job.count)
+		goto done;
+
+	//3. Decode, link, swap in
+	ok = load_ranges(&job, threads);
+
+	//4. Return 1 on success
+	done:
+	free(job.ranges);
+	munmap((void*)data, size);
+	return ok;
+}
+
+/* load_tree_packed
+ * - read_tree_packed, timed and counted in the load metrics
+ */
+int load_tree_packed(const char *filename, int threads) {
+	uint64_t t0 = metrics_now();
+	TRACE_BEGIN(load_tree_packed);
+	int ok = read_tree_packed(filename, threads);
+	TRACE_END(load_tree_packed);
+	return persist_metered(0, filename, t0, ok);
+}
+
+/* write_arena_image
+ * Save arena a, with root as the tree's root, as a VERSION 2 image that
+ * map_tree can use in place
+ *
+ * Layout:
+ * - ImageHeader, padded to IMAGE_NODES_ALIGN
+ * - links[0 .. count), then nodes[0 .. count), exactly as they sit in
+ *   memory
+ * - the string pool blob
+ *
+ * Steps:
+ * 1. Return 0 if root is NODE_NIL
+ * 2. Write to "<filename>.tmp" so a reader (or our own mapping of the
+ *    old file) never sees a half-written image
+ * 3. Write header, padding, links, nodes and strings with one fwrite each, and
+ *    fsync them: the journal drops its records once the image is in place
+ * 4. rename() the temp file over filename
+ * Nodes detached by undo are written too, which keeps every NodeId the
+ * same after mapping the image back in.
+ */
+static int write_arena_image(const char *filename, const NodeArena *a, NodeId root, uint64_t lsn) {
+	//1. Return 0 if root is NODE_NIL
+	if(root == NODE_NIL)
+		return 0;
+
+	//2. Open the temp file
+	char* tmpName = temp_name(filename);
+	if(tmpName == NULL)
+		return 0;
+
+	FILE* fp = fopen(tmpName, "wb");
+	if(fp == NULL) {
+		free(tmpName);
+		return 0;
+	}
+
+	//3. Header, then the three arrays
+	ImageHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = MAGIC;
+	hdr.version = IMAGE_VERSION;
+	hdr.nodeCount = a->count;
+	hdr.root = root;
+	hdr.nodeSize = sizeof(Node);
+	hdr.stringsSize = a->strings.size;
+	hdr.linksOffset = IMAGE_NODES_ALIGN;
+	hdr.nodesOffset = hdr.linksOffset + (uint64_t)a->count * sizeof(NodeLinks);
+	hdr.stringsOffset = hdr.nodesOffset + (uint64_t)a->count * sizeof(Node);
+	hdr.lsn = lsn;
+
+	char pad[IMAGE_NODES_ALIGN];
+	memset(pad, 0, sizeof(pad));
+	memcpy(pad, &hdr, sizeof(hdr));
+
+	int ok = fwrite(pad, 1, sizeof(pad), fp) == sizeof(pad);
+	ok = ok && fwrite(a->links, sizeof(NodeLinks), a->count, fp) == a->count;
+	ok = ok && fwrite(a->nodes, sizeof(Node), a->count, fp) == a->count;
+	ok = ok && fwrite(a->strings.bytes, 1, a->strings.size, fp) == a->strings.size;
+	ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	if(fclose(fp) != 0)
+		ok = 0;
+
+	//4. Atomically replace the old file
+	if(ok && rename(tmpName, filename) != 0)
+		ok = 0;
+	if(!ok)
+		remove(tmpName);
+	free(tmpName);
+	return ok;
+}
+
+/* save_arena_image
+ * - write_arena_image, timed and counted in the save metrics
+ */
+int save_arena_image(const char *filename, const NodeArena *a, NodeId root, uint64_t lsn) {
+	uint64_t t0 = metrics_now();
+	TRACE_BEGIN(save_arena_image);
+	int ok = write_arena_image(filename, a, root, lsn);
+	TRACE_END(save_arena_image);
+	return persist_metered(1, filename, t0, ok);
+}
+
+/* save_image
+ * - Save the live tree; the image covers every journal record written
+ *   so far
+ */
+int save_image(const char *filename) {
+	return save_arena_image(filename, &g_arena, g_root, journal_lsn());
+}
+
+/* image_lsn
+ * - The journal position a VERSION 2 image was saved at; 0 for images
+ *   saved without a journal, VERSION 1 files and anything unreadable
+ */
+uint64_t image_lsn(const char *filename) {
+	FILE* fp = fopen(filename, "rb");
+	if(fp == NULL)
+		return 0;
+
+	ImageHeader hdr;
+	int ok = fread(&hdr, sizeof(hdr), 1, fp) == 1;
+	fclose(fp);
+	if(!ok || hdr.magic != MAGIC || hdr.version != IMAGE_VERSION)
+		return 0;
+	return hdr.lsn;
+}
+
+/* map_image
+ * Map a VERSION 2 image and play it directly from the page cache
+ *
+ * Steps:
+ * 1. mmap the file MAP_PRIVATE: pages are read on first touch, and
+ *    learning writes to nodes copy-on-write without touching the file
+ * 2. Validate the header and that every section lies inside the file;
+ *    each offset is checked against the size before anything is added
+ *    to it, so a crafted header can't wrap the sums
+ * 3. Ask the kernel to read the rest ahead in the background, so the
+ *    first questions are answered before the file is fully paged in
+ * 4. Point a fresh arena at the node arrays and adopt the string blob,
+ *    then swap it into g_arena like load_tree does. With verify, run
+ *    check_integrity() on it first (reading every record: child ids,
+ *    text offsets, parents, stats) and put the old tree back if it fails
+ * 5. Leave g_index to be rebuilt on first use; rebuilding now would read
+ *    every record. Subtree stats come with the records, so the status
+ *    panel needs nothing computed either
+ */
+static int map_image(const char *filename, int verify) {
+	//1. Map the file
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0)
+		return 0;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (uint64_t)st.st_size < IMAGE_NODES_ALIGN) {
+		close(fd);
+		return 0;
+	}
+
+	size_t size = (size_t)st.st_size;
+	char* map = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return 0;
+
+	//2. Validate the header
+	ImageHeader hdr;
+	memcpy(&hdr, map, sizeof(hdr));
+
+	int ok = hdr.magic == MAGIC && hdr.version == IMAGE_VERSION
+		&& hdr.nodeSize == sizeof(Node)
+		&& hdr.nodeCount >= 2 && hdr.nodeCount - 1 <= NODE_ID_MAX
+		&& hdr.root != NODE_NIL && hdr.root < hdr.nodeCount
+		&& hdr.linksOffset <= size && hdr.nodesOffset <= size && hdr.stringsOffset <= size
+		&& hdr.linksOffset % IMAGE_NODES_ALIGN == 0 && hdr.linksOffset >= sizeof(hdr)
+		&& hdr.linksOffset + (uint64_t)hdr.nodeCount * sizeof(NodeLinks) <= hdr.nodesOffset
+		&& hdr.nodesOffset % sizeof(uint32_t) == 0
+		&& hdr.nodesOffset + (uint64_t)hdr.nodeCount * sizeof(Node) <= hdr.stringsOffset
+		&& hdr.stringsOffset + hdr.stringsSize <= size
+		&& hdr.stringsSize > 0
+		&& map[hdr.stringsOffset + hdr.stringsSize - 1] == '\0';
+	if(!ok) {
+		munmap(map, size);
+		return 0;
+	}
+
+	//3. Start read-ahead without waiting for it
+	madvise(map, size, MADV_WILLNEED);
+
+	//4. Build the arena on top of the mapping and swap it in
+	NodeArena arena;
+	arena_init(&arena);
+	arena.links = (NodeLinks*)(map + hdr.linksOffset);
+	arena.nodes = (Node*)(map + hdr.nodesOffset);
+	arena.count = hdr.nodeCount;
+	arena.capacity = hdr.nodeCount;
+	arena.nodesMapped = 1;
+	sp_adopt(&arena.strings, map + hdr.stringsOffset, hdr.stringsSize);
+	arena.map = map;
+	arena.mapSize = size;
+
+	NodeArena old = g_arena;
+	NodeId oldRoot = g_root;
+	g_arena = arena;
+	g_root = hdr.root;
+	if(verify && !check_integrity()) {
+		g_arena = old;
+		g_root = oldRoot;
+		arena_free(&arena);
+		return 0;
+	}
+	arena_free(&old);
+	es_clear(&g_undo);
+	es_clear(&g_redo);
+
+	//5. Rebuild the attribute index lazily
+	index_invalidate();
+	return 1;
+}
+
+/* map_metered
+ * - map_image, timed and counted in the load metrics
+ */
+static int map_metered(const char *filename, int verify) {
+	uint64_t t0 = metrics_now();
+	TRACE_BEGIN(map_tree);
+	int ok = map_image(filename, verify);
+	TRACE_END(map_tree);
+	return persist_metered(0, filename, t0, ok);
+}
+
+/* map_tree
+ * - Map an image this program wrote, paging records in only as games
+ *   reach them; the records themselves are not checked
+ */
+int map_tree(const char *filename) {
+	return map_metered(filename, 0);
+}
+
+/* open_tree
+ * Load whichever format filename holds: map VERSION 2 images in place
+ * (checking every record, since the file may come from anywhere),
+ * assemble VERSION 3 page snapshots from their pages, unpack VERSION 4
+ * files on every CPU, fall back to load_tree for VERSION 1 files
+ */
+int open_tree(const char *filename) {
+	FILE* fp = fopen(filename, "rb");
+	if(fp == NULL)
+		return 0;
+
+	uint32_t head[2] = {0, 0};
+	size_t got = fread(head, sizeof(uint32_t), 2, fp);
+	fclose(fp);
+
+	if(got == 2 && head[0] == MAGIC && head[1] == IMAGE_VERSION)
+		return map_metered(filename, 1);
+	if(got == 2 && head[0] == MAGIC && head[1] == PAGES_VERSION)
+		return load_pages(filename);
+	if(got == 2 && head[0] == MAGIC && head[1] == PACKED_VERSION)
+		return load_tree_packed(filename, (int)sysconf(_SC_NPROCESSORS_ONLN));
+	return load_tree(filename);
+}
@@ -0,0 +1,316 @@
+/*
+ * replay.c - Plays scripted games through the engine, with no UI
+ *
+ * Usage: ./replay [-l tree] [-s tree] [-p tree] [-j tree] [-m file] [-u file] [-r rounds] [-v] [script ...]
+ *   -l tree    start from a saved tree (either format) instead of the
+ *              starter tree the game begins with
+ *   -s tree    save the final tree as an image
+ *   -p tree    save the final tree as a page snapshot; only pages that
+ *              changed since it was last saved are written
+ *   -j tree    journal every edit to tree.log, recovering tree and its
+ *              log first if they exist
+ *   -m file    write the metrics (games, learning, save and load times)
+ *              to file in the Prometheus text format when done
+ *   -u file    write the usage report (hottest paths, subtrees no game
+ *              reached) to file when done
+ *   -r rounds  play the scripts this many times over (default 1)
+ *   -v         print every prompt and reply
+ * With no script, or "-", the script is read from stdin.
+ *
+ * A script is one reply per line, in the order the engine asks for them:
+ * y/n for questions and guesses, then after a wrong guess the animal,
+ * the new question and its y/n answer. A new game starts as soon as one
+ * ends. Blank lines and lines starting with '#' are skipped.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include "lab5.h"
+
+/* Global tree root */
+NodeId g_root = NODE_NIL;
+
+/* Global undo/redo stacks */
+EditStack g_undo = {NULL, 0, 0};
+EditStack g_redo = {NULL, 0, 0};
+
+/* Global attribute index */
+Hash g_index = {NULL, 0, 0, NULL, 0, 0, 0};
+
+/* Every script is read into memory up front, so the timed part is pure
+ * engine work. lines point into the texts. */
+typedef struct {
+    char **texts;
+    int ntexts;
+    char **lines;
+    size_t count;
+    size_t capacity;
+} Script;
+
+typedef struct {
+    uint64_t games;
+    uint64_t guessed;
+    uint64_t learned;
+    uint64_t repeated;
+    uint64_t abandoned;     /* the script ran out mid-game */
+    uint64_t replies;
+} ReplayStats;
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* read_script
+ * - Slurp fp and append its lines to sc; '\r' line endings are dropped
+ * - Return 0 if out of memory
+ */
+static int read_script(Script *sc, FILE *fp) {
+	size_t size = 0;
+	size_t capacity = 1 << 16;
+	char* text = (char*)malloc(capacity);
+	if(text == NULL)
+		return 0;
+
+	size_t got;
+	while((got = fread(text + size, 1, capacity - size - 1, fp)) > 0) {
+		size += got;
+		if(size + 1 == capacity) {
+			char* grown = (char*)realloc(text, capacity * 2);
+			if(grown == NULL) {
+				free(text);
+				return 0;
+			}
+			text = grown;
+			capacity *= 2;
+		}
+	}
+	text[size] = '\0';
+
+	char** texts = (char**)realloc(sc->texts, (sc->ntexts + 1) * sizeof(char*));
+	if(texts == NULL) {
+		free(text);
+		return 0;
+	}
+	sc->texts = texts;
+	sc->texts[sc->ntexts++] = text;
+
+	char* line = text;
+	while(line < text + size) {
+		char* end = strchr(line, '\n');
+		if(end == NULL)
+			end = text + size;
+		*end = '\0';
+		if(end > line && end[-1] == '\r')
+			end[-1] = '\0';
+
+		if(line[0] != '\0' && line[0] != '#') {
+			if(sc->count == sc->capacity) {
+				size_t cap = sc->capacity ? sc->capacity * 2 : 256;
+				char** grown = (char**)realloc(sc->lines, cap * sizeof(char*));
+				if(grown == NULL)
+					return 0;
+				sc->lines = grown;
+				sc->capacity = cap;
+			}
+			sc->lines[sc->count++] = line;
+		}
+		line = end + 1;
+	}
+	return 1;
+}
+
+static void free_script(Script *sc) {
+	for(int i = 0; i < sc->ntexts; i++)
+		free(sc->texts[i]);
+	free(sc->texts);
+	free(sc->lines);
+}
+
+/* parse_yes_no
+ * - 1 for a line starting with y/Y, 0 for n/N, -1 for anything else
+ */
+static int parse_yes_no(const char *line) {
+	int c = tolower((unsigned char)line[0]);
+	return c == 'y' ? 1 : c == 'n' ? 0 : -1;
+}
+
+/* replay
+ * Feed every script line to the engine, starting a new game whenever the
+ * last one is DONE
+ * - Return 0 (after printing where) on a line the engine can't take
+ */
+static int replay(GameSession *game, const Script *sc, int verbose, ReplayStats *st) {
+	char prompt[1200];
+	for(size_t i = 0; i < sc->count; i++) {
+		const char* line = sc->lines[i];
+
+		if(game->state == ENGINE_DONE) {
+			if(!engine_start(game)) {
+				fprintf(stderr, "replay: the tree is empty\n");
+				return 0;
+			}
+			st->games++;
+		}
+		if(verbose && engine_prompt(game, prompt, sizeof(prompt)))
+			printf("%s%s\n", prompt, line);
+
+		int ok;
+		if(game->state == ENGINE_ASK_ANIMAL || game->state == ENGINE_ASK_QUESTION) {
+			ok = engine_submit(game, line);
+		} else {
+			int yes = parse_yes_no(line);
+			ok = yes >= 0 && engine_answer(game, yes);
+		}
+		if(!ok) {
+			fprintf(stderr, "replay: script line %zu: can't answer \"%s\" here\n", i + 1, line);
+			return 0;
+		}
+		st->replies++;
+
+		if(game->state == ENGINE_DONE) {
+			if(game->result == ENGINE_GUESSED)
+				st->guessed++;
+			else if(game->result == ENGINE_LEARNED)
+				st->learned++;
+			else if(game->result == ENGINE_REPEATED)
+				st->repeated++;
+		}
+	}
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	const char* loadFile = NULL;
+	const char* saveFile = NULL;
+	const char* journalFile = NULL;
+	const char* pagesFile = NULL;
+	const char* metricsFile = NULL;
+	const char* usageFile = NULL;
+	long rounds = 1;
+	int verbose = 0;
+
+	int opt;
+	while((opt = getopt(argc, argv, "l:s:p:j:m:u:r:v")) != -1) {
+		switch(opt) {
+		case 'l': loadFile = optarg; break;
+		case 's': saveFile = optarg; break;
+		case 'p': pagesFile = optarg; break;
+		case 'j': journalFile = optarg; break;
+		case 'm': metricsFile = optarg; break;
+		case 'u': usageFile = optarg; break;
+		case 'r': rounds = strtol(optarg, NULL, 10); break;
+		case 'v': verbose = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-l tree] [-s tree] [-p tree] [-j tree] [-m file] [-u file] [-r rounds] [-v] [script ...]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	//read every script before the clock starts
+	Script sc;
+	memset(&sc, 0, sizeof(sc));
+	int ok = 1;
+	if(optind == argc) {
+		ok = read_script(&sc, stdin);
+	}
+	for(int i = optind; ok && i < argc; i++) {
+		FILE* fp = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "r");
+		if(fp == NULL) {
+			fprintf(stderr, "replay: can't open %s\n", argv[i]);
+			ok = 0;
+			break;
+		}
+		ok = read_script(&sc, fp);
+		if(fp != stdin)
+			fclose(fp);
+	}
+
+	//the tree to start from: a saved one, or the game's starter tree
+	es_init(&g_undo);
+	es_init(&g_redo);
+	if(ok && journalFile != NULL && access(journalFile, F_OK) == 0) {
+		if(!journal_open(journalFile, JOURNAL_COMPACT_BYTES)) {
+			fprintf(stderr, "replay: can't recover %s\n", journalFile);
+			ok = 0;
+		}
+	} else if(ok && loadFile != NULL) {
+		if(!open_tree(loadFile)) {
+			fprintf(stderr, "replay: can't load %s\n", loadFile);
+			ok = 0;
+		}
+	} else if(ok) {
+		NodeId water = create_question_node("Does it live in water?");
+		node_set_yes(water, create_animal_node("Fish"));
+		node_set_no(water, create_animal_node("Dog"));
+		tree_set_root(water);
+		index_rebuild();
+	}
+	if(ok && journalFile != NULL && !journal_active() && !journal_open(journalFile, JOURNAL_COMPACT_BYTES)) {
+		fprintf(stderr, "replay: can't start the journal for %s\n", journalFile);
+		ok = 0;
+	}
+
+	//play
+	ReplayStats st;
+	memset(&st, 0, sizeof(st));
+	GameSession game;
+	engine_init(&game);
+
+	double t0 = now_sec();
+	for(long r = 0; ok && r < rounds; r++)
+		ok = replay(&game, &sc, verbose, &st);
+	double t = now_sec() - t0;
+
+	if(game.state != ENGINE_DONE)
+		st.abandoned++;
+	if(journalFile != NULL && journal_active() && !journal_sync()) {
+		fprintf(stderr, "replay: can't write %s.log\n", journalFile);
+		ok = 0;
+	}
+	journal_close();
+
+	if(ok && saveFile != NULL && !save_image(saveFile)) {
+		fprintf(stderr, "replay: can't save %s\n", saveFile);
+		ok = 0;
+	}
+	if(ok && pagesFile != NULL && !save_pages(pagesFile)) {
+		fprintf(stderr, "replay: can't save %s\n", pagesFile);
+		ok = 0;
+	}
+	if(metricsFile != NULL && !metrics_write_file(metricsFile)) {
+		fprintf(stderr, "replay: can't write %s\n", metricsFile);
+		ok = 0;
+	}
+	if(usageFile != NULL && !usage_write_file(usageFile, g_root, 10)) {
+		fprintf(stderr, "replay: can't write %s\n", usageFile);
+		ok = 0;
+	}
+
+	//report
+	TreeStats ts;
+	tree_stats(g_root, &ts);
+	printf("games:     %llu (%llu guessed, %llu learned, %llu repeated, %llu unfinished)\n",
+		(unsigned long long)st.games, (unsigned long long)st.guessed,
+		(unsigned long long)st.learned, (unsigned long long)st.repeated,
+		(unsigned long long)st.abandoned);
+	printf("replies:   %llu\n", (unsigned long long)st.replies);
+	printf("seconds:   %.4f\n", t);
+	printf("games/sec: %.0f\n", t > 0 ? st.games / t : 0.0);
+	printf("tree:      %u nodes, %u animals, height %u\n", ts.nodes, ts.animals, ts.height);
+
+	engine_free(&game);
+	free_script(&sc);
+	free_edit_stack(&g_undo);
+	free_edit_stack(&g_redo);
+	h_free(&g_index);
+	pages_forget();
+	arena_free(&g_arena);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,489 @@
+/*
+ * server.c - Many concurrent games against one shared, learning tree
+ *
+ * Usage: ./server [-s socket] [-w workers] [-l tree] [-S tree] [-j tree] [-m file] [-R] [-V]
+ *   -s socket   Unix socket to listen on (default animals.sock)
+ *   -w workers  worker threads (default: one per online CPU)
+ *   -l tree     start from a saved tree instead of the starter tree
+ *   -S tree     save the tree as an image on shutdown (SIGINT/SIGTERM)
+ *   -j tree     keep the tree durable as it learns: recover tree and
+ *               tree.log if they exist (otherwise start from -l or the
+ *               starter tree), journal every edit to tree.log and fold
+ *               the log back into tree in the background
+ *   -m file     keep file up to date (every second, and at shutdown)
+ *               with the metrics in the Prometheus text format, for a
+ *               local scraper
+ *   -R          serve the tree read-only from a succinct copy (a few
+ *               bits a node plus its text); a wrong guess ends the game
+ *               with DONE STUMPED. Can't be combined with -S or -j
+ *   -V          lay the tree out in van Emde Boas order before serving,
+ *               so each game's descent touches fewer cache lines. Can't
+ *               be combined with -j (the journal names nodes by id)
+ *
+ * Protocol: one request line, one reply line.
+ *   NEW              start a game       -> QUESTION <text> | GUESS <animal>
+ *   y / n            answer a question  -> QUESTION <text> | GUESS <animal>
+ *                    answer a guess     -> DONE GUESSED | ANIMAL | DONE STUMPED
+ *   <animal>         after ANIMAL       -> DISTINGUISH | DONE REPEATED
+ *   <question>       after DISTINGUISH  -> ANSWER
+ *   y / n            after ANSWER       -> DONE LEARNED
+ *   STATS            tree size          -> STATS <nodes> <animals> <height>
+ *   QUIT             hang up            -> BYE
+ * Anything else gets ERR <reason>. Clients must read each reply before
+ * sending the next request.
+ *
+ * Threads: the main thread accepts and deals connections out to the
+ * workers round-robin; each worker runs its own epoll loop. Walking the
+ * tree (questions and guesses) takes no lock: readers bracket it with
+ * epoch_enter/epoch_exit. Learning splices the tree with a compare-and-
+ * swap, so players teaching at the same spot don't lose each other's
+ * animals; the engine serializes the rest of it on g_learnLock.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "lab5.h"
+
+/* Global tree root */
+NodeId g_root = NODE_NIL;
+
+/* Global undo/redo stacks */
+EditStack g_undo = {NULL, 0, 0};
+EditStack g_redo = {NULL, 0, 0};
+
+/* Global attribute index */
+Hash g_index = {NULL, 0, 0, NULL, 0, 0, 0};
+
+/* With -R, every game is played on this instead of g_root */
+static SuccinctTree g_frozen;
+static int g_readOnly = 0;
+
+#define LINE_MAX_BYTES 2048
+#define EVENTS_PER_WAIT 64
+
+/* One player's connection; served by the worker it was dealt to */
+typedef struct Conn {
+    int fd;
+    GameSession game;
+    char in[LINE_MAX_BYTES];
+    size_t inLen;
+    uint64_t askedAt;       /* when the last question or guess went out */
+    struct Conn *prev;
+    struct Conn *next;
+} Conn;
+
+typedef struct {
+    pthread_t thread;
+    int epfd;
+    int slot;               /* epoch reader slot */
+    pthread_mutex_t connsLock;  /* the acceptor adds, the worker removes */
+    Conn *conns;            /* every open connection, closed at shutdown */
+} Worker;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void on_signal(int sig) {
+	(void)sig;
+	g_stop = 1;
+}
+
+/* reply
+ * - Send "word" or "word arg" as one line
+ * - Return 0 if the client didn't take all of it; it gets dropped
+ */
+static int reply(Conn *c, const char *word, const char *arg) {
+	char buf[LINE_MAX_BYTES];
+	int n = arg != NULL ? snprintf(buf, sizeof(buf) - 1, "%s %s", word, arg)
+		: snprintf(buf, sizeof(buf) - 1, "%s", word);
+	if(n < 0)
+		return 0;
+	if(n > (int)sizeof(buf) - 2)
+		n = (int)sizeof(buf) - 2;
+	buf[n++] = '\n';
+	return send(c->fd, buf, (size_t)n, MSG_NOSIGNAL) == n;
+}
+
+/* reply_state
+ * - Tell the client what the game wants next
+ * - Questions and guesses read node text, so the caller is inside an epoch
+ */
+static int reply_state(Conn *c) {
+	const GameSession* g = &c->game;
+	switch(g->state) {
+	case ENGINE_QUESTION:
+		c->askedAt = metrics_now();
+		return reply(c, "QUESTION", engine_text(g));
+	case ENGINE_GUESS:
+		c->askedAt = metrics_now();
+		return reply(c, "GUESS", engine_text(g));
+	case ENGINE_ASK_ANIMAL:   return reply(c, "ANIMAL", NULL);
+	case ENGINE_ASK_QUESTION: return reply(c, "DISTINGUISH", NULL);
+	case ENGINE_ASK_ANSWER:   return reply(c, "ANSWER", NULL);
+	case ENGINE_DONE:
+		break;
+	}
+	return reply(c, "DONE", g->result == ENGINE_GUESSED ? "GUESSED"
+		: g->result == ENGINE_LEARNED ? "LEARNED"
+		: g->result == ENGINE_REPEATED ? "REPEATED"
+		: g->result == ENGINE_STUMPED ? "STUMPED" : "EMPTY");
+}
+
+static int parse_yes_no(const char *line) {
+	int c = tolower((unsigned char)line[0]);
+	return line[0] != '\0' && line[1] == '\0' ? (c == 'y' ? 1 : c == 'n' ? 0 : -1) : -1;
+}
+
+/* handle_line
+ * Run one request. Return 0 to hang up.
+ * - Questions and guesses walk the shared tree inside an epoch, no lock
+ * - The learning phase locks inside the engine: engine_submit reads the
+ *   index and the final answer splices the tree. It runs outside any
+ *   epoch, so a writer never waits on its own slot when it retires a block
+ */
+static int handle_line(Worker *w, Conn *c, const char *line) {
+	if(strcmp(line, "QUIT") == 0) {
+		reply(c, "BYE", NULL);
+		return 0;
+	}
+
+	if(strcmp(line, "STATS") == 0) {
+		TreeStats ts;
+		char buf[64];
+		if(g_readOnly) {
+			ts.nodes = g_frozen.nodes;
+			ts.animals = g_frozen.animals;
+			ts.height = g_frozen.height;
+		} else {
+			pthread_mutex_lock(&g_learnLock);
+			tree_stats(tree_root(), &ts);
+			pthread_mutex_unlock(&g_learnLock);
+		}
+		snprintf(buf, sizeof(buf), "%u %u %u", ts.nodes, ts.animals, ts.height);
+		return reply(c, "STATS", buf);
+	}
+
+	int ok;
+	if(strcmp(line, "NEW") == 0) {
+		epoch_enter(w->slot);
+		if(g_readOnly)
+			engine_start_succinct(&c->game, &g_frozen);
+		else
+			engine_start(&c->game);
+		ok = reply_state(c);
+		epoch_exit(w->slot);
+		return ok;
+	}
+
+	EngineState state = c->game.state;
+	if(state == ENGINE_QUESTION || state == ENGINE_GUESS) {
+		int yes = parse_yes_no(line);
+		if(yes < 0)
+			return reply(c, "ERR", "expected y or n");
+		metric_observe(METRIC_ANSWER_SECONDS, metrics_now() - c->askedAt);
+		epoch_enter(w->slot);
+		engine_answer(&c->game, yes);
+		ok = reply_state(c);
+		epoch_exit(w->slot);
+		return ok;
+	}
+
+	if(state == ENGINE_DONE)
+		return reply(c, "ERR", "no game; send NEW");
+
+	int took;
+	if(state == ENGINE_ASK_ANSWER) {
+		int yes = parse_yes_no(line);
+		took = yes >= 0 && engine_answer(&c->game, yes);
+	} else {
+		took = engine_submit(&c->game, line);
+	}
+	return took ? reply_state(c) : reply(c, "ERR", "expected an answer for this step");
+}
+
+/* close_conn
+ * - Unlink c from its worker's list and release it
+ */
+static void close_conn(Worker *w, Conn *c) {
+	pthread_mutex_lock(&w->connsLock);
+	if(c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		w->conns = c->next;
+	if(c->next != NULL)
+		c->next->prev = c->prev;
+	pthread_mutex_unlock(&w->connsLock);
+
+	close(c->fd);
+	engine_free(&c->game);
+	free(c);
+	metric_gauge_add(METRIC_CONNECTIONS, -1);
+}
+
+/* conn_readable
+ * - Read what arrived and run every complete line
+ * - Return 0 when the connection should be closed
+ */
+static int conn_readable(Worker *w, Conn *c) {
+	for(;;) {
+		ssize_t got = read(c->fd, c->in + c->inLen, sizeof(c->in) - c->inLen);
+		if(got == 0)
+			return 0;
+		if(got < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		c->inLen += (size_t)got;
+
+		size_t start = 0;
+		for(size_t i = 0; i < c->inLen; i++) {
+			if(c->in[i] != '\n')
+				continue;
+			c->in[i] = '\0';
+			if(i > start && c->in[i - 1] == '\r')
+				c->in[i - 1] = '\0';
+			if(!handle_line(w, c, c->in + start))
+				return 0;
+			start = i + 1;
+		}
+		memmove(c->in, c->in + start, c->inLen - start);
+		c->inLen -= start;
+
+		//a line longer than the buffer is never going to make sense
+		if(c->inLen == sizeof(c->in)) {
+			reply(c, "ERR", "line too long");
+			return 0;
+		}
+	}
+}
+
+/* worker_main
+ * - Serve the connections dealt to this worker until the server stops
+ */
+static void *worker_main(void *arg) {
+	Worker* w = (Worker*)arg;
+	struct epoll_event events[EVENTS_PER_WAIT];
+
+	while(!g_stop) {
+		int n = epoll_wait(w->epfd, events, EVENTS_PER_WAIT, 200);
+		for(int i = 0; i < n; i++) {
+			Conn* c = (Conn*)events[i].data.ptr;
+			if((events[i].events & (EPOLLERR | EPOLLHUP)) || !conn_readable(w, c)) {
+				epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+				close_conn(w, c);
+			}
+		}
+	}
+	return NULL;
+}
+
+/* load_shared_tree
+ * - Load (or build) the tree, recovering it from its journal if there is
+ *   one, and lay it out again if veb is set
+ * - Then make sure it lives on the heap: a mapped image would be
+ *   unmapped under the readers' feet when it is first copied out, so
+ *   copy it out now, before any reader exists
+ */
+static int load_shared_tree(const char *loadFile, const char *journalFile, int veb) {
+	if(journalFile != NULL && access(journalFile, F_OK) == 0) {
+		if(!journal_open(journalFile, JOURNAL_COMPACT_BYTES))
+			return 0;
+	} else if(loadFile != NULL) {
+		if(!open_tree(loadFile))
+			return 0;
+	} else {
+		NodeId water = create_question_node("Does it live in water?");
+		node_set_yes(water, create_animal_node("Fish"));
+		node_set_no(water, create_animal_node("Dog"));
+		tree_set_root(water);
+	}
+	if(journalFile != NULL && !journal_active() && !journal_open(journalFile, JOURNAL_COMPACT_BYTES))
+		return 0;
+	if(veb && !tree_relayout(LAYOUT_VEB))
+		return 0;
+	if(!sp_reserve(&g_arena.strings, 4096) || !arena_reserve(&g_arena, 1024))
+		return 0;
+	index_rebuild();
+	arena_set_retire(&g_arena, epoch_retire);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	const char* sockPath = "animals.sock";
+	const char* loadFile = NULL;
+	const char* saveFile = NULL;
+	const char* journalFile = NULL;
+	const char* metricsFile = NULL;
+	long nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	int opt;
+	int veb = 0;
+	while((opt = getopt(argc, argv, "s:w:l:S:j:m:RV")) != -1) {
+		switch(opt) {
+		case 's': sockPath = optarg; break;
+		case 'w': nworkers = strtol(optarg, NULL, 10); break;
+		case 'l': loadFile = optarg; break;
+		case 'S': saveFile = optarg; break;
+		case 'j': journalFile = optarg; break;
+		case 'm': metricsFile = optarg; break;
+		case 'R': g_readOnly = 1; break;
+		case 'V': veb = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-s socket] [-w workers] [-l tree] [-S tree] [-j tree] [-m file] [-R] [-V]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if(g_readOnly && (saveFile != NULL || journalFile != NULL)) {
+		fprintf(stderr, "server: -R serves a tree that never changes; drop -S and -j\n");
+		return 2;
+	}
+	if(veb && journalFile != NULL) {
+		fprintf(stderr, "server: -V renumbers the tree, which the journal can't follow; drop -j\n");
+		return 2;
+	}
+	if(nworkers < 1)
+		nworkers = 1;
+	if(nworkers > EPOCH_MAX_THREADS)
+		nworkers = EPOCH_MAX_THREADS;
+
+	es_init(&g_undo);
+	es_init(&g_redo);
+	if(!load_shared_tree(loadFile, journalFile, veb)) {
+		fprintf(stderr, "server: can't load %s\n", journalFile ? journalFile
+			: loadFile ? loadFile : "the starter tree");
+		return 1;
+	}
+
+	//read-only: keep just the succinct copy
+	if(g_readOnly) {
+		if(!succinct_build(&g_frozen, g_root)) {
+			fprintf(stderr, "server: the tree isn't a full binary tree of questions\n");
+			return 1;
+		}
+		arena_set_retire(&g_arena, NULL);
+		free_tree();
+		arena_free(&g_arena);
+		g_root = NODE_NIL;
+	}
+
+	//listen
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(sockPath) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "server: socket path too long\n");
+		return 1;
+	}
+	strcpy(addr.sun_path, sockPath);
+	unlink(sockPath);
+
+	int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 1024) != 0) {
+		perror("server: listen");
+		return 1;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	//start the workers
+	Worker* workers = (Worker*)calloc((size_t)nworkers, sizeof(Worker));
+	for(long i = 0; i < nworkers; i++) {
+		workers[i].epfd = epoll_create1(0);
+		workers[i].slot = epoch_register();
+		pthread_mutex_init(&workers[i].connsLock, NULL);
+		pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+	}
+	printf("server: %ld workers on %s\n", nworkers, sockPath);
+	fflush(stdout);
+
+	//deal connections out round-robin, writing the metrics out every second
+	long next = 0;
+	uint64_t exposed = 0;
+	struct pollfd pfd = {lfd, POLLIN, 0};
+	while(!g_stop) {
+		if(metricsFile != NULL && metrics_now() - exposed >= 1000000000u) {
+			metrics_write_file(metricsFile);
+			exposed = metrics_now();
+		}
+		if(poll(&pfd, 1, 200) <= 0)
+			continue;
+		int fd = accept(lfd, NULL, NULL);
+		if(fd < 0)
+			continue;
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		Conn* c = (Conn*)calloc(1, sizeof(Conn));
+		if(c == NULL) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		engine_init(&c->game);
+		metric_gauge_add(METRIC_CONNECTIONS, 1);
+
+		Worker* w = &workers[next++ % nworkers];
+		pthread_mutex_lock(&w->connsLock);
+		c->next = w->conns;
+		if(w->conns != NULL)
+			w->conns->prev = c;
+		w->conns = c;
+		pthread_mutex_unlock(&w->connsLock);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+			close_conn(w, c);
+	}
+
+	//shut down: readers first, then nothing can hold a retired block
+	for(long i = 0; i < nworkers; i++) {
+		pthread_join(workers[i].thread, NULL);
+		while(workers[i].conns != NULL)
+			close_conn(&workers[i], workers[i].conns);
+		epoch_unregister(workers[i].slot);
+		close(workers[i].epfd);
+		pthread_mutex_destroy(&workers[i].connsLock);
+	}
+	free(workers);
+	close(lfd);
+	unlink(sockPath);
+
+	int status = 0;
+	if(journalFile != NULL && !journal_sync()) {
+		fprintf(stderr, "server: can't write %s.log\n", journalFile);
+		status = 1;
+	}
+	journal_close();
+	if(saveFile != NULL && !save_image(saveFile)) {
+		fprintf(stderr, "server: can't save %s\n", saveFile);
+		status = 1;
+	}
+	if(metricsFile != NULL && !metrics_write_file(metricsFile)) {
+		fprintf(stderr, "server: can't write %s\n", metricsFile);
+		status = 1;
+	}
+
+	arena_set_retire(&g_arena, NULL);
+	epoch_drain();
+	arena_free(&g_arena);
+	h_free(&g_index);
+	succinct_free(&g_frozen);
+	free_edit_stack(&g_undo);
+	free_edit_stack(&g_redo);
+	return status;
+}
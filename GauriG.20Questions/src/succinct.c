@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+/* ========== Succinct Tree ========== */
+
+/* Every question has exactly two children and every animal none, so a
+ * tree is fully described by one bit per node (question or not) once
+ * the nodes are put in BFS order. In that order the children of the k-th
+ * question (counting from 0) are nodes 2k + 1 and 2k + 2: every question
+ * before it put two nodes on the queue ahead of its own, and the root
+ * came before them all. So
+ *   yes(i) = 2 * rank(i) + 1, no(i) = yes(i) + 1,
+ *   parent(i) = select((i - 1) / 2)
+ * where rank(i) counts the questions before node i and select(k) finds
+ * the k-th question. rank is a popcount away with one count per 64-bit
+ * word kept on the side; select is a binary search over those counts.
+ *
+ * Texts are stored back to back in the same BFS order. Only every
+ * SUCCINCT_TEXT_SAMPLE-th node's offset is kept; a text is found by
+ * skipping the few strings between it and the last sample.
+ *
+ * The result has no pointers at all, and reading down a game touches
+ * the bit vector's first few words for every game, which stay in cache.
+ */
+
+/* succinct_build
+ * Build t from the tree under root
+ *
+ * Steps:
+ * 1. Count the tree and check its shape on the way: a question needs
+ *    both children, an animal neither. Return 0 if not, or if root is
+ *    NODE_NIL
+ * 2. Allocate bits, rank counts, the text slab and the text samples
+ * 3. BFS from root: set node i's bit if it is a question (counting
+ *    animals otherwise), append its text, and note the offset of every
+ *    SUCCINCT_TEXT_SAMPLE-th text
+ * 4. Fill in the rank counts. BFS reaches the deepest nodes last, so
+ *    the last node's depth is the height
+ * 5. Return 1 (0 if out of memory, with t left empty)
+ */
+int succinct_build(SuccinctTree *t, NodeId root) {
+	memset(t, 0, sizeof(*t));
+	if(root == NODE_NIL)
+		return 0;
+
+	//1. Count and check the shape; the text total comes along for free.
+	//More nodes than the arena holds means a cycle
+	uint64_t nodes = 0, textSize = 0;
+	FrameStack todo;
+	fs_init(&todo);
+	fs_push(&todo, root, 0);
+	int ok = 1;
+	while(ok && !fs_empty(&todo)) {
+		NodeId id = fs_pop(&todo).node;
+		if(nodes >= g_arena.count) {
+			ok = 0;
+			break;
+		}
+		NodeId y = node_yes(id), n = node_no(id);
+		ok = node_is_question(id) ? y != NODE_NIL && n != NODE_NIL : y == NODE_NIL && n == NODE_NIL;
+		if(ok && node_is_question(id)) {
+			fs_push(&todo, y, 1);
+			fs_push(&todo, n, 0);
+		}
+		nodes++;
+		textSize += strlen(node_text(id)) + 1;
+	}
+	fs_free(&todo);
+	if(!ok || nodes >= UINT32_MAX)
+		return 0;
+
+	//2. Room for everything
+	uint32_t words = (uint32_t)((nodes + 63) / 64);
+	uint32_t samples = (uint32_t)((nodes + SUCCINCT_TEXT_SAMPLE - 1) / SUCCINCT_TEXT_SAMPLE);
+	t->bits = (uint64_t*)calloc(words, sizeof(uint64_t));
+	t->ranks = (uint32_t*)malloc((size_t)words * sizeof(uint32_t));
+	t->text = (char*)malloc((size_t)textSize);
+	t->textAt = (uint64_t*)malloc((size_t)samples * sizeof(uint64_t));
+	NodeId* queue = (NodeId*)malloc((size_t)nodes * sizeof(NodeId));
+	if(t->bits == NULL || t->ranks == NULL || t->text == NULL || t->textAt == NULL || queue == NULL) {
+		free(queue);
+		succinct_free(t);
+		return 0;
+	}
+	t->nodes = (uint32_t)nodes;
+	t->textSize = (size_t)textSize;
+
+	//3. BFS: the array is the queue, since every node goes through it once
+	uint32_t head = 0, tail = 0;
+	size_t at = 0;
+	queue[tail++] = root;
+	while(head < tail) {
+		uint32_t i = head;
+		NodeId id = queue[head++];
+		if(node_is_question(id)) {
+			t->bits[i / 64] |= (uint64_t)1 << (i % 64);
+			queue[tail++] = node_yes(id);
+			queue[tail++] = node_no(id);
+		} else {
+			t->animals++;
+		}
+		if(i % SUCCINCT_TEXT_SAMPLE == 0)
+			t->textAt[i / SUCCINCT_TEXT_SAMPLE] = at;
+		size_t len = strlen(node_text(id)) + 1;
+		memcpy(t->text + at, node_text(id), len);
+		at += len;
+	}
+	free(queue);
+
+	//4. Rank counts, then the height from the last node's depth
+	uint32_t before = 0;
+	for(uint32_t w = 0; w < words; w++) {
+		t->ranks[w] = before;
+		before += (uint32_t)__builtin_popcountll(t->bits[w]);
+	}
+	t->height = 1;
+	for(uint32_t i = t->nodes - 1; i > 0; i = succinct_parent(t, i))
+		t->height++;
+
+	//5. Done
+	return 1;
+}
+
+/* succinct_free
+ * - Release t's storage and leave it empty
+ */
+void succinct_free(SuccinctTree *t) {
+	free(t->bits);
+	free(t->ranks);
+	free(t->text);
+	free(t->textAt);
+	memset(t, 0, sizeof(*t));
+}
+
+/* succinct_rank
+ * - How many of nodes [0, i) are questions
+ */
+uint32_t succinct_rank(const SuccinctTree *t, uint32_t i) {
+	uint64_t below = i % 64 ? t->bits[i / 64] & (((uint64_t)1 << (i % 64)) - 1) : 0;
+	return t->ranks[i / 64] + (uint32_t)__builtin_popcountll(below);
+}
+
+/* succinct_select
+ * - Position of question number k (from 0); k must be below the number
+ *   of questions
+ * - The last word with fewer than k + 1 questions before it holds it
+ */
+uint32_t succinct_select(const SuccinctTree *t, uint32_t k) {
+	uint32_t lo = 0, hi = (t->nodes + 63) / 64 - 1;
+	while(lo < hi) {
+		uint32_t mid = lo + (hi - lo + 1) / 2;
+		if(t->ranks[mid] <= k)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	//drop the word's lower questions until k's is the lowest left
+	uint64_t word = t->bits[lo];
+	for(uint32_t skip = k - t->ranks[lo]; skip > 0; skip--)
+		word &= word - 1;
+	return lo * 64 + (uint32_t)__builtin_ctzll(word);
+}
+
+/* succinct_is_question
+ * - Is node i a question (and so has two children)?
+ */
+int succinct_is_question(const SuccinctTree *t, uint32_t i) {
+	return (int)((t->bits[i / 64] >> (i % 64)) & 1);
+}
+
+/* succinct_yes / succinct_no
+ * - Children of question i; only meaningful if i is a question
+ */
+uint32_t succinct_yes(const SuccinctTree *t, uint32_t i) {
+	return 2 * succinct_rank(t, i) + 1;
+}
+
+uint32_t succinct_no(const SuccinctTree *t, uint32_t i) {
+	return 2 * succinct_rank(t, i) + 2;
+}
+
+/* succinct_parent
+ * - Parent of node i; the root (0) has none and gets 0 back
+ */
+uint32_t succinct_parent(const SuccinctTree *t, uint32_t i) {
+	return i == 0 ? 0 : succinct_select(t, (i - 1) / 2);
+}
+
+/* succinct_text
+ * - Text of node i: start at the sample before it and skip ahead
+ */
+const char *succinct_text(const SuccinctTree *t, uint32_t i) {
+	const char* s = t->text + t->textAt[i / SUCCINCT_TEXT_SAMPLE];
+	for(uint32_t skip = i % SUCCINCT_TEXT_SAMPLE; skip > 0; skip--)
+		s += strlen(s) + 1;
+	return s;
+}
+
+/* succinct_bytes
+ * - Heap bytes t holds on to
+ */
+size_t succinct_bytes(const SuccinctTree *t) {
+	size_t words = ((size_t)t->nodes + 63) / 64;
+	size_t samples = ((size_t)t->nodes + SUCCINCT_TEXT_SAMPLE - 1) / SUCCINCT_TEXT_SAMPLE;
+	return words * (sizeof(uint64_t) + sizeof(uint32_t)) + t->textSize + samples * sizeof(uint64_t);
+}
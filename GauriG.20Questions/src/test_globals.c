@@ -1,7 +1,8 @@
 /*
  * test_globals.c
  * 
- * This file defines the global variables needed by the test suite.
+ * This file defines the global variables needed by the test suite
+ * and the benchmarks.
  * These same variables are defined in main.c for the actual game,
  * but tests.c needs its own copy to avoid linking conflicts.
  * 
@@ -13,11 +14,11 @@
 #include "lab5.h"
 
 /* Global tree root */
-Node *g_root = NULL;
+NodeId g_root = NODE_NIL;
 
 /* Global undo/redo stacks */
 EditStack g_undo = {NULL, 0, 0};
 EditStack g_redo = {NULL, 0, 0};
 
 /* Global attribute index */
-Hash g_index = {NULL, 0, 0};
+Hash g_index = {NULL, 0, 0, NULL, 0, 0, 0};
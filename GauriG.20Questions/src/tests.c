@@ -1,9 +1,97 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include "lab5.h"
 
+/* Test Node Arena */
+void test_arena() {
+    printf("Testing Node Arena...\n");
+    
+    NodeArena a;
+    arena_init(&a);
+    
+    /* Slot 0 is reserved, so the first node is 1 and ids are contiguous */
+    NodeId first = arena_alloc(&a, "Q", 1);
+    assert(first == 1);
+    for (int i = 0; i < 1000; i++) {
+        char name[20];
+        sprintf(name, "animal%d", i);
+        assert(arena_alloc(&a, name, 0) == (NodeId)(i + 2));
+    }
+    assert(a.count == 1002);
+    assert(a.capacity >= 1002);
+    assert(strcmp(a.strings.bytes + a.nodes[1001].text, "animal999") == 0);
+    assert(links_question(a.links[first]) && links_yes(a.links[first]) == NODE_NIL);
+    assert(a.links[1001].yes == NODE_NIL && a.links[1001].no == NODE_NIL);
+    
+    /* Walks read only the links: eight nodes to a 64-byte line */
+    assert(sizeof(NodeLinks) == 8);
+    
+    /* Reset drops everything at once but keeps the memory */
+    uint32_t cap = a.capacity;
+    arena_reset(&a);
+    assert(a.count == 1 && a.strings.size == 0);
+    assert(a.capacity == cap);
+    assert(arena_alloc(&a, "again", 0) == 1);
+    
+    arena_free(&a);
+    assert(a.links == NULL && a.nodes == NULL && a.strings.bytes == NULL);
+    printf("  ✓ Arena tests passed\n");
+}
+
+/* Test String Pool */
+void test_intern() {
+    printf("Testing String Pool...\n");
+    
+    StringPool p;
+    sp_init(&p);
+    
+    /* Identical texts share one copy; different texts do not */
+    uint32_t a = sp_intern(&p, "Does it live in water?");
+    uint32_t b = sp_intern(&p, "Does it live in water?");
+    uint32_t c = sp_intern(&p, "does it live in water?");
+    assert(a == b);
+    assert(a != c);
+    assert(strcmp(p.bytes + c, "does it live in water?") == 0);
+    
+    /* Many repeats across a growing table */
+    for (int i = 0; i < 2000; i++) {
+        char name[20];
+        sprintf(name, "animal%d", i % 100);
+        uint32_t off = sp_intern(&p, name);
+        assert(strcmp(p.bytes + off, name) == 0);
+    }
+    
+    InternStats st;
+    sp_stats(&p, &st);
+    assert(st.strings == 102);
+    assert(st.hits == 1 + 1900);
+    assert(st.bytesStored == p.size);
+    assert(st.bytesSaved == st.bytesRequested - st.bytesStored);
+    assert(st.bytesSaved > 0);
+    
+    /* Nodes with the same text point at the same bytes */
+    NodeId q1 = create_question_node("Can it fly?");
+    NodeId q2 = create_question_node("Can it fly?");
+    assert(q1 != q2);
+    assert(node_text(q1) == node_text(q2));
+    free_tree();
+    
+    sp_reset(&p);
+    assert(p.count == 0 && p.size == 0);
+    assert(sp_intern(&p, "Cat") == 0);
+    
+    sp_free(&p);
+    printf("  ✓ String pool tests passed\n");
+}
+
 /* Test Frame Stack */
 void test_stack() {
     printf("Testing Frame Stack...\n");
@@ -13,28 +101,28 @@ void test_stack() {
     
     assert(fs_empty(&s));
     
-    Node dummy1 = {0};
-    Node dummy2 = {0};
+    NodeId dummy1 = 1;
+    NodeId dummy2 = 2;
     
-    fs_push(&s, &dummy1, 1);
-    fs_push(&s, &dummy2, 0);
+    fs_push(&s, dummy1, 1);
+    fs_push(&s, dummy2, 0);
     
     assert(s.size == 2);
     assert(!fs_empty(&s));
     
     Frame f = fs_pop(&s);
-    assert(f.node == &dummy2);
+    assert(f.node == dummy2);
     assert(f.answeredYes == 0);
     
     f = fs_pop(&s);
-    assert(f.node == &dummy1);
+    assert(f.node == dummy1);
     assert(f.answeredYes == 1);
     
     assert(fs_empty(&s));
     
     /* Test resize */
     for (int i = 0; i < 100; i++) {
-        fs_push(&s, &dummy1, i % 2);
+        fs_push(&s, dummy1, i % 2);
     }
     assert(s.size == 100);
     assert(s.capacity >= 100);
@@ -52,32 +140,57 @@ void test_queue() {
     
     assert(q_empty(&q));
     
-    Node dummy1 = {0};
-    Node dummy2 = {0};
-    Node dummy3 = {0};
+    NodeId dummy1 = 1;
+    NodeId dummy2 = 2;
+    NodeId dummy3 = 3;
     
-    q_enqueue(&q, &dummy1, 1);
-    q_enqueue(&q, &dummy2, 2);
-    q_enqueue(&q, &dummy3, 3);
+    q_enqueue(&q, dummy1, 1);
+    q_enqueue(&q, dummy2, 2);
+    q_enqueue(&q, dummy3, 3);
     
     assert(q.size == 3);
     
-    Node *n;
+    NodeId n;
     int id;
     
     assert(q_dequeue(&q, &n, &id));
-    assert(n == &dummy1 && id == 1);
+    assert(n == dummy1 && id == 1);
     
     assert(q_dequeue(&q, &n, &id));
-    assert(n == &dummy2 && id == 2);
+    assert(n == dummy2 && id == 2);
     
     assert(q_dequeue(&q, &n, &id));
-    assert(n == &dummy3 && id == 3);
+    assert(n == dummy3 && id == 3);
     
     assert(q_empty(&q));
     assert(!q_dequeue(&q, &n, &id));
     
+    /* Wrap around the end of the ring, then grow while wrapped */
+    for (int i = 0; i < 10; i++) {
+        q_enqueue(&q, (NodeId)i, i);
+    }
+    for (int i = 0; i < 10; i++) {
+        assert(q_dequeue(&q, &n, &id) && id == i);
+    }
+    for (int i = 0; i < 100; i++) {
+        q_enqueue(&q, (NodeId)i, i);
+    }
+    assert(q.size == 100);
+    assert(q.capacity >= 100 && (q.capacity & (q.capacity - 1)) == 0);
+    for (int i = 0; i < 100; i++) {
+        assert(q_dequeue(&q, &n, &id));
+        assert(n == (NodeId)i && id == i);
+    }
+    assert(q_empty(&q));
+    
+    /* q_reserve rounds up to a power of two and keeps queued entries */
+    q_enqueue(&q, dummy1, 7);
+    q_reserve(&q, 1000);
+    assert(q.capacity == 1024);
+    assert(q_dequeue(&q, &n, &id) && n == dummy1 && id == 7);
+    
     q_free(&q);
+    assert(q.items == NULL && q.size == 0);
     printf("  ✓ Queue tests passed\n");
 }
 
@@ -115,7 +228,78 @@ void test_hash() {
     
     assert(h.size > 2);
     
+    /* Past the initial hint the table resizes; every key stays findable */
+    for (int i = 0; i < 20000; i++) {
+        char key[20];
+        sprintf(key, "grow%d", i);
+        assert(h_put(&h, key, i));
+        assert(h_put(&h, key, i + 1));
+        assert(!h_put(&h, key, i));
+    }
+    assert(h.size == 2 + 50 + 20000);
+    assert(h.nslots * 4 >= h.size * 5);
+    for (int i = 0; i < 20000; i++) {
+        char key[20];
+        sprintf(key, "grow%d", i);
+        assert(h_contains(&h, key, i) && h_contains(&h, key, i + 1));
+        assert(!h_contains(&h, key, i + 2));
+        ids = h_get_ids(&h, key, &count);
+        assert(count == 2 && ids[0] == i && ids[1] == i + 1);
+        sprintf(key, "miss%d", i);
+        assert(h_get_ids(&h, key, &count) == NULL && count == 0);
+    }
+    assert(h_contains(&h, "meow", 3));
+    
+    /* Removing ids; the last one drops the key */
+    assert(h_remove(&h, "meow", 1));
+    assert(!h_remove(&h, "meow", 1));
+    assert(!h_contains(&h, "meow", 1) && h_contains(&h, "meow", 3));
+    assert(h_remove(&h, "meow", 3));
+    assert(h_get_ids(&h, "meow", &count) == NULL);
+    assert(!h_remove(&h, "chirp", 1));
+    
+    /* Backward-shift deletion keeps every other key reachable */
+    int before = h.size;
+    for (int i = 0; i < 20000; i += 2) {
+        char key[20];
+        sprintf(key, "grow%d", i);
+        assert(h_remove(&h, key, i) && h_remove(&h, key, i + 1));
+    }
+    assert(h.size == before - 10000);
+    for (int i = 0; i < 20000; i++) {
+        char key[20];
+        sprintf(key, "grow%d", i);
+        assert(h_contains(&h, key, i) == (i % 2 == 1));
+    }
+    
+    /* Re-adding after removals reuses space once the slab is compacted */
+    for (int i = 1; i < 20000; i += 2) {
+        char key[20];
+        sprintf(key, "grow%d", i);
+        h_remove(&h, key, i);
+        h_remove(&h, key, i + 1);
+    }
+    assert(h.keysDead * 2 <= h.keysSize);
+    assert(h_put(&h, "grow7", 7) && h_contains(&h, "grow7", 7));
+    
     h_free(&h);
+    assert(h.slots == NULL && h.size == 0);
+    
+    /* A zeroed table (like g_index before h_init) is usable */
+    Hash z = {NULL, 0, 0, NULL, 0, 0, 0};
+    assert(!h_contains(&z, "meow", 1));
+    assert(h_get_ids(&z, "meow", &count) == NULL);
+    assert(h_put(&z, "meow", 1) && h_contains(&z, "meow", 1));
+    
+    /* A key slab that can't take another key without passing 4 GiB
+     * refuses it rather than wrapping (the sizes are faked, never used) */
+    uint32_t keysSize = z.keysSize, keysCapacity = z.keysCapacity;
+    z.keysSize = z.keysCapacity = UINT32_MAX - 3;
+    assert(!h_put(&z, "woof", 2));
+    z.keysSize = keysSize;
+    z.keysCapacity = keysCapacity;
+    assert(!h_contains(&z, "woof", 2) && h_contains(&z, "meow", 1));
+    h_free(&z);
     printf("  ✓ Hash table tests passed\n");
 }
 
@@ -124,28 +308,30 @@ void test_persistence() {
     printf("Testing Persistence...\n");
     
     /* Create a test tree */
-    Node *root = create_question_node("Test question?");
-    root->yes = create_animal_node("Cat");
-    root->no = create_question_node("Another question?");
-    root->no->yes = create_animal_node("Dog");
-    root->no->no = create_animal_node("Fish");
+    NodeId root = create_question_node("Test question?");
+    node_set_yes(root, create_animal_node("Cat"));
+    node_set_no(root, create_question_node("Another question?"));
+    node_set_yes(node_no(root), create_animal_node("Dog"));
+    node_set_no(node_no(root), create_animal_node("Fish"));
     
     /* Save original root */
-    Node *saved_root = g_root;
+    NodeId saved_root = g_root;
     g_root = root;
     
     /* Save */
     assert(save_tree("test.dat"));
     
     /* Free and load */
-    free_tree(g_root);
-    g_root = NULL;
+    free_tree();
+    g_root = NODE_NIL;
     
     assert(load_tree("test.dat"));
-    assert(g_root != NULL);
-    assert(g_root->isQuestion);
-    assert(strcmp(g_root->text, "Test question?") == 0);
-    assert(strcmp(g_root->yes->text, "Cat") == 0);
+    assert(g_root != NODE_NIL);
+    assert(node_is_question(g_root));
+    assert(strcmp(node_text(g_root), "Test question?") == 0);
+    assert(strcmp(node_text(node_yes(g_root)), "Cat") == 0);
+    assert(strcmp(node_text(node_yes(node_no(g_root))), "Dog") == 0);
+    assert(count_nodes(g_root) == 5);
     
     /* Round-trip test */
     assert(save_tree("test2.dat"));
@@ -160,11 +346,39 @@ void test_persistence() {
     
     assert(size1 == size2);
     
+    /* Same tree, same bytes */
+    fseek(f1, 0, SEEK_SET);
+    fseek(f2, 0, SEEK_SET);
+    for (long i = 0; i < size1; i++) {
+        assert(fgetc(f1) == fgetc(f2));
+    }
+    
     fclose(f1);
     fclose(f2);
     
+    /* Saves go through a temp file that is renamed into place */
+    assert(fopen("test.dat.tmp", "rb") == NULL);
+    
+    /* Two questions naming the same children are refused, and the tree
+     * is left alone */
+    FILE *out = fopen("test2.dat", "wb");
+    uint32_t header[3] = {0x41544C35, 1, 5};
+    fwrite(header, sizeof(header), 1, out);
+    for (int i = 0; i < 5; i++) {
+        uint8_t isQ = i < 3;
+        uint32_t len = 1;
+        int32_t ids[2] = {i == 0 ? 1 : i < 3 ? 3 : -1, i == 0 ? 2 : i < 3 ? 4 : -1};
+        fwrite(&isQ, 1, 1, out);
+        fwrite(&len, sizeof(len), 1, out);
+        fwrite(isQ ? "Q" : "A", 1, 1, out);
+        fwrite(ids, sizeof(ids), 1, out);
+    }
+    fclose(out);
+    assert(!load_tree("test2.dat"));
+    assert(count_nodes(g_root) == 5 && check_integrity());
+    
     /* Restore original root */
-    free_tree(g_root);
+    free_tree();
     g_root = saved_root;
     
     remove("test.dat");
@@ -173,30 +387,1858 @@ void test_persistence() {
     printf("  ✓ Persistence tests passed\n");
 }
 
+/* Test mmap'ed VERSION 2 images */
+void test_image() {
+    printf("Testing Mapped Images...\n");
+    
+    NodeId root = create_question_node("Does it live in water?");
+    node_set_yes(root, create_question_node("Does it have fins?"));
+    node_set_yes(node_yes(root), create_animal_node("Fish"));
+    node_set_no(node_yes(root), create_animal_node("Frog"));
+    node_set_no(root, create_animal_node("Dog"));
+    
+    NodeId saved = g_root;
+    g_root = root;
+    uint32_t count = g_arena.count;
+    
+    assert(save_image("test.img"));
+    free_tree();
+    g_root = NODE_NIL;
+    
+    /* Mapping keeps every NodeId and plays straight from the file */
+    assert(map_tree("test.img"));
+    assert(g_arena.nodesMapped && g_arena.strings.external);
+    assert(g_root == root);
+    assert(g_arena.count == count);
+    assert(strcmp(node_text(node_no(node_yes(g_root))), "Frog") == 0);
+    assert(check_integrity());
+    
+    /* Learning on a mapped tree copies it out of the mapping first */
+    NodeId q = create_question_node("Does it bark?");
+    node_set_yes(q, create_animal_node("Dog"));
+    node_set_no(q, create_animal_node("Cat"));
+    node_set_no(g_root, q);
+    assert(!g_arena.nodesMapped && !g_arena.strings.external);
+    assert(g_arena.map == NULL);
+    assert(strcmp(node_text(node_yes(node_yes(g_root))), "Fish") == 0);
+    assert(check_integrity());
+    
+    /* The VERSION 1 path still works from a mapped tree, and open_tree
+     * picks the right loader for either format */
+    assert(save_tree("test.dat"));
+    assert(open_tree("test.dat"));
+    assert(count_nodes(g_root) == 7);
+    assert(save_image("test.img"));
+    assert(open_tree("test.img"));
+    assert(g_arena.nodesMapped);
+    assert(count_nodes(g_root) == 7);
+    
+    /* open_tree checks an image's records, and one it refuses leaves the
+     * current tree alone: here the root's yes link points past the arena */
+    assert(save_image("test2.img"));
+    FILE *fp = fopen("test2.img", "r+b");
+    assert(fp != NULL);
+    uint32_t imageRoot;
+    uint64_t offsets[4];    /* nodes, strings, lsn, links */
+    assert(fseek(fp, 12, SEEK_SET) == 0 && fread(&imageRoot, sizeof(imageRoot), 1, fp) == 1);
+    assert(fseek(fp, 24, SEEK_SET) == 0 && fread(offsets, sizeof(offsets), 1, fp) == 1);
+    uint32_t badYes = NODE_QUESTION | 1000;
+    assert(fseek(fp, (long)(offsets[3] + imageRoot * sizeof(NodeLinks)), SEEK_SET) == 0);
+    assert(fwrite(&badYes, sizeof(badYes), 1, fp) == 1);
+    fclose(fp);
+    assert(!open_tree("test2.img"));
+    assert(count_nodes(g_root) == 7 && check_integrity());
+    
+    /* So is a header whose offsets would wrap when the sections are
+     * added up */
+    fp = fopen("test2.img", "r+b");
+    assert(fp != NULL);
+    offsets[0] = ~(uint64_t)0 - 63;
+    assert(fseek(fp, 24, SEEK_SET) == 0 && fwrite(offsets, sizeof(offsets[0]), 1, fp) == 1);
+    fclose(fp);
+    assert(!map_tree("test2.img") && !open_tree("test2.img"));
+    assert(count_nodes(g_root) == 7 && check_integrity());
+    remove("test2.img");
+    
+    /* Growth that copies the links out of the mapping but can't copy the
+     * nodes leaves both mapped, with no copy left behind (address space
+     * is capped so the bigger array fails; sanitizers need theirs) */
+#if !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+    struct rlimit limit;
+    unsigned long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL && fscanf(statm, "%lu", &pages) == 1 && getrlimit(RLIMIT_AS, &limit) == 0) {
+        struct rlimit capped = limit;
+        capped.rlim_cur = (rlim_t)pages * (rlim_t)sysconf(_SC_PAGESIZE) + ((rlim_t)1 << 30);
+        assert(setrlimit(RLIMIT_AS, &capped) == 0);
+        assert(!arena_reserve(&g_arena, 1u << 26));
+        assert(setrlimit(RLIMIT_AS, &limit) == 0);
+        assert(g_arena.nodesMapped && g_arena.capacity == g_arena.count);
+        assert((char *)g_arena.links >= (char *)g_arena.map && (char *)g_arena.links < (char *)g_arena.map + g_arena.mapSize);
+        assert(count_nodes(g_root) == 7 && check_integrity());
+    }
+    if (statm != NULL)
+        fclose(statm);
+#endif
+    
+    /* A mapped tree that is never modified is released by free_tree */
+    free_tree();
+    assert(g_arena.map == NULL);
+    g_root = saved;
+    
+    /* Truncated images are rejected */
+    assert(truncate("test.img", 70) == 0);
+    assert(!map_tree("test.img"));
+    
+    remove("test.img");
+    remove("test.dat");
+    printf("  ✓ Mapped image tests passed\n");
+}
+
+/* Test Cached Subtree Statistics */
+void test_stats() {
+    printf("Testing Tree Statistics...\n");
+    
+    NodeId saved = g_root;
+    TreeStats ts;
+    tree_stats(NODE_NIL, &ts);
+    assert(ts.nodes == 0 && ts.animals == 0 && ts.questions == 0 && ts.height == 0);
+    
+    NodeId root = create_question_node("Does it live in water?");
+    NodeId fish = create_animal_node("Fish");
+    NodeId dog = create_animal_node("Dog");
+    node_set_yes(root, fish);
+    node_set_no(root, dog);
+    tree_set_root(root);
+    tree_stats(g_root, &ts);
+    assert(ts.nodes == 3 && ts.animals == 2 && ts.questions == 1 && ts.height == 2);
+    assert(node_parent(fish) == root && node_parent(root) == NODE_NIL);
+    
+    /* A learn splits Dog; every ancestor is refreshed */
+    NodeId q = create_question_node("Does it bark?");
+    NodeId cat = create_animal_node("Cat");
+    node_set_yes(q, dog);
+    node_set_no(q, cat);
+    node_set_no(root, q);
+    tree_stats(g_root, &ts);
+    assert(ts.nodes == 5 && ts.animals == 3 && ts.questions == 2 && ts.height == 3);
+    assert(node_parent(dog) == q && node_parent(q) == root);
+    assert(count_nodes(q) == 3);
+    assert(check_integrity());
+    
+    /* Undo puts Dog back; redo re-links it under the question */
+    node_set_no(root, dog);
+    tree_stats(g_root, &ts);
+    assert(ts.nodes == 3 && ts.height == 2 && node_parent(dog) == root);
+    assert(check_integrity());
+    node_set_yes(q, dog);
+    node_set_no(root, q);
+    assert(count_nodes(g_root) == 5 && node_parent(dog) == q);
+    assert(check_integrity());
+    
+    /* A split at the root, undone */
+    NodeId top = create_question_node("Is it alive?");
+    NodeId rock = create_animal_node("Rock");
+    node_set_yes(top, root);
+    node_set_no(top, rock);
+    tree_set_root(top);
+    assert(count_nodes(g_root) == 7);
+    assert(check_integrity());
+    tree_set_root(root);
+    assert(check_integrity());
+    tree_set_root(top);
+    
+    /* Stats survive both file formats */
+    assert(save_tree("test.dat"));
+    assert(load_tree("test.dat"));
+    tree_stats(g_root, &ts);
+    assert(ts.nodes == 7 && ts.animals == 4 && ts.height == 4);
+    assert(check_integrity());
+    assert(save_image("test.img"));
+    assert(map_tree("test.img"));
+    tree_stats(g_root, &ts);
+    assert(ts.nodes == 7 && ts.animals == 4 && ts.height == 4);
+    assert(check_integrity());
+    
+    /* Stale stats are caught by the integrity checker */
+    free_tree();
+    root = create_question_node("Q");
+    node_set_yes(root, create_animal_node("A"));
+    node_set_no(root, create_animal_node("B"));
+    tree_set_root(root);
+    node_at(root)->size = 2;
+    assert(!check_integrity());
+    node_at(root)->size = 3;
+    node_at(node_yes(root))->parent = NODE_NIL;
+    assert(!check_integrity());
+    
+    /* A long chain: height is its length, and nothing recurses */
+    free_tree();
+    NodeId bottom = create_animal_node("Animal 0");
+    tree_set_root(bottom);
+    for (int i = 1; i <= 2000; i++) {
+        char name[32];
+        sprintf(name, "Animal %d", i);
+        NodeId split = create_question_node("Is it this one?");
+        NodeId leaf = create_animal_node(name);
+        NodeId parent = node_parent(bottom);
+        node_set_yes(split, leaf);
+        node_set_no(split, bottom);
+        if (parent == NODE_NIL)
+            tree_set_root(split);
+        else
+            node_set_no(parent, split);
+        bottom = node_no(split);
+    }
+    tree_stats(g_root, &ts);
+    assert(ts.nodes == 4001 && ts.animals == 2001 && ts.height == 2001);
+    assert(check_integrity());
+    
+    free_tree();
+    g_root = saved;
+    remove("test.dat");
+    remove("test.img");
+    printf("  ✓ Tree statistics tests passed\n");
+}
+
+/* Test Epoch-Based Reclamation */
+void test_epoch() {
+    printf("Testing Epoch Reclamation...\n");
+    
+    int r = epoch_register();
+    assert(r >= 0);
+    
+    /* Nobody inside: a retired block goes after two advances */
+    epoch_retire(malloc(16));
+    epoch_reclaim();
+    assert(epoch_pending() == 0);
+    
+    /* A reader inside holds back everything retired while it is there */
+    epoch_enter(r);
+    epoch_retire(malloc(16));
+    epoch_retire(malloc(16));
+    for (int i = 0; i < 10; i++)
+        epoch_reclaim();
+    assert(epoch_pending() == 2);
+    epoch_exit(r);
+    epoch_reclaim();
+    epoch_reclaim();
+    assert(epoch_pending() == 0);
+    
+    /* An idle but registered reader doesn't hold anything back */
+    epoch_retire(malloc(16));
+    epoch_reclaim();
+    assert(epoch_pending() == 0);
+    
+    epoch_enter(r);
+    epoch_retire(malloc(16));
+    epoch_exit(r);
+    epoch_unregister(r);
+    epoch_drain();
+    assert(epoch_pending() == 0);
+    printf("  ✓ Epoch tests passed\n");
+}
+
+/* Test Concurrent Readers
+ * Reader threads play games lock-free while this thread learns enough
+ * animals to grow (and retire) the node array and the text slab many
+ * times over. Under ASan a reader touching a freed array is caught. */
+#define SHARED_READERS 3
+#define SHARED_LEARNS 20000
+
+static int g_sharedStop;
+
+static void *shared_reader(void *arg) {
+    unsigned seed = (unsigned)(size_t)arg;
+    int slot = epoch_register();
+    assert(slot >= 0);
+    GameSession game;
+    engine_init(&game);
+    
+    long games = 0;
+    while (!__atomic_load_n(&g_sharedStop, __ATOMIC_ACQUIRE)) {
+        epoch_enter(slot);
+        engine_start(&game);
+        while (game.state == ENGINE_QUESTION) {
+            assert(node_text(game.current)[0] == 'I');
+            assert(engine_answer(&game, rand_r(&seed) & 1));
+        }
+        assert(game.state == ENGINE_GUESS);
+        assert(node_text(game.current)[0] == 'A');
+        epoch_exit(slot);
+        games++;
+    }
+    
+    engine_free(&game);
+    epoch_unregister(slot);
+    return (void *)games;
+}
+
+void test_concurrent() {
+    printf("Testing Concurrent Readers...\n");
+    
+    NodeId saved = g_root;
+    NodeId root = create_question_node("Is it big?");
+    node_set_yes(root, create_animal_node("A whale"));
+    node_set_no(root, create_animal_node("A mouse"));
+    tree_set_root(root);
+    index_rebuild();
+    arena_set_retire(&g_arena, epoch_retire);
+    
+    pthread_t readers[SHARED_READERS];
+    g_sharedStop = 0;
+    for (long i = 0; i < SHARED_READERS; i++)
+        assert(pthread_create(&readers[i], NULL, shared_reader, (void *)(i + 1)) == 0);
+    
+    /* The writer: a fresh session that guesses wrong every time */
+    GameSession game;
+    engine_init(&game);
+    unsigned seed = 7;
+    for (int i = 0; i < SHARED_LEARNS; i++) {
+        char animal[32], question[48];
+        sprintf(animal, "A beast %d", i);
+        sprintf(question, "Is it beast %d?", i);
+        engine_start(&game);
+        while (game.state == ENGINE_QUESTION)
+            engine_answer(&game, rand_r(&seed) & 1);
+        assert(engine_answer(&game, 0));
+        assert(engine_submit(&game, animal));
+        assert(engine_submit(&game, question));
+        assert(engine_answer(&game, 1) && game.result == ENGINE_LEARNED);
+    }
+    
+    __atomic_store_n(&g_sharedStop, 1, __ATOMIC_RELEASE);
+    long played = 0;
+    for (int i = 0; i < SHARED_READERS; i++) {
+        void *games;
+        pthread_join(readers[i], &games);
+        played += (long)games;
+    }
+    assert(played > 0);
+    assert(count_nodes(g_root) == 3 + 2 * SHARED_LEARNS);
+    assert(check_integrity());
+    
+    engine_free(&game);
+    arena_set_retire(&g_arena, NULL);
+    epoch_drain();
+    free_tree();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    g_root = saved;
+    printf("  ✓ Concurrent reader tests passed (%ld games read alongside)\n", played);
+}
+
+/* Test Racing Learners
+ * Every thread walks to the same wrong guess, then they all teach at
+ * once. Each splice is a compare-and-swap; the losers descend into the
+ * winner's question, so every animal must still be in the tree, and
+ * undoing everything (in whatever order the edits were recorded) must
+ * give back the starting tree. */
+#define RACE_THREADS 4
+#define RACE_ROUNDS 500
+
+static pthread_barrier_t g_raceBarrier;
+
+static void *race_learner(void *arg) {
+    int id = (int)(size_t)arg;
+    int slot = epoch_register();
+    assert(slot >= 0);
+    GameSession game;
+    engine_init(&game);
+    
+    for (int r = 0; r < RACE_ROUNDS; r++) {
+        char animal[32], question[48];
+        sprintf(animal, "A racer %d.%d", id, r);
+        sprintf(question, "Is it racer %d.%d?", id, r);
+        
+        /* New animals go on the yes side, so "no" always leads to Dog */
+        epoch_enter(slot);
+        assert(engine_start(&game));
+        while (game.state == ENGINE_QUESTION)
+            assert(engine_answer(&game, 0));
+        assert(strcmp(node_text(game.current), "Dog") == 0);
+        epoch_exit(slot);
+        assert(engine_answer(&game, 0));
+        assert(engine_submit(&game, animal));
+        assert(engine_submit(&game, question));
+        
+        pthread_barrier_wait(&g_raceBarrier);
+        assert(engine_answer(&game, 1) && game.result == ENGINE_LEARNED);
+    }
+    
+    engine_free(&game);
+    epoch_unregister(slot);
+    return NULL;
+}
+
+void test_learn_race() {
+    printf("Testing Racing Learners...\n");
+    
+    NodeId saved = g_root;
+    NodeId root = create_question_node("Does it live in water?");
+    node_set_yes(root, create_animal_node("Fish"));
+    node_set_no(root, create_animal_node("Dog"));
+    tree_set_root(root);
+    index_rebuild();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    arena_set_retire(&g_arena, epoch_retire);
+    
+    pthread_t threads[RACE_THREADS];
+    assert(pthread_barrier_init(&g_raceBarrier, NULL, RACE_THREADS) == 0);
+    for (long i = 0; i < RACE_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, race_learner, (void *)i) == 0);
+    for (int i = 0; i < RACE_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&g_raceBarrier);
+    
+    /* No insert was lost */
+    const int learned = RACE_THREADS * RACE_ROUNDS;
+    TreeStats st;
+    tree_stats(g_root, &st);
+    assert(st.nodes == 3u + 2u * learned && st.animals == 2u + learned);
+    assert(check_integrity());
+    assert(g_undo.size == learned);
+    for (int i = 0; i < RACE_THREADS; i++) {
+        for (int r = 0; r < RACE_ROUNDS; r++) {
+            char animal[32];
+            int n;
+            sprintf(animal, "A racer %d.%d", i, r);
+            index_find(animal, 0, &n);
+            assert(n == 1);
+        }
+    }
+    
+    /* The undo records agree with the tree */
+    for (int i = 0; i < learned; i++)
+        assert(undo_last_edit());
+    assert(g_root == root && count_nodes(g_root) == 3);
+    assert(strcmp(node_text(node_no(root)), "Dog") == 0);
+    assert(check_integrity());
+    for (int i = 0; i < learned; i++)
+        assert(redo_last_edit());
+    assert(count_nodes(g_root) == 3 + 2 * learned);
+    assert(check_integrity());
+    
+    arena_set_retire(&g_arena, NULL);
+    epoch_drain();
+    free_tree();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    g_root = saved;
+    printf("  ✓ Racing learner tests passed (%d animals from %d threads)\n", learned, RACE_THREADS);
+}
+
+/* teach
+ * - Play one game answering no throughout, then teach animal with a
+ *   question whose answer for it is yes
+ */
+static void teach(const char *animal, const char *question) {
+    GameSession game;
+    engine_init(&game);
+    assert(engine_start(&game));
+    while (game.state == ENGINE_QUESTION)
+        assert(engine_answer(&game, 0));
+    assert(engine_answer(&game, 0));
+    assert(engine_submit(&game, animal));
+    assert(engine_submit(&game, question));
+    assert(engine_answer(&game, 1) && game.result == ENGINE_LEARNED);
+    engine_free(&game);
+}
+
+/* Test the Edit Journal */
+void test_journal() {
+    printf("Testing Edit Journal...\n");
+    
+    NodeId saved = g_root;
+    remove("test.jrn");
+    remove("test.jrn.log");
+    remove("test.jrn.log.old");
+    NodeId root = create_question_node("Does it live in water?");
+    node_set_yes(root, create_animal_node("Fish"));
+    node_set_no(root, create_animal_node("Dog"));
+    tree_set_root(root);
+    index_rebuild();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    
+    /* Without an image the current tree becomes one */
+    assert(journal_open("test.jrn", 1u << 30));
+    assert(journal_active() && journal_lsn() == 0);
+    assert(image_lsn("test.jrn") == 0);
+    assert(!journal_open("test.jrn", 1u << 30));
+    
+    for (int i = 0; i < 5; i++) {
+        char animal[32], question[48];
+        sprintf(animal, "Journaled %d", i);
+        sprintf(question, "Is it journaled %d?", i);
+        teach(animal, question);
+    }
+    assert(undo_last_edit() && redo_last_edit() && undo_last_edit());
+    assert(journal_lsn() == 8);
+    int nodes = count_nodes(g_root);
+    NodeId top = g_root;
+    NodeId deep = node_no(node_no(g_root));
+    char deepText[48];
+    strcpy(deepText, node_text(deep));
+    
+    /* Everything synced survives a crash that never checkpointed */
+    assert(journal_sync());
+    journal_close();
+    assert(!journal_active());
+    free_tree();
+    g_root = NODE_NIL;
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    
+    assert(journal_open("test.jrn", 1u << 30));
+    JournalStats js;
+    journal_stats(&js);
+    assert(js.replayed == 8 && js.lsn == 8);
+    assert(g_root == top && count_nodes(g_root) == nodes);
+    assert(strcmp(node_text(deep), deepText) == 0);
+    assert(g_undo.size == 4 && g_redo.size == 1);
+    assert(check_integrity());
+    int n;
+    index_find("Journaled 3", 0, &n);
+    assert(n == 1);
+    assert(redo_last_edit());
+    assert(count_nodes(g_root) == nodes + 2);
+    
+    /* A checkpoint folds the log into the image and leaves no old log */
+    assert(journal_checkpoint());
+    assert(image_lsn("test.jrn") == 9);
+    assert(access("test.jrn.log.old", F_OK) != 0);
+    teach("Journaled 5", "Is it journaled 5?");
+    nodes = count_nodes(g_root);
+    journal_close();
+    
+    /* A torn record at the end of the log is dropped, the rest replayed */
+    FILE *fp = fopen("test.jrn.log", "ab");
+    assert(fp != NULL);
+    uint32_t torn[3] = {100, 0x12345678, 7};
+    fwrite(torn, sizeof(torn), 1, fp);
+    fclose(fp);
+    free_tree();
+    g_root = NODE_NIL;
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    assert(journal_open("test.jrn", 1u << 30));
+    journal_stats(&js);
+    assert(js.replayed == 1 && js.lsn == 10);
+    assert(count_nodes(g_root) == nodes);
+    assert(g_undo.size == 6 && g_redo.size == 0);
+    assert(check_integrity());
+    
+    /* Undoing after recovery is journaled like any other edit */
+    assert(undo_last_edit());
+    assert(journal_lsn() == 11);
+    journal_close();
+    
+    /* After a failed checkpoint (the image path is a directory) and a
+     * good one, the log is compacted again as soon as it is over the
+     * limit, not only past where the failure said to wait */
+    assert(journal_create("test.jrn", 2048));
+    remove("test.jrn");
+    assert(mkdir("test.jrn", 0755) == 0);
+    for (int i = 0; i < 200; i++) {
+        char animal[32], question[48];
+        sprintf(animal, "Retried %d", i);
+        sprintf(question, "Is it retried %d?", i);
+        teach(animal, question);
+    }
+    assert(journal_sync() && !journal_checkpoint());
+    journal_stats(&js);
+    assert(js.compactions == 0 && js.logBytes > 2048);
+    assert(rmdir("test.jrn") == 0);
+    assert(journal_checkpoint());
+    for (int wait = 0; wait < 200 && js.compactions < 2; wait++) {
+        usleep(10000);
+        journal_stats(&js);
+    }
+    assert(js.compactions >= 2);
+    journal_close();
+    
+    free_tree();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    g_root = saved;
+    remove("test.jrn");
+    remove("test.jrn.log");
+    remove("test.jrn.log.old");
+    remove("test.jrn.tmp");
+    printf("  ✓ Journal tests passed\n");
+}
+
+/* same_prefix / same_file
+ * - Do two files hold the same first n bytes (n < 0: all of them)?
+ */
+static int same_prefix(const char *a, const char *b, long n) {
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    int same = fa != NULL && fb != NULL;
+    for (long i = 0; same && i != n; i++) {
+        int ca = fgetc(fa);
+        int cb = fgetc(fb);
+        same = ca == cb;
+        if (ca == EOF)
+            break;
+    }
+    if (fa != NULL)
+        fclose(fa);
+    if (fb != NULL)
+        fclose(fb);
+    return same;
+}
+
+static int same_file(const char *a, const char *b) {
+    return same_prefix(a, b, -1);
+}
+
+/* teach_random
+ * - Play one game with random answers, then teach the animal after a
+ *   wrong guess
+ */
+static void teach_random(int i) {
+    char animal[32], question[48];
+    sprintf(animal, "Paged %d", i);
+    sprintf(question, "Is it paged %d?", i);
+    GameSession game;
+    engine_init(&game);
+    assert(engine_start(&game));
+    while (game.state == ENGINE_QUESTION)
+        assert(engine_answer(&game, rand() & 1));
+    assert(engine_answer(&game, 0));
+    assert(engine_submit(&game, animal));
+    assert(engine_submit(&game, question));
+    assert(engine_answer(&game, rand() & 1) && game.result == ENGINE_LEARNED);
+    engine_free(&game);
+}
+
+/* Test Page Snapshots */
+void test_pages() {
+    printf("Testing Page Snapshots...\n");
+    
+    NodeId saved = g_root;
+    remove_pages("test.pg");
+    remove_pages("full.pg");
+    NodeId root = create_question_node("Does it live in water?");
+    node_set_yes(root, create_animal_node("Fish"));
+    node_set_no(root, create_animal_node("Dog"));
+    tree_set_root(root);
+    index_rebuild();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    srand(7);
+    for (int i = 0; i < 5000; i++)
+        teach_random(i);
+    
+    /* The first save writes every page */
+    PageStats ps;
+    assert(save_pages("test.pg"));
+    pages_stats(&ps);
+    assert(ps.pages > 10 && ps.rebuilt == ps.pages && ps.written == ps.pages);
+    uint32_t pages = ps.pages;
+    
+    /* Saving an unchanged tree reads no page and writes only the table */
+    assert(save_pages("test.pg"));
+    pages_stats(&ps);
+    assert(ps.pages == pages && ps.rebuilt == 0 && ps.written == 0);
+    
+    /* One learned animal rewrites a page or two, not the tree */
+    teach_random(5000);
+    assert(save_pages("test.pg"));
+    pages_stats(&ps);
+    assert(ps.rebuilt >= 1 && ps.rebuilt <= 3 && ps.written >= 1 && ps.written <= ps.rebuilt);
+    
+    /* After any mix of learning, undo and redo, the incremental save is
+     * the save that reads every page */
+    for (int round = 0; round < 20; round++) {
+        for (int k = 0; k < 25; k++) {
+            int op = rand() % 4;
+            if (op == 0)
+                undo_last_edit();
+            else if (op == 1)
+                redo_last_edit();
+            else
+                teach_random(6000 + round * 25 + k);
+        }
+        assert(save_pages("test.pg"));
+        pages_stats(&ps);
+        assert(ps.rebuilt < ps.pages / 2);
+        pages_forget();
+        assert(save_pages("full.pg"));
+        pages_stats(&ps);
+        assert(ps.rebuilt == ps.pages);
+        assert(same_file("test.pg", "full.pg"));
+        assert(save_pages("test.pg"));
+    }
+    
+    /* Loading keeps every id and picks up where the save left off */
+    int nodes = count_nodes(g_root);
+    NodeId top = g_root;
+    NodeId deep = node_yes(node_no(node_yes(g_root)));
+    char deepText[48];
+    strcpy(deepText, node_text(deep));
+    free_tree();
+    g_root = NODE_NIL;
+    assert(open_tree("test.pg"));
+    assert(g_root == top && count_nodes(g_root) == nodes);
+    assert(strcmp(node_text(deep), deepText) == 0);
+    assert(check_integrity());
+    int n;
+    index_find("Paged 42", 0, &n);
+    assert(n == 1);
+    assert(save_pages("test.pg"));
+    pages_stats(&ps);
+    assert(ps.rebuilt == 0 && ps.written == 0);
+    teach_random(9000);
+    assert(save_pages("test.pg"));
+    pages_stats(&ps);
+    assert(ps.rebuilt >= 1 && ps.rebuilt <= 3);
+    
+    /* Page files no table names any more are removed */
+    char dir[] = "test.pg.pages";
+    uint32_t files = 0;
+    DIR *d = opendir(dir);
+    assert(d != NULL);
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+        files += ent->d_name[0] != '.';
+    closedir(d);
+    assert(files == ps.pages);
+    
+    /* A damaged page is refused and the tree left alone */
+    d = opendir(dir);
+    char path[320];
+    while ((ent = readdir(d)) != NULL && ent->d_name[0] == '.')
+        ;
+    sprintf(path, "%s/%s", dir, ent->d_name);
+    closedir(d);
+    FILE *fp = fopen(path, "r+b");
+    assert(fp != NULL);
+    fseek(fp, 9, SEEK_SET);
+    fputc('#', fp);
+    fclose(fp);
+    nodes = count_nodes(g_root);
+    assert(!load_pages("test.pg"));
+    assert(count_nodes(g_root) == nodes);
+    
+    pages_forget();
+    free_tree();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    g_root = saved;
+    remove_pages("test.pg");
+    assert(access("test.pg", F_OK) != 0 && access("test.pg.pages", F_OK) != 0);
+    remove_pages("full.pg");
+    printf("  ✓ Page snapshot tests passed (%u pages)\n", pages);
+}
+
+/* Test the Parallel Save */
+void test_parallel_save() {
+    printf("Testing Parallel Save...\n");
+    
+    NodeId saved = g_root;
+    const int threads[] = {2, 3, 8, 32};
+    
+    /* A tree too small to split, a bushy one and a long chain all come
+     * out byte for byte as save_tree writes them */
+    for (int shape = 0; shape < 3; shape++) {
+        free_tree();
+        NodeId root = create_question_node("Does it live in water?");
+        node_set_yes(root, create_animal_node("Fish"));
+        node_set_no(root, create_animal_node("Dog"));
+        tree_set_root(root);
+        index_rebuild();
+        srand(11);
+        if (shape == 1) {
+            for (int i = 0; i < 3000; i++)
+                teach_random(i);
+        } else if (shape == 2) {
+            for (int i = 0; i < 2000; i++) {
+                char text[32];
+                sprintf(text, "Is it link %d?", i);
+                NodeId q = create_question_node(text);
+                sprintf(text, "Link %d", i);
+                node_set_no(q, create_animal_node(text));
+                node_set_yes(q, g_root);
+                tree_set_root(q);
+            }
+        }
+        assert(save_tree("test.dat"));
+        for (int t = 0; t < 4; t++) {
+            assert(save_tree_parallel("test2.dat", threads[t]));
+            assert(same_file("test.dat", "test2.dat"));
+        }
+        
+        int nodes = count_nodes(g_root);
+        assert(load_tree("test2.dat"));
+        assert(count_nodes(g_root) == nodes);
+        assert(check_integrity());
+    }
+    
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    free_tree();
+    g_root = NODE_NIL;
+    assert(!save_tree_parallel("test2.dat", 4));
+    g_root = saved;
+    remove("test.dat");
+    remove("test2.dat");
+    printf("  ✓ Parallel save tests passed\n");
+}
+
+/* Test the Parallel Load */
+void test_parallel_load() {
+    printf("Testing Parallel Load...\n");
+    
+    NodeId saved = g_root;
+    const int threads[] = {2, 3, 8, 32};
+    
+    /* Every thread count rebuilds the tree save_tree wrote */
+    for (int shape = 0; shape < 3; shape++) {
+        free_tree();
+        NodeId root = create_question_node("Does it live in water?");
+        node_set_yes(root, create_animal_node("Fish"));
+        node_set_no(root, create_animal_node("Dog"));
+        tree_set_root(root);
+        index_rebuild();
+        srand(12);
+        if (shape == 1) {
+            for (int i = 0; i < 3000; i++)
+                teach_random(i);
+        } else if (shape == 2) {
+            for (int i = 0; i < 2000; i++) {
+                char text[32];
+                sprintf(text, "Is it link %d?", i);
+                NodeId q = create_question_node(text);
+                sprintf(text, "Link %d", i);
+                node_set_no(q, create_animal_node(text));
+                node_set_yes(q, g_root);
+                tree_set_root(q);
+            }
+        }
+        assert(save_tree("test.dat"));
+        int nodes = count_nodes(g_root);
+        for (int t = 0; t < 4; t++) {
+            assert(load_tree_parallel("test.dat", threads[t]));
+            assert(count_nodes(g_root) == nodes);
+            assert(check_integrity());
+            assert(save_tree("test2.dat"));
+            assert(same_file("test.dat", "test2.dat"));
+        }
+        
+        /* Texts pooled by different threads are found again when learning */
+        int n = 0;
+        index_find("Fish", 0, &n);
+        assert(n == 1);
+        teach_random(5000);
+        assert(count_nodes(g_root) == nodes + 2);
+        assert(check_integrity());
+    }
+    
+    /* A truncated file is refused and the tree left alone */
+    int nodes = count_nodes(g_root);
+    FILE *fp = fopen("test.dat", "rb");
+    FILE *out = fopen("test2.dat", "wb");
+    char buf[4096];
+    size_t n = fread(buf, 1, sizeof(buf), fp);
+    fwrite(buf, 1, n - 3, out);
+    fclose(fp);
+    fclose(out);
+    assert(!load_tree_parallel("test2.dat", 4));
+    assert(count_nodes(g_root) == nodes);
+    
+    /* So is a node listed as the child of two questions */
+    out = fopen("test2.dat", "wb");
+    uint32_t header[3] = {0x41544C35, 1, 3};
+    fwrite(header, sizeof(header), 1, out);
+    for (int i = 0; i < 3; i++) {
+        uint8_t isQ = i < 2;
+        uint32_t len = 1;
+        int32_t ids[2] = {i < 2 ? 2 : -1, i < 2 ? (i == 0 ? 1 : -1) : -1};
+        fwrite(&isQ, 1, 1, out);
+        fwrite(&len, sizeof(len), 1, out);
+        fwrite("Q", 1, 1, out);
+        fwrite(ids, sizeof(ids), 1, out);
+    }
+    fclose(out);
+    assert(!load_tree_parallel("test2.dat", 3));
+    assert(count_nodes(g_root) == nodes);
+    assert(!load_tree_parallel("missing.dat", 2));
+    
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    free_tree();
+    g_root = saved;
+    remove("test.dat");
+    remove("test2.dat");
+    printf("  ✓ Parallel load tests passed\n");
+}
+
+/* Test the Packed Format */
+void test_packed() {
+    printf("Testing Packed Format...\n");
+    
+    /* The codec round-trips text, runs, noise and nothing at all; noise
+     * that won't fit back in its own size is given up on */
+    static uint8_t raw[70000], packed[70000], back[70000];
+    const size_t sizes[] = {0, 3, 4, 100, 70000};
+    for (int kind = 0; kind < 3; kind++) {
+        for (int s = 0; s < 5; s++) {
+            size_t n = sizes[s];
+            for (size_t i = 0; i < n; i++)
+                raw[i] = kind == 0 ? "Does it have stripes? "[i % 22]
+                       : kind == 1 ? 'z' : (uint8_t)rand();
+            size_t got = lz_compress(raw, n, packed, sizeof(packed));
+            if (got == 0 && kind == 2 && n == 70000)
+                continue;
+            assert(got > 0);
+            if (kind < 2 && n == 70000)
+                assert(got < n / 20);
+            assert(lz_decompress(packed, got, back, n));
+            assert(memcmp(raw, back, n) == 0);
+            if (got > 1) {
+                assert(!lz_decompress(packed, got - 1, back, n));
+                assert(!lz_decompress(packed, got, back, n + 1));
+            }
+        }
+    }
+    assert(lz_compress(raw, 70000, packed, 100) == 0);
+    
+    NodeId saved = g_root;
+    const int threads[] = {1, 2, 8};
+    
+    /* Packed files load back the tree that was saved, on any number of
+     * threads, and open_tree recognizes them */
+    for (int shape = 0; shape < 3; shape++) {
+        free_tree();
+        NodeId root = create_question_node("Does it live in water?");
+        node_set_yes(root, create_animal_node("Fish"));
+        node_set_no(root, create_animal_node("Dog"));
+        tree_set_root(root);
+        index_rebuild();
+        srand(13);
+        if (shape == 1) {
+            for (int i = 0; i < 20000; i++)
+                teach_random(i);
+        } else if (shape == 2) {
+            for (int i = 0; i < 2000; i++) {
+                char text[32];
+                sprintf(text, "Is it link %d?", i);
+                NodeId q = create_question_node(text);
+                sprintf(text, "Link %d", i);
+                node_set_no(q, create_animal_node(text));
+                node_set_yes(q, g_root);
+                tree_set_root(q);
+            }
+        }
+        assert(save_tree("test.dat"));
+        int nodes = count_nodes(g_root);
+        /* Packed files don't keep usage counters: everything up to them
+         * must come back the same */
+        struct stat v1;
+        stat("test.dat", &v1);
+        long records = (long)v1.st_size - 8 - 12 * nodes;
+        for (int t = 0; t < 3; t++) {
+            assert(save_tree_packed("test.pk", threads[t]));
+            assert(load_tree_packed("test.pk", threads[t]));
+            assert(count_nodes(g_root) == nodes);
+            assert(check_integrity());
+            assert(save_tree("test2.dat"));
+            assert(same_prefix("test.dat", "test2.dat", records));
+        }
+        assert(open_tree("test.pk"));
+        assert(count_nodes(g_root) == nodes && check_integrity());
+        
+        struct stat v4;
+        stat("test.pk", &v4);
+        if (shape == 1)
+            assert(v4.st_size * 3 < v1.st_size);
+    }
+    
+    /* A damaged block or a truncated file is refused, tree left alone */
+    int nodes = count_nodes(g_root);
+    FILE *fp = fopen("test.pk", "r+b");
+    fseek(fp, -40, SEEK_END);
+    int c = fgetc(fp);
+    fseek(fp, -40, SEEK_END);
+    fputc(c ^ 0x5a, fp);
+    fclose(fp);
+    assert(!load_tree_packed("test.pk", 2));
+    assert(count_nodes(g_root) == nodes);
+    assert(save_tree_packed("test.pk", 2));
+    assert(truncate("test.pk", 30) == 0);
+    assert(!load_tree_packed("test.pk", 2));
+    assert(count_nodes(g_root) == nodes);
+    
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    free_tree();
+    g_root = NODE_NIL;
+    assert(!save_tree_packed("test.pk", 2));
+    g_root = saved;
+    remove("test.dat");
+    remove("test2.dat");
+    remove("test.pk");
+    printf("  ✓ Packed format tests passed\n");
+}
+
+/* Test the Succinct Tree */
+void test_succinct() {
+    printf("Testing Succinct Tree...\n");
+    
+    NodeId saved = g_root;
+    free_tree();
+    NodeId root = create_question_node("Does it live in water?");
+    node_set_yes(root, create_animal_node("Fish"));
+    node_set_no(root, create_animal_node("Dog"));
+    tree_set_root(root);
+    index_rebuild();
+    srand(14);
+    for (int i = 0; i < 3000; i++)
+        teach_random(i);
+    
+    SuccinctTree t;
+    assert(succinct_build(&t, g_root));
+    TreeStats ts;
+    tree_stats(g_root, &ts);
+    assert(t.nodes == ts.nodes && t.animals == ts.animals && t.height == ts.height);
+    
+    /* Walking both trees together meets the same nodes, and parents lead
+     * back the way we came */
+    FrameStack todo;
+    fs_init(&todo);
+    fs_push(&todo, g_root, 0);
+    uint32_t *pos = (uint32_t *)calloc(g_arena.count, sizeof(uint32_t));
+    uint32_t seen = 0;
+    while (!fs_empty(&todo)) {
+        NodeId id = fs_pop(&todo).node;
+        uint32_t i = pos[id];
+        seen++;
+        assert(succinct_is_question(&t, i) == node_is_question(id));
+        assert(strcmp(succinct_text(&t, i), node_text(id)) == 0);
+        if (node_is_question(id)) {
+            pos[node_yes(id)] = succinct_yes(&t, i);
+            pos[node_no(id)] = succinct_no(&t, i);
+            assert(succinct_parent(&t, succinct_yes(&t, i)) == i);
+            assert(succinct_parent(&t, succinct_no(&t, i)) == i);
+            fs_push(&todo, node_yes(id), 1);
+            fs_push(&todo, node_no(id), 0);
+        }
+    }
+    fs_free(&todo);
+    free(pos);
+    assert(seen == t.nodes);
+    for (uint32_t k = 0; k < t.nodes - t.animals; k++)
+        assert(succinct_rank(&t, succinct_select(&t, k)) == k);
+    
+    /* Under a byte a node besides the text itself */
+    assert(succinct_bytes(&t) - t.textSize < t.nodes);
+    
+    /* The engine plays it like the real tree; it just can't learn */
+    for (int g = 0; g < 200; g++) {
+        GameSession a, b;
+        engine_init(&a);
+        engine_init(&b);
+        assert(engine_start(&a) && engine_start_succinct(&b, &t));
+        while (a.state == ENGINE_QUESTION) {
+            assert(b.state == ENGINE_QUESTION);
+            assert(strcmp(engine_text(&a), engine_text(&b)) == 0);
+            int yes = rand() & 1;
+            assert(engine_answer(&a, yes) && engine_answer(&b, yes));
+        }
+        assert(b.state == ENGINE_GUESS);
+        char pa[256], pb[256];
+        engine_prompt(&a, pa, sizeof(pa));
+        engine_prompt(&b, pb, sizeof(pb));
+        assert(strcmp(pa, pb) == 0);
+        int yes = g & 1;
+        assert(engine_answer(&b, yes));
+        assert(b.state == ENGINE_DONE && b.result == (yes ? ENGINE_GUESSED : ENGINE_STUMPED));
+        engine_free(&a);
+        engine_free(&b);
+    }
+    succinct_free(&t);
+    
+    /* One animal is a tree too; a question short a child isn't */
+    free_tree();
+    tree_set_root(create_animal_node("Cat"));
+    assert(succinct_build(&t, g_root));
+    assert(t.nodes == 1 && t.height == 1 && !succinct_is_question(&t, 0));
+    assert(strcmp(succinct_text(&t, 0), "Cat") == 0);
+    succinct_free(&t);
+    root = create_question_node("Does it purr?");
+    node_set_yes(root, g_root);
+    tree_set_root(root);
+    assert(!succinct_build(&t, g_root));
+    assert(!succinct_build(&t, NODE_NIL));
+    
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    free_tree();
+    g_root = saved;
+    printf("  ✓ Succinct tree tests passed\n");
+}
+
+/* complete_tree
+ * - A complete tree with levels levels, questions down to the last
+ */
+static NodeId complete_tree(int levels, int *counter) {
+    char text[32];
+    sprintf(text, "Node %d", (*counter)++);
+    if (levels == 1)
+        return create_animal_node(text);
+    NodeId q = create_question_node(text);
+    node_set_yes(q, complete_tree(levels - 1, counter));
+    node_set_no(q, complete_tree(levels - 1, counter));
+    return q;
+}
+
+/* Test the Node Layout */
+void test_layout() {
+    printf("Testing Node Layout...\n");
+    
+    NodeId saved = g_root;
+    free_tree();
+    int counter = 0;
+    tree_set_root(complete_tree(4, &counter));
+    
+    /* Four levels: the top two, then each two-level bottom subtree */
+    assert(tree_relayout(LAYOUT_VEB));
+    assert(check_integrity());
+    const char *veb[] = {"Node 0", "Node 1", "Node 8", "Node 2", "Node 3", "Node 4",
+                         "Node 5", "Node 6", "Node 7", "Node 9", "Node 10", "Node 11",
+                         "Node 12", "Node 13", "Node 14"};
+    for (int i = 0; i < 15; i++)
+        assert(g_root == 1 && strcmp(node_text((NodeId)i + 1), veb[i]) == 0);
+    
+    /* BFS puts it back level by level */
+    assert(tree_relayout(LAYOUT_BFS));
+    const char *bfs[] = {"Node 0", "Node 1", "Node 8", "Node 2", "Node 5", "Node 9", "Node 12"};
+    for (int i = 0; i < 7; i++)
+        assert(strcmp(node_text((NodeId)i + 1), bfs[i]) == 0);
+    
+    /* A learned tree keeps its shape and text through both layouts and
+     * goes on learning; only the live tree is kept */
+    free_tree();
+    NodeId root = create_question_node("Does it live in water?");
+    node_set_yes(root, create_animal_node("Fish"));
+    node_set_no(root, create_animal_node("Dog"));
+    tree_set_root(root);
+    index_rebuild();
+    srand(15);
+    for (int i = 0; i < 3000; i++)
+        teach_random(i);
+    assert(undo_last_edit());
+    assert(save_tree("test.dat"));
+    int nodes = count_nodes(g_root);
+    for (int pass = 0; pass < 2; pass++) {
+        assert(tree_relayout(pass == 0 ? LAYOUT_VEB : LAYOUT_BFS));
+        assert(check_integrity());
+        assert(count_nodes(g_root) == nodes && (int)g_arena.count == nodes + 1);
+        assert(es_empty(&g_undo) && es_empty(&g_redo));
+        assert(save_tree("test2.dat"));
+        assert(same_file("test.dat", "test2.dat"));
+    }
+    assert(tree_relayout(LAYOUT_VEB));
+    teach_random(5000);
+    assert(count_nodes(g_root) == nodes + 2 && check_integrity());
+    
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    free_tree();
+    g_root = saved;
+    remove("test.dat");
+    remove("test2.dat");
+    printf("  ✓ Node layout tests passed\n");
+}
+
+/* Test the synthetic tree generator */
+void test_generator() {
+    printf("Testing Tree Generator...\n");
+    
+    NodeId saved = g_root;
+    free_tree();
+    
+    /* Every shape makes a well-formed tree of the odd size asked for */
+    uint32_t heights[] = {10, 500, 0, 0};
+    for (int s = GEN_BALANCED; s <= GEN_SKEWED; s++) {
+        GenShape shape;
+        assert(gen_shape_parse(gen_shape_name((GenShape)s), &shape) && shape == (GenShape)s);
+        assert(gen_tree(shape, 1000, 7));
+        assert(check_integrity());
+        TreeStats ts;
+        tree_stats(g_root, &ts);
+        assert(ts.nodes == 999 && ts.animals == 500 && (int)g_arena.count == 1000);
+        assert(heights[s] == 0 || ts.height == heights[s]);
+        assert(ts.height >= 10);
+        
+        /* The same seed grows the same tree, node for node */
+        assert(save_tree("test.dat"));
+        assert(gen_tree(shape, 999, 7));
+        assert(save_tree("test2.dat"));
+        assert(same_file("test.dat", "test2.dat"));
+        
+        /* and the game can carry on learning in it */
+        teach_random(s);
+        assert(count_nodes(g_root) == 1001 && check_integrity());
+    }
+    
+    /* Another seed grows another random tree */
+    assert(gen_tree(GEN_RANDOM, 999, 7));
+    assert(save_tree("test.dat"));
+    assert(gen_tree(GEN_RANDOM, 999, 8));
+    assert(save_tree("test2.dat"));
+    assert(!same_file("test.dat", "test2.dat"));
+    
+    /* Nothing to make leaves the tree alone; one node is one animal */
+    assert(!gen_tree(GEN_BALANCED, 0, 1));
+    assert(count_nodes(g_root) == 999);
+    assert(gen_tree(GEN_CHAIN, 2, 1) && count_nodes(g_root) == 1 && !node_is_question(g_root));
+    GenShape shape;
+    assert(!gen_shape_parse("bushy", &shape));
+    
+    free_tree();
+    g_root = saved;
+    remove("test.dat");
+    remove("test2.dat");
+    printf("  ✓ Tree generator tests passed\n");
+}
+
+/* Test Performance Counters */
+void test_perf_counters() {
+    printf("Testing Performance Counters...\n");
+    
+    /* Whatever the machine gives, open/start/stop/close never fail; a
+     * counter that opened counts the loop, one that didn't reads 0 */
+    PerfCounters pc;
+    int opened = perf_open(&pc);
+    assert(opened >= 0 && opened <= PERF_COUNTERS);
+    int available = 0;
+    for (int c = 0; c < PERF_COUNTERS; c++)
+        available += perf_available(&pc, (PerfCounter)c);
+    assert(available == opened);
+    
+    perf_start(&pc);
+    volatile uint64_t sink = 0;
+    for (int i = 0; i < 1000000; i++)
+        sink += (uint64_t)i * i;
+    perf_stop(&pc);
+    for (int c = 0; c < PERF_COUNTERS; c++)
+        assert(perf_available(&pc, (PerfCounter)c) || pc.value[c] == 0);
+    if (perf_available(&pc, PERF_INSTRUCTIONS))
+        assert(pc.value[PERF_INSTRUCTIONS] >= 1000000);
+    if (perf_available(&pc, PERF_CYCLES))
+        assert(pc.value[PERF_CYCLES] > 0);
+    printf("  %d of %d counters available\n", opened, PERF_COUNTERS);
+    
+    perf_close(&pc);
+    for (int c = 0; c < PERF_COUNTERS; c++)
+        assert(!perf_available(&pc, (PerfCounter)c));
+    assert(strcmp(perf_counter_name(PERF_DTLB_MISSES), "dtlb_misses") == 0);
+    
+    printf("  ✓ Performance counter tests passed\n");
+}
+
+static void *metrics_hammer(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 100000; i++) {
+        metric_add(METRIC_GAMES_STUMPED, 1);
+        metric_observe(METRIC_ANSWER_SECONDS, 1000);
+    }
+    return NULL;
+}
+
+/* Test Metrics */
+void test_metrics() {
+    printf("Testing Metrics...\n");
+    
+    NodeId saved = g_root;
+    free_tree();
+    metrics_reset();
+    
+    /* Every value lands in a bucket whose edge is at most 12.5% above it,
+     * and the buckets are in order */
+    uint64_t values[] = {0, 1, 7, 15, 16, 17, 31, 32, 100, 1000, 123456789, ((uint64_t)1 << 39) + 12345};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        uint64_t v = values[i];
+        uint32_t b = metric_bucket(v);
+        assert(b < METRIC_BUCKETS);
+        assert(v <= metric_bucket_high(b) && metric_bucket_high(b) <= v + v / 8);
+        assert(b == 0 || metric_bucket_high(b - 1) < v);
+    }
+    assert(metric_bucket((uint64_t)1 << 50) == METRIC_BUCKETS - 1);
+    
+    /* A guessed game and a learned one on a 7-node tree (3 animals) */
+    assert(gen_tree(GEN_BALANCED, 7, 1));
+    index_rebuild();
+    assert(metric_read(METRIC_TREE_NODES) == 7);
+    GameSession game;
+    engine_init(&game);
+    assert(engine_start(&game));
+    assert(engine_answer(&game, 1) && engine_answer(&game, 1) && game.state == ENGINE_GUESS);
+    assert(engine_answer(&game, 1) && game.result == ENGINE_GUESSED);
+    assert(engine_start(&game));
+    assert(engine_answer(&game, 0) && engine_answer(&game, 0) && engine_answer(&game, 0));
+    assert(engine_submit(&game, "Zebra") && engine_submit(&game, "Does it have stripes?"));
+    assert(engine_answer(&game, 1) && game.result == ENGINE_LEARNED);
+    engine_free(&game);
+    
+    assert(metric_read(METRIC_GAMES) == 2);
+    assert(metric_read(METRIC_GAMES_GUESSED) == 1 && metric_read(METRIC_GAMES_LEARNED) == 1);
+    assert(metric_read(METRIC_TREE_NODES) == 9);
+    MetricSummary ms;
+    metric_summary(METRIC_GAME_QUESTIONS, &ms);
+    assert(ms.count == 2 && ms.sum == 4 && ms.p50 == 2 && ms.max == 2);
+    metric_summary(METRIC_LEARN_SECONDS, &ms);
+    assert(ms.count == 1 && ms.sum > 0);
+    metric_summary(METRIC_INDEX_PROBES, &ms);
+    assert(ms.count == 2);
+    
+    /* Saves and loads count time and bytes; a failed load counts an error */
+    assert(save_tree("test.dat") && load_tree("test.dat"));
+    assert(!load_tree("no-such-tree.dat"));
+    metric_summary(METRIC_SAVE_SECONDS, &ms);
+    assert(ms.count == 1);
+    metric_summary(METRIC_LOAD_SECONDS, &ms);
+    assert(ms.count == 1);
+    assert(metric_read(METRIC_SAVE_BYTES) > 0 && metric_read(METRIC_SAVE_BYTES) == metric_read(METRIC_LOAD_BYTES));
+    assert(metric_read(METRIC_LOAD_ERRORS) == 1 && metric_read(METRIC_SAVE_ERRORS) == 0);
+    
+    /* Threads sharing shards lose nothing */
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++)
+        pthread_create(&threads[t], NULL, metrics_hammer, NULL);
+    for (int t = 0; t < 4; t++)
+        pthread_join(threads[t], NULL);
+    assert(metric_read(METRIC_GAMES_STUMPED) == 400000);
+    metric_summary(METRIC_ANSWER_SECONDS, &ms);
+    assert(ms.count == 400000 && ms.p99 >= 1000e-9 && ms.p99 <= 1125e-9);
+    
+    /* Gauges go up and down */
+    metric_gauge_add(METRIC_CONNECTIONS, 2);
+    metric_gauge_add(METRIC_CONNECTIONS, -1);
+    assert(metric_read(METRIC_CONNECTIONS) == 1);
+    
+    /* The exposition file has every metric, histograms cumulative */
+    assert(metrics_write_file("test.prom"));
+    FILE *fp = fopen("test.prom", "r");
+    assert(fp != NULL);
+    static char text[65536];
+    size_t len = fread(text, 1, sizeof(text) - 1, fp);
+    text[len] = '\0';
+    fclose(fp);
+    assert(strstr(text, "# TYPE animals_games_total counter\nanimals_games_total 2\n") != NULL);
+    assert(strstr(text, "# TYPE animals_connections gauge\nanimals_connections 1\n") != NULL);
+    assert(strstr(text, "animals_answer_seconds_bucket{le=\"+Inf\"} 400000\n") != NULL);
+    assert(strstr(text, "animals_answer_seconds_count 400000\n") != NULL);
+    assert(strstr(text, "animals_game_questions_bucket{le=\"2\"} 2\n") != NULL);
+    
+    metric_set(METRIC_CONNECTIONS, 0);
+    free_tree();
+    g_root = saved;
+    remove("test.dat");
+    remove("test.prom");
+    printf("  ✓ Metrics tests passed\n");
+}
+
+static void *trace_recorder(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 1000; i++)
+        trace_span("beta", metrics_now());
+    return NULL;
+}
+
+/* count_in_file
+ * - Lines of filename that contain needle
+ */
+static int count_in_file(const char *filename, const char *needle) {
+    FILE *fp = fopen(filename, "r");
+    assert(fp != NULL);
+    char line[512];
+    int count = 0;
+    while (fgets(line, sizeof(line), fp) != NULL)
+        count += strstr(line, needle) != NULL;
+    fclose(fp);
+    return count;
+}
+
+/* Test Tracing */
+void test_tracing() {
+    printf("Testing Tracing...\n");
+    
+    /* Spans from several threads all come out as complete events */
+    trace_reset();
+    for (int i = 0; i < 3; i++) {
+        uint64_t start = metrics_now();
+        trace_span("alpha", start);
+    }
+    pthread_t threads[2];
+    for (int t = 0; t < 2; t++)
+        assert(pthread_create(&threads[t], NULL, trace_recorder, NULL) == 0);
+    for (int t = 0; t < 2; t++)
+        pthread_join(threads[t], NULL);
+    assert(trace_count() == 2003);
+    assert(trace_write("test.trace"));
+    assert(count_in_file("test.trace", "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [") == 1);
+    assert(count_in_file("test.trace", "\"name\": \"alpha\", \"cat\": \"animals\", \"ph\": \"X\"") == 3);
+    assert(count_in_file("test.trace", "\"name\": \"beta\"") == 2000);
+    assert(count_in_file("test.trace", "]}") == 1);
+    
+    /* A full ring gives the newest TRACE_RING_EVENTS - 1 spans: the
+     * oldest shares its slot with the next span to be recorded */
+    trace_reset();
+    for (int i = 0; i < TRACE_RING_EVENTS + 10; i++)
+        trace_span(i < 10 ? "old" : "new", metrics_now());
+    assert(trace_write("test.trace"));
+    assert(count_in_file("test.trace", "\"name\": \"old\"") == 0);
+    assert(count_in_file("test.trace", "\"name\": \"new\"") == TRACE_RING_EVENTS - 1);
+    
+    /* Built with TRACE, a save leaves its phases behind */
+#ifdef TRACE
+    NodeId saved = g_root;
+    free_tree();
+    assert(gen_tree(GEN_BALANCED, 15, 1));
+    trace_reset();
+    assert(save_tree("test.dat"));
+    assert(trace_write("test.trace"));
+    assert(count_in_file("test.trace", "\"name\": \"save_tree\"") == 1);
+    assert(count_in_file("test.trace", "\"name\": \"save_bfs\"") == 1);
+    free_tree();
+    g_root = saved;
+    remove("test.dat");
+#endif
+    
+    /* Nowhere to write to */
+    assert(!trace_write(NULL));
+    
+    trace_reset();
+    remove("test.trace");
+    printf("  ✓ Tracing tests passed\n");
+}
+
+/* usage_digest
+ * - Every node's counters folded together, in preorder, so two trees
+ *   with the same shape and usage give the same digest
+ */
+static uint64_t usage_digest(NodeId root) {
+    uint64_t digest = 0;
+    FrameStack todo;
+    fs_init(&todo);
+    fs_push(&todo, root, -1);
+    while (!fs_empty(&todo)) {
+        NodeId id = fs_pop(&todo).node;
+        Node *n = node_at(id);
+        digest = digest * 1000003 + n->plays * 31 + n->yeses * 7 + n->correct;
+        if (node_is_question(id)) {
+            fs_push(&todo, node_no(id), 0);
+            fs_push(&todo, node_yes(id), 1);
+        }
+    }
+    fs_free(&todo);
+    return digest;
+}
+
+/* Test Usage Counters */
+void test_usage() {
+    printf("Testing Usage Counters...\n");
+    
+    NodeId saved = g_root;
+    NodeId root = create_question_node("Does it live in water?");
+    node_set_yes(root, create_animal_node("Fish"));
+    NodeId bark = create_question_node("Does it bark?");
+    node_set_no(root, bark);
+    NodeId dog = create_animal_node("Dog");
+    NodeId cat = create_animal_node("Cat");
+    node_set_yes(bark, dog);
+    node_set_no(bark, cat);
+    tree_set_root(root);
+    index_rebuild();
+    
+    /* Two right guesses and a learned animal are counted; an abandoned
+     * game is not */
+    GameSession game;
+    engine_init(&game);
+    for (int i = 0; i < 2; i++) {
+        assert(engine_start(&game));
+        assert(engine_answer(&game, 0) && engine_answer(&game, 1) && engine_answer(&game, 1));
+        assert(game.result == ENGINE_GUESSED);
+    }
+    assert(engine_start(&game) && engine_answer(&game, 1));
+    assert(engine_start(&game));
+    assert(engine_answer(&game, 0) && engine_answer(&game, 0) && engine_answer(&game, 0));
+    assert(engine_submit(&game, "Cow") && engine_submit(&game, "Does it moo?"));
+    assert(engine_answer(&game, 1) && game.result == ENGINE_LEARNED);
+    engine_free(&game);
+    
+    NodeId moo = node_no(bark);
+    assert(node_at(root)->plays == 3 && node_at(root)->yeses == 0 && node_at(root)->correct == 2);
+    assert(node_at(bark)->plays == 3 && node_at(bark)->yeses == 2 && node_at(bark)->correct == 2);
+    assert(node_at(dog)->plays == 2 && node_at(dog)->yeses == 2 && node_at(dog)->correct == 2);
+    assert(node_at(cat)->plays == 1 && node_at(cat)->yeses == 0 && node_at(cat)->correct == 0);
+    assert(node_at(node_yes(root))->plays == 0 && node_at(moo)->plays == 0);
+    
+    /* The report: Dog then Cat are hottest; Fish and the new Cow were
+     * never reached, but the new question above Cat was, through Cat */
+    UsageEntry entries[4];
+    assert(usage_hot(g_root, entries, 4) == 2);
+    assert(entries[0].node == dog && entries[0].plays == 2 && entries[0].correct == 2);
+    assert(entries[1].node == cat && entries[1].plays == 1);
+    assert(usage_hot(g_root, entries, 1) == 1 && entries[0].node == dog);
+    assert(usage_dead(g_root, entries, 4) == 2);
+    assert(usage_dead(g_root, entries, 1) == 2);
+    char path[128];
+    usage_path(cat, path, sizeof(path));
+    assert(strcmp(path, "Does it live in water? no > Does it bark? no > Does it moo? no > Cat") == 0);
+    assert(usage_path(cat, path, 12) == 11 && strcmp(path, "Does it liv") == 0);
+    usage_path(g_root, path, sizeof(path));
+    assert(strcmp(path, "Does it live in water?") == 0);
+    assert(usage_write_file("test.usage", g_root, 10));
+    assert(count_in_file("test.usage", "games: 3 counted, 2 guessed right (67%)") == 1);
+    assert(count_in_file("test.usage", "       2   100%  Does it live in water? no > Does it bark? yes > Dog") == 1);
+    assert(count_in_file("test.usage", "never reached: 2 subtrees") == 1);
+    assert(count_in_file("test.usage", "       1       1  Does it live in water? yes > Fish") == 1);
+    
+    /* Saved and loaded with the tree, serially or in parallel */
+    uint64_t digest = usage_digest(g_root);
+    assert(save_tree("test.dat"));
+    assert(load_tree("test.dat") && usage_digest(g_root) == digest);
+    assert(load_tree_parallel("test.dat", 4) && usage_digest(g_root) == digest);
+    
+    /* A file from before the counters loads with them all zero; one cut
+     * off inside the usage section doesn't load at all */
+    FILE *fp = fopen("test.dat", "rb");
+    assert(fp != NULL);
+    static unsigned char bytes[4096];
+    size_t len = fread(bytes, 1, sizeof(bytes), fp);
+    fclose(fp);
+    size_t bare = len - 8 - 12 * (size_t)count_nodes(g_root);
+    for (int cut = 0; cut < 2; cut++) {
+        fp = fopen("test2.dat", "wb");
+        assert(fp != NULL && fwrite(bytes, 1, bare + cut * 10, fp) == bare + cut * 10);
+        fclose(fp);
+        assert(load_tree("test2.dat") == !cut);
+        assert(load_tree_parallel("test2.dat", 4) == !cut);
+    }
+    assert(count_nodes(g_root) == 7 && usage_digest(g_root) == 0);
+    
+    /* A bigger tree: parallel saves match save_tree byte for byte, and
+     * images and relayouts keep the counters */
+    srand(5);
+    for (int i = 0; i < 3000; i++) {
+        teach_random(i);
+        engine_init(&game);
+        assert(engine_start(&game));
+        while (game.state == ENGINE_QUESTION)
+            assert(engine_answer(&game, rand() & 1));
+        assert(engine_answer(&game, 1) && game.result == ENGINE_GUESSED);
+        engine_free(&game);
+    }
+    assert(node_at(g_root)->plays == 6000 && node_at(g_root)->correct == 3000);
+    digest = usage_digest(g_root);
+    assert(save_tree("test.dat"));
+    assert(save_tree_parallel("test2.dat", 4) && same_file("test.dat", "test2.dat"));
+    assert(load_tree_parallel("test2.dat", 3) && usage_digest(g_root) == digest);
+    assert(tree_relayout(LAYOUT_VEB) && usage_digest(g_root) == digest);
+    assert(save_image("test.img") && map_tree("test.img") && usage_digest(g_root) == digest);
+    assert(load_tree("test.dat") && usage_digest(g_root) == digest);
+    
+    /* No tree, nothing to report */
+    free_tree();
+    g_root = NODE_NIL;
+    assert(usage_hot(g_root, entries, 4) == 0 && usage_dead(g_root, entries, 4) == 0);
+    assert(usage_write_file("test.usage", g_root, 10));
+    assert(count_in_file("test.usage", "games: 0 counted") == 1);
+    
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    g_root = saved;
+    remove("test.dat");
+    remove("test2.dat");
+    remove("test.img");
+    remove("test.usage");
+    printf("  ✓ Usage counter tests passed\n");
+}
+
+/* Test Tree Display */
+void test_display() {
+    printf("Testing Tree Display...\n");
+    
+    NodeId saved = g_root;
+    NodeId root = create_question_node("Does it live in water?");
+    node_set_yes(root, create_animal_node("Fish"));
+    node_set_no(root, create_question_node("Does it bark?"));
+    node_set_yes(node_no(root), create_animal_node("Dog"));
+    node_set_no(node_no(root), create_animal_node("Cat"));
+    
+    /* Pre-order, yes before no, two spaces per level */
+    char buf[256];
+    assert(build_tree_display(root) == 5);
+    format_display_line(0, buf, sizeof(buf));
+    assert(strcmp(buf, "ROOT: Does it live in water?") == 0);
+    format_display_line(1, buf, sizeof(buf));
+    assert(strcmp(buf, "  [YES] Fish") == 0);
+    format_display_line(2, buf, sizeof(buf));
+    assert(strcmp(buf, "  [NO] Does it bark?") == 0);
+    format_display_line(3, buf, sizeof(buf));
+    assert(strcmp(buf, "    [YES] Dog") == 0);
+    format_display_line(4, buf, sizeof(buf));
+    assert(strcmp(buf, "    [NO] Cat") == 0);
+    
+    /* A lone animal is just the root line; nothing is no lines */
+    assert(build_tree_display(node_yes(root)) == 1);
+    assert(build_tree_display(NODE_NIL) == 0);
+    free_tree_display();
+    
+    free_tree();
+    g_root = saved;
+    printf("  ✓ Tree display tests passed\n");
+}
+
+/* Test Deep Chains
+ * Every wrong guess adds a question one level deeper, so learned trees
+ * can degenerate into one long chain. Nothing may recurse over it. */
+#define STRESS_DEPTH 10000000u
+
+void test_deep_chain() {
+    printf("Testing a %u-deep chain...\n", STRESS_DEPTH);
+    
+    NodeId saved = g_root;
+    assert(arena_reserve(&g_arena, 2 * STRESS_DEPTH + 1));
+    
+    /* Built bottom-up, so each link refreshes only the new question */
+    NodeId chain = create_animal_node("Animal");
+    for (uint32_t i = 0; i < STRESS_DEPTH; i++) {
+        NodeId q = create_question_node("Is it this one?");
+        node_set_yes(q, create_animal_node("Animal"));
+        node_set_no(q, chain);
+        chain = q;
+    }
+    tree_set_root(chain);
+    
+    /* Count */
+    TreeStats ts;
+    tree_stats(g_root, &ts);
+    assert(ts.nodes == 2 * STRESS_DEPTH + 1);
+    assert(ts.animals == STRESS_DEPTH + 1);
+    assert(ts.height == STRESS_DEPTH + 1);
+    assert(count_nodes(g_root) == (int)(2 * STRESS_DEPTH + 1));
+    assert(check_integrity());
+    
+    /* Render */
+    char buf[256];
+    assert(build_tree_display(g_root) == (int)(2 * STRESS_DEPTH + 1));
+    format_display_line(2 * STRESS_DEPTH, buf, sizeof(buf));
+    assert(strstr(buf, "(depth 10000000) [NO] Animal") != NULL);
+    free_tree_display();
+    
+    /* Free */
+    free_tree();
+    assert(g_arena.count == 1);
+    g_root = saved;
+    printf("  ✓ Deep chain tests passed\n");
+}
+
+/* Test Game Engine */
+void test_engine() {
+    printf("Testing Game Engine...\n");
+    
+    NodeId saved = g_root;
+    NodeId root = create_question_node("Does it live in water?");
+    node_set_yes(root, create_animal_node("Fish"));
+    node_set_no(root, create_animal_node("Dog"));
+    tree_set_root(root);
+    index_rebuild();
+    
+    GameSession game;
+    engine_init(&game);
+    char prompt[1200];
+    int n;
+    
+    /* A right guess */
+    assert(engine_start(&game) && game.state == ENGINE_QUESTION);
+    assert(engine_prompt(&game, prompt, sizeof(prompt)));
+    assert(strcmp(prompt, "Does it live in water? (y/n): ") == 0);
+    assert(!engine_submit(&game, "Cat"));
+    assert(engine_answer(&game, 1) && game.state == ENGINE_GUESS);
+    engine_prompt(&game, prompt, sizeof(prompt));
+    assert(strcmp(prompt, "Is it a Fish? (y/n): ") == 0);
+    assert(engine_answer(&game, 1));
+    assert(game.state == ENGINE_DONE && game.result == ENGINE_GUESSED);
+    assert(!engine_prompt(&game, prompt, sizeof(prompt)) && prompt[0] == '\0');
+    assert(!engine_answer(&game, 1));
+    
+    /* A wrong guess teaches the tree a new animal */
+    assert(engine_start(&game));
+    assert(engine_answer(&game, 0) && engine_answer(&game, 0));
+    assert(game.state == ENGINE_ASK_ANIMAL);
+    assert(!engine_answer(&game, 1) && !engine_submit(&game, ""));
+    assert(engine_submit(&game, "Cat") && game.state == ENGINE_ASK_QUESTION);
+    assert(game.knownAnimal == 0);
+    engine_prompt(&game, prompt, sizeof(prompt));
+    assert(strcmp(prompt, "Give me a yes/no question to distinguish Cat from Dog: ") == 0);
+    assert(engine_submit(&game, "Does it bark?") && game.state == ENGINE_ASK_ANSWER);
+    assert(engine_answer(&game, 0));
+    assert(game.state == ENGINE_DONE && game.result == ENGINE_LEARNED);
+    
+    NodeId q = node_no(root);
+    assert(node_is_question(q) && strcmp(node_text(q), "Does it bark?") == 0);
+    assert(strcmp(node_text(node_yes(q)), "Dog") == 0);
+    assert(strcmp(node_text(node_no(q)), "Cat") == 0);
+    assert(count_nodes(g_root) == 5 && g_undo.size == 1);
+    index_find("cat", 0, &n);
+    assert(n == 1);
+    assert(check_integrity());
+    
+    /* The new animal is found next time */
+    assert(engine_start(&game));
+    assert(engine_answer(&game, 0) && engine_answer(&game, 0));
+    assert(game.state == ENGINE_GUESS && strcmp(node_text(game.current), "Cat") == 0);
+    assert(engine_answer(&game, 1) && game.result == ENGINE_GUESSED);
+    
+    /* Naming the guessed animal learns nothing */
+    assert(engine_start(&game));
+    assert(engine_answer(&game, 1) && engine_answer(&game, 0));
+    assert(engine_submit(&game, "Fish"));
+    assert(game.state == ENGINE_DONE && game.result == ENGINE_REPEATED);
+    assert(count_nodes(g_root) == 5);
+    
+    /* Undo and redo go through the same bookkeeping */
+    assert(undo_last_edit());
+    assert(count_nodes(g_root) == 3 && node_no(root) != q);
+    index_find("cat", 0, &n);
+    assert(n == 0);
+    assert(check_integrity());
+    assert(redo_last_edit());
+    assert(count_nodes(g_root) == 5 && node_no(root) == q);
+    index_find("cat", 0, &n);
+    assert(n == 1);
+    assert(check_integrity());
+    
+    /* A one-animal tree starts at the guess; learning replaces the root */
+    free_tree();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    tree_set_root(create_animal_node("Dog"));
+    assert(engine_start(&game) && game.state == ENGINE_GUESS);
+    assert(engine_answer(&game, 0));
+    assert(engine_submit(&game, "Cat"));
+    assert(engine_submit(&game, "Does it meow?"));
+    assert(engine_answer(&game, 1));
+    assert(node_is_question(g_root) && count_nodes(g_root) == 3);
+    assert(check_integrity());
+    assert(undo_last_edit() && !node_is_question(g_root));
+    assert(check_integrity());
+    assert(redo_last_edit() && node_is_question(g_root));
+    assert(check_integrity());
+    
+    /* No tree, no game */
+    free_tree();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    g_root = NODE_NIL;
+    assert(!engine_start(&game) && game.state == ENGINE_DONE);
+    
+    engine_free(&game);
+    g_root = saved;
+    printf("  ✓ Game engine tests passed\n");
+}
+
+/* Test Attribute Index */
+void test_index() {
+    printf("Testing Attribute Index...\n");
+    
+    NodeId saved = g_root;
+    NodeId root = create_question_node("Does it live in water?");
+    node_set_yes(root, create_question_node("Does it have fins?"));
+    node_set_yes(node_yes(root), create_animal_node("Fish"));
+    node_set_no(node_yes(root), create_animal_node("Frog"));
+    node_set_no(root, create_question_node("Does it have fins?"));
+    node_set_yes(node_no(root), create_animal_node("fish"));
+    node_set_no(node_no(root), create_animal_node("Dog"));
+    g_root = root;
+    index_rebuild();
+    
+    /* Canonical text finds every node that asks or guesses it */
+    int n;
+    int *ids = index_find("does it have FINS", 1, &n);
+    assert(n == 2);
+    assert((ids[0] == (int)node_yes(root) && ids[1] == (int)node_no(root)) ||
+           (ids[1] == (int)node_yes(root) && ids[0] == (int)node_no(root)));
+    index_find("Fish!", 0, &n);
+    assert(n == 2);
+    index_find("Fish", 1, &n);
+    assert(n == 0);
+    assert(index_find("Does it fly?", 1, &n) == NULL && n == 0);
+    
+    /* Incremental updates, as learn and undo/redo do them */
+    NodeId q = create_question_node("Does it bark?");
+    NodeId cat = create_animal_node("Cat");
+    node_set_yes(q, node_no(node_no(root)));
+    node_set_no(q, cat);
+    node_set_no(node_no(root), q);
+    index_add(q);
+    index_add(cat);
+    index_find("does it bark", 1, &n);
+    assert(n == 1);
+    index_remove(q);
+    index_remove(cat);
+    index_find("does it bark", 1, &n);
+    assert(n == 0);
+    index_find("cat", 0, &n);
+    assert(n == 0);
+    index_add(q);
+    index_add(cat);
+    
+    /* load_tree rebuilds the index for the tree it loads */
+    assert(save_tree("test.dat"));
+    free_tree();
+    g_root = NODE_NIL;
+    assert(load_tree("test.dat"));
+    index_find("cat", 0, &n);
+    assert(n == 1);
+    index_find("does it have fins", 1, &n);
+    assert(n == 2);
+    
+    /* A mapped image indexes itself on first lookup */
+    assert(save_image("test.img"));
+    assert(map_tree("test.img"));
+    assert(g_index.size == 0 || g_arena.nodesMapped);
+    index_find("Does it bark?", 1, &n);
+    assert(n == 1);
+    
+    free_tree();
+    g_root = saved;
+    remove("test.dat");
+    remove("test.img");
+    printf("  ✓ Attribute index tests passed\n");
+}
+
 /* Test Integrity Checker */
 void test_integrity() {
     printf("Testing Integrity Checker...\n");
     
     /* Valid tree */
-    Node *root = create_question_node("Q1");
-    root->yes = create_animal_node("A1");
-    root->no = create_animal_node("A2");
+    NodeId root = create_question_node("Q1");
+    node_set_yes(root, create_animal_node("A1"));
+    node_set_no(root, create_animal_node("A2"));
     
-    Node *saved = g_root;
+    NodeId saved = g_root;
     g_root = root;
     
     assert(check_integrity());
     
     /* Invalid tree - question with one child */
-    free_tree(root->no); //added line
-    root->no = NULL;
+    node_set_no(root, NODE_NIL);
     assert(!check_integrity());
     
     /* Restore */
-    root->no = create_animal_node("A2");
+    node_set_no(root, create_animal_node("A2"));
     assert(check_integrity());
     
-    free_tree(g_root);
+    free_tree();
     g_root = saved;
     
     printf("  ✓ Integrity tests passed\n");
@@ -218,6 +2260,11 @@ void test_canonicalize() {
     assert(strcmp(c3, "abc123") == 0);
     free(c3);
     
+    /* Punctuation in the middle leaves no gap */
+    char *c4 = canonicalize("Does it bark, or meow?");
+    assert(strcmp(c4, "does_it_bark_or_meow") == 0);
+    free(c4);
+    
     printf("  ✓ Canonicalization tests passed\n");
 }
 
@@ -226,29 +2273,38 @@ void test_nodes() {
     printf("Testing Node Functions...\n");
     
     /* Test question node */
-    Node *q = create_question_node("Does it fly?");
-    assert(q != NULL);
-    assert(q->isQuestion == 1);
-    assert(strcmp(q->text, "Does it fly?") == 0);
-    assert(q->yes == NULL);
-    assert(q->no == NULL);
+    NodeId q = create_question_node("Does it fly?");
+    assert(q != NODE_NIL);
+    assert(node_is_question(q));
+    assert(strcmp(node_text(q), "Does it fly?") == 0);
+    assert(node_yes(q) == NODE_NIL);
+    assert(node_no(q) == NODE_NIL);
     
     /* Test animal node */
-    Node *a = create_animal_node("Eagle");
-    assert(a != NULL);
-    assert(a->isQuestion == 0);
-    assert(strcmp(a->text, "Eagle") == 0);
-    assert(a->yes == NULL);
-    assert(a->no == NULL);
+    NodeId a = create_animal_node("Eagle");
+    assert(a != NODE_NIL);
+    assert(!node_is_question(a));
+    assert(strcmp(node_text(a), "Eagle") == 0);
+    assert(node_yes(a) == NODE_NIL);
+    assert(node_no(a) == NODE_NIL);
     
     /* Test tree structure and count */
-    q->yes = a;
-    q->no = create_animal_node("Penguin");
+    node_set_yes(q, a);
+    node_set_no(q, create_animal_node("Penguin"));
     
     assert(count_nodes(q) == 3);
-    assert(count_nodes(NULL) == 0);
+    assert(count_nodes(NODE_NIL) == 0);
+    
+    /* Linking a yes child keeps the question flag that shares its word */
+    assert(node_is_question(q) && node_yes(q) == a);
+    NodeId b = create_animal_node("Robin");
+    NodeId expected = b;
+    assert(!node_cas_child(q, 1, &expected, b));
+    assert(expected == a && node_is_question(q));
+    assert(node_cas_child(q, 1, &expected, b));
+    assert(node_is_question(q) && node_yes(q) == b);
     
-    free_tree(q);
+    free_tree();
     
     printf("  ✓ Node tests passed\n");
 }
@@ -264,10 +2320,10 @@ void test_edit_stack() {
     
     Edit e1, e2;
     e1.type = EDIT_INSERT_SPLIT;
-    e1.parent = NULL;
+    e1.parent = NODE_NIL;
     
     e2.type = EDIT_INSERT_SPLIT;
-    e2.parent = (Node*)0x1234;  // Dummy pointer
+    e2.parent = 0x1234;  // Dummy node index
     
     es_push(&s, e1);
     es_push(&s, e2);
@@ -276,10 +2332,10 @@ void test_edit_stack() {
     assert(!es_empty(&s));
     
     Edit popped = es_pop(&s);
-    assert(popped.parent == (Node*)0x1234);
+    assert(popped.parent == 0x1234);
     
     popped = es_pop(&s);
-    assert(popped.parent == NULL);
+    assert(popped.parent == NODE_NIL);
     
     assert(es_empty(&s));
     
@@ -299,6 +2355,8 @@ void test_edit_stack() {
 int main() {
     printf("\n=== Running Unit Tests ===\n\n");
     
+    test_arena();
+    test_intern();
     test_nodes();
     test_stack();
     test_edit_stack();
@@ -306,8 +2364,34 @@ int main() {
     test_canonicalize();
     test_hash();
     test_persistence();
+    test_image();
+    test_index();
+    test_stats();
+    test_engine();
+    test_epoch();
+    test_concurrent();
+    test_learn_race();
+    test_journal();
+    test_pages();
+    test_parallel_save();
+    test_parallel_load();
+    test_packed();
+    test_succinct();
+    test_layout();
+    test_generator();
+    test_perf_counters();
+    test_metrics();
+    test_tracing();
+    test_usage();
+    test_display();
+    test_deep_chain();
     test_integrity();
     
+    arena_free(&g_arena);
+    h_free(&g_index);
+    es_free(&g_undo);
+    es_free(&g_redo);
+    
     printf("\n=== All Tests Passed! ===\n\n");
     printf("Great job! Your implementations are working correctly.\n");
     printf("Next steps:\n");
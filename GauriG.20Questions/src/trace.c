@@ -0,0 +1,167 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lab5.h"
+
+/* ========== Tracing ========== */
+
+/* Each thread that records a span gets a ring of the last
+ * TRACE_RING_EVENTS spans, allocated the first time and never freed, so
+ * spans of threads that have exited can still be written out. Only the
+ * owning thread writes its ring: a span is stored, then head is bumped
+ * with a release store, so there is no lock and no contended line.
+ *
+ * trace_write may run while others are still recording. It reads each
+ * ring's head, copies out what is below it, then reads head again and
+ * drops whatever the owner could have overwritten in between, counting
+ * the slot of the span it may be writing right now; so a full ring gives
+ * up its oldest span, and a ring that wrapped loses its oldest spans.
+ *
+ * Rings are pushed onto g_rings with a compare-and-swap and never taken
+ * off, so walking the list needs no lock either. With ANIMALS_TRACE set
+ * in the environment, the first ring also arranges for everything to be
+ * written to that file at exit. */
+
+typedef struct {
+	const char *name;
+	uint64_t start;         /* metrics_now() ns */
+	uint64_t duration;
+} TraceEvent;
+
+typedef struct TraceRing {
+	TraceEvent events[TRACE_RING_EVENTS];
+	uint64_t head;          /* spans ever recorded; head % size is next */
+	uint32_t tid;
+	struct TraceRing *next;
+} TraceRing;
+
+static TraceRing *g_rings = NULL;
+static uint32_t g_nextTid = 0;
+static int g_atExit = 0;
+static __thread TraceRing *t_ring = NULL;
+
+static void trace_at_exit(void) {
+	trace_write(getenv("ANIMALS_TRACE"));
+}
+
+/* my_ring
+ * - This thread's ring, made and published the first time; NULL if out
+ *   of memory (the span is dropped)
+ */
+static TraceRing *my_ring(void) {
+	if(t_ring != NULL)
+		return t_ring;
+	TraceRing* r = (TraceRing*)calloc(1, sizeof(TraceRing));
+	if(r == NULL)
+		return NULL;
+	r->tid = __atomic_add_fetch(&g_nextTid, 1, __ATOMIC_RELAXED);
+	r->next = __atomic_load_n(&g_rings, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&g_rings, &r->next, r, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	t_ring = r;
+
+	if(getenv("ANIMALS_TRACE") != NULL && !__atomic_exchange_n(&g_atExit, 1, __ATOMIC_RELAXED))
+		atexit(trace_at_exit);
+	return r;
+}
+
+/* trace_span
+ * - Record a span called name that began at start and ends now. name
+ *   must outlive the trace (TRACE_END passes a literal)
+ */
+void trace_span(const char *name, uint64_t start) {
+	uint64_t end = metrics_now();
+	TraceRing* r = my_ring();
+	if(r == NULL)
+		return;
+	uint64_t head = r->head;
+	TraceEvent* e = &r->events[head % TRACE_RING_EVENTS];
+	//release stores all round: a reader that sees this span also sees
+	//every head before it (plain stores on x86)
+	__atomic_store_n(&e->name, name, __ATOMIC_RELEASE);
+	__atomic_store_n(&e->start, start, __ATOMIC_RELEASE);
+	__atomic_store_n(&e->duration, end - start, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* trace_write
+ * Write every ring's spans to filename as Chrome trace_event JSON
+ * (chrome://tracing, Perfetto), one complete ("X") event a line
+ *
+ * Steps:
+ * 1. For each ring, note head and copy out the spans still in it
+ * 2. Read head again; spans the owner may have overwritten meanwhile,
+ *    or be overwriting now, are dropped
+ * 3. Write the rest, times in microseconds, one tid per ring
+ * 4. Return 1 on success, 0 if there is no filename or it can't be
+ *    written; no spans at all is still a valid, empty trace
+ */
+int trace_write(const char *filename) {
+	if(filename == NULL)
+		return 0;
+	FILE* fp = fopen(filename, "w");
+	if(fp == NULL)
+		return 0;
+	TraceEvent* copy = (TraceEvent*)malloc(TRACE_RING_EVENTS * sizeof(TraceEvent));
+	if(copy == NULL) {
+		fclose(fp);
+		return 0;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	int pid = (int)getpid(), first = 1;
+	for(TraceRing* r = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		//1. What the ring holds now
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t from = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+		//   (acquire loads, so head is read again only after them)
+		for(uint64_t i = from; i < head; i++) {
+			const TraceEvent* e = &r->events[i % TRACE_RING_EVENTS];
+			copy[i - from].name = __atomic_load_n(&e->name, __ATOMIC_ACQUIRE);
+			copy[i - from].start = __atomic_load_n(&e->start, __ATOMIC_ACQUIRE);
+			copy[i - from].duration = __atomic_load_n(&e->duration, __ATOMIC_ACQUIRE);
+		}
+
+		//2. Drop what was overwritten while copying
+		uint64_t now = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+		uint64_t safe = now > TRACE_RING_EVENTS ? now - TRACE_RING_EVENTS + 1 : 0;
+
+		//3. The spans, oldest first
+		for(uint64_t i = from > safe ? from : safe; i < head; i++) {
+			const TraceEvent* e = &copy[i - from];
+			fprintf(fp, "%s{\"name\": \"%s\", \"cat\": \"animals\", \"ph\": \"X\", \"ts\": %.3f, "
+				"\"dur\": %.3f, \"pid\": %d, \"tid\": %u}", first ? "" : ",\n", e->name,
+				e->start / 1e3, e->duration / 1e3, pid, r->tid);
+			first = 0;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	free(copy);
+
+	//4. Done
+	int ok = !ferror(fp);
+	if(fclose(fp) != 0)
+		ok = 0;
+	return ok;
+}
+
+/* trace_count
+ * - Spans recorded so far on every thread, including ones since
+ *   overwritten
+ */
+uint64_t trace_count(void) {
+	uint64_t total = 0;
+	for(TraceRing* r = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+		total += __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	return total;
+}
+
+/* trace_reset
+ * - Forget every span; only while nothing else is recording (tests)
+ */
+void trace_reset(void) {
+	for(TraceRing* r = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+		__atomic_store_n(&r->head, 0, __ATOMIC_RELEASE);
+}
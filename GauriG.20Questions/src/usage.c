@@ -0,0 +1,216 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+/* ========== Usage Report ========== */
+
+/* The engine counts every finished game into the nodes it reached (see
+ * count_usage in engine.c), so a node's plays is how many games got as
+ * far as it. The hot paths are the paths to the animals with the most
+ * plays. A dead subtree is one where no node has a play although its
+ * parent has: nothing that was played ever got in. Nodes learned since
+ * the counting began start at zero, so a fresh question with an old,
+ * often guessed animal under it is not dead. */
+
+static uint32_t plays_of(NodeId id) {
+	return __atomic_load_n(&node_at(id)->plays, __ATOMIC_RELAXED);
+}
+
+/* keep_top
+ * - Put e into out, which holds *count entries (at most max) ordered by
+ *   key, highest first; e is dropped if out is full of higher ones
+ */
+static void keep_top(UsageEntry *out, int *count, int max, UsageEntry e, uint32_t (*key)(const UsageEntry *)) {
+	int at = *count < max ? (*count)++ : max;
+	while(at > 0 && key(&out[at - 1]) < key(&e)) {
+		if(at < max)
+			out[at] = out[at - 1];
+		at--;
+	}
+	if(at < max)
+		out[at] = e;
+}
+
+static uint32_t by_plays(const UsageEntry *e) { return e->plays; }
+static uint32_t by_size(const UsageEntry *e) { return e->size; }
+
+static UsageEntry entry(NodeId id) {
+	UsageEntry e = {id, plays_of(id), __atomic_load_n(&node_at(id)->correct, __ATOMIC_RELAXED), node_at(id)->size};
+	return e;
+}
+
+/* usage_hot
+ * - The (at most max) animals under root that games reached most often,
+ *   most played first; animals never reached are left out
+ * - Return how many there are in out
+ */
+int usage_hot(NodeId root, UsageEntry *out, int max) {
+	int count = 0;
+	if(root == NODE_NIL || max <= 0)
+		return 0;
+	FrameStack todo;
+	fs_init(&todo);
+	fs_push(&todo, root, -1);
+	while(!fs_empty(&todo)) {
+		NodeId id = fs_pop(&todo).node;
+		if(node_is_question(id)) {
+			fs_push(&todo, node_yes(id), 1);
+			fs_push(&todo, node_no(id), 0);
+		} else if(plays_of(id) > 0) {
+			keep_top(out, &count, max, entry(id), by_plays);
+		}
+	}
+	fs_free(&todo);
+	return count;
+}
+
+/* usage_dead
+ * Find the subtrees under root that no game reached
+ *
+ * Steps:
+ * 1. Post-order walk: a node is live if it or anything below it has a
+ *    play (a Frame's answeredYes marks its second visit)
+ * 2. Pre-order walk of the live nodes: a child that isn't live is a dead
+ *    subtree; keep the max largest in out, biggest first
+ * 3. Return how many dead subtrees there are in all (0 if root itself
+ *    was never played, when there is nothing to tell apart), or -1 if
+ *    out of memory
+ */
+int usage_dead(NodeId root, UsageEntry *out, int max) {
+	if(root == NODE_NIL)
+		return 0;
+	uint8_t* live = (uint8_t*)calloc(g_arena.count, 1);
+	if(live == NULL)
+		return -1;
+
+	//1. Which subtrees have a play anywhere
+	FrameStack todo;
+	fs_init(&todo);
+	fs_push(&todo, root, 0);
+	while(!fs_empty(&todo)) {
+		Frame f = fs_pop(&todo);
+		if(!node_is_question(f.node)) {
+			live[f.node] = plays_of(f.node) > 0;
+		} else if(f.answeredYes == 0) {
+			fs_push(&todo, f.node, 1);
+			fs_push(&todo, node_yes(f.node), 0);
+			fs_push(&todo, node_no(f.node), 0);
+		} else {
+			live[f.node] = plays_of(f.node) > 0 || live[node_yes(f.node)] || live[node_no(f.node)];
+		}
+	}
+
+	//2. Dead children of live questions
+	int dead = 0, kept = 0;
+	if(live[root])
+		fs_push(&todo, root, -1);
+	while(!fs_empty(&todo)) {
+		NodeId id = fs_pop(&todo).node;
+		if(!node_is_question(id))
+			continue;
+		NodeId kids[2] = {node_yes(id), node_no(id)};
+		for(int k = 0; k < 2; k++) {
+			if(live[kids[k]]) {
+				fs_push(&todo, kids[k], k == 0);
+				continue;
+			}
+			dead++;
+			keep_top(out, &kept, max, entry(kids[k]), by_size);
+		}
+	}
+	fs_free(&todo);
+	free(live);
+
+	//3. How many
+	return dead;
+}
+
+/* usage_path
+ * - Write the path from the root down to node into buf: each question
+ *   and the answer taken, then node's own text, e.g.
+ *   "Does it live in water? no > Does it bark? yes > Dog"
+ * - Truncated to fit; return the length written
+ */
+size_t usage_path(NodeId node, char *buf, size_t size) {
+	if(size == 0)
+		return 0;
+	buf[0] = '\0';
+	FrameStack up;
+	fs_init(&up);
+	for(NodeId id = node; id != NODE_NIL; id = node_parent(id))
+		fs_push(&up, id, 0);
+
+	size_t used = 0;
+	while(!fs_empty(&up) && used + 1 < size) {
+		NodeId id = fs_pop(&up).node;
+		const char* answer = "";
+		if(!fs_empty(&up))
+			answer = node_yes(id) == up.frames[up.size - 1].node ? " yes > " : " no > ";
+		int n = snprintf(buf + used, size - used, "%s%s", node_text(id), answer);
+		if(n < 0)
+			break;
+		used += (size_t)n < size - used ? (size_t)n : size - used - 1;
+	}
+	fs_free(&up);
+	return used;
+}
+
+/* usage_report
+ * Write a plain-text report of root's usage to fp
+ * - How many games were counted and how many were guessed right
+ * - The top hottest paths, with plays and the share guessed right
+ * - How many subtrees were never reached, and the top largest of them
+ * - Return 1 if everything was written
+ */
+int usage_report(FILE *fp, NodeId root, int top) {
+	UsageEntry* entries = (UsageEntry*)malloc((size_t)(top > 0 ? top : 1) * sizeof(UsageEntry));
+	if(entries == NULL)
+		return 0;
+	char path[1024];
+
+	uint32_t games = root != NODE_NIL ? plays_of(root) : 0;
+	uint32_t right = root != NODE_NIL ? __atomic_load_n(&node_at(root)->correct, __ATOMIC_RELAXED) : 0;
+	fprintf(fp, "games: %u counted, %u guessed right (%.0f%%)\n", games, right,
+		games > 0 ? 100.0 * right / games : 0.0);
+
+	int hot = usage_hot(root, entries, top);
+	fprintf(fp, "\nhottest paths:\n%8s %6s  %s\n", "plays", "right", "path");
+	for(int i = 0; i < hot; i++) {
+		usage_path(entries[i].node, path, sizeof(path));
+		fprintf(fp, "%8u %5.0f%%  %s\n", entries[i].plays, 100.0 * entries[i].correct / entries[i].plays, path);
+	}
+
+	int dead = usage_dead(root, entries, top);
+	if(dead < 0) {
+		free(entries);
+		return 0;
+	}
+	fprintf(fp, "\nnever reached: %d subtree%s\n%8s %7s  %s\n", dead, dead == 1 ? "" : "s", "nodes",
+		"animals", "path");
+	for(int i = 0; i < dead && i < top; i++) {
+		usage_path(entries[i].node, path, sizeof(path));
+		fprintf(fp, "%8u %7u  %s\n", entries[i].size, node_at(entries[i].node)->leaves, path);
+	}
+	free(entries);
+	return !ferror(fp);
+}
+
+/* usage_write_file
+ * - usage_report into filename.tmp, renamed over filename once complete
+ */
+int usage_write_file(const char *filename, NodeId root, int top) {
+	char* temp = suffixed(filename, ".tmp");
+	if(temp == NULL)
+		return 0;
+	FILE* fp = fopen(temp, "w");
+	int ok = fp != NULL && usage_report(fp, root, top);
+	if(fp != NULL && fclose(fp) != 0)
+		ok = 0;
+	ok = ok && rename(temp, filename) == 0;
+	if(!ok)
+		remove(temp);
+	free(temp);
+	return ok;
+}
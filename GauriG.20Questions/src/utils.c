@@ -1,38 +1,61 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "lab5.h"
 
-extern Node *g_root;
+extern NodeId g_root;
+
+/* stats_agree
+ * - Does id's cached size/leaves/height follow from its children's?
+ */
+static int stats_agree(NodeId id) {
+	const Node* n = node_at(id);
+	const Node* y = node_at(node_yes(id));
+	const Node* o = node_at(node_no(id));
+	uint32_t height = 1 + (y->height > o->height ? y->height : o->height);
+	uint32_t leaves = node_is_question(id) ? y->leaves + o->leaves : 1;
+	return n->size == 1 + y->size + o->size && n->leaves == leaves && n->height == height;
+}
 
 /* Implement check_integrity
  * Use BFS to verify tree structure:
- * - Question nodes must have both yes and no children (not NULL)
- * - Leaf nodes (isQuestion == 0) must have NULL children
+ * - Question nodes must have both yes and no children (not NODE_NIL)
+ * - Leaf nodes (no question flag) must have NODE_NIL children
+ * - Child indices and text offsets must lie inside the arena (map_tree
+ *   leaves an image's records to this; open_tree runs it on them)
+ * - Reaching more nodes than the arena holds means there is a cycle
+ * - Parent links and cached subtree stats must agree with the children
+ *   (checking each node against its children is enough: by induction the
+ *   whole tree's stats are then right)
  * 
  * Return 1 if valid, 0 if invalid
  * 
  * Steps:
- * 1. Return 1 if g_root is NULL (empty tree is valid)
+ * 1. Return 1 if g_root is NODE_NIL (empty tree is valid)
  * 2. Initialize queue and enqueue root with id=0
  * 3. Set valid = 1
  * 4. While queue not empty:
  *    - Dequeue node
  *    - If node->isQuestion:
- *      - Check if yes == NULL or no == NULL
+ *      - Check if yes == NODE_NIL or no == NODE_NIL
  *      - If so, set valid = 0 and break
  *      - Otherwise, enqueue both children
  *    - Else (leaf node):
- *      - Check if yes != NULL or no != NULL
+ *      - Check if yes != NODE_NIL or no != NODE_NIL
  *      - If so, set valid = 0 and break
  * 5. Free queue and return valid
  */
 int check_integrity() {
-	//1. Return 1 if g_root is NULL (empty tree is valid)
-	if(g_root == NULL)
+	//1. Return 1 if g_root is NODE_NIL (empty tree is valid)
+	if(g_root == NODE_NIL)
 		return 1;
 
 	//2. Initialize queue and enqueue root with id=0
+	TRACE_BEGIN(check_integrity);
 	Queue* q = (Queue*)malloc(sizeof(Queue));
 	q_init(q);
 	q_enqueue(q, g_root, 0);
@@ -40,33 +63,50 @@ int check_integrity() {
 
 	//3. Set valid = 1
 	int valid = 1;
+	if(g_root >= g_arena.count || node_parent(g_root) != NODE_NIL)
+		valid = 0;
+
+	//a tree can't have more nodes than the arena; more visits means a cycle
+	uint32_t visits = 0;
 
 	//4. While queue not empty:
-	while(q_empty(q) != 1){
+	while(valid && q_empty(q) != 1){
  		// - Dequeue node
 		int qId = 0;
-		Node* qNode = NULL;
+		NodeId qNode = NODE_NIL;
 		q_dequeue(q, &qNode, &qId);
 
+		// - Bounds-check the record before trusting any of it
+		if(++visits >= g_arena.count || node_at(qNode)->text >= g_arena.strings.size){
+			valid = 0;
+			break;
+		}
+
 		// - If node->isQuestion:
-		if(qNode->isQuestion){
-		//   - Check if yes == NULL or no == NULL
-			if(qNode->yes == NULL || qNode->no == NULL){
+		if(node_is_question(qNode)){
+		//   - Check if yes == NODE_NIL or no == NODE_NIL
+			if(node_yes(qNode) == NODE_NIL || node_no(qNode) == NODE_NIL
+				|| node_yes(qNode) >= g_arena.count || node_no(qNode) >= g_arena.count){
 				//   - If so, set valid = 0 and break
 				valid = 0;
 				break;
 			}
+			else if(node_parent(node_yes(qNode)) != qNode || node_parent(node_no(qNode)) != qNode
+				|| !stats_agree(qNode)){
+				valid = 0;
+				break;
+			}
 			else {
 				//   - Otherwise, enqueue both children
 				initId++;
-				q_enqueue(q, qNode->yes, initId);
+				q_enqueue(q, node_yes(qNode), initId);
 				initId++;
-				q_enqueue(q, qNode->no, initId);
+				q_enqueue(q, node_no(qNode), initId);
 			}
 		} else {
 		// - Else (leaf node):
-			//   - Check if yes != NULL or no != NULL
-			if(qNode->yes != NULL || qNode->no != NULL) {
+			//   - Check if yes != NODE_NIL or no != NODE_NIL
+			if(node_yes(qNode) != NODE_NIL || node_no(qNode) != NODE_NIL || !stats_agree(qNode)) {
 				//   - If so, set valid = 0 and break
 				valid = 0;
 				break;
@@ -76,7 +116,66 @@ int check_integrity() {
 	}
 	q_free(q);
 	free(q);
+	TRACE_END(check_integrity);
 	return valid;
 }
 
+/* fnv1a
+ * - 32-bit FNV-1a hash of len bytes, for catching damaged records
+ */
+uint32_t fnv1a(const char *data, size_t len) {
+	uint32_t h = 2166136261u;
+	for(size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 16777619u;
+	}
+	return h;
+}
 
+/* suffixed
+ * - Return a malloc'd name + suffix (NULL if out of memory)
+ */
+char *suffixed(const char *name, const char *suffix) {
+	size_t a = strlen(name);
+	size_t b = strlen(suffix);
+	char* out = (char*)malloc(a + b + 1);
+	if(out != NULL) {
+		memcpy(out, name, a);
+		memcpy(out + a, suffix, b + 1);
+	}
+	return out;
+}
+
+/* write_all
+ * - write() all of data, retrying short writes and EINTR
+ */
+int write_all(int fd, const char *data, size_t len) {
+	while(len > 0) {
+		ssize_t n = write(fd, data, len);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return 0;
+		data += n;
+		len -= (size_t)n;
+	}
+	return 1;
+}
+
+/* sync_dir
+ * - fsync the directory holding name, so renames and new files in it
+ *   survive a crash
+ */
+void sync_dir(const char *name) {
+	const char* slash = strrchr(name, '/');
+	char* dir = slash == NULL ? suffixed(".", "")
+		: slash == name ? suffixed("/", "") : strndup(name, (size_t)(slash - name));
+	if(dir == NULL)
+		return;
+	int fd = open(dir, O_RDONLY);
+	if(fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	free(dir);
+}
@@ -4,64 +4,124 @@
 #include <ncurses.h>
 #include "lab5.h"
 
-extern Node *g_root;
+extern NodeId g_root;
 
 #define MAX_DISPLAY_LINES 1000
 #define COLOR_TREE_Q 6
 #define COLOR_TREE_A 7
 
+/* Past this many columns of indentation a line shows its depth instead */
+#define MAX_DISPLAY_INDENT 64
+
+/* Lines are formatted only when they are drawn, so a line is just where
+ * its node sits; a tree of millions of nodes costs 12 bytes per line */
 typedef struct DisplayLine {
-    char *text;
-    int indent;
-    int isQuestion;
+    NodeId node;
+    uint32_t depth;
+    int branch;         /* 1 yes, 0 no, -1 root */
 } DisplayLine;
 
 static DisplayLine *lines = NULL;
 static int line_count = 0;
 static int line_capacity = 0;
 
-void add_display_line(const char *text, int indent, int isQuestion) {
+static int add_display_line(NodeId node, uint32_t depth, int branch) {
     if (line_count >= line_capacity) {
-        line_capacity = line_capacity ? line_capacity * 2 : 100;
-        lines = realloc(lines, line_capacity * sizeof(DisplayLine));
+        int capacity = line_capacity ? line_capacity * 2 : 100;
+        DisplayLine *grown = realloc(lines, (size_t)capacity * sizeof(DisplayLine));
+        if (grown == NULL) return 0;
+        lines = grown;
+        line_capacity = capacity;
     }
     
-    lines[line_count].text = strdup(text);
-    lines[line_count].indent = indent;
-    lines[line_count].isQuestion = isQuestion;
+    lines[line_count].node = node;
+    lines[line_count].depth = depth;
+    lines[line_count].branch = branch;
     line_count++;
+    return 1;
 }
 
-void build_tree_display(Node *node, int depth, const char *prefix, int isYesBranch) {
-    if (node == NULL) return;
-    
-    char line[256];
-    char branch[64];
+/* build_tree_display
+ * Pre-order walk with an explicit FrameStack instead of recursion, so
+ * the deepest learned chain can't overflow the C stack
+ * - The stack holds the path from root to the current node; its size is
+ *   the depth of the next child
+ * - A frame's answeredYes says which child is next: -1 yes, 1 no, 0 done
+ * - Leaves are emitted without ever being pushed
+ * Returns the number of lines, or -1 if out of memory
+ */
+int build_tree_display(NodeId root) {
+    free_tree_display();
+    if (root == NODE_NIL) return 0;
     
-    if (depth == 0) {
-        snprintf(line, sizeof(line), "ROOT: %s", node->text);
-    } else {
-        snprintf(branch, sizeof(branch), "%s", isYesBranch ? "[YES]" : "[NO]");
-        snprintf(line, sizeof(line), "%s%s %s", prefix, branch, node->text);
-    }
+    if (!add_display_line(root, 0, -1)) return -1;
+    if (!node_is_question(root)) return line_count;
     
-    add_display_line(line, depth, node->isQuestion);
+    FrameStack path;
+    fs_init(&path);
+    fs_push(&path, root, -1);
     
-    if (node->isQuestion) {
-        char new_prefix[256];
-        snprintf(new_prefix, sizeof(new_prefix), "%s  ", prefix);
+    int ok = 1;
+    while (ok && !fs_empty(&path)) {
+        Frame *top = &path.frames[path.size - 1];
+        NodeId child;
+        int branch;
         
-        if (node->yes) {
-            build_tree_display(node->yes, depth + 1, new_prefix, 1);
-        }
-        if (node->no) {
-            build_tree_display(node->no, depth + 1, new_prefix, 0);
+        if (top->answeredYes == -1) {
+            top->answeredYes = 1;
+            child = node_yes(top->node);
+            branch = 1;
+        } else if (top->answeredYes == 1) {
+            top->answeredYes = 0;
+            child = node_no(top->node);
+            branch = 0;
+        } else {
+            fs_pop(&path);
+            continue;
         }
+        
+        if (child == NODE_NIL) continue;
+        ok = add_display_line(child, (uint32_t)path.size, branch);
+        if (ok && node_is_question(child))
+            fs_push(&path, child, -1);
+    }
+    fs_free(&path);
+    
+    return ok ? line_count : -1;
+}
+
+/* format_display_line
+ * - "ROOT: text" for the root, otherwise two spaces per level, then
+ *   "[YES]"/"[NO]" and the node's text
+ * - Lines nested deeper than MAX_DISPLAY_INDENT columns say their depth
+ *   instead of indenting further
+ */
+void format_display_line(int index, char *buf, size_t size) {
+    const DisplayLine *dl = &lines[index];
+    const char *branch = dl->branch ? "[YES]" : "[NO]";
+    
+    if (dl->branch == -1) {
+        snprintf(buf, size, "ROOT: %s", node_text(dl->node));
+    } else if (dl->depth * 2 <= MAX_DISPLAY_INDENT) {
+        snprintf(buf, size, "%*s%s %s", (int)(dl->depth * 2), "", branch, node_text(dl->node));
+    } else {
+        snprintf(buf, size, "%*s(depth %u) %s %s", MAX_DISPLAY_INDENT, "", dl->depth,
+                 branch, node_text(dl->node));
     }
 }
 
+/* free_tree_display
+ * - Drop the lines of the last build_tree_display
+ */
+void free_tree_display(void) {
+    free(lines);
+    lines = NULL;
+    line_count = 0;
+    line_capacity = 0;
+}
+
 void draw_tree() {
-    if (g_root == NULL) {
+    if (g_root == NODE_NIL) {
         clear();
         attron(COLOR_PAIR(5) | A_BOLD);
         mvprintw(0, 0, "%-80s", " Tree Visualization");
@@ -81,8 +141,10 @@ void draw_tree() {
     init_pair(COLOR_TREE_A, COLOR_GREEN, COLOR_BLACK);
     
     /* Build display lines */
-    line_count = 0;
-    build_tree_display(g_root, 0, "", 0);
+    if (build_tree_display(g_root) < 0) {
+        free_tree_display();
+        return;
+    }
     
     int scroll_offset = 0;
     int max_lines = LINES - 6;
@@ -114,16 +176,16 @@ void draw_tree() {
         for (int i = 0; i < max_lines && (i + scroll_offset) < line_count; i++) {
             int line_idx = i + scroll_offset;
             DisplayLine *dl = &lines[line_idx];
+            int isQuestion = node_is_question(dl->node);
             
-            int color = dl->isQuestion ? COLOR_TREE_Q : COLOR_TREE_A;
-            int attr = dl->isQuestion ? A_BOLD : A_NORMAL;
+            int color = isQuestion ? COLOR_TREE_Q : COLOR_TREE_A;
+            int attr = isQuestion ? A_BOLD : A_NORMAL;
             
             attron(COLOR_PAIR(color) | attr);
             
             /* Truncate line if too long */
             char display[256];
-            strncpy(display, dl->text, sizeof(display) - 1);
-            display[sizeof(display) - 1] = '\0';
+            format_display_line(line_idx, display, sizeof(display));
             
             if (strlen(display) > (size_t)(COLS - 6)) {
                 display[COLS - 9] = '.';
@@ -185,13 +247,5 @@ void draw_tree() {
     }
     
     /* Cleanup */
-    for (int i = 0; i < line_count; i++) {
-        free(lines[i].text);
-    }
-    if (lines) {
-        free(lines);
-        lines = NULL;
-    }
-    line_count = 0;
-    line_capacity = 0;
+    free_tree_display();
 }